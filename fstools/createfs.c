@@ -0,0 +1,1096 @@
+/* createfs.c - builds file system images for the kernel
+ * vim:ts=4 sw=4 noexpandtab
+ *
+ * Usage: createfs [-1] [-z] [-D] [-C] [-b <blocks>] [-i <inodes>] [-j <blocks>] <dir> -o <image>
+ *
+ * Writes a version 2 image by default: the tree under <dir> becomes nested
+ * directories, and files may be as large as the indirect blocks allow. -1
+ * writes the original flat format instead, which holds at most 63 entries
+ * from the top of <dir> and files of up to 1023 blocks.
+ *
+ * Version 2 images are writable: they carry block and inode bitmaps, and
+ * -b and -i set how many free data blocks and inodes to leave for files
+ * created at run time. They also get a metadata journal of -j blocks,
+ * which -j 0 leaves out.
+ *
+ * -z stores regular files LZ4 compressed, a 4kB block at a time, wherever
+ * that saves a block. The kernel decompresses them as they're read, but
+ * can't write to them until they're truncated to nothing.
+ *
+ * Identical blocks of regular files are stored once, however many files
+ * (or places in a file) hold them. Version 2 images count the extra holders
+ * of each block in a share table, and the kernel copies a shared block
+ * before writing to it. -D stores every block separately instead.
+ *
+ * Version 2 images also get a table of the CRC32C of every data block in
+ * use, which the kernel checks blocks against as it reads them. -C leaves
+ * it out.
+ *
+ * Character devices become rtc entries, the way fs_script makes them.
+ *
+ * The on-disk structures here must match student-distrib/file_sys.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define BLOCK_SIZE     4096
+#define FILE_NAME_SIZE 32
+
+#define FILE_TYPE_RTC 0
+#define FILE_TYPE_DIR 1
+#define FILE_TYPE_REG 2
+
+#define MAX_DENTRIES 63
+#define V1_MAX_BLOCKS (BLOCK_SIZE / 4 - 1)
+
+#define FS_MAGIC     0x32534659
+#define FS_VERSION_2 2
+#define FS_WRITABLE  0x1
+#define FS_JOURNAL   0x2
+#define FS_LZ4       0x4
+#define FS_SHARED    0x8
+#define FS_CSUM      0x10
+
+/* the Castagnoli polynomial, bit reversed */
+#define CRC32C_POLY 0x82F63B78
+
+/* journal header, see student-distrib/journal.h */
+#define JOURNAL_MAGIC      0x44484A59
+#define JOURNAL_MIN_BLOCKS 15
+
+#define BITS_PER_BLOCK (BLOCK_SIZE * 8)
+#define SHARES_PER_BLOCK (BLOCK_SIZE / 2)
+#define MAX_SHARES 0xFFFF
+
+/* buckets of the table of stored blocks, by a hash of their contents */
+#define DEDUP_BUCKETS 4096
+
+/* how contents are stored: in a run of their own and never shared (like
+ * directories, which change in place), block by block with any of them
+ * shared, or in one run that's only shared as a whole */
+#define STORE_PRIVATE 0
+#define STORE_SHARED  1
+#define STORE_RUN     2
+
+/* free space left in version 2 images unless told otherwise */
+#define DEFAULT_FREE_BLOCKS 256
+#define DEFAULT_FREE_INODES 64
+#define DEFAULT_JOURNAL_BLOCKS 64
+
+#define INODE_DIRECT     12
+#define INODE_EXTENTS_MAX 7
+#define INODE_EXTENTS    0x1
+#define INODE_LZ4        0x2
+
+/* LZ4 block format: matches are at least 4 bytes, the last 5 bytes are
+ * always literals and the last match starts 12 bytes from the end or more */
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_LIMIT   12
+#define LZ4_MAX_OFFSET    65535
+#define LZ4_RUN_MASK      15
+#define LZ4_HASH_BITS     12
+#define PTRS_PER_BLOCK   (BLOCK_SIZE / 4)
+#define INODES_PER_BLOCK (BLOCK_SIZE / sizeof(inode2_t))
+#define NULL_INODE       0
+#define ROOT_INODE       1
+
+typedef struct dentry {
+	uint8_t file_name[FILE_NAME_SIZE];
+	uint32_t file_type;
+	uint32_t inode;
+	uint8_t reserved[24];
+} __attribute__((packed)) dentry_t;
+
+typedef struct boot_block {
+	uint32_t num_dentries;
+	uint32_t num_inodes;
+	uint32_t num_dblocks;
+	uint8_t reserved[52];
+	dentry_t entries[MAX_DENTRIES];
+} __attribute__((packed)) boot_block_t;
+
+typedef struct index_node {
+	uint32_t byte_length;
+	uint32_t data_blocks[V1_MAX_BLOCKS];
+} __attribute__((packed)) index_node_t;
+
+typedef struct super_block {
+	uint32_t num_dentries;
+	uint32_t num_inodes;
+	uint32_t num_dblocks;
+	uint32_t magic;
+	uint32_t version;
+	uint32_t root_inode;
+	uint32_t inode_blocks;
+	uint32_t features;
+	uint32_t block_bitmap;
+	uint32_t inode_bitmap;
+	uint32_t journal_start;
+	uint32_t journal_blocks;
+	uint32_t share_table;
+	uint32_t csum_table;
+	uint8_t reserved[BLOCK_SIZE - 56];
+} __attribute__((packed)) super_block_t;
+
+typedef struct extent {
+	uint32_t start;
+	uint32_t length;
+} __attribute__((packed)) extent_t;
+
+typedef struct inode2 {
+	uint32_t byte_length;
+	uint32_t flags;
+	union {
+		struct {
+			uint32_t direct[INODE_DIRECT];
+			uint32_t indirect;
+			uint32_t double_indirect;
+		} __attribute__((packed));
+		extent_t extents[INODE_EXTENTS_MAX];
+	};
+} __attribute__((packed)) inode2_t;
+
+/* A file or directory found under the input directory */
+typedef struct node {
+	char name[FILE_NAME_SIZE + 1];
+	char *path;
+	uint32_t type;
+	uint32_t inode;
+	struct node *parent;
+	struct node **children;
+	uint32_t nchildren;
+} node_t;
+
+/* Data blocks of the image being built */
+static uint8_t *blocks = NULL;
+static uint32_t nblocks = 0;
+static uint32_t blocks_cap = 0;
+
+/* Every node that gets an inode, indexed by inode number */
+static node_t **inodes = NULL;
+static uint32_t ninodes = 0;
+
+/* free space to leave in version 2 images */
+static uint32_t free_blocks = DEFAULT_FREE_BLOCKS;
+static uint32_t free_inodes = DEFAULT_FREE_INODES;
+static uint32_t journal_blocks = DEFAULT_JOURNAL_BLOCKS;
+
+/* whether to compress regular files, and whether any were */
+static int compress = 0;
+static int compressed_any = 0;
+
+/* A data block holding file contents, which other files may share */
+typedef struct stored {
+	uint32_t hash;
+	uint32_t block;
+	struct stored *next;
+} stored_t;
+
+/* whether to share identical blocks, the blocks that can be shared, and
+ * how many more files than one hold each data block */
+static int dedup = 1;
+static stored_t *dedup_table[DEDUP_BUCKETS];
+static uint16_t *shares = NULL;
+static uint32_t nshares = 0;
+
+/* whether to write a checksum table */
+static int checksums = 1;
+
+/*
+ * Prints an error and exits
+ */
+static void die(const char *what, const char *detail)
+{
+	fprintf(stderr, "createfs: %s%s%s\n", what, detail ? ": " : "", detail ? detail : "");
+	exit(1);
+}
+
+/*
+ * Allocates count contiguous, zeroed data blocks
+ *
+ * Outputs: index of the first block
+ */
+static uint32_t alloc_blocks(uint32_t count)
+{
+	uint32_t first = nblocks;
+
+	if (nblocks + count > blocks_cap) {
+		while (nblocks + count > blocks_cap) {
+			blocks_cap = blocks_cap ? blocks_cap * 2 : 256;
+		}
+		blocks = realloc(blocks, (size_t)blocks_cap * BLOCK_SIZE);
+		if (!blocks) {
+			die("out of memory", NULL);
+		}
+	}
+
+	memset(blocks + (size_t)first * BLOCK_SIZE, 0, (size_t)count * BLOCK_SIZE);
+	nblocks += count;
+	return first;
+}
+
+/*
+ * Returns a data block by index
+ */
+static uint8_t *block_data(uint32_t idx)
+{
+	return blocks + (size_t)idx * BLOCK_SIZE;
+}
+
+/*
+ * Copies block i of some contents out, zero padded to a whole block
+ */
+static void file_block(uint8_t *block, const uint8_t *data, uint32_t len, uint32_t i)
+{
+	uint32_t chunk = (len - i * BLOCK_SIZE < BLOCK_SIZE) ? len - i * BLOCK_SIZE : BLOCK_SIZE;
+
+	memcpy(block, data + (size_t)i * BLOCK_SIZE, chunk);
+	memset(block + chunk, 0, BLOCK_SIZE - chunk);
+}
+
+/*
+ * Hashes a block's contents (FNV-1a)
+ */
+static uint32_t block_hash(const uint8_t *block)
+{
+	uint32_t hash = 2166136261U;
+	uint32_t i;
+
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		hash = (hash ^ block[i]) * 16777619U;
+	}
+
+	return hash;
+}
+
+/*
+ * Makes a stored data block available for sharing
+ */
+static void dedup_add(uint32_t idx)
+{
+	stored_t *entry;
+
+	entry = malloc(sizeof(*entry));
+	if (!entry) {
+		die("out of memory", NULL);
+	}
+	entry->hash = block_hash(block_data(idx));
+	entry->block = idx;
+	entry->next = dedup_table[entry->hash % DEDUP_BUCKETS];
+	dedup_table[entry->hash % DEDUP_BUCKETS] = entry;
+}
+
+/*
+ * Counts another file holding a data block
+ *
+ * Outputs: 0 on success, -1 if the block's count is full
+ */
+static int share_block(uint32_t idx)
+{
+	uint32_t old = nshares;
+
+	if (idx >= nshares) {
+		nshares = idx + 1;
+		shares = realloc(shares, nshares * sizeof(uint16_t));
+		if (!shares) {
+			die("out of memory", NULL);
+		}
+		memset(shares + old, 0, (nshares - old) * sizeof(uint16_t));
+	}
+
+	if (shares[idx] == MAX_SHARES) {
+		return -1;
+	}
+	shares[idx]++;
+	return 0;
+}
+
+/*
+ * Looks for a run of stored blocks holding the same contents as the blocks
+ * of some data
+ *
+ * Inputs: data - the contents
+ *         len - length of the contents
+ *         first, count - which of its blocks to match
+ * Outputs: the first data block of the run, -1 if there isn't one
+ */
+static int32_t dedup_find(const uint8_t *data, uint32_t len, uint32_t first, uint32_t count)
+{
+	uint8_t block[BLOCK_SIZE];
+	stored_t *entry;
+	uint32_t hash;
+	uint32_t i;
+
+	file_block(block, data, len, first);
+	hash = block_hash(block);
+
+	for (entry = dedup_table[hash % DEDUP_BUCKETS]; entry; entry = entry->next) {
+		if (entry->hash != hash || entry->block + count > nblocks) {
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			file_block(block, data, len, first + i);
+			if (memcmp(block_data(entry->block + i), block, BLOCK_SIZE)
+					|| (entry->block + i < nshares && shares[entry->block + i] == MAX_SHARES)) {
+				break;
+			}
+		}
+		if (i == count) {
+			return entry->block;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Stores contents in data blocks. Blocks of files are shared with any
+ * stored block holding the same bytes, the rest are allocated one after
+ * another, so contents stored from scratch land in one run.
+ *
+ * Inputs: data - the contents
+ *         len - length of the contents
+ *         list - set to the data block of each block of the contents
+ *         mode - STORE_PRIVATE, STORE_SHARED or STORE_RUN
+ * Outputs: none
+ */
+static void store_blocks(const uint8_t *data, uint32_t len, uint32_t *list, int mode)
+{
+	uint32_t count = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int32_t found;
+	uint32_t first;
+	uint32_t i;
+
+	if (mode == STORE_PRIVATE || !dedup) {
+		first = alloc_blocks(count);
+		memcpy(block_data(first), data, len);
+		for (i = 0; i < count; i++) {
+			list[i] = first + i;
+		}
+		return;
+	}
+
+	if (mode == STORE_RUN) {
+		found = count ? dedup_find(data, len, 0, count) : -1;
+		first = (found >= 0) ? (uint32_t)found : alloc_blocks(count);
+		for (i = 0; i < count; i++) {
+			list[i] = first + i;
+			if (found >= 0) {
+				share_block(list[i]);
+			}
+			else {
+				file_block(block_data(list[i]), data, len, i);
+				dedup_add(list[i]);
+			}
+		}
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		found = dedup_find(data, len, i, 1);
+		if (found >= 0) {
+			list[i] = found;
+			share_block(found);
+			continue;
+		}
+
+		list[i] = alloc_blocks(1);
+		file_block(block_data(list[i]), data, len, i);
+		dedup_add(list[i]);
+	}
+}
+
+/*
+ * Returns the CRC32C of a data block, a bit at a time
+ */
+static uint32_t block_crc32c(const uint8_t *block)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	uint32_t i, k;
+
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		crc ^= block[i];
+		for (k = 0; k < 8; k++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+	}
+
+	return ~crc;
+}
+
+/*
+ * Reads a whole host file into memory
+ *
+ * Inputs: path - the file
+ *         len - set to its length
+ * Outputs: the contents, to be freed by the caller
+ */
+static uint8_t *slurp(const char *path, uint32_t *len)
+{
+	FILE *fp;
+	uint8_t *buf;
+	long size;
+
+	fp = fopen(path, "rb");
+	if (!fp || fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)) {
+		die(path, strerror(errno));
+	}
+
+	buf = malloc(size ? size : 1);
+	if (!buf || fread(buf, 1, size, fp) != (size_t)size) {
+		die(path, "read failed");
+	}
+
+	fclose(fp);
+	*len = size;
+	return buf;
+}
+
+/*
+ * Orders nodes by name, so images don't depend on readdir order
+ */
+static int node_cmp(const void *a, const void *b)
+{
+	return strcmp((*(node_t * const *)a)->name, (*(node_t * const *)b)->name);
+}
+
+/*
+ * Reads the tree under a host directory
+ *
+ * Inputs: path - the directory
+ *         parent - its node, whose children get filled in
+ *         recurse - whether to descend into subdirectories
+ * Outputs: none
+ */
+static void scan_dir(const char *path, node_t *parent, int recurse)
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct stat st;
+	node_t *node;
+
+	dir = opendir(path);
+	if (!dir) {
+		die(path, strerror(errno));
+	}
+
+	while ((ent = readdir(dir))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+			continue;
+		}
+
+		if (strlen(ent->d_name) > FILE_NAME_SIZE) {
+			fprintf(stderr, "createfs: skipping %s/%s, name too long\n", path, ent->d_name);
+			continue;
+		}
+
+		node = calloc(1, sizeof(*node));
+		if (!node) {
+			die("out of memory", NULL);
+		}
+		strcpy(node->name, ent->d_name);
+		node->parent = parent;
+		node->path = malloc(strlen(path) + strlen(ent->d_name) + 2);
+		sprintf(node->path, "%s/%s", path, ent->d_name);
+
+		if (stat(node->path, &st)) {
+			die(node->path, strerror(errno));
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			if (!recurse) {
+				fprintf(stderr, "createfs: skipping directory %s\n", node->path);
+				free(node->path);
+				free(node);
+				continue;
+			}
+			node->type = FILE_TYPE_DIR;
+			scan_dir(node->path, node, recurse);
+		}
+		else if (S_ISCHR(st.st_mode)) {
+			node->type = FILE_TYPE_RTC;
+		}
+		else if (S_ISREG(st.st_mode)) {
+			node->type = FILE_TYPE_REG;
+		}
+		else {
+			free(node->path);
+			free(node);
+			continue;
+		}
+
+		parent->children = realloc(parent->children, (parent->nchildren + 1) * sizeof(node_t *));
+		parent->children[parent->nchildren++] = node;
+	}
+
+	closedir(dir);
+	qsort(parent->children, parent->nchildren, sizeof(node_t *), node_cmp);
+}
+
+/*
+ * Fills in a directory entry
+ */
+static void make_dentry(dentry_t *dentry, const char *name, uint32_t type, uint32_t inode)
+{
+	memset(dentry, 0, sizeof(*dentry));
+	/* names that fill the whole field have no terminator */
+	memcpy(dentry->file_name, name, strnlen(name, FILE_NAME_SIZE));
+	dentry->file_type = type;
+	dentry->inode = inode;
+}
+
+/*
+ * Writes the original flat format: boot block, one 4KB inode per file,
+ * then the data blocks
+ */
+static void write_v1(node_t *root, FILE *out)
+{
+	boot_block_t boot;
+	index_node_t *nodes;
+	node_t *node;
+	uint8_t *data;
+	uint32_t list[V1_MAX_BLOCKS];
+	uint32_t len, count;
+	uint32_t i;
+
+	if (root->nchildren + 1 > MAX_DENTRIES) {
+		die("too many files for the version 1 format", NULL);
+	}
+
+	memset(&boot, 0, sizeof(boot));
+	make_dentry(&boot.entries[0], ".", FILE_TYPE_DIR, 0);
+	boot.num_dentries = 1;
+
+	nodes = calloc(root->nchildren ? root->nchildren : 1, sizeof(index_node_t));
+	if (!nodes) {
+		die("out of memory", NULL);
+	}
+
+	for (i = 0; i < root->nchildren; i++) {
+		node = root->children[i];
+
+		if (node->type == FILE_TYPE_REG) {
+			node->inode = boot.num_inodes++;
+
+			data = slurp(node->path, &len);
+			count = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			if (count > V1_MAX_BLOCKS) {
+				die(node->path, "too large for the version 1 format");
+			}
+
+			store_blocks(data, len, list, STORE_SHARED);
+			memcpy(nodes[node->inode].data_blocks, list, count * sizeof(uint32_t));
+			free(data);
+
+			nodes[node->inode].byte_length = len;
+		}
+
+		make_dentry(&boot.entries[boot.num_dentries++], node->name, node->type, node->inode);
+	}
+
+	boot.num_dblocks = nblocks;
+
+	if (fwrite(&boot, sizeof(boot), 1, out) != 1
+			|| fwrite(nodes, sizeof(index_node_t), boot.num_inodes, out) != boot.num_inodes
+			|| fwrite(blocks, BLOCK_SIZE, nblocks, out) != nblocks) {
+		die("write failed", strerror(errno));
+	}
+
+	free(nodes);
+}
+
+/*
+ * Gives every directory and regular file under node an inode, parents
+ * before their children
+ */
+static void assign_inodes(node_t *node)
+{
+	uint32_t i;
+
+	if (node->type == FILE_TYPE_RTC) {
+		node->inode = NULL_INODE;
+		return;
+	}
+
+	node->inode = ninodes++;
+	inodes = realloc(inodes, ninodes * sizeof(node_t *));
+	inodes[node->inode] = node;
+
+	for (i = 0; i < node->nchildren; i++) {
+		assign_inodes(node->children[i]);
+	}
+}
+
+/*
+ * Points an inode at the data blocks holding its file. Blocks that fall in
+ * at most INODE_EXTENTS_MAX contiguous runs are stored as extents, anything
+ * more fragmented gets direct and indirect index blocks.
+ *
+ * Inputs: inode - inode to fill in
+ *         list - data block of each block of the file, in order
+ *         count - number of blocks
+ * Outputs: none
+ */
+static void set_inode_blocks(inode2_t *inode, const uint32_t *list, uint32_t count)
+{
+	uint32_t nextents, ptrs, nptr;
+	uint32_t *table;
+	uint32_t i;
+
+	if (count > INODE_DIRECT + PTRS_PER_BLOCK + PTRS_PER_BLOCK * PTRS_PER_BLOCK) {
+		die("file too large", NULL);
+	}
+
+	/* count the runs */
+	for (i = 0, nextents = 0; i < count; i++) {
+		if (!i || list[i] != list[i - 1] + 1) {
+			nextents++;
+		}
+	}
+
+	if (nextents <= INODE_EXTENTS_MAX) {
+		inode->flags |= INODE_EXTENTS;
+		for (i = 0, nextents = 0; i < count; i++) {
+			if (i && list[i] == list[i - 1] + 1) {
+				inode->extents[nextents - 1].length++;
+				continue;
+			}
+			inode->extents[nextents].start = list[i];
+			inode->extents[nextents].length = 1;
+			nextents++;
+		}
+		return;
+	}
+
+	for (i = 0; i < count && i < INODE_DIRECT; i++) {
+		inode->direct[i] = list[i];
+	}
+	if (count <= INODE_DIRECT) {
+		return;
+	}
+
+	/* single indirect */
+	inode->indirect = alloc_blocks(1);
+	for (i = INODE_DIRECT; i < count && i < INODE_DIRECT + PTRS_PER_BLOCK; i++) {
+		((uint32_t *)block_data(inode->indirect))[i - INODE_DIRECT] = list[i];
+	}
+	if (count <= INODE_DIRECT + PTRS_PER_BLOCK) {
+		return;
+	}
+
+	/* double indirect */
+	nptr = count - INODE_DIRECT - PTRS_PER_BLOCK;
+	ptrs = (nptr + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
+	inode->double_indirect = alloc_blocks(1 + ptrs);
+	for (i = 0; i < ptrs; i++) {
+		((uint32_t *)block_data(inode->double_indirect))[i] = inode->double_indirect + 1 + i;
+	}
+	for (i = 0; i < nptr; i++) {
+		table = (uint32_t *)block_data(inode->double_indirect + 1 + i / PTRS_PER_BLOCK);
+		table[i % PTRS_PER_BLOCK] = list[INODE_DIRECT + PTRS_PER_BLOCK + i];
+	}
+}
+
+/*
+ * Stores file contents in data blocks and points an inode at them
+ *
+ * Inputs: inode - inode to fill in
+ *         data - the contents
+ *         len - length of the contents
+ *         mode - how to store them, see store_blocks
+ * Outputs: none
+ */
+static void write_file_v2(inode2_t *inode, const uint8_t *data, uint32_t len, int mode)
+{
+	uint32_t count = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	uint32_t *list;
+
+	list = malloc((count ? count : 1) * sizeof(uint32_t));
+	if (!list) {
+		die("out of memory", NULL);
+	}
+
+	store_blocks(data, len, list, mode);
+
+	inode->byte_length = len;
+	set_inode_blocks(inode, list, count);
+	free(list);
+}
+
+/*
+ * Writes an LZ4 length past what fits in a nibble, as 255s and a remainder
+ */
+static uint8_t *lz4_length(uint8_t *out, uint32_t len)
+{
+	for (; len >= 255; len -= 255) {
+		*out++ = 255;
+	}
+	*out++ = len;
+	return out;
+}
+
+/*
+ * Writes one LZ4 sequence: literals, then a match unless mlen is 0
+ */
+static uint8_t *lz4_sequence(uint8_t *out, const uint8_t *lit, uint32_t nlit, uint32_t offset, uint32_t mlen)
+{
+	uint8_t *token = out++;
+
+	*token = (nlit < LZ4_RUN_MASK ? nlit : LZ4_RUN_MASK) << 4;
+	if (nlit >= LZ4_RUN_MASK) {
+		out = lz4_length(out, nlit - LZ4_RUN_MASK);
+	}
+	memcpy(out, lit, nlit);
+	out += nlit;
+
+	if (mlen) {
+		*out++ = offset & 0xFF;
+		*out++ = offset >> 8;
+		mlen -= LZ4_MIN_MATCH;
+		*token |= mlen < LZ4_RUN_MASK ? mlen : LZ4_RUN_MASK;
+		if (mlen >= LZ4_RUN_MASK) {
+			out = lz4_length(out, mlen - LZ4_RUN_MASK);
+		}
+	}
+
+	return out;
+}
+
+/*
+ * Compresses a block in the LZ4 block format, greedily taking whatever match
+ * a hash of the next 4 bytes turns up
+ *
+ * Inputs: src - the block
+ *         len - its size, at most BLOCK_SIZE
+ *         dst - room for at least 2 * BLOCK_SIZE bytes
+ * Outputs: size of the compressed block
+ */
+static uint32_t lz4_compress(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+	int32_t table[1 << LZ4_HASH_BITS];
+	uint8_t *out = dst;
+	uint32_t anchor = 0;
+	uint32_t ip = 0;
+	uint32_t seq, hash, mlen;
+	int32_t ref;
+
+	memset(table, 0xFF, sizeof(table));
+
+	while (ip + LZ4_MATCH_LIMIT <= len) {
+		memcpy(&seq, src + ip, sizeof(seq));
+		hash = (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+		ref = table[hash];
+		table[hash] = ip;
+
+		if (ref < 0 || ip - ref > LZ4_MAX_OFFSET || memcmp(src + ref, src + ip, LZ4_MIN_MATCH)) {
+			ip++;
+			continue;
+		}
+
+		for (mlen = LZ4_MIN_MATCH; ip + mlen < len - LZ4_LAST_LITERALS && src[ref + mlen] == src[ip + mlen]; mlen++);
+
+		out = lz4_sequence(out, src + anchor, ip - anchor, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+
+	out = lz4_sequence(out, src + anchor, len - anchor, 0, 0);
+	return out - dst;
+}
+
+/*
+ * Stores a regular file compressed if that takes fewer blocks: a table of
+ * where each compressed block ends, then the blocks, each left as is if it
+ * doesn't get any smaller
+ *
+ * Inputs: inode - inode to fill in
+ *         data - the contents
+ *         len - length of the contents
+ * Outputs: 1 if it was stored, 0 if it's better left uncompressed
+ */
+static int write_file_lz4(inode2_t *inode, const uint8_t *data, uint32_t len)
+{
+	uint32_t count = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	uint32_t *ends;
+	uint8_t *stream;
+	uint32_t size;
+	uint32_t chunk, clen;
+	uint32_t i;
+
+	if (!count) {
+		return 0;
+	}
+
+	stream = malloc(count * sizeof(uint32_t) + (size_t)count * 2 * BLOCK_SIZE);
+	if (!stream) {
+		die("out of memory", NULL);
+	}
+	ends = (uint32_t *)stream;
+
+	size = count * sizeof(uint32_t);
+	for (i = 0; i < count; i++) {
+		chunk = (i + 1 < count) ? BLOCK_SIZE : len - i * BLOCK_SIZE;
+		clen = lz4_compress(data + i * BLOCK_SIZE, chunk, stream + size);
+		if (clen >= chunk) {
+			memcpy(stream + size, data + i * BLOCK_SIZE, chunk);
+			clen = chunk;
+		}
+		size += clen;
+		ends[i] = size;
+	}
+
+	if ((size + BLOCK_SIZE - 1) / BLOCK_SIZE >= count) {
+		free(stream);
+		return 0;
+	}
+
+	/* the stream lands in one run, so it gets an extent */
+	write_file_v2(inode, stream, size, STORE_RUN);
+	inode->byte_length = len;
+	inode->flags |= INODE_LZ4;
+	compressed_any = 1;
+
+	free(stream);
+	return 1;
+}
+
+/*
+ * Marks the first count bits of a bitmap and everything past its last
+ * nbits in the same word as used
+ *
+ * Inputs: map - the bitmap
+ *         count - bits in use
+ *         nbits - bits the bitmap covers
+ * Outputs: none
+ */
+static void fill_bitmap(uint8_t *map, uint32_t count, uint32_t nbits)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		map[i / 8] |= 1 << (i % 8);
+	}
+	for (i = nbits; i % 32; i++) {
+		map[i / 8] |= 1 << (i % 8);
+	}
+}
+
+/*
+ * Writes the version 2 format: superblock, inode table, then data blocks
+ * holding file contents, directory files and index blocks, followed by
+ * the bitmaps, the journal, the share table if any blocks are shared, the
+ * checksum table and the free blocks
+ */
+static void write_v2(node_t *root, FILE *out)
+{
+	super_block_t super;
+	inode2_t *table;
+	dentry_t *entries;
+	node_t *node;
+	uint8_t *data;
+	uint32_t len;
+	uint32_t inode_blocks;
+	uint32_t used, total;
+	uint32_t block_bitmap, inode_bitmap;
+	uint32_t bmap_blocks, imap_blocks;
+	uint32_t journal;
+	uint32_t share_table, share_blocks;
+	uint32_t csum_table, csum_blocks;
+	uint32_t *sums;
+	uint32_t *header;
+	uint32_t i, j;
+
+	/* inode 0 is the empty inode */
+	ninodes = 1;
+	inodes = calloc(1, sizeof(node_t *));
+	assign_inodes(root);
+
+	inode_blocks = (ninodes + free_inodes + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK;
+	table = calloc(inode_blocks, BLOCK_SIZE);
+	if (!table) {
+		die("out of memory", NULL);
+	}
+
+	for (i = ROOT_INODE; i < ninodes; i++) {
+		node = inodes[i];
+
+		if (node->type == FILE_TYPE_DIR) {
+			/* ".", "..", then the children */
+			len = (node->nchildren + 2) * sizeof(dentry_t);
+			entries = calloc(node->nchildren + 2, sizeof(dentry_t));
+			make_dentry(&entries[0], ".", FILE_TYPE_DIR, node->inode);
+			make_dentry(&entries[1], "..", FILE_TYPE_DIR, node->parent ? node->parent->inode : node->inode);
+			for (j = 0; j < node->nchildren; j++) {
+				make_dentry(&entries[j + 2], node->children[j]->name, node->children[j]->type, node->children[j]->inode);
+			}
+			write_file_v2(&table[i], (uint8_t *)entries, len, STORE_PRIVATE);
+			free(entries);
+		}
+		else {
+			data = slurp(node->path, &len);
+			if (!compress || !write_file_lz4(&table[i], data, len)) {
+				write_file_v2(&table[i], data, len, STORE_SHARED);
+			}
+			free(data);
+		}
+	}
+
+	/* the bitmaps, the journal and the tables go after everything in use,
+	 * the block bitmap and the tables have to cover their own blocks too */
+	used = nblocks;
+	imap_blocks = (inode_blocks * INODES_PER_BLOCK + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+	bmap_blocks = 1;
+	share_blocks = 0;
+	csum_blocks = 0;
+	for (;;) {
+		total = used + imap_blocks + bmap_blocks + journal_blocks + share_blocks + csum_blocks + free_blocks;
+		if (bmap_blocks * BITS_PER_BLOCK < total) {
+			bmap_blocks++;
+		}
+		else if (nshares && share_blocks * SHARES_PER_BLOCK < total) {
+			share_blocks++;
+		}
+		else if (checksums && csum_blocks * PTRS_PER_BLOCK < total) {
+			csum_blocks++;
+		}
+		else {
+			break;
+		}
+	}
+
+	block_bitmap = alloc_blocks(bmap_blocks);
+	inode_bitmap = alloc_blocks(imap_blocks);
+	journal = alloc_blocks(journal_blocks);
+	share_table = alloc_blocks(share_blocks);
+	csum_table = alloc_blocks(csum_blocks);
+	alloc_blocks(free_blocks);
+
+	if (share_blocks) {
+		memcpy(block_data(share_table), shares, nshares * sizeof(uint16_t));
+	}
+
+	/* only the blocks in use before the bitmaps, which don't change under
+	 * the kernel without it dropping their checksums */
+	if (csum_blocks) {
+		sums = (uint32_t *)block_data(csum_table);
+		for (i = 0; i < used; i++) {
+			sums[i] = block_crc32c(block_data(i));
+		}
+	}
+
+	/* an empty log, its first transaction is 1 */
+	if (journal_blocks) {
+		header = (uint32_t *)block_data(journal);
+		header[0] = JOURNAL_MAGIC;
+		header[1] = 1;
+	}
+
+	fill_bitmap(block_data(block_bitmap), used + bmap_blocks + imap_blocks + journal_blocks + share_blocks + csum_blocks, total);
+	fill_bitmap(block_data(inode_bitmap), ninodes, inode_blocks * INODES_PER_BLOCK);
+
+	memset(&super, 0, sizeof(super));
+	super.num_inodes = inode_blocks * INODES_PER_BLOCK;
+	super.num_dblocks = nblocks;
+	super.magic = FS_MAGIC;
+	super.version = FS_VERSION_2;
+	super.root_inode = ROOT_INODE;
+	super.inode_blocks = inode_blocks;
+	super.features = FS_WRITABLE | (journal_blocks ? FS_JOURNAL : 0) | (compressed_any ? FS_LZ4 : 0)
+		| (share_blocks ? FS_SHARED : 0) | (csum_blocks ? FS_CSUM : 0);
+	super.block_bitmap = block_bitmap;
+	super.inode_bitmap = inode_bitmap;
+	super.journal_start = journal_blocks ? journal : 0;
+	super.journal_blocks = journal_blocks;
+	super.share_table = share_blocks ? share_table : 0;
+	super.csum_table = csum_blocks ? csum_table : 0;
+
+	if (fwrite(&super, sizeof(super), 1, out) != 1
+			|| fwrite(table, BLOCK_SIZE, inode_blocks, out) != inode_blocks
+			|| fwrite(blocks, BLOCK_SIZE, nblocks, out) != nblocks) {
+		die("write failed", strerror(errno));
+	}
+
+	free(table);
+}
+
+int main(int argc, char **argv)
+{
+	const char *in = NULL;
+	const char *out_name = NULL;
+	int version = FS_VERSION_2;
+	node_t root;
+	FILE *out;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			out_name = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-1")) {
+			version = 1;
+		}
+		else if (!strcmp(argv[i], "-z")) {
+			compress = 1;
+		}
+		else if (!strcmp(argv[i], "-D")) {
+			dedup = 0;
+		}
+		else if (!strcmp(argv[i], "-C")) {
+			checksums = 0;
+		}
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			free_blocks = strtoul(argv[++i], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+			free_inodes = strtoul(argv[++i], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			journal_blocks = strtoul(argv[++i], NULL, 0);
+		}
+		else if (!in) {
+			in = argv[i];
+		}
+		else {
+			in = NULL;
+			break;
+		}
+	}
+
+	if (!in || !out_name) {
+		fprintf(stderr, "usage: %s [-1] [-z] [-D] [-C] [-b <blocks>] [-i <inodes>] [-j <blocks>] <dir> -o <image>\n", argv[0]);
+		return 1;
+	}
+	if (journal_blocks && journal_blocks < JOURNAL_MIN_BLOCKS) {
+		die("journal too small", NULL);
+	}
+
+	memset(&root, 0, sizeof(root));
+	strcpy(root.name, ".");
+	root.type = FILE_TYPE_DIR;
+	scan_dir(in, &root, version == FS_VERSION_2);
+
+	out = fopen(out_name, "wb");
+	if (!out) {
+		die(out_name, strerror(errno));
+	}
+
+	if (version == FS_VERSION_2) {
+		write_v2(&root, out);
+	}
+	else {
+		write_v1(&root, out);
+	}
+
+	if (fclose(out)) {
+		die(out_name, strerror(errno));
+	}
+
+	return 0;
+}
@@ -0,0 +1,622 @@
+/* ata.c - ATA disk driver for the IDE controller, with busmaster DMA
+ * vim:ts=4 sw=4 noexpandtab
+ *
+ * Requests are queued per channel and handed to the drive one command at a
+ * time. The queue is kept in sector order and served as a one-way elevator:
+ * the next command starts at the first request past where the last one
+ * ended, wrapping around to the lowest. Requests that continue right where
+ * the chosen one ends, in the same direction, ride along in the same
+ * command, each with its own pieces of the PRD table. Completion comes in
+ * through IRQ 14 and 15, so the CPU only touches the drive once a command,
+ * or once a sector when there's no busmaster to do DMA.
+ */
+
+#include "types.h"
+#include "lib.h"
+#include "i8259.h"
+#include "paging.h"
+#include "frame.h"
+#include "proc.h"
+#include "syscall.h"
+#include "pci.h"
+#include "ata.h"
+
+/* interrupt enable flag in EFLAGS */
+#define EFLAGS_IF 0x200
+
+/* words in a sector, for PIO */
+#define SECTOR_WORDS (SECTOR_SIZE / 2)
+
+/* A channel of the controller and the requests going to its drives */
+typedef struct ata_channel {
+	uint16_t io;
+	uint16_t ctrl;
+	uint16_t bm;          /* busmaster base, 0 if there's no DMA */
+	uint16_t irq;
+	blk_req_t *queue;     /* waiting requests, sorted by drive then sector */
+	blk_req_t *flushes;   /* waiting cache flushes, run when queue empties */
+	blk_req_t *active;    /* the requests the current command is moving */
+	uint32_t dma;         /* whether the current command is a DMA */
+	uint32_t head_drive;  /* where the last command ended, for the elevator */
+	uint32_t head_lba;
+	blk_req_t *pio_req;   /* PIO progress through the active requests */
+	uint32_t pio_sector;
+	prd_t *prdt;
+} ata_channel_t;
+
+static ata_channel_t channels[ATA_CHANNELS] = {
+	{ .io = ATA_PRIMARY_IO,   .ctrl = ATA_PRIMARY_CTRL,   .irq = ATA0_IRQ_PORT },
+	{ .io = ATA_SECONDARY_IO, .ctrl = ATA_SECONDARY_CTRL, .irq = ATA1_IRQ_PORT },
+};
+
+/* sector count of each drive, 0 if it's missing */
+static uint32_t drive_sectors[ATA_DRIVES];
+
+ata_stats_t ata_stats;
+
+/* Helper functions */
+static int32_t ata_identify(uint32_t drive);
+static int32_t req_before(const blk_req_t *a, uint32_t drive, uint32_t lba);
+static uint32_t prd_pieces(const uint8_t *buf, uint32_t len);
+static void ata_dispatch(ata_channel_t *ch);
+static void ata_start(ata_channel_t *ch);
+static void ata_finish(ata_channel_t *ch, int32_t status);
+static void pio_transfer(ata_channel_t *ch);
+
+/*
+ * Finds the drives on both channels and the busmaster registers of the
+ * controller. Drives are found with interrupts off at the drive, which are
+ * turned back on once a drive is found.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void ata_init(void)
+{
+	pci_addr_t pci;
+	uint32_t bar4;
+	uint32_t i;
+
+	memset(&ata_stats, 0, sizeof(ata_stats));
+
+	/* DMA needs the controller's busmaster registers, and to be let on the bus */
+	bar4 = 0;
+	if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci)) {
+		bar4 = pci_read(&pci, PCI_BAR4);
+		if (bar4 & PCI_BAR_IO) {
+			pci_write(&pci, PCI_COMMAND, pci_read(&pci, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+			bar4 &= PCI_BAR_MASK;
+		}
+		else {
+			bar4 = 0;
+		}
+	}
+
+	for (i = 0; i < ATA_CHANNELS; i++) {
+		channels[i].queue = NULL;
+		channels[i].flushes = NULL;
+		channels[i].active = NULL;
+		channels[i].bm = 0;
+
+		/* a bus with nothing on it floats high */
+		if (inb(channels[i].io + ATA_REG_STATUS) == 0xFF) {
+			continue;
+		}
+
+		outb(ATA_CTRL_NIEN, channels[i].ctrl);
+
+		if (bar4) {
+			/* the PRD table can't cross 64KB, which no pool frame does */
+			channels[i].prdt = kpage_alloc(0);
+			if (channels[i].prdt) {
+				channels[i].bm = bar4 + i * BM_SECONDARY;
+			}
+		}
+	}
+
+	for (i = 0; i < ATA_DRIVES; i++) {
+		drive_sectors[i] = 0;
+		if (inb(channels[i / 2].io + ATA_REG_STATUS) != 0xFF) {
+			ata_identify(i);
+		}
+	}
+
+	for (i = 0; i < ATA_CHANNELS; i++) {
+		if (drive_sectors[2 * i] || drive_sectors[2 * i + 1]) {
+			/* reading the status drops anything identify left pending */
+			inb(channels[i].io + ATA_REG_STATUS);
+			outb(0, channels[i].ctrl);
+		}
+	}
+}
+
+/*
+ * Asks a drive how large it is, by polling
+ *
+ * Inputs: drive - which drive, channel * 2 + slave
+ * Outputs: 0 if it's an ATA disk, -1 if it's missing or something else
+ */
+static int32_t ata_identify(uint32_t drive)
+{
+	ata_channel_t *ch = &channels[drive / 2];
+	uint16_t ident[SECTOR_WORDS];
+	uint32_t status;
+	uint32_t i;
+
+	outb(ATA_DRIVE_LBA | ((drive % 2) ? ATA_DRIVE_SLAVE : 0), ch->io + ATA_REG_DRIVE);
+	/* give the drive select 400ns to settle */
+	for (i = 0; i < 4; i++) {
+		inb(ch->ctrl);
+	}
+
+	outb(0, ch->io + ATA_REG_COUNT);
+	outb(0, ch->io + ATA_REG_LBA0);
+	outb(0, ch->io + ATA_REG_LBA1);
+	outb(0, ch->io + ATA_REG_LBA2);
+	outb(ATA_CMD_IDENTIFY, ch->io + ATA_REG_COMMAND);
+
+	if (!inb(ch->io + ATA_REG_STATUS)) {
+		return -1;
+	}
+
+	for (i = 0; (inb(ch->io + ATA_REG_STATUS) & ATA_SR_BSY); i++) {
+		if (i >= ATA_TIMEOUT) {
+			return -1;
+		}
+	}
+
+	/* ATAPI and SATA devices set these to their signature */
+	if (inb(ch->io + ATA_REG_LBA1) || inb(ch->io + ATA_REG_LBA2)) {
+		return -1;
+	}
+
+	for (i = 0; !((status = inb(ch->io + ATA_REG_STATUS)) & (ATA_SR_DRQ | ATA_SR_ERR)); i++) {
+		if (i >= ATA_TIMEOUT) {
+			return -1;
+		}
+	}
+	if (status & ATA_SR_ERR) {
+		return -1;
+	}
+
+	for (i = 0; i < SECTOR_WORDS; i++) {
+		ident[i] = inw(ch->io + ATA_REG_DATA);
+	}
+
+	drive_sectors[drive] = ident[ATA_IDENT_SECTORS] | ((uint32_t)ident[ATA_IDENT_SECTORS + 1] << 16);
+	return drive_sectors[drive] ? 0 : -1;
+}
+
+/*
+ * Returns the number of sectors on a drive, 0 if there's no drive
+ */
+uint32_t ata_sectors(uint32_t drive)
+{
+	return (drive < ATA_DRIVES) ? drive_sectors[drive] : 0;
+}
+
+/*
+ * Returns whether a request comes before a spot on the channel's drives
+ */
+static int32_t req_before(const blk_req_t *a, uint32_t drive, uint32_t lba)
+{
+	return a->drive < drive || (a->drive == drive && a->lba < lba);
+}
+
+/*
+ * Returns how many PRD entries a buffer takes, splitting it wherever it
+ * would cross a 64KB boundary
+ */
+static uint32_t prd_pieces(const uint8_t *buf, uint32_t len)
+{
+	uint32_t start = (uint32_t)buf;
+
+	return (start + len - 1) / PRD_BOUNDARY - start / PRD_BOUNDARY + 1;
+}
+
+/*
+ * Queues a request. It's started right away if its channel is idle, and
+ * otherwise when the elevator gets to it.
+ *
+ * Inputs: req - the request, owned by the driver until req->done is set
+ * Outputs: 0 if it was queued, -1 if it's invalid
+ */
+int32_t ata_submit(blk_req_t *req)
+{
+	ata_channel_t *ch;
+	blk_req_t **link;
+	uint32_t flags;
+
+	if (!req || req->drive >= ATA_DRIVES || !drive_sectors[req->drive]) {
+		return -1;
+	}
+
+	if (req->flags & BLK_FLUSH) {
+		req->count = 0;
+	}
+	else if (!req->count || req->count > ATA_MAX_SECTORS
+			|| req->lba + req->count > drive_sectors[req->drive]
+			|| req->lba + req->count > ATA_LBA28_MAX
+			|| (uint32_t)req->buf + req->count * SECTOR_SIZE > FAKE_VIDEO_MEM) {
+		return -1;
+	}
+
+	ch = &channels[req->drive / 2];
+	req->status = 0;
+	req->done = 0;
+	req->next = NULL;
+
+	cli_and_save(flags);
+
+	ata_stats.requests++;
+
+	if (req->flags & BLK_FLUSH) {
+		req->next = ch->flushes;
+		ch->flushes = req;
+	}
+	else {
+		/* keep the queue in order for the elevator */
+		for (link = &ch->queue; *link && !req_before(req, (*link)->drive, (*link)->lba); link = &(*link)->next);
+		req->next = *link;
+		*link = req;
+	}
+
+	if (!ch->active) {
+		ata_dispatch(ch);
+	}
+
+	restore_flags(flags);
+	return 0;
+}
+
+/*
+ * Picks the next command for an idle channel and starts it. Must be called
+ * with interrupts off.
+ *
+ * Inputs: ch - the channel
+ * Outputs: none
+ */
+static void ata_dispatch(ata_channel_t *ch)
+{
+	blk_req_t **link, **pick;
+	blk_req_t *last;
+	uint32_t sectors;
+	uint32_t prds;
+
+	if (ch->active) {
+		return;
+	}
+
+	if (!ch->queue) {
+		/* flushes wait for the writes queued ahead of them, one command
+		 * covers every flush of the same drive */
+		if (ch->flushes) {
+			last = ch->flushes;
+			ch->flushes = last->next;
+			ch->active = last;
+			for (link = &ch->flushes; *link; ) {
+				if ((*link)->drive == ch->active->drive) {
+					last->next = *link;
+					last = *link;
+					*link = last->next;
+				}
+				else {
+					link = &(*link)->next;
+				}
+			}
+			last->next = NULL;
+			ata_start(ch);
+		}
+		return;
+	}
+
+	/* first request past the head, or the lowest one to start a new sweep */
+	for (pick = &ch->queue; *pick && req_before(*pick, ch->head_drive, ch->head_lba); pick = &(*pick)->next);
+	if (!*pick) {
+		pick = &ch->queue;
+	}
+
+	last = *pick;
+	*pick = last->next;
+	ch->active = last;
+	sectors = last->count;
+	prds = prd_pieces(last->buf, last->count * SECTOR_SIZE);
+
+	/* the requests that continue where this one ends are next in the queue */
+	for (link = pick; *link; ) {
+		if ((*link)->drive != last->drive
+				|| (*link)->lba != last->lba + last->count
+				|| ((*link)->flags & BLK_WRITE) != (last->flags & BLK_WRITE)
+				|| sectors + (*link)->count > ATA_MAX_SECTORS
+				|| prds + prd_pieces((*link)->buf, (*link)->count * SECTOR_SIZE) > ATA_MAX_PRDS) {
+			break;
+		}
+
+		sectors += (*link)->count;
+		prds += prd_pieces((*link)->buf, (*link)->count * SECTOR_SIZE);
+		last->next = *link;
+		last = *link;
+		*link = last->next;
+		ata_stats.merged++;
+	}
+	last->next = NULL;
+
+	ch->head_drive = last->drive;
+	ch->head_lba = last->lba + last->count;
+
+	ata_start(ch);
+}
+
+/*
+ * Sends the command for a channel's active requests
+ *
+ * Inputs: ch - the channel, with its active chain set
+ * Outputs: none
+ */
+static void ata_start(ata_channel_t *ch)
+{
+	blk_req_t *req = ch->active;
+	uint32_t write = req->flags & BLK_WRITE;
+	uint32_t sectors;
+	uint32_t addr, end, piece;
+	uint32_t nprd;
+	uint32_t i;
+
+	ata_stats.commands++;
+
+	/* the drive has to be ready for a new command */
+	for (i = 0; (inb(ch->ctrl) & ATA_SR_BSY) && i < ATA_TIMEOUT; i++);
+
+	if (req->flags & BLK_FLUSH) {
+		ch->dma = 0;
+		ch->pio_req = NULL;
+		outb(ATA_DRIVE_LBA | ((req->drive % 2) ? ATA_DRIVE_SLAVE : 0), ch->io + ATA_REG_DRIVE);
+		outb(ATA_CMD_FLUSH, ch->io + ATA_REG_COMMAND);
+		return;
+	}
+
+	sectors = 0;
+	nprd = 0;
+	for (; req; req = req->next) {
+		sectors += req->count;
+
+		/* split each buffer at 64KB boundaries */
+		for (addr = (uint32_t)req->buf, end = addr + req->count * SECTOR_SIZE; addr < end; addr += piece) {
+			piece = min(end - addr, PRD_BOUNDARY - addr % PRD_BOUNDARY);
+			ch->prdt[nprd].addr = addr;
+			ch->prdt[nprd].size = piece & 0xFFFF;  /* 0 means 64KB */
+			ch->prdt[nprd].flags = 0;
+			nprd++;
+		}
+	}
+	ch->prdt[nprd - 1].flags = PRD_EOT;
+	ata_stats.sectors += sectors;
+
+	req = ch->active;
+	ch->dma = ch->bm != 0;
+
+	if (ch->dma) {
+		outl((uint32_t)ch->prdt, ch->bm + BM_REG_PRDT);
+		outb(BM_SR_IRQ | BM_SR_ERR, ch->bm + BM_REG_STATUS);
+		outb(write ? 0 : BM_CMD_READ, ch->bm + BM_REG_COMMAND);
+	}
+
+	outb(ATA_DRIVE_LBA | ((req->drive % 2) ? ATA_DRIVE_SLAVE : 0) | ((req->lba >> 24) & 0x0F),
+			ch->io + ATA_REG_DRIVE);
+	outb(sectors & 0xFF, ch->io + ATA_REG_COUNT);
+	outb(req->lba & 0xFF, ch->io + ATA_REG_LBA0);
+	outb((req->lba >> 8) & 0xFF, ch->io + ATA_REG_LBA1);
+	outb((req->lba >> 16) & 0xFF, ch->io + ATA_REG_LBA2);
+
+	if (ch->dma) {
+		outb(write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA, ch->io + ATA_REG_COMMAND);
+		outb((write ? 0 : BM_CMD_READ) | BM_CMD_START, ch->bm + BM_REG_COMMAND);
+		return;
+	}
+
+	ch->pio_req = req;
+	ch->pio_sector = 0;
+	outb(write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO, ch->io + ATA_REG_COMMAND);
+
+	if (write) {
+		/* the drive asks for the first sector without an interrupt */
+		for (i = 0; !(inb(ch->ctrl) & ATA_SR_DRQ) && i < ATA_TIMEOUT; i++);
+		pio_transfer(ch);
+	}
+}
+
+/*
+ * Moves the next sector of a PIO command between the drive and its buffer
+ *
+ * Inputs: ch - the channel
+ * Outputs: none
+ */
+static void pio_transfer(ata_channel_t *ch)
+{
+	uint16_t *data;
+	uint32_t i;
+
+	data = (uint16_t *)(ch->pio_req->buf + ch->pio_sector * SECTOR_SIZE);
+
+	if (ch->pio_req->flags & BLK_WRITE) {
+		for (i = 0; i < SECTOR_WORDS; i++) {
+			outw(data[i], ch->io + ATA_REG_DATA);
+		}
+	}
+	else {
+		for (i = 0; i < SECTOR_WORDS; i++) {
+			data[i] = inw(ch->io + ATA_REG_DATA);
+		}
+	}
+}
+
+/*
+ * Completes a channel's active requests and starts the next command
+ *
+ * Inputs: ch - the channel
+ *         status - 0 if the command worked, -1 if it failed
+ * Outputs: none
+ */
+static void ata_finish(ata_channel_t *ch, int32_t status)
+{
+	blk_req_t *req, *next;
+
+	req = ch->active;
+	ch->active = NULL;
+
+	if (status) {
+		ata_stats.errors++;
+	}
+
+	/* completions may queue more requests, which can start right away */
+	for (; req; req = next) {
+		next = req->next;
+		req->status = status;
+		req->done = 1;
+		if (req->complete) {
+			req->complete(req);
+		}
+	}
+
+	ata_dispatch(ch);
+}
+
+/*
+ * Services an interrupt from a channel. Also called by ata_wait to poll when
+ * interrupts are off.
+ *
+ * Inputs: channel - which channel interrupted
+ * Outputs: none
+ */
+void ata_handle_interrupt(uint32_t channel)
+{
+	ata_channel_t *ch;
+	uint32_t bm_status = 0;
+	uint32_t status;
+	uint32_t flags;
+
+	if (channel >= ATA_CHANNELS) {
+		return;
+	}
+	ch = &channels[channel];
+
+	cli_and_save(flags);
+
+	if (ch->dma) {
+		bm_status = inb(ch->bm + BM_REG_STATUS);
+		if (!(bm_status & BM_SR_IRQ)) {
+			/* not done yet */
+			goto out;
+		}
+		outb(0, ch->bm + BM_REG_COMMAND);
+		outb(BM_SR_IRQ | BM_SR_ERR, ch->bm + BM_REG_STATUS);
+	}
+
+	/* reading the status register acknowledges the interrupt */
+	status = inb(ch->io + ATA_REG_STATUS);
+	if (!ch->active || (status & ATA_SR_BSY)) {
+		goto out;
+	}
+
+	if ((status & (ATA_SR_ERR | ATA_SR_DF)) || (bm_status & BM_SR_ERR)) {
+		ata_finish(ch, -1);
+		goto out;
+	}
+
+	if (ch->dma || !ch->pio_req) {
+		ata_finish(ch, 0);
+		goto out;
+	}
+
+	/* PIO reads interrupt when a sector is ready, writes once it's taken */
+	if (!(ch->pio_req->flags & BLK_WRITE)) {
+		if (!(status & ATA_SR_DRQ)) {
+			goto out;
+		}
+		pio_transfer(ch);
+	}
+
+	if (++ch->pio_sector == ch->pio_req->count) {
+		ch->pio_req = ch->pio_req->next;
+		ch->pio_sector = 0;
+	}
+
+	if (!ch->pio_req) {
+		ata_finish(ch, 0);
+	}
+	else if (ch->pio_req->flags & BLK_WRITE) {
+		pio_transfer(ch);
+	}
+
+out:
+	restore_flags(flags);
+}
+
+/*
+ * Waits for a submitted request to finish. Processes give up their time
+ * while they wait; with interrupts off, like during boot, the channel is
+ * polled instead.
+ *
+ * Inputs: req - the request
+ * Outputs: its status, 0 on success and -1 on failure
+ */
+int32_t ata_wait(blk_req_t *req)
+{
+	uint32_t flags;
+
+	while (!req->done) {
+		cli_and_save(flags);
+		restore_flags(flags);
+
+		if (!(flags & EFLAGS_IF)) {
+			ata_handle_interrupt(req->drive / 2);
+		}
+		else if (get_proc_pcb()) {
+			sched();
+		}
+		else {
+			asm volatile ("hlt");
+		}
+	}
+
+	return req->status;
+}
+
+/*
+ * Reads or writes sectors and waits for them
+ *
+ * Inputs: drive - which drive
+ *         lba - first sector
+ *         count - number of sectors, at most ATA_MAX_SECTORS
+ *         buf - identity mapped kernel memory
+ *         flags - BLK_WRITE to write
+ * Outputs: 0 on success, -1 on failure
+ */
+int32_t ata_rw(uint32_t drive, uint32_t lba, uint32_t count, uint8_t *buf, uint32_t flags)
+{
+	blk_req_t req;
+
+	memset(&req, 0, sizeof(req));
+	req.drive = drive;
+	req.lba = lba;
+	req.count = count;
+	req.buf = buf;
+	req.flags = flags;
+
+	if (ata_submit(&req)) {
+		return -1;
+	}
+
+	return ata_wait(&req);
+}
+
+/*
+ * Flushes a drive's write cache, after everything queued for its channel
+ *
+ * Inputs: drive - which drive
+ * Outputs: 0 on success, -1 on failure
+ */
+int32_t ata_flush(uint32_t drive)
+{
+	return ata_rw(drive, 0, 0, NULL, BLK_FLUSH);
+}
@@ -0,0 +1,178 @@
+/* ata.h - ATA disk driver for the IDE controller, with busmaster DMA
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#ifndef _ATA_H
+#define _ATA_H
+
+#include "types.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+#define SECTOR_SIZE 512
+
+/* two channels of two drives each */
+#define ATA_CHANNELS 2
+#define ATA_DRIVES   4
+
+/* legacy port bases of the two channels */
+#define ATA_PRIMARY_IO     0x1F0
+#define ATA_PRIMARY_CTRL   0x3F6
+#define ATA_SECONDARY_IO   0x170
+#define ATA_SECONDARY_CTRL 0x376
+
+/* task file registers, from the channel's I/O base */
+#define ATA_REG_DATA     0
+#define ATA_REG_ERROR    1
+#define ATA_REG_COUNT    2
+#define ATA_REG_LBA0     3
+#define ATA_REG_LBA1     4
+#define ATA_REG_LBA2     5
+#define ATA_REG_DRIVE    6
+#define ATA_REG_STATUS   7
+#define ATA_REG_COMMAND  7
+
+/* status register bits */
+#define ATA_SR_ERR  0x01
+#define ATA_SR_DRQ  0x08
+#define ATA_SR_DF   0x20
+#define ATA_SR_BSY  0x80
+
+/* device control register bits */
+#define ATA_CTRL_NIEN 0x02
+#define ATA_CTRL_SRST 0x04
+
+/* drive register: LBA addressing, and which drive */
+#define ATA_DRIVE_LBA   0xE0
+#define ATA_DRIVE_SLAVE 0x10
+
+/* commands */
+#define ATA_CMD_READ_PIO  0x20
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_READ_DMA  0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_FLUSH     0xE7
+#define ATA_CMD_IDENTIFY  0xEC
+
+/* busmaster registers, from the channel's busmaster base */
+#define BM_REG_COMMAND 0
+#define BM_REG_STATUS  2
+#define BM_REG_PRDT    4
+
+/* busmaster bits */
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  /* the device writes to memory */
+#define BM_SR_ACTIVE  0x01
+#define BM_SR_ERR     0x02
+#define BM_SR_IRQ     0x04
+
+/* the busmaster registers of the secondary channel come after the primary's */
+#define BM_SECONDARY 8
+
+/* PCI class of IDE controllers */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE  0x01
+
+/* last word of a PRD table has this set, and entries can't cross 64KB */
+#define PRD_EOT      0x8000
+#define PRD_BOUNDARY 0x10000
+
+/* most sectors one LBA28 command moves, a count of 0 means 256 */
+#define ATA_MAX_SECTORS 256
+
+/* entries in each channel's PRD table */
+#define ATA_MAX_PRDS 64
+
+/* highest sector LBA28 can address */
+#define ATA_LBA28_MAX 0x0FFFFFFF
+
+/* identify words holding the LBA28 sector count */
+#define ATA_IDENT_SECTORS 60
+
+/* polls before a drive is given up on during setup */
+#define ATA_TIMEOUT 100000
+
+/* request flags */
+#define BLK_WRITE 0x1
+#define BLK_FLUSH 0x2  /* flush the drive's write cache, moves no data */
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* Block Request
+ *  A transfer of whole sectors between a drive and memory. Buffers are
+ *  handed to the controller by physical address, so they have to be in
+ *  identity mapped kernel memory (the kernel image or the kernel pool).
+ *  The request belongs to the driver from ata_submit until done is set,
+ *  after which complete, if any, has been called from the interrupt.
+ */
+typedef struct blk_req {
+	uint32_t drive;
+	uint32_t lba;
+	uint32_t count;
+	uint8_t *buf;
+	uint32_t flags;
+	volatile int32_t status;
+	volatile uint32_t done;
+	void (*complete)(struct blk_req *req);
+	void *priv;
+	struct blk_req *next;
+} blk_req_t;
+
+/* Physical Region Descriptor, one contiguous piece of a DMA transfer */
+typedef struct prd {
+	uint32_t addr;
+	uint16_t size;
+	uint16_t flags;
+} __attribute__((packed)) prd_t;
+
+/* queue statistics, for tuning the elevator */
+typedef struct ata_stats {
+	uint32_t requests;
+	uint32_t commands;
+	uint32_t merged;
+	uint32_t sectors;
+	uint32_t errors;
+} ata_stats_t;
+
+
+/****************************************
+ *           Global Variables           *
+ ****************************************/
+
+extern ata_stats_t ata_stats;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Finds the drives and the busmaster, unmask IRQ 14 and 15 afterwards */
+void ata_init(void);
+
+/* Returns the number of sectors on a drive, 0 if there's no drive */
+uint32_t ata_sectors(uint32_t drive);
+
+/* Queues a request, returns right away */
+int32_t ata_submit(blk_req_t *req);
+
+/* Waits for a submitted request to finish, returns its status */
+int32_t ata_wait(blk_req_t *req);
+
+/* Reads or writes sectors and waits for them */
+int32_t ata_rw(uint32_t drive, uint32_t lba, uint32_t count, uint8_t *buf, uint32_t flags);
+
+/* Flushes a drive's write cache */
+int32_t ata_flush(uint32_t drive);
+
+/* Services an interrupt from a channel */
+void ata_handle_interrupt(uint32_t channel);
+
+#endif /* ASM */
+
+#endif /* _ATA_H */
@@ -0,0 +1,721 @@
+/* bcache.c - buffer cache of file system blocks, over memory or a disk
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "frame.h"
+#include "proc.h"
+#include "bcache.h"
+
+bcache_stats_t bcache_stats;
+
+static bdev_t bdev;
+static buf_t bufs[BCACHE_BUFS];
+static uint8_t *frames[BCACHE_BUFS];
+static buf_t *buckets[BCACHE_BUCKETS];
+static buf_t lru;
+static uint32_t nbufs;
+
+/* PIT ticks since boot, the age of dirty buffers is measured in these */
+static volatile uint32_t bcache_ticks;
+
+/* last journal transaction that committed, buffers of later ones are held */
+static volatile uint32_t committed_tid;
+
+/* whether a buffer may be written back, or evicted once clean */
+#define BUF_HELD(buf) ((int32_t)((buf)->tid - committed_tid) > 0)
+
+/* Helper functions */
+static uint32_t bcache_hash(uint32_t block);
+static buf_t *bcache_lookup(uint32_t block);
+static void bcache_flush(uint32_t age);
+static buf_t *buf_claim(uint32_t block, uint32_t may_write);
+static buf_t *buf_get(uint32_t block, uint32_t *hit);
+static int32_t buf_submit(buf_t *buf, uint32_t flags);
+static void buf_done(blk_req_t *req);
+static void buf_wait(buf_t *buf);
+static void lru_unlink(buf_t *buf);
+static void lru_push(buf_t *buf);
+static void hash_unlink(buf_t *buf);
+
+/*
+ * Sets up a device over an image in memory
+ *
+ * Inputs: dev - the device
+ *         image - start of the image, must be mapped
+ *         size - size of the image in bytes
+ * Outputs: none
+ */
+void bdev_mem(bdev_t *dev, void *image, uint32_t size)
+{
+	dev->nblocks = size / BCACHE_BLOCK_SIZE;
+	dev->map = image;
+	dev->drive = 0;
+	dev->start = 0;
+}
+
+/*
+ * Sets up a device over a whole disk, or over one of the primary partitions
+ * listed in its master boot record.
+ *
+ * Inputs: dev - the device
+ *         drive - which drive
+ *         part - partition number 1-4, 0 for the whole disk
+ * Outputs: 0 on success, -1 if there's no such drive or partition
+ */
+int32_t bdev_disk(bdev_t *dev, uint32_t drive, uint32_t part)
+{
+	uint32_t sectors = ata_sectors(drive);
+	uint8_t *mbr;
+	uint8_t *entry;
+	int32_t ret = -1;
+
+	if (!sectors || part > MBR_PARTITIONS) {
+		return -1;
+	}
+
+	dev->map = NULL;
+	dev->drive = drive;
+	dev->start = 0;
+	dev->nblocks = sectors / BCACHE_SECTORS;
+	if (!part) {
+		return 0;
+	}
+
+	/* the sector has to be somewhere the controller can reach */
+	mbr = kpage_alloc(0);
+	if (!mbr) {
+		return -1;
+	}
+	if (ata_rw(drive, 0, 1, mbr, 0) || *(uint16_t*)(mbr + SECTOR_SIZE - 2) != MBR_SIGNATURE) {
+		goto out;
+	}
+
+	/* type at 4, first sector at 8 and sector count at 12 */
+	entry = mbr + MBR_TABLE + (part - 1) * 16;
+	if (!entry[4] || *(uint32_t*)(entry + 8) >= sectors
+			|| *(uint32_t*)(entry + 12) > sectors - *(uint32_t*)(entry + 8)) {
+		goto out;
+	}
+
+	dev->start = *(uint32_t*)(entry + 8);
+	dev->nblocks = *(uint32_t*)(entry + 12) / BCACHE_SECTORS;
+	ret = 0;
+
+out:
+	kpage_free(mbr, 0);
+	return ret;
+}
+
+/*
+ * Empties the cache and points it at a device. Disks get a kernel pool
+ * frame for every buffer, if the pool runs short the cache just ends up
+ * smaller. Buffers of memory devices point into the image instead.
+ * Nothing may be pinned, and dirty blocks of the old device are dropped.
+ *
+ * Inputs: dev - the device
+ * Outputs: 0 on success, -1 if no buffers could be set up
+ */
+int32_t bcache_init(const bdev_t *dev)
+{
+	uint32_t i;
+
+	bdev = *dev;
+	committed_tid = 0;
+	memset(&bcache_stats, 0, sizeof(bcache_stats));
+	memset(buckets, 0, sizeof(buckets));
+
+	lru.lru_prev = lru.lru_next = &lru;
+	nbufs = 0;
+
+	for (i = 0; i < BCACHE_BUFS; i++) {
+		if (!bdev.map && !frames[i]) {
+			frames[i] = kpage_alloc(0);
+			if (!frames[i]) {
+				break;
+			}
+		}
+
+		memset(&bufs[i], 0, sizeof(buf_t));
+		bufs[i].req.priv = &bufs[i];
+		lru_push(&bufs[i]);
+		nbufs++;
+	}
+
+	return nbufs ? 0 : -1;
+}
+
+/*
+ * Returns a block pinned and read in. The buffer stays put until brelse,
+ * changes to it need a bdirty to make it to the disk.
+ *
+ * Inputs: block - block of the device
+ * Outputs: the buffer, NULL if the block couldn't be read or every buffer
+ *          is pinned
+ */
+buf_t *bread(uint32_t block)
+{
+	buf_t *buf;
+	uint32_t hit;
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	buf = buf_get(block, &hit);
+	if (buf) {
+		if (hit) {
+			bcache_stats.hits++;
+		}
+		else {
+			bcache_stats.misses++;
+		}
+
+		if (buf->flags & BUF_RA) {
+			buf->flags &= ~BUF_RA;
+			bcache_stats.ra_hits++;
+		}
+
+		/* also retries blocks readahead couldn't read */
+		if (!(buf->flags & (BUF_VALID | BUF_IO))) {
+			buf_submit(buf, 0);
+		}
+	}
+
+	restore_flags(flags);
+
+	if (!buf) {
+		return NULL;
+	}
+
+	buf_wait(buf);
+	if (!(buf->flags & BUF_VALID)) {
+		brelse(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/*
+ * Returns a block pinned without reading it in, for callers about to
+ * overwrite all of it.
+ *
+ * Inputs: block - block of the device
+ * Outputs: the buffer, NULL if every buffer is pinned
+ */
+buf_t *bget(uint32_t block)
+{
+	buf_t *buf;
+	uint32_t hit;
+	uint32_t flags;
+
+	cli_and_save(flags);
+	buf = buf_get(block, &hit);
+	if (buf) {
+		buf->flags &= ~BUF_RA;
+	}
+	restore_flags(flags);
+
+	if (!buf) {
+		return NULL;
+	}
+
+	/* a read landing after the caller's writes would undo them */
+	buf_wait(buf);
+	buf->flags |= BUF_VALID;
+
+	return buf;
+}
+
+/*
+ * Marks a pinned buffer as changed, the flusher writes it back once it has
+ * been dirty for BCACHE_DIRTY_AGE ticks.
+ *
+ * Inputs: buf - the buffer
+ * Outputs: none
+ */
+void bdirty(buf_t *buf)
+{
+	uint32_t flags;
+
+	/* the image is the block itself */
+	if (bdev.map) {
+		return;
+	}
+
+	cli_and_save(flags);
+	if (!(buf->flags & BUF_DIRTY)) {
+		buf->dirtied = bcache_ticks;
+	}
+	buf->flags |= BUF_DIRTY;
+	restore_flags(flags);
+}
+
+/*
+ * Unpins a buffer
+ *
+ * Inputs: buf - the buffer
+ * Outputs: none
+ */
+void brelse(buf_t *buf)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	if (buf->pins) {
+		buf->pins--;
+	}
+	restore_flags(flags);
+}
+
+/*
+ * Starts reading blocks ahead of a sequential reader, without waiting for
+ * them. Cached blocks are skipped and only clean buffers are taken, so
+ * readahead never waits for a write. Adjacent blocks end up merged into
+ * one disk command by the elevator.
+ *
+ * Inputs: block - first block to bring in
+ *         count - number of blocks
+ * Outputs: none
+ */
+void bcache_readahead(uint32_t block, uint32_t count)
+{
+	buf_t *buf;
+	uint32_t flags;
+	uint32_t i;
+
+	/* memory needs no reading */
+	if (bdev.map) {
+		return;
+	}
+
+	cli_and_save(flags);
+
+	for (i = 0; i < count && block + i < bdev.nblocks; i++) {
+		if (bcache_lookup(block + i)) {
+			continue;
+		}
+
+		buf = buf_claim(block + i, 0);
+		if (!buf) {
+			break;
+		}
+		if (buf_submit(buf, 0)) {
+			break;
+		}
+		buf->flags |= BUF_RA;
+		bcache_stats.readahead++;
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * Tracks whether a reader goes front to back. The window doubles each time
+ * a sequential read reaches a new block, up to BCACHE_RA_MAX, and a read
+ * anywhere else drops it until the reads are sequential again.
+ *
+ * Inputs: ra - the reader's state, RA_PACK(0, 0) for a new reader
+ *         first - block the read started in
+ *         next - block the reader's next read starts in
+ *         window - set to how many blocks from next to read ahead, 0 for none
+ * Outputs: the reader's new state
+ */
+int32_t bcache_ra_step(int32_t ra, uint32_t first, uint32_t next, uint32_t *window)
+{
+	uint32_t prev_next = RA_NEXT(ra);
+	uint32_t ra_window = RA_WINDOW(ra);
+
+	*window = 0;
+	if (first != prev_next) {
+		ra_window = 0;
+	}
+	else if (next != prev_next) {
+		ra_window = ra_window ? min(ra_window * 2, BCACHE_RA_MAX) : BCACHE_RA_MIN;
+		*window = ra_window;
+	}
+
+	return RA_PACK(next, ra_window);
+}
+
+/*
+ * Writes every dirty block that isn't held, waits for the writes and
+ * flushes the drive's write cache.
+ *
+ * Inputs: none
+ * Outputs: 0 on success, -1 if a block couldn't be written
+ */
+int32_t bcache_sync(void)
+{
+	uint32_t flags;
+	uint32_t i;
+	int32_t ret = 0;
+
+	if (bdev.map) {
+		return 0;
+	}
+
+	/* writes already in flight may have been dirtied again since */
+	for (i = 0; i < nbufs; i++) {
+		buf_wait(&bufs[i]);
+	}
+
+	cli_and_save(flags);
+	bcache_flush(0);
+	restore_flags(flags);
+
+	for (i = 0; i < nbufs; i++) {
+		buf_wait(&bufs[i]);
+		if ((bufs[i].flags & BUF_DIRTY) && !BUF_HELD(&bufs[i])) {
+			ret = -1;
+		}
+	}
+
+	if (ata_flush(bdev.drive)) {
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Runs the flusher. Called on every PIT tick (50 a second), every
+ * BCACHE_FLUSH_TICKS it starts writes for the blocks that have been dirty
+ * for BCACHE_DIRTY_AGE ticks or more. Nothing here waits, the writes
+ * finish from the disk interrupt.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void bcache_tick(void)
+{
+	if (++bcache_ticks % BCACHE_FLUSH_TICKS) {
+		return;
+	}
+
+	bcache_flush(BCACHE_DIRTY_AGE);
+}
+
+/*
+ * Starts writing every dirty block that isn't held, so that a request
+ * queued afterwards finds every change made so far on its way to the disk.
+ * Blocks changed again while an older write of theirs is in flight are
+ * waited for and written again, the rest isn't waited for.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void bcache_writeback(void)
+{
+	uint32_t flags;
+	uint32_t i;
+
+	cli_and_save(flags);
+	bcache_flush(0);
+
+	for (i = 0; i < nbufs && !bdev.map; i++) {
+		if ((bufs[i].flags & (BUF_DIRTY | BUF_IO)) == (BUF_DIRTY | BUF_IO) && !BUF_HELD(&bufs[i])) {
+			buf_wait(&bufs[i]);
+			if ((bufs[i].flags & (BUF_DIRTY | BUF_IO)) == BUF_DIRTY) {
+				buf_submit(&bufs[i], BLK_WRITE);
+			}
+		}
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * Marks journal transactions up to tid as committed, after which the
+ * flusher may write back the buffers they logged
+ *
+ * Inputs: tid - the transaction
+ * Outputs: none
+ */
+void bcache_commit(uint32_t tid)
+{
+	committed_tid = tid;
+}
+
+/*
+ * Cachestat system call. Copies the cache counters out so the hit rate can
+ * be watched while tuning.
+ *
+ * Inputs: buf - where to copy them, a bcache_stats_t
+ *         nbytes - size of buf, fewer counters are copied if it's short
+ * Outputs: bytes copied, -1 if buf is invalid
+ */
+int32_t sys_cachestat(bcache_stats_t *buf, int32_t nbytes)
+{
+	if (!buf || nbytes < 0) {
+		return -1;
+	}
+
+	nbytes = min(nbytes, sizeof(bcache_stats_t));
+	if (!user_range_ok(buf, nbytes)) {
+		return -1;
+	}
+
+	memcpy(buf, &bcache_stats, nbytes);
+
+	return nbytes;
+}
+
+/*
+ * Hashes a block number into a bucket index
+ */
+static uint32_t bcache_hash(uint32_t block)
+{
+	return (block * 0x9E3779B1UL) >> 24 & (BCACHE_BUCKETS - 1);
+}
+
+/*
+ * Finds a cached block
+ *
+ * Inputs: block - the block
+ * Outputs: the buffer holding it, NULL if it isn't cached
+ */
+static buf_t *bcache_lookup(uint32_t block)
+{
+	buf_t *buf;
+
+	for (buf = buckets[bcache_hash(block)]; buf; buf = buf->hash_next) {
+		if (buf->block == block) {
+			return buf;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Starts writes for the dirty buffers that aren't busy or held and have
+ * been dirty for at least age ticks. Must be called with interrupts off.
+ *
+ * Inputs: age - ticks since the buffer was first dirtied
+ * Outputs: none
+ */
+static void bcache_flush(uint32_t age)
+{
+	uint32_t i;
+
+	if (bdev.map) {
+		return;
+	}
+
+	for (i = 0; i < nbufs; i++) {
+		if ((bufs[i].flags & (BUF_DIRTY | BUF_IO)) == BUF_DIRTY && !BUF_HELD(&bufs[i])
+				&& bcache_ticks - bufs[i].dirtied >= age) {
+			buf_submit(&bufs[i], BLK_WRITE);
+		}
+	}
+}
+
+/*
+ * Takes the least recently used buffer that isn't pinned, busy or held for a
+ * block. Clean buffers go first; if every candidate is dirty the oldest is
+ * written out, waiting for it with interrupts off. Must be called with
+ * interrupts off.
+ *
+ * Inputs: block - the block, must not be cached already
+ *         may_write - whether a dirty buffer may be written to free it
+ * Outputs: the buffer, unpinned and not yet valid for disks, NULL if
+ *          none could be taken
+ */
+static buf_t *buf_claim(uint32_t block, uint32_t may_write)
+{
+	buf_t *buf;
+	buf_t *dirty;
+	uint32_t bucket;
+
+	if (block >= bdev.nblocks) {
+		return NULL;
+	}
+
+	for (;;) {
+		dirty = NULL;
+		for (buf = lru.lru_prev; buf != &lru; buf = buf->lru_prev) {
+			if (buf->pins || (buf->flags & BUF_IO) || BUF_HELD(buf)) {
+				continue;
+			}
+			if (!(buf->flags & BUF_DIRTY)) {
+				break;
+			}
+			if (!dirty) {
+				dirty = buf;
+			}
+		}
+		if (buf != &lru) {
+			break;
+		}
+
+		if (!dirty || !may_write || buf_submit(dirty, BLK_WRITE)) {
+			return NULL;
+		}
+		buf_wait(dirty);
+	}
+
+	if (buf->flags & BUF_VALID) {
+		bcache_stats.evictions++;
+	}
+	if (buf->data) {
+		hash_unlink(buf);
+	}
+
+	buf->block = block;
+	buf->tid = 0;
+	if (bdev.map) {
+		buf->data = bdev.map + block * BCACHE_BLOCK_SIZE;
+		buf->flags = BUF_VALID;
+	}
+	else {
+		buf->data = frames[buf - bufs];
+		buf->flags = 0;
+	}
+
+	bucket = bcache_hash(block);
+	buf->hash_next = buckets[bucket];
+	buckets[bucket] = buf;
+
+	lru_unlink(buf);
+	lru_push(buf);
+
+	return buf;
+}
+
+/*
+ * Finds or claims the buffer of a block, pins it and makes it the most
+ * recently used one. Must be called with interrupts off.
+ *
+ * Inputs: block - the block
+ *         hit - set if the block was already cached
+ * Outputs: the buffer, NULL if every buffer is pinned
+ */
+static buf_t *buf_get(uint32_t block, uint32_t *hit)
+{
+	buf_t *buf;
+
+	buf = bcache_lookup(block);
+	*hit = buf != NULL;
+
+	if (!buf) {
+		buf = buf_claim(block, 1);
+		if (!buf) {
+			return NULL;
+		}
+	}
+	else if (buf != lru.lru_next) {
+		lru_unlink(buf);
+		lru_push(buf);
+	}
+
+	buf->pins++;
+	return buf;
+}
+
+/*
+ * Queues a read or write of a buffer. Writes take the dirty mark off right
+ * away, so a change made while the write is in flight dirties it again.
+ * Must be called with interrupts off.
+ *
+ * Inputs: buf - the buffer, not busy
+ *         flags - BLK_WRITE to write
+ * Outputs: 0 if it was queued, -1 if not
+ */
+static int32_t buf_submit(buf_t *buf, uint32_t flags)
+{
+	buf->req.drive = bdev.drive;
+	buf->req.lba = bdev.start + buf->block * BCACHE_SECTORS;
+	buf->req.count = BCACHE_SECTORS;
+	buf->req.buf = buf->data;
+	buf->req.flags = flags;
+	buf->req.complete = &buf_done;
+
+	buf->flags |= BUF_IO;
+	buf->flags &= ~BUF_DIRTY;
+
+	if (ata_submit(&buf->req)) {
+		buf->flags &= ~BUF_IO;
+		if (flags & BLK_WRITE) {
+			buf->flags |= BUF_DIRTY;
+		}
+		bcache_stats.errors++;
+		return -1;
+	}
+
+	if (flags & BLK_WRITE) {
+		bcache_stats.writebacks++;
+	}
+
+	return 0;
+}
+
+/*
+ * Finishes a buffer's read or write, from the disk interrupt. A failed
+ * write leaves the buffer dirty so it's tried again.
+ *
+ * Inputs: req - the buffer's request
+ * Outputs: none
+ */
+static void buf_done(blk_req_t *req)
+{
+	buf_t *buf = req->priv;
+
+	if (req->status) {
+		bcache_stats.errors++;
+		if (req->flags & BLK_WRITE) {
+			buf->flags |= BUF_DIRTY;
+		}
+	}
+	else if (!(req->flags & BLK_WRITE)) {
+		buf->flags |= BUF_VALID;
+	}
+
+	buf->flags &= ~BUF_IO;
+}
+
+/*
+ * Waits for a buffer's read or write to finish, if one is in flight
+ */
+static void buf_wait(buf_t *buf)
+{
+	while (buf->flags & BUF_IO) {
+		ata_wait(&buf->req);
+	}
+}
+
+/*
+ * Takes a buffer off the LRU list
+ */
+static void lru_unlink(buf_t *buf)
+{
+	buf->lru_prev->lru_next = buf->lru_next;
+	buf->lru_next->lru_prev = buf->lru_prev;
+}
+
+/*
+ * Puts a buffer at the head of the LRU list
+ */
+static void lru_push(buf_t *buf)
+{
+	buf->lru_next = lru.lru_next;
+	buf->lru_prev = &lru;
+	lru.lru_next->lru_prev = buf;
+	lru.lru_next = buf;
+}
+
+/*
+ * Takes a buffer out of its hash bucket
+ */
+static void hash_unlink(buf_t *buf)
+{
+	buf_t **link;
+
+	link = &buckets[bcache_hash(buf->block)];
+	while (*link && *link != buf) {
+		link = &(*link)->hash_next;
+	}
+	if (*link) {
+		*link = buf->hash_next;
+	}
+}
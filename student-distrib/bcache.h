@@ -0,0 +1,156 @@
+/* bcache.h - buffer cache of file system blocks, over memory or a disk
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+#include "types.h"
+#include "ata.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* size of a cached block, same as a file system block */
+#define BCACHE_BLOCK_SIZE 4096
+
+/* sectors in a block */
+#define BCACHE_SECTORS (BCACHE_BLOCK_SIZE / SECTOR_SIZE)
+
+/* cached blocks, one kernel pool frame each (1MB) */
+#define BCACHE_BUFS    256
+
+/* hash buckets, must be a power of two */
+#define BCACHE_BUCKETS 256
+
+/* readahead window bounds, in blocks */
+#define BCACHE_RA_MIN  4
+#define BCACHE_RA_MAX  32
+
+/* Readahead state of a sequential reader, like a regular file's file_t
+ * reserved field: the block its next read starts in, and the window */
+#define RA_NEXT(ra)   ((uint32_t)(ra) & 0x00FFFFFF)
+#define RA_WINDOW(ra) ((uint32_t)(ra) >> 24)
+#define RA_PACK(next, window) ((int32_t)(((window) << 24) | ((next) & 0x00FFFFFF)))
+
+/* PIT ticks between flusher runs, and how long a block may stay dirty */
+#define BCACHE_FLUSH_TICKS 50
+#define BCACHE_DIRTY_AGE   250
+
+/* buffer flags */
+#define BUF_VALID 0x1  /* data holds the block */
+#define BUF_DIRTY 0x2  /* data is newer than the disk */
+#define BUF_IO    0x4  /* a read or write is in flight */
+#define BUF_RA    0x8  /* brought in by readahead and not read yet */
+
+/* MBR partition table */
+#define MBR_TABLE      0x1BE
+#define MBR_PARTITIONS 4
+#define MBR_SIGNATURE  0xAA55
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* Block Device
+ *  Either memory holding a whole image, like the multiboot module, or a
+ *  range of sectors on a disk.
+ */
+typedef struct bdev {
+	uint32_t nblocks;
+	uint8_t *map;      /* the image, NULL for disks */
+	uint32_t drive;    /* disks: which drive */
+	uint32_t start;    /* disks: first sector */
+} bdev_t;
+
+/* Buffer
+ *  A cached block. Buffers are pinned from bread or bget until brelse and
+ *  are never evicted while pinned. Every buffer sits on the LRU list, most
+ *  recently used at the head, and those holding a block are also chained
+ *  into their hash bucket. Buffers of memory devices point right at the
+ *  image, so they never need reading or writing. Buffers logged by a
+ *  journal transaction that hasn't committed yet are held: they aren't
+ *  written back or evicted until bcache_commit reaches their tid.
+ */
+typedef struct buf {
+	uint32_t block;
+	volatile uint32_t flags;
+	uint32_t pins;
+	uint32_t dirtied;  /* tick the buffer was first dirtied at */
+	uint32_t tid;      /* journal transaction that last logged it, 0 if none */
+	uint8_t *data;
+	blk_req_t req;
+	struct buf *hash_next;
+	struct buf *lru_prev;
+	struct buf *lru_next;
+} buf_t;
+
+/* Cache counters, hit rate is hits / (hits + misses) */
+typedef struct bcache_stats {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t readahead;
+	uint32_t ra_hits;  /* readahead blocks that were read later */
+	uint32_t evictions;
+	uint32_t writebacks;
+	uint32_t errors;
+} bcache_stats_t;
+
+
+/****************************************
+ *           Global Variables           *
+ ****************************************/
+
+extern bcache_stats_t bcache_stats;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Sets up a device over an image in memory */
+void bdev_mem(bdev_t *dev, void *image, uint32_t size);
+
+/* Sets up a device over a disk, or one of its primary partitions (1-4) */
+int32_t bdev_disk(bdev_t *dev, uint32_t drive, uint32_t part);
+
+/* Empties the cache and points it at a device */
+int32_t bcache_init(const bdev_t *dev);
+
+/* Returns the block pinned and read in, NULL on failure */
+buf_t *bread(uint32_t block);
+
+/* Returns the block pinned without reading it, for callers overwriting it all */
+buf_t *bget(uint32_t block);
+
+/* Marks a pinned buffer as changed */
+void bdirty(buf_t *buf);
+
+/* Unpins a buffer */
+void brelse(buf_t *buf);
+
+/* Starts reading blocks that aren't cached, without waiting for them */
+void bcache_readahead(uint32_t block, uint32_t count);
+
+/* Advances a reader's readahead state past a read, sets how far to read ahead */
+int32_t bcache_ra_step(int32_t ra, uint32_t first, uint32_t next, uint32_t *window);
+
+/* Writes every dirty block and waits for them */
+int32_t bcache_sync(void);
+
+/* Starts writing every dirty block that isn't held, ahead of whatever is queued next */
+void bcache_writeback(void);
+
+/* Lets buffers logged by transactions up to tid be written back */
+void bcache_commit(uint32_t tid);
+
+/* Called on every PIT tick, writes back blocks that have been dirty a while */
+void bcache_tick(void);
+
+/* Copies the cache counters out, for tuning */
+int32_t sys_cachestat(bcache_stats_t *buf, int32_t nbytes);
+
+#endif /* ASM */
+#endif /* _BCACHE_H */
@@ -0,0 +1,222 @@
+/* bitmap.c - two-level allocation bitmaps with bsf-based searching
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "types.h"
+#include "bitmap.h"
+
+/* masks of the bit positions a run of 2^order bits may start on */
+static const uint32_t run_align[] = {
+	0xFFFFFFFFUL,
+	0x55555555UL,
+	0x11111111UL,
+	0x01010101UL,
+	0x00010001UL,
+	0x00000001UL,
+};
+
+/*
+ * Sets up a bitmap over caller-provided storage. Bits past nbits are
+ * marked allocated so they are never handed out.
+ *
+ * Inputs: bm - bitmap to set up
+ *         map - storage for BITMAP_WORDS(nbits) words
+ *         full - storage for BITMAP_WORDS(BITMAP_WORDS(nbits)) words
+ *         nbits - number of allocatable bits
+ * Outputs: none
+ */
+void bitmap_init(bitmap_t *bm, uint32_t *map, uint32_t *full, uint32_t nbits)
+{
+	uint32_t i;
+	uint32_t nwords = BITMAP_WORDS(nbits);
+
+	bm->nbits = nbits;
+	bm->nfree = nbits;
+	bm->map = map;
+	bm->full = full;
+
+	for (i = 0; i < nwords; i++) {
+		map[i] = 0;
+	}
+	for (i = 0; i < BITMAP_WORDS(nwords); i++) {
+		full[i] = 0;
+	}
+
+	/* pad out the tail of the last map word */
+	if (nbits % BITS_PER_WORD) {
+		map[nwords - 1] = ~((1UL << (nbits % BITS_PER_WORD)) - 1);
+	}
+
+	/* pad out the tail of the last summary word */
+	if (nwords % BITS_PER_WORD) {
+		full[BITMAP_WORDS(nwords) - 1] = ~((1UL << (nwords % BITS_PER_WORD)) - 1);
+	}
+}
+
+/*
+ * Sets up a bitmap over storage that already holds allocation bits, like a
+ * bitmap read off a disk, and builds the summary and free count from it.
+ * Bits past nbits in the last word must already be set.
+ *
+ * Inputs: bm - bitmap to set up
+ *         map - BITMAP_WORDS(nbits) words of allocation bits
+ *         full - storage for BITMAP_WORDS(BITMAP_WORDS(nbits)) words
+ *         nbits - number of allocatable bits
+ * Outputs: none
+ */
+void bitmap_attach(bitmap_t *bm, uint32_t *map, uint32_t *full, uint32_t nbits)
+{
+	uint32_t i;
+	uint32_t word;
+	uint32_t nwords = BITMAP_WORDS(nbits);
+
+	bm->nbits = nbits;
+	bm->nfree = 0;
+	bm->map = map;
+	bm->full = full;
+
+	for (i = 0; i < BITMAP_WORDS(nwords); i++) {
+		full[i] = 0;
+	}
+
+	/* pad out the tail of the last summary word */
+	if (nwords % BITS_PER_WORD) {
+		full[BITMAP_WORDS(nwords) - 1] = ~((1UL << (nwords % BITS_PER_WORD)) - 1);
+	}
+
+	for (i = 0; i < nwords; i++) {
+		if (map[i] == 0xFFFFFFFFUL) {
+			full[BITMAP_WORD(i)] |= BITMAP_MASK(i);
+			continue;
+		}
+
+		/* count the clear bits */
+		for (word = ~map[i]; word; word &= word - 1) {
+			bm->nfree++;
+		}
+	}
+}
+
+/*
+ * Marks a bit as allocated, keeping the summary in sync.
+ *
+ * Inputs: bm - bitmap, bit - bit to set
+ * Outputs: none
+ */
+void bitmap_set(bitmap_t *bm, uint32_t bit)
+{
+	uint32_t word = BITMAP_WORD(bit);
+
+	if (bit >= bm->nbits || bitmap_test(bm, bit)) {
+		return;
+	}
+
+	bm->map[word] |= BITMAP_MASK(bit);
+	bm->nfree--;
+
+	if (bm->map[word] == 0xFFFFFFFFUL) {
+		bm->full[BITMAP_WORD(word)] |= BITMAP_MASK(word);
+	}
+}
+
+/*
+ * Marks a bit as free, keeping the summary in sync.
+ *
+ * Inputs: bm - bitmap, bit - bit to clear
+ * Outputs: none
+ */
+void bitmap_clear(bitmap_t *bm, uint32_t bit)
+{
+	uint32_t word = BITMAP_WORD(bit);
+
+	if (bit >= bm->nbits || !bitmap_test(bm, bit)) {
+		return;
+	}
+
+	bm->map[word] &= ~BITMAP_MASK(bit);
+	bm->full[BITMAP_WORD(word)] &= ~BITMAP_MASK(word);
+	bm->nfree++;
+}
+
+/*
+ * Allocates the lowest free bit.
+ *
+ * Inputs: bm - bitmap to allocate from
+ * Outputs: index of the allocated bit, -1 if the bitmap is full
+ */
+int32_t bitmap_alloc(bitmap_t *bm)
+{
+	uint32_t i;
+	uint32_t word;
+	uint32_t bit;
+
+	for (i = 0; i < BITMAP_WORDS(BITMAP_WORDS(bm->nbits)); i++) {
+		if (~bm->full[i]) {
+			word = i * BITS_PER_WORD + bsf(~bm->full[i]);
+			bit = word * BITS_PER_WORD + bsf(~bm->map[word]);
+			bitmap_set(bm, bit);
+			return bit;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Allocates an aligned run of 2^order bits. Runs never cross a word, which
+ * is what limits order to 5.
+ *
+ * Inputs: bm - bitmap to allocate from
+ *         order - log2 of the run length
+ * Outputs: first bit of the run, -1 if no run is free
+ */
+int32_t bitmap_alloc_run(bitmap_t *bm, uint32_t order)
+{
+	uint32_t word;
+	uint32_t free;
+	uint32_t shift;
+	uint32_t bit;
+	uint32_t i;
+
+	if (order >= sizeof run_align / sizeof run_align[0]) {
+		return -1;
+	}
+
+	for (word = 0; word < BITMAP_WORDS(bm->nbits); word++) {
+		if (bm->full[BITMAP_WORD(word)] & BITMAP_MASK(word)) {
+			continue;
+		}
+
+		/* leave a bit set only where the 2^order bits above it are all free */
+		free = ~bm->map[word];
+		for (shift = 1; shift < (1UL << order); shift <<= 1) {
+			free &= free >> shift;
+		}
+		free &= run_align[order];
+
+		if (free) {
+			bit = word * BITS_PER_WORD + bsf(free);
+			for (i = 0; i < (1UL << order); i++) {
+				bitmap_set(bm, bit + i);
+			}
+			return bit;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Frees a run of 2^order bits.
+ *
+ * Inputs: bm - bitmap, bit - first bit of the run, order - log2 of its length
+ * Outputs: none
+ */
+void bitmap_free_run(bitmap_t *bm, uint32_t bit, uint32_t order)
+{
+	uint32_t i;
+
+	for (i = 0; i < (1UL << order); i++) {
+		bitmap_clear(bm, bit + i);
+	}
+}
@@ -0,0 +1,85 @@
+/* bitmap.h - two-level allocation bitmaps with bsf-based searching
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#include "types.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+#define BITS_PER_WORD 32
+
+/* number of words needed to hold nbits */
+#define BITMAP_WORDS(nbits) (((nbits) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+
+/* word index and mask of a given bit */
+#define BITMAP_WORD(bit) ((bit) / BITS_PER_WORD)
+#define BITMAP_MASK(bit) (1UL << ((bit) % BITS_PER_WORD))
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* Allocation bitmap
+ *  A set bit in map marks an allocated item. Each bit in full marks a word
+ *  of map that has no clear bits left, so finding a free item takes one bsf
+ *  per 32 words of map plus one bsf in the word that was found.
+ */
+typedef struct bitmap {
+	uint32_t nbits;
+	uint32_t nfree;
+	uint32_t *map;
+	uint32_t *full;
+} bitmap_t;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Returns the index of the lowest set bit of a nonzero word */
+static inline uint32_t bsf(uint32_t word)
+{
+	uint32_t idx;
+	asm ("bsfl   %1, %0"
+			: "=r"(idx)
+			: "rm"(word)
+			: "cc");
+	return idx;
+}
+
+/* Tests whether a bit is allocated */
+static inline int32_t bitmap_test(const bitmap_t *bm, uint32_t bit)
+{
+	return (bm->map[BITMAP_WORD(bit)] & BITMAP_MASK(bit)) != 0;
+}
+
+/* Sets up a bitmap over caller-provided storage, every bit starts free */
+void bitmap_init(bitmap_t *bm, uint32_t *map, uint32_t *full, uint32_t nbits);
+
+/* Sets up a bitmap over storage that already holds allocation bits */
+void bitmap_attach(bitmap_t *bm, uint32_t *map, uint32_t *full, uint32_t nbits);
+
+/* Marks a bit as allocated */
+void bitmap_set(bitmap_t *bm, uint32_t bit);
+
+/* Marks a bit as free */
+void bitmap_clear(bitmap_t *bm, uint32_t bit);
+
+/* Allocates the first free bit, returns -1 if none are left */
+int32_t bitmap_alloc(bitmap_t *bm);
+
+/* Allocates 2^order consecutive bits aligned to 2^order (order <= 5),
+ * returns the first bit or -1 if no such run is free */
+int32_t bitmap_alloc_run(bitmap_t *bm, uint32_t order);
+
+/* Frees 2^order consecutive bits starting at bit */
+void bitmap_free_run(bitmap_t *bm, uint32_t bit, uint32_t order);
+
+#endif /* ASM */
+#endif /* _BITMAP_H */
@@ -0,0 +1,120 @@
+/* crc32c.c - CRC32C (Castagnoli) checksums
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "crc32c.h"
+
+/* set by crc32c_init when the processor has the SSE4.2 crc32 instruction */
+static uint32_t crc32c_hw;
+static uint32_t crc32c_ready;
+
+/* Slice-by-8 tables: table[k][b] is the CRC of byte b followed by k zero
+ * bytes, so eight bytes are folded in with eight lookups */
+static uint32_t crc32c_table[8][256];
+
+/* Helper functions */
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, uint32_t len);
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+/*
+ * Checks CPUID for SSE4.2 and builds the slice-by-8 tables if it's missing.
+ * Only the first call does anything.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void crc32c_init(void)
+{
+	uint32_t eax = 1, ebx, ecx, edx;
+	uint32_t crc;
+	uint32_t i, k;
+
+	if (crc32c_ready) {
+		return;
+	}
+
+	asm volatile ("cpuid"
+			: "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+	crc32c_hw = (ecx & CPUID_ECX_SSE42) != 0;
+
+	if (!crc32c_hw) {
+		for (i = 0; i < 256; i++) {
+			crc = i;
+			for (k = 0; k < 8; k++) {
+				crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+			}
+			crc32c_table[0][i] = crc;
+		}
+		for (i = 0; i < 256; i++) {
+			for (k = 1; k < 8; k++) {
+				crc = crc32c_table[k - 1][i];
+				crc32c_table[k][i] = (crc >> 8) ^ crc32c_table[0][crc & 0xFF];
+			}
+		}
+	}
+
+	crc32c_ready = 1;
+}
+
+/*
+ * Continues a CRC32C over more bytes. The CRC is kept inverted in between,
+ * so a CRC started at 0 matches the usual definition.
+ *
+ * Inputs: crc - CRC of the bytes so far, 0 to start
+ *         buf - the bytes
+ *         len - how many
+ * Outputs: CRC of everything so far
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, uint32_t len)
+{
+	if (!crc32c_ready) {
+		crc32c_init();
+	}
+
+	if (crc32c_hw) {
+		return ~crc32c_sse42(~crc, buf, len);
+	}
+	return ~crc32c_sw(~crc, buf, len);
+}
+
+/*
+ * Runs the crc32 instruction over the bytes, four at a time
+ */
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+	for (; len >= 4; buf += 4, len -= 4) {
+		asm ("crc32l  %1, %0"
+				: "+r"(crc)
+				: "rm"(*(const uint32_t*)buf));
+	}
+	for (; len; buf++, len--) {
+		asm ("crc32b  %1, %0"
+				: "+r"(crc)
+				: "rm"(*buf));
+	}
+
+	return crc;
+}
+
+/*
+ * Looks up the bytes in the slice-by-8 tables, eight at a time
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+	uint32_t lo, hi;
+
+	for (; len >= 8; buf += 8, len -= 8) {
+		lo = *(const uint32_t*)buf ^ crc;
+		hi = *(const uint32_t*)(buf + 4);
+		crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF]
+			^ crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24]
+			^ crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF]
+			^ crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+	}
+	for (; len; buf++, len--) {
+		crc = crc32c_table[0][(crc ^ *buf) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc;
+}
@@ -0,0 +1,32 @@
+/* crc32c.h - CRC32C (Castagnoli) checksums
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
+#include "types.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* the Castagnoli polynomial, bit reversed */
+#define CRC32C_POLY 0x82F63B78
+
+/* CPUID leaf 1 sets this bit of ecx on processors with SSE4.2 */
+#define CPUID_ECX_SSE42 (1 << 20)
+
+#ifndef ASM
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Picks the crc32 instruction if there is one, builds the tables otherwise */
+void crc32c_init(void);
+
+/* Continues a CRC32C over more bytes, start with crc 0 */
+uint32_t crc32c(uint32_t crc, const void *buf, uint32_t len);
+
+#endif /* ASM */
+#endif /* _CRC32C_H */
@@ -5,7 +5,17 @@
 
 #include "lib.h"
 #include "proc.h"
+#include "bitmap.h"
 #include "file_sys.h"
+#include "frame.h"
+#include "bcache.h"
+#include "journal.h"
+#include "lz4.h"
+#include "crc32c.h"
+#include "poll.h"
+#include "wait.h"
+#include "syscall.h"
+#include "rtc.h"
 
 /* File operations jump table */
 fops_t file_fops = {
@@ -13,6 +23,7 @@ fops_t file_fops = {
 	.write = &file_write,
 	.open  = &file_open,
 	.close = &file_close,
+	.poll  = &file_poll,
 };
 
 /* Directory operations jump table */
@@ -21,27 +32,740 @@ fops_t dir_fops = {
 	.write = &dir_write,
 	.open  = &dir_open,
 	.close = &dir_close,
+	.poll  = &file_poll,
 };
 
 /*Variables for File_sys functions*/
-static index_node_t* node_head;
 static data_block_t* data_head;
 static boot_block_t* boot_block;
 
+/* version 2 images */
+static super_block_t* super_block;
+
+/* format of the mounted image, and the directory paths start from */
+static uint32_t fs_version;
+static uint32_t root_dir;
+
+/* Everything is read and written through the buffer cache. The superblock
+ * and the inode table of version 2 images stay pinned in it while mounted,
+ * and data blocks are counted from data_start. */
+static buf_t *super_buf;
+static buf_t **inode_bufs;
+static uint32_t data_start;
+
+/* set when the whole image is in memory, whose cached blocks are the image
+ * itself, so reads then copy whole runs straight out of it */
+static uint32_t fs_mapped;
+
+/* Writable images: which data blocks and inodes are in use, copied out of
+ * the image and written back a word at a time as they change */
+static uint32_t fs_writable;
+static bitmap_t block_map;
+static bitmap_t inode_map;
+
+/* Held while a writable image is changed, so changes happen one at a time
+ * and can sleep on the disk with interrupts on. Readers don't take it. A
+ * process killed from the keyboard partway through a change is halted once
+ * it's done, fs_halt_pid is which. */
+static mutex_t fs_lock;
+static int32_t fs_halt_pid = -1;
+
+/* Blocks freed by journal transactions that haven't committed, a bit per
+ * block like block_map. They stay allocated in block_map, but not in the
+ * image, until freeing_tid is done committing. */
+static uint32_t *freeing;
+static uint32_t freeing_tid;
+
+/* With FS_SHARED, how many more files than one hold each data block, NULL
+ * otherwise. Written back a word at a time like the bitmaps. */
+static uint16_t *block_shares;
+
+/* With FS_CSUM, which data blocks have been checked against the checksum
+ * table since mounting (or changed, so there's nothing to check), and
+ * which of those failed. NULL otherwise. */
+static uint32_t *csum_checked;
+static uint32_t *csum_bad;
+
+/* Decompressed blocks of compressed files, the least recently used one is
+ * replaced. They're known by where the compressed block is in the image,
+ * so files sharing their data share these too. zscratch holds a compressed
+ * block on its way in. */
+typedef struct zblock {
+	uint32_t db_idx;  /* data block the compressed block starts in */
+	uint32_t offset;  /* and where in it */
+	uint32_t size;    /* its compressed size */
+	uint32_t used;    /* 0 when empty */
+	uint8_t *data;
+} zblock_t;
+
+static zblock_t zcache[LZ4_CACHE_BLOCKS];
+static uint32_t zclock;
+static uint8_t *zscratch;
+
+/* how many open files each inode has, and whether its last entry is gone */
+static uint16_t *inode_refs;
+#define INODE_ORPHAN 0x8000
+
+/* A name in the lookup table, keyed by its directory and name */
+typedef struct dentry_node {
+	uint8_t name[FILE_NAME_SIZE];
+	uint32_t name_len;
+	uint32_t hash;
+	uint32_t parent;
+	uint32_t file_type;
+	uint32_t inode;
+	struct dentry_node *next;
+} dentry_node_t;
+
+#define NODES_PER_PAGE  (PAGE_SIZE / sizeof(dentry_node_t))
+#define MAX_INDEX_PAGES ((MAX_INDEX_NODES + NODES_PER_PAGE - 1) / NODES_PER_PAGE)
+
+/* Name lookup table over every directory, built by fs_init. Nodes are
+ * handed out in order from pages of the kernel pool. */
+static dentry_node_t *dentry_buckets[DENTRY_BUCKETS];
+static dentry_node_t *index_pages[MAX_INDEX_PAGES];
+static uint32_t index_nodes;
+
+/* nodes of removed names, handed out again before new ones */
+static dentry_node_t *index_free;
+
+/* Helper functions */
+static inode2_t *inode_ptr(uint32_t inode);
+static void inode_dirty(uint32_t inode);
+static int32_t word_get(uint32_t db_idx, uint32_t slot);
+static int32_t word_set(uint32_t db_idx, uint32_t slot, uint32_t value);
+static void file_readahead(uint32_t inode, uint32_t block, uint32_t count);
+static int32_t index_block(uint32_t inode, uint32_t block);
+static int32_t inode_run(uint32_t inode, uint32_t block, uint32_t max, uint32_t *count);
+static uint32_t inode_nblocks(uint32_t inode);
+static int32_t raw_read(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length);
+static int32_t data_span(uint32_t inode, uint32_t offset, uint32_t length, const uint8_t **data, buf_t **held);
+static int32_t inode_lz4(uint32_t inode);
+static int32_t lz4_span(uint32_t inode, uint32_t block, uint32_t *start, uint32_t *end);
+static zblock_t *lz4_block(uint32_t inode, uint32_t block);
+static int32_t lz4_read(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length);
+static void lz4_forget(uint32_t inode);
+static uint32_t name_hash(const uint8_t *name, uint32_t parent, uint32_t *len);
+static dentry_node_t *index_node(uint32_t idx);
+static int32_t index_add(uint32_t parent, const dentry_t *dentry);
+static dentry_node_t *index_find(uint32_t parent, const uint8_t *name, uint32_t *len);
+static void index_remove(dentry_node_t *node);
+static int32_t walk_path(const uint8_t *path, uint32_t *parent, const uint8_t **name);
+static int32_t read_dir_entry(uint32_t dir, uint32_t index, dentry_t *dentry);
+static void build_dentry_index(void);
+static uint32_t pool_order(uint32_t size);
+static int32_t csum_init(void);
+static int32_t block_verify(uint32_t inode, uint32_t db_idx, const uint8_t *data);
+static void csum_clear(uint32_t db_idx);
+static int32_t bitmaps_init(void);
+static void bitmap_store(const bitmap_t *bm, uint32_t first_block, uint32_t bit);
+static int32_t block_alloc(uint32_t hint);
+static void block_free(uint32_t db_idx);
+static void blocks_release(void);
+static void share_store(uint32_t db_idx);
+static uint32_t index_meta(uint32_t nblocks);
+static int32_t index_set(uint32_t inode, uint32_t block, uint32_t db_idx);
+static int32_t index_replace(uint32_t inode, uint32_t block, uint32_t db_idx);
+static int32_t inode_unextent(uint32_t inode);
+static int32_t inode_append_block(uint32_t inode, uint32_t nblocks);
+static int32_t inode_unshare(uint32_t inode, uint32_t block, uint32_t db_idx);
+static void inode_shrink(uint32_t inode, uint32_t nblocks);
+static int32_t inode_resize(uint32_t inode, uint32_t length);
+static void inode_put(uint32_t inode);
+static int32_t fs_create(uint32_t dir, const uint8_t *name);
+static int32_t inode_write(uint32_t inode, uint32_t offset, const uint8_t *buf, uint32_t length, uint32_t meta);
+static void fs_unlock(void);
+static int32_t fs_held_by(pcb_t *pcb);
+
 
 /*
- * Sets up the head pointer for the file system
+ * Mounts a file system image through the buffer cache
  * Sets up relevant structures and variables
  *
- * Inputs: boot_val -	pointer to fs head
- * Outputs:	none
+ * Inputs: dev - the device holding the image, in memory or on a disk
+ * Outputs:	0 on success, -1 if the image can't be read, doesn't fit on
+ *          the device, or its inode table or journal doesn't fit
+ */
+int32_t fs_init(const bdev_t *dev)
+{
+	uint32_t nblocks;
+	uint32_t journal;
+	uint32_t replayed;
+	uint32_t i;
+
+	if (bcache_init(dev)) {
+		return -1;
+	}
+
+	super_buf = bread(0);
+	if (!super_buf) {
+		return -1;
+	}
+	boot_block = (boot_block_t*)super_buf->data;
+	super_block = (super_block_t*)super_buf->data;
+
+	if (super_block->magic == FS_MAGIC && super_block->version == FS_VERSION_2) {
+		fs_version = FS_VERSION_2;
+		root_dir = super_block->root_inode;
+
+		data_start = 1 + super_block->inode_blocks;
+		nblocks = data_start + super_block->num_dblocks;
+
+		if (super_block->num_inodes > super_block->inode_blocks * INODES_PER_BLOCK
+				|| root_dir >= super_block->num_inodes
+				|| super_block->inode_blocks > BCACHE_BUFS / 4) {
+			return -1;
+		}
+	}
+	else {
+		fs_version = FS_VERSION_1;
+		root_dir = 0;
+
+		data_start = 1 + boot_block->num_inodes;
+		nblocks = data_start + boot_block->num_dblocks;
+	}
+
+	if (nblocks > dev->nblocks || nblocks < data_start) {
+		return -1;
+	}
+
+	fs_mapped = dev->map != NULL;
+	data_head = fs_mapped ? (data_block_t*)dev->map + data_start : NULL;
+
+	/* keep the inode table pinned, inodes are looked at all the time */
+	if (fs_version == FS_VERSION_2) {
+		inode_bufs = kpage_alloc(pool_order(super_block->inode_blocks * sizeof(buf_t*)));
+		if (!inode_bufs) {
+			return -1;
+		}
+		for (i = 0; i < super_block->inode_blocks; i++) {
+			inode_bufs[i] = bread(1 + i);
+			if (!inode_bufs[i]) {
+				return -1;
+			}
+		}
+	}
+
+	/* frames for decompressed blocks are kept across mounts */
+	for (i = 0; i < LZ4_CACHE_BLOCKS; i++) {
+		zcache[i].used = 0;
+	}
+	if (fs_version == FS_VERSION_2 && (super_block->features & FS_LZ4)) {
+		for (i = 0; i < LZ4_CACHE_BLOCKS; i++) {
+			if (!zcache[i].data && !(zcache[i].data = kpage_alloc(0))) {
+				return -1;
+			}
+		}
+		if (!zscratch && !(zscratch = kpage_alloc(0))) {
+			return -1;
+		}
+	}
+
+	/* checksums are checked as blocks are first read */
+	csum_checked = NULL;
+	if (fs_version == FS_VERSION_2 && (super_block->features & FS_CSUM) && csum_init()) {
+		return -1;
+	}
+
+	/* replay what a crash interrupted before anything else is read, an
+	 * image whose journal can't be replayed is mounted read only */
+	journal = fs_version == FS_VERSION_2 && (super_block->features & FS_JOURNAL);
+	if (journal && (super_block->journal_start >= super_block->num_dblocks
+				|| super_block->journal_blocks > super_block->num_dblocks - super_block->journal_start)) {
+		return -1;
+	}
+	replayed = !journal_init(dev, data_start + super_block->journal_start,
+			journal ? super_block->journal_blocks : 0);
+
+	build_dentry_index();
+
+	fs_writable = fs_version == FS_VERSION_2 && replayed
+		&& (super_block->features & FS_WRITABLE) && !bitmaps_init();
+
+	return 0;
+}
+
+/*
+ * Returns an inode of a version 2 image, in its pinned buffer
+ */
+static inode2_t *inode_ptr(uint32_t inode)
+{
+	return (inode2_t*)inode_bufs[inode / INODES_PER_BLOCK]->data + inode % INODES_PER_BLOCK;
+}
+
+/*
+ * Logs the block holding a changed inode
+ */
+static void inode_dirty(uint32_t inode)
+{
+	journal_dirty(inode_bufs[inode / INODES_PER_BLOCK]);
+}
+
+/*
+ * Reads a word of a data block, like an entry of a block of indices
+ *
+ * Inputs: db_idx - the data block
+ *         slot - which word
+ * Outputs: the word, -1 if the block couldn't be read
+ */
+static int32_t word_get(uint32_t db_idx, uint32_t slot)
+{
+	buf_t *buf;
+	int32_t ptr;
+
+	buf = bread(data_start + db_idx);
+	if (!buf) {
+		return -1;
+	}
+
+	ptr = ((uint32_t*)buf->data)[slot];
+	brelse(buf);
+
+	return ptr;
+}
+
+/*
+ * Writes a word of a data block, like an entry of a block of indices or
+ * of a bitmap
+ *
+ * Inputs: db_idx - the data block
+ *         slot - which word
+ *         value - what to store
+ * Outputs: 0 on success, -1 if the block couldn't be read
+ */
+static int32_t word_set(uint32_t db_idx, uint32_t slot, uint32_t value)
+{
+	buf_t *buf;
+
+	buf = bread(data_start + db_idx);
+	if (!buf) {
+		return -1;
+	}
+
+	csum_clear(db_idx);
+	((uint32_t*)buf->data)[slot] = value;
+	journal_dirty(buf);
+	brelse(buf);
+
+	return 0;
+}
+
+/*
+ * Returns the smallest order of pool frames holding size bytes
+ */
+static uint32_t pool_order(uint32_t size)
+{
+	uint32_t order = 0;
+
+	while ((PAGE_SIZE << order) < size) {
+		order++;
+	}
+
+	return order;
+}
+
+/*
+ * Sets up checking the data blocks of an image against its checksum table
+ *
+ * Inputs: none
+ * Outputs: 0 on success, -1 if the table doesn't fit in the image or the
+ *          bitmaps don't fit in the pool
+ */
+static int32_t csum_init(void)
+{
+	uint32_t nblocks = (super_block->num_dblocks + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
+	uint32_t size = BITMAP_WORDS(super_block->num_dblocks) * sizeof(uint32_t);
+
+	if (super_block->csum_table >= super_block->num_dblocks
+			|| nblocks > super_block->num_dblocks - super_block->csum_table) {
+		return -1;
+	}
+
+	csum_checked = kpage_alloc(pool_order(size));
+	csum_bad = kpage_alloc(pool_order(size));
+	if (!csum_checked || !csum_bad) {
+		if (csum_checked) {
+			kpage_free(csum_checked, pool_order(size));
+		}
+		if (csum_bad) {
+			kpage_free(csum_bad, pool_order(size));
+		}
+		csum_checked = NULL;
+		csum_bad = NULL;
+		return -1;
+	}
+	memset(csum_checked, 0, size);
+	memset(csum_bad, 0, size);
+
+	crc32c_init();
+
+	return 0;
+}
+
+/*
+ * Checks a data block against its checksum the first time it's read after
+ * mounting. Blocks without a checksum pass. A block that fails is reported
+ * along with the file it was read for, once, and fails every read after.
+ *
+ * Inputs: inode - the file the block is being read for
+ *         db_idx - the data block
+ *         data - its contents, NULL to read them in
+ * Outputs: 0 if the block is good, -1 if it isn't or can't be read
+ */
+static int32_t block_verify(uint32_t inode, uint32_t db_idx, const uint8_t *data)
+{
+	uint32_t word = BITMAP_WORD(db_idx);
+	uint32_t mask = BITMAP_MASK(db_idx);
+	buf_t *table, *buf = NULL;
+	uint32_t sum;
+
+	if (!csum_checked || (csum_checked[word] & mask)) {
+		return 0;
+	}
+	if (csum_bad[word] & mask) {
+		return -1;
+	}
+
+	table = bread(data_start + super_block->csum_table + db_idx / PTRS_PER_BLOCK);
+	if (!table) {
+		return -1;
+	}
+	sum = ((uint32_t*)table->data)[db_idx % PTRS_PER_BLOCK];
+	brelse(table);
+
+	if (sum && !data) {
+		buf = bread(data_start + db_idx);
+		if (!buf) {
+			return -1;
+		}
+		data = buf->data;
+	}
+	if (sum && crc32c(0, data, BLOCK_SIZE) != sum) {
+		csum_bad[word] |= mask;
+		printf("file_sys: inode %d: data block %d doesn't match its checksum\n", inode, db_idx);
+	}
+	else {
+		csum_checked[word] |= mask;
+	}
+	if (buf) {
+		brelse(buf);
+	}
+
+	return (csum_bad[word] & mask) ? -1 : 0;
+}
+
+/*
+ * Drops the checksum of a data block that's about to change, it isn't
+ * checked again
+ */
+static void csum_clear(uint32_t db_idx)
+{
+	uint32_t *sum;
+	buf_t *buf;
+
+	if (!csum_checked) {
+		return;
+	}
+	csum_checked[BITMAP_WORD(db_idx)] |= BITMAP_MASK(db_idx);
+	csum_bad[BITMAP_WORD(db_idx)] &= ~BITMAP_MASK(db_idx);
+
+	buf = bread(data_start + super_block->csum_table + db_idx / PTRS_PER_BLOCK);
+	if (!buf) {
+		return;
+	}
+	sum = (uint32_t*)buf->data + db_idx % PTRS_PER_BLOCK;
+	if (*sum) {
+		*sum = 0;
+		journal_dirty(buf);
+	}
+	brelse(buf);
+}
+
+/*
+ * Copies the block and inode bitmaps of a writable image into the kernel
+ * pool, and sets up the open counts of its inodes.
+ *
+ * Inputs: none
+ * Outputs: 0 on success, -1 if the bitmaps are corrupt or don't fit
+ */
+static int32_t bitmaps_init(void)
+{
+	struct {
+		bitmap_t *bm;
+		uint32_t first;
+		uint32_t nbits;
+	} maps[] = {
+		{ &block_map, super_block->block_bitmap, super_block->num_dblocks },
+		{ &inode_map, super_block->inode_bitmap, super_block->num_inodes },
+	};
+	uint32_t nblocks;
+	uint32_t *map, *full;
+	buf_t *buf;
+	uint32_t i, j;
+
+	for (i = 0; i < sizeof(maps) / sizeof(maps[0]); i++) {
+		nblocks = (maps[i].nbits + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8);
+		if (maps[i].first >= super_block->num_dblocks
+				|| nblocks > super_block->num_dblocks - maps[i].first) {
+			return -1;
+		}
+
+		/* pool runs are at most 32 frames, which is plenty */
+		map = kpage_alloc(pool_order(nblocks * BLOCK_SIZE));
+		full = kpage_alloc(pool_order(BITMAP_WORDS(BITMAP_WORDS(maps[i].nbits)) * sizeof(uint32_t)));
+		if (!map || !full) {
+			return -1;
+		}
+
+		for (j = 0; j < nblocks; j++) {
+			buf = bread(data_start + maps[i].first + j);
+			if (!buf) {
+				return -1;
+			}
+			memcpy(map + j * PTRS_PER_BLOCK, buf->data, BLOCK_SIZE);
+			brelse(buf);
+		}
+		bitmap_attach(maps[i].bm, map, full, maps[i].nbits);
+	}
+
+	freeing = kpage_alloc(pool_order(BITMAP_WORDS(block_map.nbits) * sizeof(uint32_t)));
+	if (!freeing) {
+		return -1;
+	}
+	memset(freeing, 0, BITMAP_WORDS(block_map.nbits) * sizeof(uint32_t));
+	freeing_tid = 0;
+
+	block_shares = NULL;
+	if (super_block->features & FS_SHARED) {
+		nblocks = (super_block->num_dblocks + SHARES_PER_BLOCK - 1) / SHARES_PER_BLOCK;
+		if (super_block->share_table >= super_block->num_dblocks
+				|| nblocks > super_block->num_dblocks - super_block->share_table) {
+			return -1;
+		}
+
+		block_shares = kpage_alloc(pool_order(nblocks * BLOCK_SIZE));
+		if (!block_shares) {
+			return -1;
+		}
+		for (j = 0; j < nblocks; j++) {
+			buf = bread(data_start + super_block->share_table + j);
+			if (!buf) {
+				return -1;
+			}
+			memcpy(block_shares + j * SHARES_PER_BLOCK, buf->data, BLOCK_SIZE);
+			brelse(buf);
+		}
+	}
+
+	inode_refs = kpage_alloc(pool_order(super_block->num_inodes * sizeof(uint16_t)));
+	if (!inode_refs) {
+		return -1;
+	}
+	memset(inode_refs, 0, super_block->num_inodes * sizeof(uint16_t));
+
+	/* inode 0 stands in for entries without data, it's never handed out */
+	bitmap_set(&inode_map, NULL_INODE);
+
+	return 0;
+}
+
+/*
+ * Writes the word of a bitmap holding a bit back to the image. The copy
+ * in memory is what allocations go by, so if the block can't be read the
+ * image is just left behind.
+ *
+ * Inputs: bm - the bitmap
+ *         first_block - data block the bitmap starts at in the image
+ *         bit - the bit that changed
+ * Outputs: none
+ */
+static void bitmap_store(const bitmap_t *bm, uint32_t first_block, uint32_t bit)
+{
+	uint32_t word = BITMAP_WORD(bit);
+	uint32_t value = bm->map[word];
+
+	/* blocks being freed are free as far as the image goes */
+	if (bm == &block_map) {
+		value &= ~freeing[word];
+	}
+
+	word_set(first_block + word / PTRS_PER_BLOCK, word % PTRS_PER_BLOCK, value);
+}
+
+/*
+ * Hashes a file name (FNV-1a) together with the directory it's in. Stops at
+ * the end of a path component and looks at no more than FILE_NAME_SIZE
+ * characters, just like the on-disk names.
+ *
+ * Inputs: name - the name to hash
+ *         parent - inode of the directory the name is in
+ *         len - set to the length of the name, capped at FILE_NAME_SIZE
+ * Outputs: the hash
+ */
+static uint32_t name_hash(const uint8_t *name, uint32_t parent, uint32_t *len)
+{
+	uint32_t hash = 2166136261UL ^ (parent * 0x9E3779B1UL);
+	uint32_t i;
+
+	for (i = 0; i < FILE_NAME_SIZE && name[i] && name[i] != PATH_SEP; i++) {
+		hash = (hash ^ name[i]) * 16777619UL;
+	}
+
+	*len = i;
+	return hash;
+}
+
+/*
+ * Returns a node of the lookup table by the order it was added in
+ */
+static dentry_node_t *index_node(uint32_t idx)
+{
+	return &index_pages[idx / NODES_PER_PAGE][idx % NODES_PER_PAGE];
+}
+
+/*
+ * Adds a directory entry to the lookup table
+ *
+ * Inputs: parent - inode of the directory holding the entry
+ *         dentry - the entry
+ * Outputs: 0 on success, -1 if the table is full
+ */
+static int32_t index_add(uint32_t parent, const dentry_t *dentry)
+{
+	dentry_node_t *node;
+	uint32_t bucket;
+	uint32_t flags;
+
+	if (index_free) {
+		node = index_free;
+		index_free = node->next;
+	}
+	else {
+		if (index_nodes >= MAX_INDEX_NODES) {
+			return -1;
+		}
+
+		/* grow by a page when the last one fills up */
+		if (!(index_nodes % NODES_PER_PAGE)) {
+			index_pages[index_nodes / NODES_PER_PAGE] = kpage_alloc(0);
+			if (!index_pages[index_nodes / NODES_PER_PAGE]) {
+				return -1;
+			}
+		}
+
+		node = index_node(index_nodes++);
+	}
+
+	memcpy(node->name, dentry->file_name, FILE_NAME_SIZE);
+	node->hash = name_hash(node->name, parent, &node->name_len);
+	node->parent = parent;
+	node->file_type = dentry->file_type;
+	node->inode = dentry->inode;
+
+	/* opens look names up without the file system's lock */
+	bucket = node->hash & (DENTRY_BUCKETS - 1);
+	cli_and_save(flags);
+	node->next = dentry_buckets[bucket];
+	dentry_buckets[bucket] = node;
+	restore_flags(flags);
+
+	return 0;
+}
+
+/*
+ * Looks a name up in the lookup table
+ *
+ * Inputs: parent - inode of the directory to look in
+ *         name - the name, which may be followed by more of a path
+ *         len - set to the length of the name, capped at FILE_NAME_SIZE
+ * Outputs: the node, NULL if the directory has no such name
+ */
+static dentry_node_t *index_find(uint32_t parent, const uint8_t *name, uint32_t *len)
+{
+	dentry_node_t *node;
+	uint32_t hash;
+
+	hash = name_hash(name, parent, len);
+
+	for (node = dentry_buckets[hash & (DENTRY_BUCKETS - 1)]; node; node = node->next) {
+		/* same as comparing on the max length of a file name */
+		if (node->hash == hash && node->parent == parent && node->name_len == *len
+				&& !strncmp((int8_t*)name, (int8_t*)node->name, *len)) {
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Takes a node out of the lookup table, keeping it for the next index_add
+ */
+static void index_remove(dentry_node_t *node)
+{
+	dentry_node_t **link;
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	for (link = &dentry_buckets[node->hash & (DENTRY_BUCKETS - 1)]; *link; link = &(*link)->next) {
+		if (*link == node) {
+			*link = node->next;
+			node->next = index_free;
+			index_free = node;
+			break;
+		}
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * Builds the name lookup table from every directory, so opens hash each
+ * name once instead of comparing it against every entry. Directories are
+ * scanned in the order they're found, which makes the list of nodes double
+ * as the queue of directories left to scan.
+ *
+ * Inputs: none
+ * Outputs: none
  */
-void fs_init(boot_block_t* boot_val)
+static void build_dentry_index(void)
 {
-	boot_block = boot_val;
+	dentry_node_t *node;
+	dentry_t dentry;
+	uint32_t idx;
+	uint32_t i;
+
+	memset(dentry_buckets, 0, sizeof(dentry_buckets));
+	index_nodes = 0;
+	index_free = NULL;
+
+	/* the root directory */
+	for (i = 0; !read_dir_entry(root_dir, i, &dentry); i++) {
+		/* there are some null entries in the fs; they'd match an empty name */
+		if (dentry.file_name[0] && index_add(root_dir, &dentry)) {
+			return;
+		}
+	}
+
+	if (fs_version == FS_VERSION_1) {
+		return;
+	}
+
+	for (idx = 0; idx < index_nodes; idx++) {
+		node = index_node(idx);
+		if (node->file_type != FILE_TYPE_DIR
+				|| !strncmp((int8_t*)node->name, ".", FILE_NAME_SIZE)
+				|| !strncmp((int8_t*)node->name, "..", FILE_NAME_SIZE)) {
+			continue;
+		}
 
-	node_head = (index_node_t*)boot_block + 1;
-	data_head = (data_block_t*)node_head + boot_block->num_inodes;
+		for (i = 0; !read_dir_entry(node->inode, i, &dentry); i++) {
+			if (dentry.file_name[0] && index_add(node->inode, &dentry)) {
+				return;
+			}
+		}
+	}
 }
 
 /*
@@ -58,6 +782,7 @@ int32_t file_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes)
 {
 	file_t *file;
 	int32_t ret;
+	uint32_t first, window;
 
 	file = get_file_from_fd(pcb, fd);
 
@@ -66,23 +791,56 @@ int32_t file_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes)
 		return -1;
 	}
 
+	first = file->file_pos / BLOCK_SIZE;
+
 	ret = read_data(file->inode_ptr, file->file_pos, (uint8_t *)buf, nbytes);
+	if (ret <= 0) {
+		/* lseek can leave the position past the end */
+		if (ret < 0 && file->file_pos > file_length(file->inode_ptr)) {
+			return 0;
+		}
+		return ret;
+	}
 	file->file_pos += ret;
 
+	/* read ahead while the file is read front to back */
+	file->reserved = bcache_ra_step(file->reserved, first, file->file_pos / BLOCK_SIZE, &window);
+	if (window) {
+		file_readahead(file->inode_ptr, file->file_pos / BLOCK_SIZE, window);
+	}
+
 	return ret;
 }
 
 /*
- *  Write system call for regular file types. 
- *  Read-only file system - Not implemented;
+ * Write system call for regular file types. Writes a buffer into a file at
+ * the file's position, growing the file if it runs past the end.
  *
- *  Return -1
+ * Inputs: pcb - the pcb of the calling process,
+ *         fd - file descriptor,
+ *         buf - buffer
+ *         nbytes - number of bytes to write
+ * Outputs: Number of bytes written, -1 if the file system is read-only
  */
 int32_t file_write(pcb_t *pcb, int32_t fd, const void* buf, int nbytes)
 {
-	/* silence warnings about unused variables */
-	(void) pcb; (void)fd; (void)buf; (void)nbytes;
-	return -1;
+	file_t *file;
+	int32_t ret;
+
+	file = get_file_from_fd(pcb, fd);
+
+	/* ensure file is open */
+	if (!file || !(file->flags & FILE_OPEN) || nbytes < 0) {
+		return -1;
+	}
+
+	ret = write_data(file->inode_ptr, file->file_pos, (const uint8_t *)buf, nbytes);
+	if (ret <= 0) {
+		return ret;
+	}
+	file->file_pos += ret;
+
+	return ret;
 }
 
 /*  
@@ -90,18 +848,15 @@ int32_t file_write(pcb_t *pcb, int32_t fd, const void* buf, int nbytes)
  *  for a specific file for a specific process.
  *
  *  Inputs: pcb - the pcb of the calling process,
- *          filename - name of the file
+ *          dentry - directory entry of the file, already looked up
  *  Outputs: file descriptor
  */
-int32_t file_open(pcb_t *pcb, const uint8_t *filename)
+int32_t file_open(pcb_t *pcb, const dentry_t *dentry)
 {
-	dentry_t dentry;
 	int32_t fd;
 	file_t *file;
-	int32_t status;
 
-	status = read_dentry_by_name(filename, &dentry);
-	if (status) {
+	if (!dentry) {
 		return -1;
 	}
 
@@ -116,9 +871,17 @@ int32_t file_open(pcb_t *pcb, const uint8_t *filename)
 
 	/* set up the file */
 	file->flags |= FILE_OPEN;
-	file->inode_ptr = dentry.inode;
+	file->inode_ptr = dentry->inode;
 	file->file_pos = 0;
 	file->file_op = &file_fops;
+	file->reserved = RA_PACK(0, 0);
+
+	/* keep the data around while it's open, even if it's unlinked */
+	if (fs_writable) {
+		mutex_lock(&fs_lock);
+		inode_refs[dentry->inode]++;
+		fs_unlock();
+	}
 
 	return fd;
 }
@@ -131,14 +894,40 @@ int32_t file_open(pcb_t *pcb, const uint8_t *filename)
  */
 int32_t file_close(pcb_t *pcb, int32_t fd)
 {
-	release_fd(pcb, fd);
+	file_t *file;
+
+	file = get_file_from_fd(pcb, fd);
+
+	if (fs_writable && file && (file->flags & FILE_OPEN)) {
+		mutex_lock(&fs_lock);
+		journal_begin();
+		inode_refs[file->inode_ptr]--;
+		inode_put(file->inode_ptr);
+		journal_end();
+		fs_unlock();
+	}
+
+	release_fd(pcb, fd);
 	return 0;
 }
 
+/*  Poll for regular files and directories. Everything is already in
+ *  memory or comes straight from the disk, so nothing ever waits.
+ *
+ *  Input: fd - File descriptor
+ *         wait - unused, there's nothing to wait on
+ *  Return POLLIN and POLLOUT
+ */
+int32_t file_poll(pcb_t *pcb, int32_t fd, struct wait_entry *wait)
+{
+	(void)pcb; (void)fd; (void)wait;
+	return POLLIN | POLLOUT;
+}
+
 
 /*	
  *	Read Directory Entry by Name
- *	Parameters:	fname 	- the name of the file.
+ *	Parameters:	fname 	- the name of the file, directories separated by '/'.
  *				dentry	- pointer to directory entry of file to set name.
  *
  *  Fill 'dentry_t' block passed in with:
@@ -149,41 +938,86 @@ int32_t file_close(pcb_t *pcb, int32_t fd)
  */
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry)
 {
-	dentry_t* temp;
-	uint8_t i;
-	uint32_t entries = boot_block->num_dentries;
-	uint32_t len_filename;
+	dentry_node_t *node;
+	uint32_t parent;
+	uint32_t len;
+
+	if (walk_path(fname, &parent, &fname)) {
+		return -1;
+	}
+
+	node = index_find(parent, fname, &len);
+	if (!node) {
+		return -1;
+	}
+
+	strncpy((int8_t *)dentry->file_name, (int8_t*)node->name, len);
+	/* just in case the filename doesn't end in a null character */
+	if (len < FILE_NAME_SIZE) {
+		dentry->file_name[len] = '\0';
+	}
+	dentry->file_type = node->file_type;
+	dentry->inode = node->inode;
 
-	for(i = 0; i <= entries ; i++) {
+	return 0;
+}
+
+/*
+ * Walks a path to the directory its last name is in
+ *
+ * Inputs: path - names separated by '/', always from the root
+ *         parent - set to the inode of the directory holding the last name
+ *         name - set to the last name, which may be followed by a '/'
+ * Outputs: 0 on success, -1 if the path is empty or a directory on the way
+ *          doesn't exist
+ */
+static int32_t walk_path(const uint8_t *path, uint32_t *parent, const uint8_t **name)
+{
+	dentry_node_t *node;
+	const uint8_t *next;
+	uint32_t dir = root_dir;
+	uint32_t len;
 
-		temp = &boot_block->entries[i];
+	if (!path) {
+		return -1;
+	}
 
-		/* length of the filename in the filesystem */
-		len_filename = strlen((int8_t*)temp->file_name);
+	while (*path == PATH_SEP) {
+		path++;
+	}
 
-		/* there are some null entries in the fs; needed or they'll match any string passed */
-		if (!len_filename) {
-			continue;
+	while (1) {
+		/* skip the rest of an overlong name, then any separators */
+		for (next = path; *next && *next != PATH_SEP; next++);
+		while (*next == PATH_SEP) {
+			next++;
 		}
 
-		/* we need to compare on the max length of a file, or else we get weird matching results */
-		if(!strncmp((int8_t*)fname, (int8_t*)temp->file_name, FILE_NAME_SIZE)) {
-			strncpy((int8_t *)dentry->file_name, (int8_t*)temp->file_name, len_filename);
-			/* just in case the filename doesn't end in a null character */
-			dentry->file_name[len_filename] = '\0';
-			dentry->file_type = temp->file_type;
-			dentry->inode = temp->inode;
+		if (!*next) {
+			break;
+		}
 
-			return 0;
+		/* more to go, this one has to be a directory */
+		node = index_find(dir, path, &len);
+		if (!node || node->file_type != FILE_TYPE_DIR) {
+			return -1;
 		}
+		dir = node->inode;
+		path = next;
 	}
 
-	return -1;
+	if (!*path) {
+		return -1;
+	}
+
+	*parent = dir;
+	*name = path;
+	return 0;
 }
 
 /*	
- *	Read Directory Entry by Name
- *	Parameters:	fname 	- the name of the file.
+ *	Read Directory Entry by Index
+ *	Parameters:	index 	- the index of the entry in the root directory.
  *				dentry	- pointer to directory entry of file to set name.
  *
  *  Fill 'dentry_t' block passed in with:
@@ -194,78 +1028,1380 @@ int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry)
  */
 int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry)
 {
-	//Check for non-existant file or invalid index
-	if(index <= boot_block->num_dentries) {
+	return read_dir_entry(root_dir, index, dentry);
+}
+
+/*
+ * Reads an entry of a directory. Version 1 has just the one directory, in
+ * the boot block; version 2 directories are files of dentry_t.
+ *
+ * Inputs: dir - inode of the directory
+ *         index - which entry
+ *         dentry - filled with the entry, whose name may be empty
+ * Outputs: 0 on success, -1 past the last entry
+ */
+static int32_t read_dir_entry(uint32_t dir, uint32_t index, dentry_t *dentry)
+{
+	if (fs_version == FS_VERSION_1) {
+		//Check for non-existant file or invalid index
+		if (index >= min(boot_block->num_dentries, MAX_DENTRIES)) {
+			return -1;
+		}
+
 		strncpy((int8_t*)dentry->file_name, (int8_t*)boot_block->entries[index].file_name, FILE_NAME_SIZE);
 		dentry->file_type = boot_block->entries[index].file_type;
 		dentry->inode = boot_block->entries[index].inode;
 
-		return 0;
+		return 0;
+	}
+
+	if (read_data(dir, index * sizeof(dentry_t), (uint8_t*)dentry, sizeof(dentry_t)) != sizeof(dentry_t)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*	
+ *	Read Data
+ *	Parameters:	inode	- the index node of the data.
+ *				offset	- how many bytes to begin reading at?
+ *				buf		- data array to read.
+ *				length  - size of array.
+ *
+ *  Reads up to 'length' bytes from position 'offset'
+ *	  in the file with 'inode' number into the given 'buf' buffer.
+ *	  Compressed files are decompressed a block at a time as they're read.
+ *
+ *  Return  # of bytes read and placed into buffer
+ *			0 when end of file reached.
+ *			-1 on failure.
+ *
+ */
+int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
+{
+	uint32_t byte_length;
+
+	/* verify bounds */
+	if (inode >= boot_block->num_inodes) {
+		return -1;
+	}
+
+	byte_length = file_length(inode);
+
+	if (byte_length < offset) {
+		return -1;
+	}
+
+	/* compute number of bytes to read */
+	length = min(byte_length - offset, length);
+
+	if (inode_lz4(inode)) {
+		return lz4_read(inode, offset, buf, length);
+	}
+
+	return raw_read(inode, offset, buf, length);
+}
+
+/*
+ * Copies bytes of a file straight out of its blocks, which for compressed
+ * files are the compressed blocks and the table in front of them
+ *
+ * Inputs: inode - the file
+ *         offset - where to start
+ *         buf - where to put them
+ *         length - how many
+ * Outputs: # of bytes copied, fewer if the blocks run out
+ */
+static int32_t raw_read(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length)
+{
+	uint32_t block;
+	uint32_t skip;
+	uint32_t count;
+	int32_t db_idx;
+	int32_t b_read;
+	int32_t b_rem;
+	int32_t round_read;
+	buf_t *block_buf;
+	uint32_t i;
+
+	b_rem = length;
+	b_read = 0;
+	while (b_rem > 0 && fs_mapped) {
+		/* find the run of contiguous blocks the next byte is in */
+		block = (offset + b_read) / BLOCK_SIZE;
+		skip = (offset + b_read) % BLOCK_SIZE;
+		db_idx = inode_run(inode, block, (skip + b_rem + BLOCK_SIZE - 1) / BLOCK_SIZE, &count);
+		if (db_idx < 0) {
+			break;
+		}
+
+		/* stopping short of any block that fails its checksum */
+		for (i = 0; i < count && !block_verify(inode, db_idx + i, data_head[db_idx + i].data); i++);
+		if (!(count = i)) {
+			break;
+		}
+
+		/* and copy as much of it as we need in one go */
+		round_read = min(b_rem, count * BLOCK_SIZE - skip);
+		memcpy(buf + b_read, data_head[db_idx].data + skip, round_read);
+		b_read += round_read;
+		b_rem -= round_read;
+	}
+
+	while (b_rem > 0 && !fs_mapped) {
+		/* compute number of bytes to read from this block */
+		block = (offset + b_read) / BLOCK_SIZE;
+		skip = (offset + b_read) % BLOCK_SIZE;
+		round_read = min(b_rem, BLOCK_SIZE - skip);
+
+		/* copy data into buffer through the buffer cache */
+		db_idx = inode_run(inode, block, 1, &count);
+		if (db_idx < 0) {
+			break;
+		}
+		block_buf = bread(data_start + db_idx);
+		if (!block_buf) {
+			break;
+		}
+		if (block_verify(inode, db_idx, block_buf->data)) {
+			brelse(block_buf);
+			break;
+		}
+		memcpy(buf + b_read, block_buf->data + skip, round_read);
+		brelse(block_buf);
+
+		b_read += round_read;
+		b_rem -= round_read;
+	}
+
+	return b_read;
+}
+
+/*
+ * Finds the bytes of an uncompressed file at offset where they're stored,
+ * so they can be handed on without copying them out first
+ *
+ * Inputs: inode - the file
+ *         offset - where to start
+ *         length - most bytes wanted
+ *         data - set to where the bytes are
+ *         held - set to the cache buffer holding them, which has to be
+ *                brelse'd once they're used, or NULL if there's none
+ * Outputs: # of bytes there in a row, -1 if the block can't be had
+ */
+static int32_t data_span(uint32_t inode, uint32_t offset, uint32_t length, const uint8_t **data, buf_t **held)
+{
+	uint32_t block;
+	uint32_t skip;
+	uint32_t count;
+	int32_t db_idx;
+	buf_t *block_buf;
+	uint32_t i;
+
+	block = offset / BLOCK_SIZE;
+	skip = offset % BLOCK_SIZE;
+	*held = NULL;
+
+	/* a mapped image has the whole run of blocks in place */
+	if (fs_mapped) {
+		db_idx = inode_run(inode, block, (skip + length + BLOCK_SIZE - 1) / BLOCK_SIZE, &count);
+		if (db_idx < 0) {
+			return -1;
+		}
+
+		for (i = 0; i < count && !block_verify(inode, db_idx + i, data_head[db_idx + i].data); i++);
+		if (!i) {
+			return -1;
+		}
+
+		*data = data_head[db_idx].data + skip;
+		return min(length, i * BLOCK_SIZE - skip);
+	}
+
+	db_idx = inode_run(inode, block, 1, &count);
+	if (db_idx < 0) {
+		return -1;
+	}
+
+	block_buf = bread(data_start + db_idx);
+	if (!block_buf) {
+		return -1;
+	}
+	if (block_verify(inode, db_idx, block_buf->data)) {
+		brelse(block_buf);
+		return -1;
+	}
+
+	*held = block_buf;
+	*data = block_buf->data + skip;
+	return min(length, BLOCK_SIZE - skip);
+}
+
+/*	
+ *	Write Data
+ *	Parameters:	inode	- the index node of the file.
+ *				offset	- where in the file to start writing, may be past
+ *						  its end, the gap then reads as zeroes.
+ *				buf		- data to write.
+ *				length  - size of buf.
+ *
+ *  Writes 'length' bytes from 'buf' to position 'offset' in the file with
+ *    'inode' number, allocating blocks as the file grows. New blocks are
+ *    taken right after the file's last one when that's free, so files
+ *    written front to back stay in few extents.
+ *
+ *  Return  # of bytes written, less than length if the file system filled.
+ *			-1 on failure.
+ *
+ */
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length)
+{
+	int32_t ret;
+
+	mutex_lock(&fs_lock);
+	ret = inode_write(inode, offset, buf, length, 0);
+	fs_unlock();
+
+	return ret;
+}
+
+/*
+ * Writes to a file like write_data. The blocks of directories are logged
+ * to the journal along with the rest of the metadata, file data is just
+ * written in place, ahead of the commit that makes it part of the file.
+ * Called with the file system's lock held.
+ *
+ * Inputs: inode - the file
+ *         offset - where to start writing
+ *         buf - data to write
+ *         length - size of buf
+ *         meta - whether the file is a directory
+ * Outputs: # of bytes written, -1 on failure
+ */
+static int32_t inode_write(uint32_t inode, uint32_t offset, const uint8_t *buf, uint32_t length, uint32_t meta)
+{
+	inode2_t *p_inode;
+	uint32_t nblocks;
+	uint32_t block;
+	uint32_t skip;
+	uint32_t count;
+	int32_t db_idx;
+	int32_t b_written;
+	int32_t round_write;
+	buf_t *block_buf;
+
+	if (!fs_writable || inode >= super_block->num_inodes || inode == NULL_INODE
+			|| offset + length < offset || (int32_t)length < 0 || inode_lz4(inode)) {
+		return -1;
+	}
+
+	p_inode = inode_ptr(inode);
+
+	journal_begin();
+
+	if (offset > p_inode->byte_length && inode_resize(inode, offset)) {
+		journal_end();
+		return -1;
+	}
+
+	nblocks = (p_inode->byte_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	b_written = 0;
+	while (b_written < (int32_t)length) {
+		block = (offset + b_written) / BLOCK_SIZE;
+		skip = (offset + b_written) % BLOCK_SIZE;
+
+		/* long writes are split into operations the journal has room for */
+		if (b_written && !(block % JOURNAL_WRITE_CHUNK) && !skip) {
+			inode_dirty(inode);
+			journal_end();
+			journal_begin();
+		}
+
+		if (block < nblocks) {
+			db_idx = inode_run(inode, block, 1, &count);
+			if (db_idx >= 0) {
+				db_idx = inode_unshare(inode, block, db_idx);
+			}
+		}
+		else {
+			/* grow by a block */
+			db_idx = inode_append_block(inode, nblocks);
+		}
+		if (db_idx < 0) {
+			break;
+		}
+
+		/* blocks written whole needn't be read in first */
+		round_write = min(length - b_written, BLOCK_SIZE - skip);
+		if (round_write == BLOCK_SIZE) {
+			block_buf = bget(data_start + db_idx);
+		}
+		else {
+			block_buf = bread(data_start + db_idx);
+		}
+		if (!block_buf) {
+			break;
+		}
+		csum_clear(db_idx);
+		memcpy(block_buf->data + skip, buf + b_written, round_write);
+		if (meta) {
+			journal_dirty(block_buf);
+		}
+		else {
+			bdirty(block_buf);
+		}
+		brelse(block_buf);
+		b_written += round_write;
+
+		if (offset + b_written > p_inode->byte_length) {
+			p_inode->byte_length = offset + b_written;
+			nblocks = (p_inode->byte_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		}
+	}
+
+	inode_dirty(inode);
+	journal_end();
+
+	return (b_written || !length) ? b_written : -1;
+}
+
+/*
+ * Returns the size of a file in bytes, 0 for an invalid inode
+ */
+uint32_t file_length(uint32_t inode)
+{
+	buf_t *buf;
+	uint32_t length;
+
+	if (inode >= boot_block->num_inodes) {
+		return 0;
+	}
+
+	if (fs_version == FS_VERSION_1) {
+		buf = bread(1 + inode);
+		if (!buf) {
+			return 0;
+		}
+		length = ((index_node_t*)buf->data)->byte_length;
+		brelse(buf);
+		return length;
+	}
+
+	return inode_ptr(inode)->byte_length;
+}
+
+/*
+ * Index Block
+ *	Parameters:	inode	- the index node of the file.
+ *				block	- index of the block within the file, not past its end.
+ *
+ *  Looks up which data block holds a block of a file whose inode lists
+ *    block indices. Version 2 inodes list their first blocks directly, then
+ *    through one block of indices, then through a block of blocks of indices.
+ *
+ *  Return the data block index, -1 if the inode or a block of its indices
+ *    is corrupt.
+ *
+ */
+static int32_t index_block(uint32_t inode, uint32_t block)
+{
+	inode2_t *p_inode;
+	uint32_t db_idx;
+	uint32_t ptr_idx;
+	buf_t *buf;
+
+	if (fs_version == FS_VERSION_1) {
+		if (block >= sizeof(((index_node_t*)0)->data_blocks) / sizeof(uint32_t)) {
+			return -1;
+		}
+		buf = bread(1 + inode);
+		if (!buf) {
+			return -1;
+		}
+		db_idx = ((index_node_t*)buf->data)->data_blocks[block];
+		brelse(buf);
+	}
+	else {
+		p_inode = inode_ptr(inode);
+
+		if (block < INODE_DIRECT) {
+			db_idx = p_inode->direct[block];
+		}
+		else if ((block -= INODE_DIRECT) < PTRS_PER_BLOCK) {
+			if (p_inode->indirect >= boot_block->num_dblocks
+					|| block_verify(inode, p_inode->indirect, NULL)) {
+				return -1;
+			}
+			db_idx = word_get(p_inode->indirect, block);
+		}
+		else if ((block -= PTRS_PER_BLOCK) < PTRS_PER_BLOCK * PTRS_PER_BLOCK) {
+			if (p_inode->double_indirect >= boot_block->num_dblocks
+					|| block_verify(inode, p_inode->double_indirect, NULL)) {
+				return -1;
+			}
+			ptr_idx = word_get(p_inode->double_indirect, block / PTRS_PER_BLOCK);
+			if (ptr_idx >= boot_block->num_dblocks || block_verify(inode, ptr_idx, NULL)) {
+				return -1;
+			}
+			db_idx = word_get(ptr_idx, block % PTRS_PER_BLOCK);
+		}
+		else {
+			return -1;
+		}
+	}
+
+	if (db_idx >= boot_block->num_dblocks) {
+		return -1;
+	}
+
+	return db_idx;
+}
+
+/*
+ * Inode Run
+ *	Parameters:	inode	- the index node of the file.
+ *				block	- index of the block within the file.
+ *				max		- most blocks the caller wants.
+ *				count	- set to the number of blocks in the run.
+ *
+ *  Finds the data block holding a block of a file along with how many of
+ *    the blocks after it are stored right after it too, so they can be
+ *    copied together. Extent inodes have the answer stored; inodes listing
+ *    indices are checked one index at a time, which is still far cheaper
+ *    than copying the block.
+ *
+ *  Return the first data block index, -1 if the block is past the end of
+ *    the file.
+ *
+ */
+static int32_t inode_run(uint32_t inode, uint32_t block, uint32_t max, uint32_t *count)
+{
+	inode2_t *p_inode;
+	extent_t *extent;
+	uint32_t nblocks;
+	int32_t db_idx;
+	uint32_t run;
+	uint32_t i;
+
+	if (inode >= boot_block->num_inodes) {
+		return -1;
+	}
+
+	nblocks = inode_nblocks(inode);
+	if (block >= nblocks) {
+		return -1;
+	}
+	max = max ? min(max, nblocks - block) : 1;
+
+	if (fs_version == FS_VERSION_2 && (inode_ptr(inode)->flags & INODE_EXTENTS)) {
+		p_inode = inode_ptr(inode);
+
+		for (i = 0; i < INODE_EXTENTS_MAX; i++) {
+			extent = &p_inode->extents[i];
+			if (block < extent->length) {
+				if (extent->start + extent->length > boot_block->num_dblocks
+						|| extent->start + extent->length < extent->start) {
+					return -1;
+				}
+				*count = min(max, extent->length - block);
+				return extent->start + block;
+			}
+			block -= extent->length;
+		}
+
+		/* the extents don't cover the whole file */
+		return -1;
+	}
+
+	db_idx = index_block(inode, block);
+	if (db_idx < 0) {
+		return -1;
+	}
+
+	for (run = 1; run < max && index_block(inode, block + run) == db_idx + (int32_t)run; run++);
+
+	*count = run;
+	return db_idx;
+}
+
+/*
+ * File Readahead
+ *	Parameters:	inode	- the index node of the file.
+ *				block	- first block of the file to bring in.
+ *				count	- number of blocks.
+ *
+ *  Starts reading blocks of a file into the buffer cache a run of
+ *    contiguous blocks at a time, stopping at the end of the file.
+ *
+ *  Return none.
+ *
+ */
+static void file_readahead(uint32_t inode, uint32_t block, uint32_t count)
+{
+	int32_t db_idx;
+	uint32_t run;
+	uint32_t start, end, last;
+
+	/* compressed files bring in the blocks holding those blocks compressed */
+	if (inode_lz4(inode)) {
+		last = (file_length(inode) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		if (block >= last) {
+			return;
+		}
+		last = min(last, block + count) - 1;
+		if (lz4_span(inode, block, &start, &end) || lz4_span(inode, last, &run, &end)) {
+			return;
+		}
+		block = start / BLOCK_SIZE;
+		count = (end + BLOCK_SIZE - 1) / BLOCK_SIZE - block;
+	}
+
+	while (count) {
+		db_idx = inode_run(inode, block, count, &run);
+		if (db_idx < 0) {
+			break;
+		}
+
+		bcache_readahead(data_start + db_idx, run);
+		block += run;
+		count -= run;
+	}
+}
+
+/*
+ * Returns how many data blocks a file has, which for compressed files is
+ * fewer than its length takes
+ */
+static uint32_t inode_nblocks(uint32_t inode)
+{
+	inode2_t *p_inode;
+	uint32_t nblocks;
+	uint32_t i;
+
+	if (!inode_lz4(inode)) {
+		return (file_length(inode) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	}
+
+	p_inode = inode_ptr(inode);
+	if (!(p_inode->flags & INODE_EXTENTS)) {
+		return 0;
+	}
+
+	for (i = 0, nblocks = 0; i < INODE_EXTENTS_MAX; i++) {
+		nblocks += p_inode->extents[i].length;
+	}
+	return nblocks;
+}
+
+/*
+ * Checks whether a file is compressed
+ */
+static int32_t inode_lz4(uint32_t inode)
+{
+	return fs_version == FS_VERSION_2 && (inode_ptr(inode)->flags & INODE_LZ4);
+}
+
+/*
+ * Finds where a block of a compressed file is kept in its data, from the
+ * table of where each compressed block ends
+ *
+ * Inputs: inode - the file
+ *         block - which block of its contents
+ *         start - set to the offset of the compressed block
+ *         end - set to the offset just past it
+ * Outputs: 0 on success, -1 if the table can't be read or makes no sense
+ */
+static int32_t lz4_span(uint32_t inode, uint32_t block, uint32_t *start, uint32_t *end)
+{
+	uint32_t nblocks = (file_length(inode) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	uint32_t ends[2];
+
+	if (block >= nblocks) {
+		return -1;
+	}
+
+	if (!block) {
+		ends[0] = nblocks * sizeof(uint32_t);
+		if (raw_read(inode, 0, (uint8_t*)&ends[1], sizeof(uint32_t)) != sizeof(uint32_t)) {
+			return -1;
+		}
+	}
+	else if (raw_read(inode, (block - 1) * sizeof(uint32_t), (uint8_t*)ends, sizeof(ends)) != sizeof(ends)) {
+		return -1;
+	}
+
+	if (ends[0] < nblocks * sizeof(uint32_t) || ends[1] < ends[0] || ends[1] - ends[0] > BLOCK_SIZE) {
+		return -1;
+	}
+
+	*start = ends[0];
+	*end = ends[1];
+	return 0;
+}
+
+/*
+ * Returns a block of a compressed file decompressed, from the cache of
+ * decompressed blocks or read in and decompressed into it. Must be called
+ * with interrupts off, the block is only good until they're back on.
+ *
+ * Inputs: inode - the file
+ *         block - which block of its contents
+ * Outputs: the cache entry, NULL if the block can't be read or is corrupt
+ */
+static zblock_t *lz4_block(uint32_t inode, uint32_t block)
+{
+	zblock_t *zb = NULL;
+	uint32_t start, end;
+	uint32_t length;
+	uint32_t count;
+	int32_t db_idx;
+	uint32_t i;
+
+	if (lz4_span(inode, block, &start, &end)) {
+		return NULL;
+	}
+	db_idx = inode_run(inode, start / BLOCK_SIZE, 1, &count);
+	if (db_idx < 0) {
+		return NULL;
+	}
+
+	for (i = 0; i < LZ4_CACHE_BLOCKS; i++) {
+		if (zcache[i].used && zcache[i].db_idx == (uint32_t)db_idx
+				&& zcache[i].offset == start % BLOCK_SIZE && zcache[i].size == end - start) {
+			zcache[i].used = ++zclock;
+			return &zcache[i];
+		}
+		if (!zb || zcache[i].used < zb->used) {
+			zb = &zcache[i];
+		}
+	}
+
+	if (!zb->data) {
+		return NULL;
+	}
+	length = min(file_length(inode) - block * BLOCK_SIZE, BLOCK_SIZE);
+
+	zb->used = 0;
+	if (end - start == length) {
+		/* it didn't compress */
+		if (raw_read(inode, start, zb->data, length) != (int32_t)length) {
+			return NULL;
+		}
+	}
+	else if (raw_read(inode, start, zscratch, end - start) != (int32_t)(end - start)
+			|| lz4_decompress(zscratch, end - start, zb->data, length) != (int32_t)length) {
+		return NULL;
+	}
+
+	zb->db_idx = db_idx;
+	zb->offset = start % BLOCK_SIZE;
+	zb->size = end - start;
+	zb->used = ++zclock;
+	return zb;
+}
+
+/*
+ * Reads from a compressed file, a decompressed block at a time
+ *
+ * Inputs: inode - the file
+ *         offset - where to start, within the file
+ *         buf - where to put the bytes
+ *         length - how many, not past the end of the file
+ * Outputs: # of bytes read, fewer if a block can't be read
+ */
+static int32_t lz4_read(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length)
+{
+	zblock_t *zb;
+	uint32_t skip;
+	uint32_t flags;
+	int32_t b_read = 0;
+	int32_t round_read;
+
+	while (b_read < (int32_t)length) {
+		skip = (offset + b_read) % BLOCK_SIZE;
+		round_read = min(length - b_read, BLOCK_SIZE - skip);
+
+		cli_and_save(flags);
+		zb = lz4_block(inode, (offset + b_read) / BLOCK_SIZE);
+		if (zb) {
+			memcpy(buf + b_read, zb->data + skip, round_read);
+		}
+		restore_flags(flags);
+
+		if (!zb) {
+			break;
+		}
+		b_read += round_read;
+	}
+
+	return b_read;
+}
+
+/*
+ * Drops the decompressed blocks that came out of the data of a file whose
+ * data is going away, since its blocks may be handed out again
+ */
+static void lz4_forget(uint32_t inode)
+{
+	extent_t *extent;
+	uint32_t i, j;
+
+	for (i = 0; i < INODE_EXTENTS_MAX; i++) {
+		extent = &inode_ptr(inode)->extents[i];
+		for (j = 0; j < LZ4_CACHE_BLOCKS; j++) {
+			if (zcache[j].db_idx - extent->start < extent->length) {
+				zcache[j].used = 0;
+			}
+		}
+	}
+}
+
+/*
+ * Allocates a zeroed data block of a writable image
+ *
+ * Inputs: hint - block to take if it's free, normally the one after the
+ *                previous block of the file
+ * Outputs: the data block index, -1 if the image is full
+ */
+static int32_t block_alloc(uint32_t hint)
+{
+	int32_t db_idx;
+	buf_t *buf;
+
+	blocks_release();
+
+	if (hint < block_map.nbits && !bitmap_test(&block_map, hint)) {
+		bitmap_set(&block_map, hint);
+		db_idx = hint;
+	}
+	else {
+		db_idx = bitmap_alloc(&block_map);
+		if (db_idx < 0) {
+			return -1;
+		}
+	}
+
+	buf = bget(data_start + db_idx);
+	if (!buf) {
+		bitmap_clear(&block_map, db_idx);
+		return -1;
+	}
+	/* copies the journal logged while it held metadata are stale now */
+	journal_revoke(data_start + db_idx);
+	csum_clear(db_idx);
+	memset(buf->data, 0, BLOCK_SIZE);
+	bdirty(buf);
+	brelse(buf);
+
+	bitmap_store(&block_map, super_block->block_bitmap, db_idx);
+
+	return db_idx;
+}
+
+/*
+ * Frees a data block of a writable image, or gives up one file's share of
+ * it if other files hold it too
+ */
+static void block_free(uint32_t db_idx)
+{
+	uint32_t tid = journal_tid();
+
+	if (block_shares && block_shares[db_idx]) {
+		block_shares[db_idx]--;
+		share_store(db_idx);
+		return;
+	}
+
+	/* file data isn't logged, so the block can't take new data before
+	 * the file giving it up is gone for good */
+	if (tid) {
+		freeing[BITMAP_WORD(db_idx)] |= BITMAP_MASK(db_idx);
+		freeing_tid = tid;
+	}
+	else {
+		bitmap_clear(&block_map, db_idx);
+	}
+	bitmap_store(&block_map, super_block->block_bitmap, db_idx);
+}
+
+/*
+ * Frees the blocks in freeing once the transaction that last added to it
+ * has committed
+ */
+static void blocks_release(void)
+{
+	uint32_t word;
+
+	if (!freeing_tid || !journal_done(freeing_tid)) {
+		return;
+	}
+
+	for (word = 0; word < BITMAP_WORDS(block_map.nbits); word++) {
+		while (freeing[word]) {
+			bitmap_clear(&block_map, word * BITS_PER_WORD + bsf(freeing[word]));
+			freeing[word] &= freeing[word] - 1;
+		}
+	}
+	freeing_tid = 0;
+}
+
+/*
+ * Writes the word of the share table holding a block's count back to the
+ * image
+ */
+static void share_store(uint32_t db_idx)
+{
+	uint32_t word = db_idx / 2;
+
+	word_set(super_block->share_table + word / PTRS_PER_BLOCK, word % PTRS_PER_BLOCK,
+			((uint32_t*)block_shares)[word]);
+}
+
+/*
+ * Returns how many index blocks an inode listing nblocks blocks by index
+ * needs on top of its data blocks
+ */
+static uint32_t index_meta(uint32_t nblocks)
+{
+	uint32_t meta = 0;
+
+	if (nblocks > INODE_DIRECT) {
+		meta++;
+	}
+	if (nblocks > INODE_DIRECT + PTRS_PER_BLOCK) {
+		nblocks -= INODE_DIRECT + PTRS_PER_BLOCK;
+		meta += 1 + (nblocks + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
+	}
+
+	return meta;
+}
+
+/*
+ * Index Set
+ *	Parameters:	inode	- the index node of the file, listing blocks by index.
+ *				block	- index of the block within the file, which must be
+ *						  the block right after the file's last one.
+ *				db_idx	- data block holding it.
+ *
+ *  Adds a block to the end of an inode's index, allocating index blocks
+ *    as the file reaches them. Callers check there's room for those first.
+ *
+ *  Return 0 on success, -1 if the image is full or the file is too large.
+ *
+ */
+static int32_t index_set(uint32_t inode, uint32_t block, uint32_t db_idx)
+{
+	inode2_t *p_inode = inode_ptr(inode);
+	int32_t ptr_idx;
+
+	if (block < INODE_DIRECT) {
+		p_inode->direct[block] = db_idx;
+		return 0;
+	}
+
+	if ((block -= INODE_DIRECT) < PTRS_PER_BLOCK) {
+		if (!block) {
+			ptr_idx = block_alloc(db_idx + 1);
+			if (ptr_idx < 0) {
+				return -1;
+			}
+			p_inode->indirect = ptr_idx;
+		}
+		return word_set(p_inode->indirect, block, db_idx);
+	}
+
+	if ((block -= PTRS_PER_BLOCK) >= PTRS_PER_BLOCK * PTRS_PER_BLOCK) {
+		return -1;
+	}
+
+	if (!block) {
+		ptr_idx = block_alloc(db_idx + 1);
+		if (ptr_idx < 0) {
+			return -1;
+		}
+		p_inode->double_indirect = ptr_idx;
+	}
+
+	if (!(block % PTRS_PER_BLOCK)) {
+		ptr_idx = block_alloc(db_idx + 1);
+		if (ptr_idx < 0 || word_set(p_inode->double_indirect, block / PTRS_PER_BLOCK, ptr_idx)) {
+			return -1;
+		}
+	}
+	else {
+		ptr_idx = word_get(p_inode->double_indirect, block / PTRS_PER_BLOCK);
+		if (ptr_idx < 0) {
+			return -1;
+		}
+	}
+
+	return word_set(ptr_idx, block % PTRS_PER_BLOCK, db_idx);
+}
+
+/*
+ * Index Replace
+ *	Parameters:	inode	- the index node of the file, listing blocks by index.
+ *				block	- index of a block the file already has.
+ *				db_idx	- data block to hold it from now on.
+ *
+ *  Points an existing entry of an inode's index at another data block.
+ *    Unlike index_set it never allocates, the index blocks are all there.
+ *
+ *  Return 0 on success, -1 if an index block can't be read.
+ *
+ */
+static int32_t index_replace(uint32_t inode, uint32_t block, uint32_t db_idx)
+{
+	inode2_t *p_inode = inode_ptr(inode);
+	int32_t ptr_idx;
+
+	if (block < INODE_DIRECT) {
+		p_inode->direct[block] = db_idx;
+		return 0;
+	}
+
+	if ((block -= INODE_DIRECT) < PTRS_PER_BLOCK) {
+		return word_set(p_inode->indirect, block, db_idx);
+	}
+
+	block -= PTRS_PER_BLOCK;
+	ptr_idx = word_get(p_inode->double_indirect, block / PTRS_PER_BLOCK);
+	if (ptr_idx < 0) {
+		return -1;
+	}
+
+	return word_set(ptr_idx, block % PTRS_PER_BLOCK, db_idx);
+}
+
+/*
+ * Inode Unextent
+ *	Parameters:	inode	- the index node of the file, listing blocks as
+ *						  extents.
+ *
+ *  Rewrites an inode to list its blocks by index instead of as extents.
+ *    Callers check there's room for the index blocks first.
+ *
+ *  Return the number of blocks the file has, -1 if the image is full.
+ *
+ */
+static int32_t inode_unextent(uint32_t inode)
+{
+	inode2_t *p_inode = inode_ptr(inode);
+	extent_t extents[INODE_EXTENTS_MAX];
+	uint32_t block;
+	uint32_t i, j;
+
+	memcpy(extents, p_inode->extents, sizeof(extents));
+	memset(p_inode->extents, 0, sizeof(extents));
+	p_inode->flags &= ~INODE_EXTENTS;
+
+	for (i = 0, block = 0; i < INODE_EXTENTS_MAX; i++) {
+		for (j = 0; j < extents[i].length; j++) {
+			if (index_set(inode, block++, extents[i].start + j)) {
+				return -1;
+			}
+		}
+	}
+
+	return block;
+}
+
+/*
+ * Inode Append Block
+ *	Parameters:	inode	- the index node of the file.
+ *				nblocks	- number of blocks the file has now.
+ *
+ *  Gives a file one more data block, zeroed. Extent inodes grow their last
+ *    extent when the block after it was free, start a new extent when it
+ *    wasn't, and are rewritten to list their blocks by index when they're
+ *    out of extents.
+ *
+ *  Return the new data block index, -1 if the image is full.
+ *
+ */
+static int32_t inode_append_block(uint32_t inode, uint32_t nblocks)
+{
+	inode2_t *p_inode = inode_ptr(inode);
+	extent_t *last = NULL;
+	uint32_t hint = 0;
+	int32_t block;
+	int32_t db_idx;
+	uint32_t i;
+
+	/* blocks freed by committed transactions count toward the room */
+	blocks_release();
+
+	if (p_inode->flags & INODE_EXTENTS) {
+		for (i = 0; i < INODE_EXTENTS_MAX && p_inode->extents[i].length; i++) {
+			last = &p_inode->extents[i];
+		}
+		if (last) {
+			hint = last->start + last->length;
+		}
+
+		/* converting needs room for the index blocks too */
+		if (i == INODE_EXTENTS_MAX && block_map.nfree < index_meta(nblocks + 1) + 1) {
+			return -1;
+		}
+
+		db_idx = block_alloc(hint);
+		if (db_idx < 0) {
+			return -1;
+		}
+
+		if (last && (uint32_t)db_idx == hint) {
+			last->length++;
+			return db_idx;
+		}
+		if (i < INODE_EXTENTS_MAX) {
+			p_inode->extents[i].start = db_idx;
+			p_inode->extents[i].length = 1;
+			return db_idx;
+		}
+
+		/* out of extents, list every block by index instead */
+		block = inode_unextent(inode);
+		if (block >= 0) {
+			index_set(inode, block, db_idx);
+		}
+
+		return db_idx;
+	}
+
+	if (nblocks) {
+		hint = index_block(inode, nblocks - 1) + 1;
+	}
+
+	if (block_map.nfree < index_meta(nblocks + 1) - index_meta(nblocks) + 1) {
+		return -1;
+	}
+
+	db_idx = block_alloc(hint);
+	if (db_idx < 0) {
+		return -1;
+	}
+
+	if (index_set(inode, nblocks, db_idx)) {
+		block_free(db_idx);
+		return -1;
+	}
+
+	return db_idx;
+}
+
+/*
+ * Inode Unshare
+ *	Parameters:	inode	- the index node of the file.
+ *				block	- index of a block within the file.
+ *				db_idx	- data block holding it.
+ *
+ *  Gives a file its own copy of a block it shares with other files, before
+ *    the file changes it. The copy can't go in the middle of an extent, so
+ *    extent inodes are rewritten to list their blocks by index first.
+ *
+ *  Return the data block holding the file's block from now on, which is
+ *    db_idx if it wasn't shared, -1 if the image is full.
+ *
+ */
+static int32_t inode_unshare(uint32_t inode, uint32_t block, uint32_t db_idx)
+{
+	inode2_t *p_inode = inode_ptr(inode);
+	int32_t copy;
+	buf_t *from, *to;
+
+	if (!block_shares || !block_shares[db_idx]) {
+		return db_idx;
+	}
+
+	blocks_release();
+	if (p_inode->flags & INODE_EXTENTS) {
+		if (block_map.nfree < index_meta(inode_nblocks(inode)) + 1 || inode_unextent(inode) < 0) {
+			return -1;
+		}
+	}
+
+	copy = block_alloc(db_idx + 1);
+	if (copy < 0) {
+		return -1;
+	}
+
+	from = bread(data_start + db_idx);
+	to = from ? bget(data_start + copy) : NULL;
+	if (!to || index_replace(inode, block, copy)) {
+		goto fail;
+	}
+	memcpy(to->data, from->data, BLOCK_SIZE);
+	bdirty(to);
+	brelse(to);
+	brelse(from);
+
+	block_free(db_idx);
+	inode_dirty(inode);
+
+	return copy;
+
+fail:
+	if (from) {
+		brelse(from);
+	}
+	if (to) {
+		brelse(to);
+	}
+	block_free(copy);
+	return -1;
+}
+
+/*
+ * Inode Shrink
+ *	Parameters:	inode	- the index node of the file.
+ *				nblocks	- number of blocks to keep.
+ *
+ *  Frees the data blocks of a file past the first nblocks, along with any
+ *    index blocks that no longer point at anything. Doesn't touch the
+ *    file's length.
+ *
+ *  Return none.
+ *
+ */
+static void inode_shrink(uint32_t inode, uint32_t nblocks)
+{
+	inode2_t *p_inode = inode_ptr(inode);
+	extent_t *extent;
+	uint32_t old_blocks;
+	uint32_t first, keep;
+	uint32_t old_ptrs, new_ptrs;
+	uint32_t block;
+	int32_t db_idx;
+	uint32_t i;
+
+	old_blocks = inode_nblocks(inode);
+	if (nblocks >= old_blocks) {
+		return;
+	}
+
+	if (p_inode->flags & INODE_EXTENTS) {
+		for (i = 0, first = 0; i < INODE_EXTENTS_MAX; i++) {
+			extent = &p_inode->extents[i];
+			keep = (nblocks > first) ? min(extent->length, nblocks - first) : 0;
+			first += extent->length;
+
+			for (block = keep; block < extent->length; block++) {
+				block_free(extent->start + block);
+			}
+			extent->length = keep;
+			if (!keep) {
+				extent->start = 0;
+			}
+		}
+		return;
+	}
+
+	/* blocks behind corrupt indices are left allocated */
+	for (block = nblocks; block < old_blocks; block++) {
+		db_idx = index_block(inode, block);
+		if (db_idx >= 0) {
+			block_free(db_idx);
+		}
+	}
+
+	/* blocks of indices past the ones still in use */
+	if (old_blocks > INODE_DIRECT + PTRS_PER_BLOCK) {
+		old_ptrs = (old_blocks - INODE_DIRECT - PTRS_PER_BLOCK + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
+		new_ptrs = (nblocks > INODE_DIRECT + PTRS_PER_BLOCK)
+			? (nblocks - INODE_DIRECT - PTRS_PER_BLOCK + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK : 0;
+
+		/* as above, what a corrupt block of indices points to stays allocated */
+		if (p_inode->double_indirect < boot_block->num_dblocks
+				&& !block_verify(inode, p_inode->double_indirect, NULL)) {
+			for (i = new_ptrs; i < old_ptrs; i++) {
+				db_idx = word_get(p_inode->double_indirect, i);
+				if (db_idx >= 0 && db_idx < boot_block->num_dblocks) {
+					block_free(db_idx);
+				}
+			}
+		}
+		if (!new_ptrs) {
+			block_free(p_inode->double_indirect);
+			p_inode->double_indirect = 0;
+		}
+	}
+
+	if (old_blocks > INODE_DIRECT && nblocks <= INODE_DIRECT) {
+		block_free(p_inode->indirect);
+		p_inode->indirect = 0;
+	}
+}
+
+/*
+ * Inode Resize
+ *	Parameters:	inode	- the index node of the file.
+ *				length	- new length in bytes.
+ *
+ *  Grows or shrinks a file. Bytes past the end of a file's last block are
+ *    always kept zero, so growing only has to add zeroed blocks, and a
+ *    shared last block is copied before it's cut.
+ *
+ *  Return 0 on success, -1 if the image is full or the file is compressed
+ *    and isn't being emptied, the file is then unchanged.
+ *
+ */
+static int32_t inode_resize(uint32_t inode, uint32_t length)
+{
+	inode2_t *p_inode = inode_ptr(inode);
+	uint32_t old_length = p_inode->byte_length;
+	uint32_t old_blocks, nblocks;
+	uint32_t count;
+	int32_t db_idx;
+	buf_t *buf;
+
+	/* compressed files can only be emptied, which leaves a plain file */
+	if (p_inode->flags & INODE_LZ4) {
+		if (length) {
+			return -1;
+		}
+		lz4_forget(inode);
+		inode_shrink(inode, 0);
+		p_inode->flags &= ~INODE_LZ4;
+		p_inode->byte_length = 0;
+		inode_dirty(inode);
+		return 0;
+	}
+
+	old_blocks = (p_inode->byte_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	nblocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	if (length < p_inode->byte_length) {
+		/* zero what's cut off the new last block */
+		if (length % BLOCK_SIZE) {
+			db_idx = inode_run(inode, length / BLOCK_SIZE, 1, &count);
+			if (db_idx >= 0) {
+				db_idx = inode_unshare(inode, length / BLOCK_SIZE, db_idx);
+				if (db_idx < 0) {
+					return -1;
+				}
+			}
+			buf = (db_idx >= 0) ? bread(data_start + db_idx) : NULL;
+			if (buf) {
+				csum_clear(db_idx);
+				memset(buf->data + length % BLOCK_SIZE, 0, BLOCK_SIZE - length % BLOCK_SIZE);
+				bdirty(buf);
+				brelse(buf);
+			}
+		}
+		inode_shrink(inode, nblocks);
+		p_inode->byte_length = length;
+		inode_dirty(inode);
+		return 0;
+	}
+
+	for (count = old_blocks; count < nblocks; count++) {
+		if (inode_append_block(inode, count) < 0) {
+			inode_shrink(inode, old_blocks);
+			p_inode->byte_length = old_length;
+			inode_dirty(inode);
+			return -1;
+		}
+		/* the new block has to count as part of the file for the next one */
+		p_inode->byte_length = count * BLOCK_SIZE + 1;
+	}
+
+	p_inode->byte_length = length;
+	inode_dirty(inode);
+	return 0;
+}
+
+/*
+ * Frees an inode and its data once it has no directory entry and no one has
+ * it open
+ */
+static void inode_put(uint32_t inode)
+{
+	if (inode == NULL_INODE || inode_refs[inode] != INODE_ORPHAN) {
+		return;
 	}
 
-	return -1;
+	inode_resize(inode, 0);
+	memset(inode_ptr(inode), 0, sizeof(inode2_t));
+	inode_dirty(inode);
+	inode_refs[inode] = 0;
+
+	bitmap_clear(&inode_map, inode);
+	bitmap_store(&inode_map, super_block->inode_bitmap, inode);
 }
 
-/*	
- *	Read Data
- *	Parameters:	inode	- the index node of the data.
- *				offset	- how many bytes to begin reading at?
- *				buf		- data array to read.
- *				length  - size of array.
- *
- *  Reads up to 'length' bytes from position 'offset'
- *	  in the file with 'inode' number into the given 'buf' buffer.
- *
- *  Return  # of bytes read and placed into buffer
- *			0 when end of file reached.
- *			-1 on failure.
+/*
+ * Creates an empty regular file
  *
+ * Inputs: dir - inode of the directory to put it in
+ *         name - its name, which may be followed by a '/'
+ * Outputs: 0 on success, -1 if the name is taken or invalid, or the image
+ *          is full
  */
-int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
+static int32_t fs_create(uint32_t dir, const uint8_t *name)
 {
-	int32_t db_idx;
-	int32_t b_read;
-	int32_t b_rem;
-	int32_t round_read;
-	data_block_t *p_db;
-	index_node_t *p_inode;
-	uint8_t *data;
+	dentry_t dentry;
+	dentry_t entry;
+	int32_t inode;
+	uint32_t len;
+	uint32_t slot;
 
-	/* verify bounds */
-	if (inode > boot_block->num_inodes) {
+	if (!fs_writable) {
 		return -1;
 	}
 
-	p_inode = node_head + inode;
-
-	if (p_inode->byte_length < offset) {
+	/* names can't be too long or be one of the ones every directory has */
+	for (len = 0; name[len] && name[len] != PATH_SEP; len++);
+	if (!len || len > FILE_NAME_SIZE || name[len] == PATH_SEP
+			|| !strncmp((int8_t*)name, ".", len) || !strncmp((int8_t*)name, "..", len)) {
 		return -1;
 	}
 
-	/* compute number of bytes to read */
-	b_rem = min(p_inode->byte_length - offset, length);
+	mutex_lock(&fs_lock);
+	journal_begin();
 
-	/* compute first datablock */
-	db_idx = offset / BLOCK_SIZE;
-	p_db = data_head + p_inode->data_blocks[db_idx];
-	data = p_db->data + offset % BLOCK_SIZE;
+	if (index_find(dir, name, &len)) {
+		goto fail;
+	}
 
-	b_read = 0;
-	while (b_rem > 0) {
-		/* compute number of bytes to read this iteration */
-		round_read = min(b_rem, p_db->data + BLOCK_SIZE - data);
+	inode = bitmap_alloc(&inode_map);
+	if (inode < 0) {
+		goto fail;
+	}
+	bitmap_store(&inode_map, super_block->inode_bitmap, inode);
+	memset(inode_ptr(inode), 0, sizeof(inode2_t));
+	inode_ptr(inode)->flags = INODE_EXTENTS;
+	inode_dirty(inode);
 
-		/* copy data into buffer */
-		memcpy(buf+b_read, data, round_read);
-		b_read += round_read;
-		b_rem -= round_read;
+	memset(&dentry, 0, sizeof(dentry));
+	memcpy(dentry.file_name, name, len);
+	dentry.file_type = FILE_TYPE_REG;
+	dentry.inode = inode;
+
+	/* take the first free entry of the directory, or add one to its end */
+	for (slot = 0; !read_dir_entry(dir, slot, &entry) && entry.file_name[0]; slot++);
 
-		/* get next block */
-		p_db = data_head + p_inode->data_blocks[++db_idx];
-		data = p_db->data;
+	if (inode_write(dir, slot * sizeof(dentry_t), (uint8_t*)&dentry, sizeof(dentry_t), 1) != sizeof(dentry_t)) {
+		goto fail_inode;
+	}
+	if (index_add(dir, &dentry)) {
+		memset(&dentry, 0, sizeof(dentry));
+		inode_write(dir, slot * sizeof(dentry_t), (uint8_t*)&dentry, sizeof(dentry_t), 1);
+		goto fail_inode;
 	}
 
-	return b_read;
+	journal_end();
+	fs_unlock();
+	return 0;
+
+fail_inode:
+	inode_refs[inode] = INODE_ORPHAN;
+	inode_put(inode);
+fail:
+	journal_end();
+	fs_unlock();
+	return -1;
 }
 
 /* 
@@ -283,6 +2419,7 @@ int32_t dir_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes)
 {
 	file_t *file;
 	int32_t ret;
+	int32_t len;
 	dentry_t dentry;
 
 	file = get_file_from_fd(pcb, fd);
@@ -292,34 +2429,63 @@ int32_t dir_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes)
 		return -1;
 	}
 
-	ret = read_dentry_by_index(file->file_pos, &dentry);
-	if (ret) {
-		/* at the end of the directory */
-		return 0;
-	}
+	/* skip over empty entries */
+	do {
+		ret = read_dir_entry(file->inode_ptr, file->file_pos, &dentry);
+		if (ret) {
+			/* at the end of the directory */
+			return 0;
+		}
+		file->file_pos += 1;
+	} while (!dentry.file_name[0]);
 
 	strncpy((int8_t*)buf, (int8_t*)dentry.file_name, nbytes);
 
 	/* just in case */
 	((int8_t*)buf)[nbytes-1] = '\0';
 
-	/* increment directory position */
-	file->file_pos += 1;
+	/* names that fill the whole field have no terminator */
+	for (len = 0; len < FILE_NAME_SIZE && dentry.file_name[len]; len++);
 
-	return strlen((int8_t*)dentry.file_name);
+	return len;
 }
 
 /*  
- *  Write system call for directory file types.
- *  Read-only file system.
+ *  Write system call for directory file types. Writing a name to a
+ *  directory creates an empty regular file by that name in it.
  *
- *  Return -1
+ *  Inputs: pcb - the pcb of the calling process,
+ *          fd - file descriptor of the directory
+ *          buf - the name, without any '/'
+ *          nbytes - length of the name
+ *  Outputs: nbytes on success, -1 if the file can't be created
  */
 int32_t dir_write(pcb_t *pcb, int32_t fd, const void* buf, int32_t nbytes)
 {
-	/* unused params */
-	(void)pcb; (void)fd; (void)buf; (void)nbytes;
-	return -1;
+	file_t *file;
+	uint8_t name[FILE_NAME_SIZE + 1];
+	int32_t i;
+
+	file = get_file_from_fd(pcb, fd);
+
+	/* ensure file is open */
+	if (!file || !(file->flags & FILE_OPEN) || nbytes <= 0 || nbytes > FILE_NAME_SIZE) {
+		return -1;
+	}
+
+	for (i = 0; i < nbytes; i++) {
+		name[i] = ((const uint8_t*)buf)[i];
+		if (name[i] == PATH_SEP || !name[i]) {
+			return -1;
+		}
+	}
+	name[nbytes] = '\0';
+
+	if (fs_create(file->inode_ptr, name)) {
+		return -1;
+	}
+
+	return nbytes;
 }
 
 /* 
@@ -328,19 +2494,16 @@ int32_t dir_write(pcb_t *pcb, int32_t fd, const void* buf, int32_t nbytes)
  * Creates a file descriptor for a directory file type.
  *
  * Inputs: pcb - the pcb of the calling process,
- *         filename - name of the file to be opened
+ *         dentry - directory entry of the directory, already looked up
  * Outputs: fd- file descriptor
  *
  */
-int32_t dir_open(pcb_t *pcb, const uint8_t *filename)
+int32_t dir_open(pcb_t *pcb, const dentry_t *dentry)
 {
-	dentry_t dentry;
 	int32_t fd;
 	file_t *file;
-	int32_t status;
 
-	status = read_dentry_by_name(filename, &dentry);
-	if (status) {
+	if (!dentry) {
 		return -1;
 	}
 
@@ -355,7 +2518,7 @@ int32_t dir_open(pcb_t *pcb, const uint8_t *filename)
 
 	/* set up the file */
 	file->flags |= FILE_OPEN;
-	file->inode_ptr = dentry.inode;
+	file->inode_ptr = dentry->inode;
 	file->file_pos = 0;
 	file->file_op = &dir_fops;
 
@@ -392,8 +2555,11 @@ uint32_t file_loader(dentry_t* file, uint32_t* eip)
 	uint32_t f_pos;
 	uint8_t *dest;
 
-	/* Read the entire file */
-	b_rem = node_head[file->inode].byte_length;
+	/* Read the entire file, which has to fit in the user page */
+	b_rem = file_length(file->inode);
+	if (b_rem > OFFSET_4MB - EXEC_OFFSET) {
+		return -1;
+	}
 
 	f_pos = 0;
 
@@ -401,6 +2567,9 @@ uint32_t file_loader(dentry_t* file, uint32_t* eip)
 	dest = (uint8_t *)(USER_MEM + EXEC_OFFSET);
 	while(b_rem > 0) {
 		b_read = read_data(file->inode, f_pos, dest + f_pos, b_rem);
+		if ((int32_t)b_read <= 0) {
+			return -1;
+		}
 		f_pos += b_read;
 		b_rem -= b_read;
 	}
@@ -415,3 +2584,442 @@ uint32_t file_loader(dentry_t* file, uint32_t* eip)
 
 	return 0;
 }
+
+/*
+ * Creates an empty regular file. Only version 2 images made with free space
+ * can be written to.
+ *
+ * Inputs: filename - path of the file, its directory has to exist
+ * Outputs: 0 on success, -1 on failure
+ */
+int32_t sys_create(const uint8_t *filename)
+{
+	uint32_t parent;
+	const uint8_t *name;
+
+	if (walk_path(filename, &parent, &name)) {
+		return -1;
+	}
+
+	return fs_create(parent, name);
+}
+
+/*
+ * Writes to the end of an open regular file, leaving the file's position
+ * just past what was written.
+ *
+ * Inputs: fd - file descriptor of the file
+ *         buf - data to write
+ *         nbytes - number of bytes to write
+ * Outputs: number of bytes written, -1 on failure
+ */
+int32_t sys_append(int32_t fd, const void *buf, int32_t nbytes)
+{
+	pcb_t *pcb = get_proc_pcb();
+	file_t *file;
+
+	file = get_file_from_fd(pcb, fd);
+
+	if (!buf || !file || !(file->flags & FILE_OPEN) || file->file_op != &file_fops) {
+		return -1;
+	}
+
+	file->file_pos = file_length(file->inode_ptr);
+	return file_write(pcb, fd, buf, nbytes);
+}
+
+/*
+ * Sets the length of an open regular file, cutting off its end or padding
+ * it with zeroes. The file's position isn't moved.
+ *
+ * Inputs: fd - file descriptor of the file
+ *         length - new length in bytes
+ * Outputs: 0 on success, -1 on failure
+ */
+int32_t sys_truncate(int32_t fd, uint32_t length)
+{
+	file_t *file;
+	int32_t ret;
+
+	file = get_file_from_fd(get_proc_pcb(), fd);
+
+	if (!fs_writable || !file || !(file->flags & FILE_OPEN) || file->file_op != &file_fops
+			|| file->inode_ptr == NULL_INODE) {
+		return -1;
+	}
+
+	mutex_lock(&fs_lock);
+	journal_begin();
+	ret = inode_resize(file->inode_ptr, length);
+	journal_end();
+	fs_unlock();
+
+	return ret;
+}
+
+/*
+ * Removes a file's directory entry. Its inode and data are freed right away
+ * unless a process has it open, then once the last one closes it.
+ * Directories can't be removed.
+ *
+ * Inputs: filename - path of the file
+ * Outputs: 0 on success, -1 on failure
+ */
+int32_t sys_unlink(const uint8_t *filename)
+{
+	dentry_node_t *node;
+	dentry_t dentry;
+	uint32_t parent;
+	const uint8_t *name;
+	uint32_t inode;
+	uint32_t len;
+	uint32_t slot;
+
+	if (!fs_writable || walk_path(filename, &parent, &name)) {
+		return -1;
+	}
+
+	mutex_lock(&fs_lock);
+	journal_begin();
+
+	node = index_find(parent, name, &len);
+	if (!node || node->file_type == FILE_TYPE_DIR) {
+		goto fail;
+	}
+
+	/* find the entry in the directory itself */
+	for (slot = 0; ; slot++) {
+		if (read_dir_entry(parent, slot, &dentry)) {
+			goto fail;
+		}
+		if (!strncmp((int8_t*)dentry.file_name, (int8_t*)node->name, FILE_NAME_SIZE)) {
+			break;
+		}
+	}
+
+	memset(&dentry, 0, sizeof(dentry));
+	if (inode_write(parent, slot * sizeof(dentry_t), (uint8_t*)&dentry, sizeof(dentry_t), 1) != sizeof(dentry_t)) {
+		goto fail;
+	}
+
+	inode = node->inode;
+	index_remove(node);
+
+	if (inode != NULL_INODE) {
+		inode_refs[inode] |= INODE_ORPHAN;
+		inode_put(inode);
+	}
+
+	journal_end();
+	fs_unlock();
+	return 0;
+
+fail:
+	journal_end();
+	fs_unlock();
+	return -1;
+}
+
+/*
+ * Copies bytes from an open regular file, starting at its position, to
+ * another descriptor through that one's write operation. The bytes are
+ * handed over from the buffer cache or the mapped image as they sit, with
+ * no trip through a user buffer; compressed files are decompressed a page
+ * at a time first. The file's position moves past what was written.
+ *
+ * Inputs: out_fd - descriptor to write to, a terminal, pipe or file
+ *         in_fd - regular file to read from
+ *         count - most bytes to copy
+ * Outputs: number of bytes copied, 0 at the end of the file, -1 on failure
+ */
+int32_t sys_sendfile(int32_t out_fd, int32_t in_fd, int32_t count)
+{
+	pcb_t *pcb = get_proc_pcb();
+	file_t *in, *out;
+	const uint8_t *data;
+	uint8_t *bounce = NULL;
+	buf_t *held;
+	uint32_t inode;
+	uint32_t length;
+	uint32_t block, ra_next;
+	int32_t done, n;
+	int32_t ret = 0;
+
+	in = get_file_from_fd(pcb, in_fd);
+	out = get_file_from_fd(pcb, out_fd);
+
+	if (!in || !(in->flags & FILE_OPEN) || in->file_op != &file_fops
+			|| !out || !(out->flags & FILE_PRESENT) || count < 0) {
+		return -1;
+	}
+
+	inode = in->inode_ptr;
+	length = file_length(inode);
+	if (in->file_pos >= length) {
+		return 0;
+	}
+	count = min((uint32_t)count, length - in->file_pos);
+
+	if (inode_lz4(inode)) {
+		bounce = kpage_alloc(0);
+		if (!bounce) {
+			return -1;
+		}
+	}
+
+	ra_next = 0;
+	for (done = 0; done < count; done += ret) {
+		/* keep the cache a window ahead of the blocks we're handing on */
+		block = in->file_pos / BLOCK_SIZE;
+		if (block >= ra_next) {
+			ra_next = block + BCACHE_RA_MAX;
+			file_readahead(inode, block, BCACHE_RA_MAX);
+		}
+
+		if (bounce) {
+			held = NULL;
+			data = bounce;
+			n = read_data(inode, in->file_pos, bounce, min(count - done, PAGE_SIZE));
+		}
+		else {
+			n = data_span(inode, in->file_pos, count - done, &data, &held);
+		}
+		if (n <= 0) {
+			ret = -1;
+			break;
+		}
+
+		ret = out->file_op->write(pcb, out_fd, data, n);
+		if (held) {
+			brelse(held);
+		}
+		if (ret <= 0) {
+			break;
+		}
+
+		in->file_pos += ret;
+		if (ret < n) {
+			done += ret;
+			break;
+		}
+	}
+
+	if (bounce) {
+		kpage_free(bounce, 0);
+	}
+
+	/* only fail if nothing made it */
+	if (!done && ret < 0) {
+		return ret;
+	}
+	return done;
+}
+
+/*
+ * Moves the position of an open regular file, which may be past its end;
+ * reads there find the end of the file and writes fill the gap with
+ * zeroes.
+ *
+ * Inputs: fd - file descriptor of the file
+ *         offset - bytes to move by
+ *         whence - SEEK_SET, SEEK_CUR or SEEK_END, what offset counts from
+ * Outputs: the new position, -1 on failure
+ */
+int32_t sys_lseek(int32_t fd, int32_t offset, int32_t whence)
+{
+	file_t *file;
+	int32_t base;
+
+	file = get_file_from_fd(get_proc_pcb(), fd);
+
+	if (!file || !(file->flags & FILE_OPEN) || file->file_op != &file_fops) {
+		return -1;
+	}
+
+	switch (whence) {
+		case SEEK_SET:
+			base = 0;
+			break;
+		case SEEK_CUR:
+			base = file->file_pos;
+			break;
+		case SEEK_END:
+			base = file_length(file->inode_ptr);
+			break;
+		default:
+			return -1;
+	}
+
+	if (base + offset < 0 || (offset > 0 && base + offset < base)) {
+		return -1;
+	}
+
+	file->file_pos = base + offset;
+	return file->file_pos;
+}
+
+/*
+ * Reads an open regular file at an offset, leaving its position where it
+ * is. System calls only take three arguments, so the last three come in a
+ * block; the library passes the ones on its stack.
+ *
+ * Inputs: fd - file descriptor of the file
+ *         args - buffer, number of bytes and offset to read at
+ * Outputs: number of bytes read, 0 at or past the end, -1 on failure
+ */
+int32_t sys_pread(int32_t fd, const pread_args_t *args)
+{
+	file_t *file;
+	pread_args_t req;
+
+	file = get_file_from_fd(get_proc_pcb(), fd);
+
+	if (!file || !(file->flags & FILE_OPEN) || file->file_op != &file_fops
+			|| !user_range_ok(args, sizeof(*args))) {
+		return -1;
+	}
+
+	/* copy it out first, the process can change it under us */
+	req = *args;
+	if (!req.buf || req.nbytes < 0 || !user_range_ok(req.buf, req.nbytes)) {
+		return -1;
+	}
+
+	if (req.offset >= file_length(file->inode_ptr)) {
+		return 0;
+	}
+
+	return read_data(file->inode_ptr, req.offset, req.buf, req.nbytes);
+}
+
+/*
+ * Reports what an open file is. Regular files and directories give their
+ * inode and length, the rtc has neither. Terminals and pipes aren't files.
+ *
+ * Inputs: fd - file descriptor of the file
+ *         buf - where to store it
+ * Outputs: 0 on success, -1 on failure
+ */
+int32_t sys_fstat(int32_t fd, stat_t *buf)
+{
+	file_t *file;
+	stat_t st;
+
+	file = get_file_from_fd(get_proc_pcb(), fd);
+
+	if (!file || !(file->flags & FILE_OPEN) || !user_range_ok(buf, sizeof(*buf))) {
+		return -1;
+	}
+
+	if (file->file_op == &file_fops) {
+		st.type = FILE_TYPE_REG;
+	}
+	else if (file->file_op == &dir_fops) {
+		st.type = FILE_TYPE_DIR;
+	}
+	else if (file->file_op == &rtc_fops) {
+		st.type = FILE_TYPE_RTC;
+	}
+	else {
+		return -1;
+	}
+
+	if (st.type == FILE_TYPE_RTC) {
+		st.inode = NULL_INODE;
+		st.size = 0;
+	}
+	else {
+		st.inode = file->inode_ptr;
+		st.size = file_length(file->inode_ptr);
+	}
+
+	*buf = st;
+	return 0;
+}
+
+/*
+ * Holds off halting a process from the keyboard while it's changing the
+ * file system, since the change can't be stopped halfway. The thread
+ * making it halts the process as soon as it's done. Called with
+ * interrupts off.
+ *
+ * Inputs: pid - the process to halt
+ * Outputs: 1 if the halt was put off, 0 if it can go ahead now
+ */
+int32_t fs_halt_later(int32_t pid)
+{
+	pcb_t *pcb;
+
+	pcb = get_pcb_from_pid(pid);
+	if (!pcb || !fs_held_by(pcb)) {
+		return 0;
+	}
+
+	fs_halt_pid = pid;
+	return 1;
+}
+
+/*
+ * Gets the file system ready for a process, or a thread, to halt. One of
+ * its threads partway through a change is left to finish it first. If
+ * that's the caller, which faulted partway through, the change is given
+ * up instead, so the file system isn't left locked. Called with
+ * interrupts off, it may sleep.
+ *
+ * Inputs: pcb - the one halting
+ * Outputs: 1 if it slept, so whatever the caller looked up may be gone,
+ *          0 if the halt can go ahead
+ */
+int32_t fs_halting(pcb_t *pcb)
+{
+	if (fs_halt_pid == (int32_t)pcb->pid) {
+		fs_halt_pid = -1;
+	}
+
+	if (!fs_held_by(pcb)) {
+		return 0;
+	}
+
+	if (fs_lock.owner == get_proc_pcb()) {
+		journal_abandon();
+		mutex_unlock(&fs_lock);
+		return 0;
+	}
+
+	sleep_on(&fs_lock.waiters);
+	return 1;
+}
+
+/*
+ * Releases the file system's lock, then halts the process that was killed
+ * from the keyboard while it held it
+ */
+static void fs_unlock(void)
+{
+	uint32_t flags;
+	int32_t pid;
+
+	cli_and_save(flags);
+
+	pid = fs_halt_pid;
+	fs_halt_pid = -1;
+	mutex_unlock(&fs_lock);
+
+	if (pid >= 0) {
+		sys_halt_internal(pid, 256);
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * Checks whether the file system's lock is held by a thread, or by any
+ * thread of a process
+ */
+static int32_t fs_held_by(pcb_t *pcb)
+{
+	pcb_t *owner = fs_lock.owner;
+
+	return fs_lock.locked && owner
+		&& (owner == pcb || (!pcb->leader && owner->leader == pcb));
+}
@@ -8,6 +8,7 @@
 
 #include "types.h"
 #include "proc.h"
+#include "bcache.h"
 
 /****************************************
  *            Global Defines            *
@@ -21,8 +22,56 @@
 
 #define BLOCK_SIZE 4096
 
+/* directory entries the boot block holds */
+#define MAX_DENTRIES 63
+
+/* buckets in the name lookup table, must be a power of two */
+#define DENTRY_BUCKETS 1024
+
+/* most names the lookup table holds, 73 per page of the kernel pool */
+#define MAX_INDEX_NODES 16384
+
+/* version 2 superblock magic, "YFS2", and format versions */
+#define FS_MAGIC     0x32534659
+#define FS_VERSION_1 1
+#define FS_VERSION_2 2
+
+/* version 2 inodes */
+#define INODE_DIRECT       12
+#define INODE_EXTENTS_MAX  7
+#define PTRS_PER_BLOCK     (BLOCK_SIZE / sizeof(uint32_t))
+#define INODES_PER_BLOCK   (BLOCK_SIZE / sizeof(inode2_t))
+#define DENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(dentry_t))
+#define SHARES_PER_BLOCK   (BLOCK_SIZE / sizeof(uint16_t))
+
+/* version 2 feature flags */
+#define FS_WRITABLE 0x1  /* the image has block and inode bitmaps and free space */
+#define FS_JOURNAL  0x2  /* the image has a metadata journal */
+#define FS_LZ4      0x4  /* some files are compressed */
+#define FS_SHARED   0x8  /* some data blocks belong to more than one file */
+#define FS_CSUM     0x10 /* data blocks have CRC32C checksums */
+
+/* version 2 inode flags */
+#define INODE_EXTENTS 0x1  /* blocks are listed as extents, not indices */
+#define INODE_LZ4     0x2  /* the blocks hold the file compressed, read only */
+
+/* decompressed blocks of compressed files kept around, one pool frame each */
+#define LZ4_CACHE_BLOCKS 16
+
+/* inode 0 of a version 2 file system is empty, entries that have no data
+ * (like the rtc) point at it */
+#define NULL_INODE 0
+
+/* separates directories in a path */
+#define PATH_SEP '/'
+
 #define ELF_EIP_OFFSET 24
 
+/* where lseek counts its offset from */
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
 #ifndef ASM
 
 /****************************************
@@ -86,9 +135,131 @@ typedef struct boot_block{
 	uint32_t num_inodes;
 	uint32_t num_dblocks;
 	uint8_t reserved[52];
-	dentry_t entries[63];
+	dentry_t entries[MAX_DENTRIES];
 } __attribute__((packed)) boot_block_t;
 
+/*
+ * Version 2 Superblock Struct
+ *  Takes the place of the boot block. The boot block's reserved bytes are
+ *  zero on version 1 images, which is how the two are told apart. Entries
+ *  live in directory files starting at the root directory's inode instead
+ *  of the superblock, and num_dentries is 0 so older kernels see an empty
+ *  file system rather than garbage.
+ * Size: 4096 bytes
+ * Members:
+ *   -  4 byte number of directory entries (always 0)
+ *   -  4 byte number of inodes
+ *   -  4 byte number of data blocks
+ *   -  4 byte magic number (FS_MAGIC)
+ *   -  4 byte format version
+ *   -  4 byte inode of the root directory
+ *   -  4 byte number of blocks in the inode table
+ *   -  4 byte feature flags
+ *   -  4 byte data block the block bitmap starts at
+ *   -  4 byte data block the inode bitmap starts at
+ *   -  4 byte data block the journal starts at
+ *   -  4 byte number of blocks in the journal
+ *   -  4 byte data block the share table starts at
+ *   -  4 byte data block the checksum table starts at
+ *   - 4040 byte reserved
+ *  With FS_WRITABLE, num_inodes counts every slot of the inode table and the
+ *  bitmaps mark which data blocks and inodes are in use, set bits for used.
+ *  Each bitmap takes as many whole blocks as it needs, its bits past the
+ *  last block or inode are set, and its own blocks are marked used.
+ *  With FS_JOURNAL, changes to inodes, bitmaps, directories and blocks of
+ *  indices are logged to the journal's blocks before they're written home,
+ *  which are also marked used.
+ *  With FS_SHARED, identical data blocks of files are stored once and the
+ *  share table has a 2 byte count per data block of how many more files
+ *  than one hold it, 0 for most. Shared blocks are copied before they're
+ *  written and only freed by the last file giving them up.
+ *  With FS_CSUM, the checksum table has the CRC32C of each data block as
+ *  the image was made, a 4 byte word per block, 0 for blocks that aren't
+ *  checked (like the bitmaps, the journal and the tables). Blocks are
+ *  checked the first time they're read after mounting, and a block that
+ *  changes loses its checksum in the same transaction.
+ */
+typedef struct super_block{
+	uint32_t num_dentries;
+	uint32_t num_inodes;
+	uint32_t num_dblocks;
+	uint32_t magic;
+	uint32_t version;
+	uint32_t root_inode;
+	uint32_t inode_blocks;
+	uint32_t features;
+	uint32_t block_bitmap;
+	uint32_t inode_bitmap;
+	uint32_t journal_start;
+	uint32_t journal_blocks;
+	uint32_t share_table;
+	uint32_t csum_table;
+	uint8_t reserved[BLOCK_SIZE - 56];
+} __attribute__((packed)) super_block_t;
+
+/*
+ * Extent Struct
+ *  A run of physically contiguous data blocks.
+ * Size: 8 bytes
+ * Members:
+ *   - 4 byte index of the first data block
+ *   - 4 byte number of blocks
+ */
+typedef struct extent{
+	uint32_t start;
+	uint32_t length;
+} __attribute__((packed)) extent_t;
+
+/*
+ * Version 2 Index Node Struct
+ *  Packed 64 to a block after the superblock. Data block indices count
+ *  from the first block after the inode table, as in version 1. Files in at
+ *  most 7 runs of contiguous blocks (which is what createfs writes) have
+ *  INODE_EXTENTS set and list the runs in file order instead.
+ * Size: 64 bytes
+ * Members:
+ *   -  4 byte length
+ *   -  4 byte flags
+ *   - 48 byte indices of the first 12 data blocks
+ *   -  4 byte index of a block of data block indices
+ *   -  4 byte index of a block of indices of blocks of data block indices
+ *  or, with INODE_EXTENTS
+ *   - 56 byte list of 7 extents, unused ones have length 0
+ *  INODE_LZ4 files always have INODE_EXTENTS. Their length is the length
+ *  of the contents, and their blocks hold each 4kB block of the contents
+ *  compressed on its own, so any of them can be read without the rest:
+ *   - 4 byte offset of the end of each compressed block, n of them
+ *   - the compressed blocks, back to back from offset 4n on
+ *  A block that's just as long as its contents is stored as is.
+ */
+typedef struct inode2{
+	uint32_t byte_length;
+	uint32_t flags;
+	union {
+		struct {
+			uint32_t direct[INODE_DIRECT];
+			uint32_t indirect;
+			uint32_t double_indirect;
+		} __attribute__((packed));
+		extent_t extents[INODE_EXTENTS_MAX];
+	};
+} __attribute__((packed)) inode2_t;
+
+/* What pread reads, laid out as its arguments after fd sit on the
+ * caller's stack */
+typedef struct pread_args {
+	void *buf;
+	int32_t nbytes;
+	uint32_t offset;
+} pread_args_t;
+
+/* What fstat reports, type is one of FILE_TYPE_*, size is in bytes */
+typedef struct stat {
+	uint32_t type;
+	uint32_t inode;
+	uint32_t size;
+} stat_t;
+
 
 /****************************************
  *           Global Variables           *
@@ -103,8 +274,8 @@ extern fops_t dir_fops;
  *         Function Declarations        *
  ****************************************/
 
-/* Sets up the head pointer for the file system */
-void fs_init(boot_block_t* boot_val);
+/* Mounts an image of either version, from memory or a disk */
+int32_t fs_init(const bdev_t *dev);
 
 /* Reads a data entry based on the file name */
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry);
@@ -123,11 +294,15 @@ int32_t dir_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes);
 int32_t dir_write(pcb_t *pcb, int32_t fd, const void* buf, int32_t nbytes);
 
 /* Creates file descriptor for a directory file type */
-int32_t dir_open(pcb_t *pcb, const uint8_t *filename);
+int32_t dir_open(pcb_t *pcb, const dentry_t *dentry);
 
 /* Releases file descriptor of a directory file type */
 int32_t dir_close(pcb_t *pcb, int32_t fd);
 
+/* Writes 'length' bytes from 'buf' at position 'offset' in the file with
+ * 'inode' number, growing it as needed */
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length);
+
 /* Reads n bytes of data from a file and stores it in a buffer*/
 int32_t file_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes);
 
@@ -135,14 +310,50 @@ int32_t file_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes);
 int32_t file_write(pcb_t *pcb, int32_t fd, const void* buf, int32_t nbytes);
 
 /* Creates a file descriptor of a regular file type*/
-int32_t file_open(pcb_t *pcb, const uint8_t* filename);
+int32_t file_open(pcb_t *pcb, const dentry_t *dentry);
 
 /* Releases file descriptor for a regular file type*/
 int32_t file_close(pcb_t *pcb, int32_t fd);
 
+/* Reports regular files and directories as always ready */
+int32_t file_poll(pcb_t *pcb, int32_t fd, struct wait_entry *wait);
+
+/* Returns the size of a file in bytes */
+uint32_t file_length(uint32_t inode);
+
 /* Loads data for an executable file into a specific location in memory*/
 uint32_t file_loader(dentry_t* file, uint32_t* eip);
 
+/* Creates an empty regular file */
+int32_t sys_create(const uint8_t *filename);
+
+/* Writes to the end of an open regular file */
+int32_t sys_append(int32_t fd, const void *buf, int32_t nbytes);
+
+/* Sets the length of an open regular file */
+int32_t sys_truncate(int32_t fd, uint32_t length);
+
+/* Removes a file's directory entry, its data goes once it's closed */
+int32_t sys_unlink(const uint8_t *filename);
+
+/* Copies from an open file to another descriptor without a user buffer */
+int32_t sys_sendfile(int32_t out_fd, int32_t in_fd, int32_t count);
+
+/* Moves the position of an open regular file */
+int32_t sys_lseek(int32_t fd, int32_t offset, int32_t whence);
+
+/* Reads an open regular file at an offset without moving its position */
+int32_t sys_pread(int32_t fd, const pread_args_t *args);
+
+/* Reports the type, inode and size of an open file */
+int32_t sys_fstat(int32_t fd, stat_t *buf);
+
+/* Puts off halting a process from the keyboard until it's done changing the file system */
+int32_t fs_halt_later(int32_t pid);
+
+/* Lets a halting process finish, or give up, a change to the file system */
+int32_t fs_halting(pcb_t *pcb);
+
 #endif /* ASM           */
 
 #endif /* _FILE_SYS_H   */
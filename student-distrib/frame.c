@@ -0,0 +1,186 @@
+/* frame.c - physical frame allocator
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "bitmap.h"
+#include "frame.h"
+
+/* kernel pool of 4KB frames */
+static uint32_t kpool_map[BITMAP_WORDS(KPOOL_FRAMES)];
+static uint32_t kpool_full[BITMAP_WORDS(BITMAP_WORDS(KPOOL_FRAMES))];
+static bitmap_t kpool;
+
+/* 4MB frames for user programs */
+static uint32_t uframe_map[BITMAP_WORDS(MAX_USER_FRAMES)];
+static uint32_t uframe_full[BITMAP_WORDS(BITMAP_WORDS(MAX_USER_FRAMES))];
+static bitmap_t uframes;
+
+/*
+ * Sets up the frame bitmaps. The kernel pool is always fully present, the
+ * number of user frames depends on how much memory the machine has.
+ *
+ * Inputs: mem_top - physical address of the end of usable memory, 0 if unknown
+ * Outputs: none
+ */
+void frame_init(uint32_t mem_top)
+{
+	uint32_t nframes;
+
+	if (!mem_top) {
+		mem_top = DEFAULT_MEM_TOP;
+	}
+
+	bitmap_init(&kpool, kpool_map, kpool_full, KPOOL_FRAMES);
+
+	nframes = 0;
+	if (mem_top > USER_FRAMES) {
+		nframes = min((mem_top - USER_FRAMES) / PAGE_SIZE_4MB, MAX_USER_FRAMES);
+	}
+
+	bitmap_init(&uframes, uframe_map, uframe_full, nframes);
+}
+
+/*
+ * Marks the kernel pool frames that overlap a range as allocated, for memory
+ * the bootloader put things in (like the file system image).
+ *
+ * Inputs: start - physical address of the range
+ *         end - physical address just past the range
+ * Outputs: none
+ */
+void frame_reserve(uint32_t start, uint32_t end)
+{
+	uint32_t addr;
+	uint32_t flags;
+
+	start = max(start, KERNEL_POOL) & ~(PAGE_SIZE - 1);
+	end = min(end, KERNEL_POOL + KERNEL_POOL_SIZE);
+
+	cli_and_save(flags);
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		bitmap_set(&kpool, (addr - KERNEL_POOL) / PAGE_SIZE);
+	}
+	restore_flags(flags);
+}
+
+/*
+ * Allocates frames from the kernel pool. The pool is identity mapped, so the
+ * returned pointer is usable directly.
+ *
+ * Inputs: order - log2 of the number of frames
+ * Outputs: pointer to the first frame, NULL when out of memory
+ */
+void *kpage_alloc(uint32_t order)
+{
+	int32_t frame;
+	uint32_t flags;
+
+	cli_and_save(flags);
+	frame = bitmap_alloc_run(&kpool, order);
+	restore_flags(flags);
+
+	if (frame < 0) {
+		return NULL;
+	}
+
+	return (void *)(KERNEL_POOL + frame * PAGE_SIZE);
+}
+
+/*
+ * Allocates a kernel pool frame to back a page of user memory, like the
+ * heap or a thread stack, unless that would eat into the KPOOL_RESERVE
+ * frames kept for the kernel itself.
+ *
+ * Inputs: none
+ * Outputs: pointer to the frame, NULL when the pool is down to its reserve
+ */
+void *kpage_alloc_user(void)
+{
+	int32_t frame = -1;
+	uint32_t flags;
+
+	cli_and_save(flags);
+	if (kpool.nfree > KPOOL_RESERVE) {
+		frame = bitmap_alloc_run(&kpool, 0);
+	}
+	restore_flags(flags);
+
+	if (frame < 0) {
+		return NULL;
+	}
+
+	return (void *)(KERNEL_POOL + frame * PAGE_SIZE);
+}
+
+/*
+ * Returns frames to the kernel pool.
+ *
+ * Inputs: addr - pointer from kpage_alloc, order - order it was allocated with
+ * Outputs: none
+ */
+void kpage_free(void *addr, uint32_t order)
+{
+	uint32_t flags;
+
+	if ((uint32_t)addr < KERNEL_POOL || (uint32_t)addr >= KERNEL_POOL + KERNEL_POOL_SIZE) {
+		return;
+	}
+
+	cli_and_save(flags);
+	bitmap_free_run(&kpool, ((uint32_t)addr - KERNEL_POOL) / PAGE_SIZE, order);
+	restore_flags(flags);
+}
+
+/*
+ * Allocates a 4MB frame for a user program.
+ *
+ * Inputs: none
+ * Outputs: physical address of the frame, 0 when out of memory
+ */
+uint32_t uframe_alloc(void)
+{
+	int32_t frame;
+	uint32_t flags;
+
+	cli_and_save(flags);
+	frame = bitmap_alloc(&uframes);
+	restore_flags(flags);
+
+	if (frame < 0) {
+		return 0;
+	}
+
+	return USER_FRAMES + frame * PAGE_SIZE_4MB;
+}
+
+/*
+ * Returns a 4MB frame.
+ *
+ * Inputs: addr - physical address from uframe_alloc
+ * Outputs: none
+ */
+void uframe_free(uint32_t addr)
+{
+	uint32_t flags;
+
+	if (addr < USER_FRAMES) {
+		return;
+	}
+
+	cli_and_save(flags);
+	bitmap_clear(&uframes, (addr - USER_FRAMES) / PAGE_SIZE_4MB);
+	restore_flags(flags);
+}
+
+/* Number of free kernel pool frames */
+uint32_t kpage_free_count(void)
+{
+	return kpool.nfree;
+}
+
+/* Number of free user frames */
+uint32_t uframe_free_count(void)
+{
+	return uframes.nfree;
+}
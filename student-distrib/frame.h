@@ -0,0 +1,59 @@
+/* frame.h - physical frame allocator
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include "types.h"
+#include "paging.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* number of 4KB frames in the kernel pool */
+#define KPOOL_FRAMES    (KERNEL_POOL_SIZE / PAGE_SIZE)
+
+/* kernel pool frames user pages can't take, so a process filling its heap
+ * can't starve PCBs, page tables and the file system caches */
+#define KPOOL_RESERVE   1024
+
+/* most 4MB user frames we track, enough for 4GB of memory */
+#define MAX_USER_FRAMES 1024
+
+/* memory assumed present when the bootloader doesn't tell us */
+#define DEFAULT_MEM_TOP 0x4000000
+
+#ifndef ASM
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Sets up the allocators given the physical address of the top of memory */
+void frame_init(uint32_t mem_top);
+
+/* Keeps the kernel pool frames overlapping a physical range from being used */
+void frame_reserve(uint32_t start, uint32_t end);
+
+/* Allocates 2^order contiguous kernel pool frames aligned to their size */
+void *kpage_alloc(uint32_t order);
+
+/* Frees frames from kpage_alloc */
+void kpage_free(void *addr, uint32_t order);
+
+/* Allocates a kernel pool frame to back a user page, freed with kpage_free */
+void *kpage_alloc_user(void);
+
+/* Allocates a 4MB user frame, returns its physical address or 0 */
+uint32_t uframe_alloc(void);
+
+/* Frees a frame from uframe_alloc */
+void uframe_free(uint32_t addr);
+
+/* Number of free frames of each kind */
+uint32_t kpage_free_count(void);
+uint32_t uframe_free_count(void);
+
+#endif /* ASM */
+#endif /* _FRAME_H */
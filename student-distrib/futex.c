@@ -0,0 +1,157 @@
+/* futex.c - waiting on and waking user memory words
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "paging.h"
+#include "proc.h"
+#include "syscall.h"
+#include "heap.h"
+#include "thread.h"
+#include "wait.h"
+#include "futex.h"
+
+/* Helper functions */
+static int32_t futex_key(const int32_t *addr, uint32_t *key);
+static uint32_t futex_hash(uint32_t key);
+
+/* waiters hashed by the physical address of their word, zeroed queues are
+ * empty */
+static wait_queue_t buckets[FUTEX_BUCKETS];
+
+/*
+ * Futex Wait:
+ *  Sleeps until a futex_wake on the same word, if the word still holds val.
+ *  The word is checked and the caller put to sleep without a wake getting
+ *  in between, so a lock can be released and its waiters woken without
+ *  one being missed. Words are matched by physical address, so threads
+ *  and processes sharing memory wait on each other.
+ *
+ * INPUT: addr - 4 byte aligned word in the caller's memory
+ *        val - what the caller last saw there
+ * Returns 0 once woken, -EAGAIN if the word changed, -1 on fail
+ */
+int32_t sys_futex_wait(int32_t *addr, int32_t val)
+{
+	futex_waiter_t waiter;
+	uint32_t flags;
+
+	waiter.wait.pcb = get_proc_pcb();
+	if (!waiter.wait.pcb) {
+		return -1;
+	}
+
+	cli_and_save(flags);
+
+	if (futex_key(addr, &waiter.key)) {
+		restore_flags(flags);
+		return -1;
+	}
+
+	if (*addr != val) {
+		restore_flags(flags);
+		return -EAGAIN;
+	}
+
+	/* futex_wake takes us off the queue */
+	waiter.woken = 0;
+	wait_add(&buckets[futex_hash(waiter.key)], &waiter.wait);
+	while (!waiter.woken) {
+		wait_sleep();
+	}
+
+	restore_flags(flags);
+	return 0;
+}
+
+/*
+ * Futex Wake:
+ *  Wakes up to n processes sleeping in futex_wait on the same word.
+ *
+ * INPUT: addr - 4 byte aligned word in the caller's memory
+ *        n - most processes to wake
+ * Returns the number woken, -1 on fail
+ */
+int32_t sys_futex_wake(int32_t *addr, int32_t n)
+{
+	wait_queue_t *queue;
+	wait_entry_t *entry, *next;
+	futex_waiter_t *waiter;
+	uint32_t flags;
+	uint32_t key;
+	int32_t woken = 0;
+
+	cli_and_save(flags);
+
+	if (futex_key(addr, &key)) {
+		restore_flags(flags);
+		return -1;
+	}
+
+	queue = &buckets[futex_hash(key)];
+	for (entry = queue->head; entry && woken < n; entry = next) {
+		next = entry->next;
+
+		waiter = (futex_waiter_t *)entry;
+		if (waiter->key != key) {
+			continue;
+		}
+
+		wait_remove(entry);
+		waiter->woken = 1;
+		wake_up_entry(entry);
+		woken++;
+	}
+
+	restore_flags(flags);
+	return woken;
+}
+
+/*
+ * Gets the physical address of a user word, which is what processes
+ * sharing it have in common. Heap and thread stack pages that weren't
+ * touched yet are filled in, as touching the word would.
+ *
+ * Inputs: addr - the word
+ *         key - where to store its physical address
+ * Outputs: 0 on success, -1 if it isn't an aligned word of user memory
+ */
+static int32_t futex_key(const int32_t *addr, uint32_t *key)
+{
+	pcb_t *pcb;
+	pte_t *entry;
+	uint32_t virt = (uint32_t)addr;
+
+	/* threads share their process's memory */
+	pcb = get_proc_leader(get_proc_pcb());
+	if (!pcb || virt & (sizeof(int32_t) - 1)) {
+		return -1;
+	}
+
+	/* the program's 4MB page */
+	if (virt >= USER_MEM && virt < USER_MEM + OFFSET_4MB) {
+		*key = pcb->user_frame + (virt - USER_MEM);
+		return 0;
+	}
+
+	entry = get_user_pte(pcb->page_directory, virt);
+	if ((!entry || !entry->present) && heap_fault(virt) && thread_fault(virt)) {
+		return -1;
+	}
+
+	entry = get_user_pte(pcb->page_directory, virt);
+	if (!entry || !entry->present || !entry->user_supervisor) {
+		return -1;
+	}
+
+	*key = (entry->page_base_addr << 12) | (virt & PAGE_OFFSET_MASK);
+	return 0;
+}
+
+/*
+ * Hashes a physical address into a bucket index
+ */
+static uint32_t futex_hash(uint32_t key)
+{
+	return ((key >> 2) * 0x9E3779B1UL) >> 24 & (FUTEX_BUCKETS - 1);
+}
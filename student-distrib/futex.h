@@ -0,0 +1,47 @@
+/* futex.h - waiting on and waking user memory words
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include "types.h"
+#include "wait.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* wait queues waiters are hashed into, a power of two */
+#define FUTEX_BUCKETS 64
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* Futex waiter
+ *  Kept on the kernel stack of a process in futex_wait. Waiters on words
+ *  that hash alike share a queue, so each carries the physical address it
+ *  waits on, and futex_wake takes the ones it wakes off the queue.
+ */
+typedef struct futex_waiter {
+	/* first, so an entry on the queue is its waiter */
+	wait_entry_t wait;
+	uint32_t key;
+	volatile int32_t woken;
+} futex_waiter_t;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Sleeps until woken through addr, if it still holds val */
+int32_t sys_futex_wait(int32_t *addr, int32_t val);
+
+/* Wakes up to n processes waiting on addr */
+int32_t sys_futex_wake(int32_t *addr, int32_t n);
+
+#endif /* ASM */
+#endif /* _FUTEX_H */
@@ -0,0 +1,94 @@
+/* heap.c - user heap growth with lazily filled pages
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "paging.h"
+#include "frame.h"
+#include "proc.h"
+#include "heap.h"
+
+/* rounds an address up to the next page boundary */
+#define PAGE_ROUND_UP(addr) (((addr) + PAGE_SIZE - 1) & ~PAGE_OFFSET_MASK)
+
+/*
+ * Sbrk:
+ *  Moves the end of the caller's heap. Growing only reserves the range;
+ *  pages get a frame the first time they're touched (see heap_fault), so
+ *  a large sbrk costs nothing until it's used. Shrinking gives back the
+ *  frames of every page wholly past the new break. The heap's pages come
+ *  from the kernel pool, so it's capped at HEAP_MAX_SIZE.
+ *
+ * INPUT: increment - bytes to grow (or shrink, if negative) the heap by
+ * Returns the old break on success, -1 on fail
+ */
+int32_t sys_sbrk(int32_t increment)
+{
+	pcb_t *pcb;
+	uint32_t old_brk, new_brk;
+	uint32_t addr;
+	uint32_t flags;
+	pte_t entry;
+
+	pcb = get_proc_leader(get_proc_pcb());
+	if (!pcb) {
+		return -1;
+	}
+
+	old_brk = pcb->brk;
+	new_brk = old_brk + increment;
+
+	/* catches wraparound too, since the window is far from both ends */
+	if (new_brk < USER_HEAP || new_brk > USER_HEAP + HEAP_MAX_SIZE) {
+		return -1;
+	}
+
+	if (new_brk < old_brk) {
+		cli_and_save(flags);
+		for (addr = PAGE_ROUND_UP(new_brk); addr < old_brk; addr += PAGE_SIZE) {
+			entry = unmap_user_page(pcb->page_directory, addr);
+			if (entry.present && (entry.val & PG_OWNED)) {
+				kpage_free((void *)(entry.page_base_addr << 12), 0);
+			}
+		}
+		restore_flags(flags);
+	}
+
+	pcb->brk = new_brk;
+
+	return old_brk;
+}
+
+/*
+ * Handles a not-present fault inside the current process's heap by mapping
+ * a freshly zeroed page there. Faults from the kernel count too, since
+ * syscalls like read write straight into user buffers.
+ *
+ * Inputs: addr - the faulting address (cr2)
+ * Outputs: 0 if the fault was handled and the access can be retried,
+ *          -1 if it's a real fault
+ */
+int32_t heap_fault(uint32_t addr)
+{
+	pcb_t *pcb;
+	void *page;
+	uint32_t base = addr & ~PAGE_OFFSET_MASK;
+
+	pcb = get_proc_leader(get_proc_pcb());
+	if (!pcb || addr < USER_HEAP || addr >= pcb->brk) {
+		return -1;
+	}
+
+	page = kpage_alloc_user();
+	if (!page) {
+		return -1;
+	}
+	memset(page, 0, PAGE_SIZE);
+
+	if (map_user_page(pcb->page_directory, base, (uint32_t)page, PG_WRITE | PG_OWNED)) {
+		kpage_free(page, 0);
+		return -1;
+	}
+
+	return 0;
+}
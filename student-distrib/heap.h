@@ -0,0 +1,29 @@
+/* heap.h - user heap growth with lazily filled pages
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _HEAP_H
+#define _HEAP_H
+
+#include "types.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* most a process's heap may grow to, its pages come from the kernel pool */
+#define HEAP_MAX_SIZE 0x400000
+
+#ifndef ASM
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Moves the caller's program break, returns the old break */
+int32_t sys_sbrk(int32_t increment);
+
+/* Backs a faulting heap address with a zeroed page, 0 if it was handled */
+int32_t heap_fault(uint32_t addr);
+
+#endif /* ASM */
+#endif /* _HEAP_H */
@@ -20,6 +20,8 @@
 #define PIT_IRQ_PORT 0x00
 #define KBD_IRQ_PORT 0x01
 #define RTC_IRQ_PORT 0x08
+#define ATA0_IRQ_PORT 0x0E
+#define ATA1_IRQ_PORT 0x0F
 
 /* Initialization control words to init each PIC.
  * See the Intel manuals for details on the meaning
@@ -13,6 +13,9 @@
 #include "paging.h"
 #include "syscall.h"
 #include "proc.h"
+#include "heap.h"
+#include "thread.h"
+#include "ata.h"
 #include "isr.h"
 
 /* 
@@ -171,6 +174,13 @@ void isr_impl(registers_t regs)
 			asm("movl    %%cr3, %0"
 					: "=r"(cr3)
 					: :"memory");
+
+			/* untouched heap and thread stack pages are filled in on demand */
+			if (regs.isrno == EXCEPTION_PAGE_FAULT && !(regs.errno & 0x01)
+					&& (heap_fault(cr2) == 0 || thread_fault(cr2) == 0)) {
+				break;
+			}
+
 			puts("Interrupt occurred(14): page_fault\n");
 			puts("Details:\n");
 			printf("    Address: 0x%x\n", cr2);
@@ -237,8 +247,6 @@ void isr_impl(registers_t regs)
 		case IRQ11:
 		case IRQ12:
 		case IRQ13:
-		case IRQ14:
-		case IRQ15:
 			printf("Unhandled IRQ(%d)\n", regs.isrno - IRQ_START);
 			send_eoi(regs.isrno - IRQ_START);
 			break;
@@ -256,6 +264,17 @@ void isr_impl(registers_t regs)
 			send_eoi(KBD_IRQ_PORT);
 			break;
 
+			/* handle the disk interrupts */
+		case IRQ_ATA0:
+			ata_handle_interrupt(0);
+			send_eoi(ATA0_IRQ_PORT);
+			break;
+
+		case IRQ_ATA1:
+			ata_handle_interrupt(1);
+			send_eoi(ATA1_IRQ_PORT);
+			break;
+
 			/* handle the RTC interrupt */
 		case IRQ_RTC:
 			/* mask the interrupt and immediately send EOI so we can service other interrupts */
@@ -431,7 +450,7 @@ void set_task_gate(uint8_t n, uint16_t gdt)
 
 /*
  * Sets all the gates corresponding to all exceptions/interrupts.
- * Initialze the sys_call vector to 0x80
+ * Initialze the sys_call vector to 0x80, and SYSENTER where there is one
  * Loads the Interrupt Descriptor Table.
  *
  * Inputs: none
@@ -488,7 +507,34 @@ void install_interrupts()
 
 	/* initialize system call vector*/
 	set_system_gate(0x80, (uint32_t)&enter_syscall);
+	sysenter_init();
 
 	/* load IDT */
 	lidt(idt_desc_ptr);
 }
+
+/*
+ * Sets up the SYSENTER entry to system calls alongside int $0x80, if the
+ * processor has it. SYSENTER takes cs from the MSR and ss from the GDT
+ * entry after it, SYSEXIT the two after those, which is the order
+ * KERNEL_CS, KERNEL_DS, USER_CS and USER_DS are in. The kernel stack
+ * changes with every process, so esp is pointed at tss.esp0 and the entry
+ * loads the stack from there.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void sysenter_init(void)
+{
+	uint32_t eax = 1, ebx, ecx, edx;
+
+	asm volatile ("cpuid"
+			: "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+	if (!(edx & CPUID_EDX_SEP)) {
+		return;
+	}
+
+	wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+	wrmsr(MSR_SYSENTER_ESP, (uint32_t)&tss.esp0);
+	wrmsr(MSR_SYSENTER_EIP, (uint32_t)&enter_sysenter);
+}
@@ -53,8 +53,8 @@
 #define IRQ11   (IRQ_START + 11)
 #define IRQ12   (IRQ_START + 12)
 #define IRQ13   (IRQ_START + 13)
-#define IRQ14   (IRQ_START + 14)
-#define IRQ15   (IRQ_START + 15)
+#define IRQ_ATA0 (IRQ_START + ATA0_IRQ_PORT)
+#define IRQ_ATA1 (IRQ_START + ATA1_IRQ_PORT)
 
 /* convenience methods for managing stack for syscalls and interrupts */
 #define PUSH_ALL \
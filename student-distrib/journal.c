@@ -0,0 +1,686 @@
+/* journal.c - write-ahead journal of file system metadata
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "frame.h"
+#include "journal.h"
+
+/* A transaction
+ *  Operations between journal_begin and journal_end join the running
+ *  transaction, so one commit covers everything that happened since the
+ *  last. The buffers it logged stay held in the cache until it commits.
+ */
+typedef struct journal_tx {
+	uint32_t tid;
+	uint32_t count;
+	uint32_t nrevoke;
+	uint32_t started;  /* tick its first block was logged at */
+	buf_t *bufs[JOURNAL_MAX_TX];
+	uint32_t revoked[JOURNAL_MAX_REVOKE];
+} journal_tx_t;
+
+/* steps of a commit, each started from the completion of the one before */
+#define JPHASE_IDLE   0
+#define JPHASE_LOG    1  /* descriptor, block copies and file data written, then a flush */
+#define JPHASE_COMMIT 2  /* commit block */
+#define JPHASE_FLUSH  3  /* and a flush so it's on the disk */
+
+journal_stats_t journal_stats;
+
+static bdev_t jdev;
+static uint32_t jfirst;
+static uint32_t jblocks;
+static uint32_t active;
+
+/* next free block of the log, the header is block 0 */
+static uint32_t jhead;
+
+/* operations in progress, they nest */
+static uint32_t handles;
+
+static journal_tx_t running;
+
+/* the commit in flight, which request it's waiting on, and its copies of
+ * the descriptor, the logged blocks and the commit block */
+static volatile uint32_t phase;
+static uint32_t commit_tid;
+static volatile uint32_t done_tid;
+static uint32_t commit_count;
+static uint32_t commit_failed;
+static blk_req_t *volatile jcurrent;
+static blk_req_t log_reqs[JOURNAL_MAX_TX + 2];
+static blk_req_t flush_reqs[2];
+static uint8_t *frames[JOURNAL_MAX_TX + 2];
+
+/* blocks logged since the last checkpoint, which reuse has to revoke */
+static uint32_t *logged;
+static uint32_t nlogged;
+
+/* where each transaction found by replay starts */
+static uint32_t replay_pos[JOURNAL_MAX_BLOCKS / 2];
+
+static volatile uint32_t jticks;
+
+/* Helper functions */
+static void journal_replay(uint32_t *tid);
+static int32_t replay_revoked(uint32_t tx, uint32_t ntx, uint32_t block);
+static void journal_start_commit(void);
+static void journal_step(blk_req_t *req);
+static void journal_finish(void);
+static void journal_wait(void);
+static void journal_checkpoint(void);
+static void log_req(blk_req_t *req, uint32_t pos, uint8_t *frame);
+
+/*
+ * Replays the journal of a file system being mounted, then starts an empty
+ * log. Replay reads just the log, so how long it takes depends on the
+ * size of the journal rather than the file system. Memory devices are
+ * replayed but not logged to, since nothing in them survives a crash.
+ *
+ * Inputs: dev - the device, already handed to bcache_init
+ *         first - device block of the journal header
+ *         nblocks - size of the journal, 0 for file systems without one
+ * Outputs: 0 on success, -1 if the journal is corrupt or can't be written
+ */
+int32_t journal_init(const bdev_t *dev, uint32_t first, uint32_t nblocks)
+{
+	journal_header_t *header;
+	buf_t *buf;
+	uint32_t tid;
+	uint32_t i;
+
+	active = 0;
+	handles = 0;
+	phase = JPHASE_IDLE;
+	memset(&journal_stats, 0, sizeof(journal_stats));
+
+	if (!nblocks) {
+		return 0;
+	}
+	if (nblocks < JOURNAL_CREDITS + 3) {
+		return -1;
+	}
+
+	jdev = *dev;
+	jfirst = first;
+	jblocks = min(nblocks, JOURNAL_MAX_BLOCKS);
+
+	buf = bread(jfirst);
+	if (!buf) {
+		return -1;
+	}
+	header = (journal_header_t*)buf->data;
+	tid = header->tid;
+	if (header->magic != JOURNAL_MAGIC) {
+		brelse(buf);
+		return -1;
+	}
+	brelse(buf);
+
+	journal_replay(&tid);
+
+	/* everything replayed has to be home before the log can be reused */
+	if (bcache_sync()) {
+		return -1;
+	}
+
+	buf = bread(jfirst);
+	if (!buf) {
+		return -1;
+	}
+	((journal_header_t*)buf->data)->tid = tid;
+	bdirty(buf);
+	brelse(buf);
+	if (bcache_sync()) {
+		return -1;
+	}
+
+	bcache_commit(tid - 1);
+	done_tid = tid - 1;
+	memset(&running, 0, sizeof(running));
+	running.tid = tid;
+	jhead = 1;
+	nlogged = 0;
+
+	if (dev->map) {
+		return 0;
+	}
+
+	/* the frames are kept across mounts */
+	for (i = 0; i < JOURNAL_MAX_TX + 2; i++) {
+		if (!frames[i] && !(frames[i] = kpage_alloc(0))) {
+			return -1;
+		}
+	}
+	if (!logged && !(logged = kpage_alloc(0))) {
+		return -1;
+	}
+
+	active = 1;
+	return 0;
+}
+
+/*
+ * Starts an operation. If the running transaction might not have room for
+ * it, in the transaction or in the log, the transaction is committed first,
+ * and once the log is full everything is written home so it can start over.
+ * Callers serialize operations with the file system's lock, and the waits
+ * sleep with interrupts on; the PIT doesn't commit while one is open.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void journal_begin(void)
+{
+	uint32_t flags;
+	uint32_t full = 0;
+
+	cli_and_save(flags);
+
+	if (active && !handles++) {
+		journal_stats.ops++;
+
+		full = running.count + JOURNAL_CREDITS > JOURNAL_MAX_TX
+			|| running.nrevoke + JOURNAL_WRITE_CHUNK + JOURNAL_CREDITS > JOURNAL_MAX_REVOKE
+			|| jhead + running.count + JOURNAL_CREDITS + 2 > jblocks;
+	}
+
+	restore_flags(flags);
+
+	if (full) {
+		journal_wait();
+
+		cli_and_save(flags);
+		journal_start_commit();
+		restore_flags(flags);
+
+		journal_wait();
+
+		if (jhead + JOURNAL_CREDITS + 2 > jblocks) {
+			journal_checkpoint();
+		}
+	}
+}
+
+/*
+ * Ends an operation. The running transaction commits from the PIT tick
+ * once it has collected operations for a while, or right away once it's
+ * half full, without waiting either way.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void journal_end(void)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	if (active && handles && !--handles
+			&& phase == JPHASE_IDLE && running.count >= JOURNAL_MAX_TX / 2) {
+		journal_start_commit();
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * Ends every open operation, for a process halted partway through one.
+ * What it logged commits with the rest of the transaction.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void journal_abandon(void)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	handles = 0;
+	restore_flags(flags);
+}
+
+/*
+ * Logs a changed metadata block in the running transaction. It's held in
+ * the cache until the transaction commits, and written home after that.
+ * Must be between journal_begin and journal_end.
+ *
+ * Inputs: buf - the pinned buffer
+ * Outputs: none
+ */
+void journal_dirty(buf_t *buf)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	if (active && buf->tid != running.tid) {
+		if (running.count < JOURNAL_MAX_TX && jhead + running.count + 3 <= jblocks) {
+			if (!running.count) {
+				running.started = jticks;
+			}
+			running.bufs[running.count++] = buf;
+			buf->tid = running.tid;
+			journal_stats.logged++;
+		}
+		else {
+			/* more than the credits allow, it goes home unlogged */
+			journal_stats.errors++;
+		}
+	}
+
+	bdirty(buf);
+	restore_flags(flags);
+}
+
+/*
+ * Revokes a block that's being reused for file data, which is written in
+ * place. Copies of it logged since the last checkpoint would otherwise
+ * be replayed over the data.
+ *
+ * Inputs: block - device block
+ * Outputs: none
+ */
+void journal_revoke(uint32_t block)
+{
+	uint32_t flags;
+	uint32_t i;
+
+	if (!active) {
+		return;
+	}
+
+	cli_and_save(flags);
+
+	for (i = 0; i < nlogged && logged[i] != block; i++);
+	if (i < nlogged) {
+		for (i = 0; i < running.nrevoke && running.revoked[i] != block; i++);
+		if (i < running.nrevoke) {
+			/* already revoked */
+		}
+		else if (running.nrevoke < JOURNAL_MAX_REVOKE) {
+			running.revoked[running.nrevoke++] = block;
+		}
+		else {
+			journal_stats.errors++;
+		}
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * Returns the running transaction, the one changes made now commit with
+ *
+ * Inputs: none
+ * Outputs: its tid, 0 if the journal isn't logging
+ */
+uint32_t journal_tid(void)
+{
+	return active ? running.tid : 0;
+}
+
+/*
+ * Checks whether a transaction is done committing. Blocks it frees can be
+ * reused for file data from then on, before that a crash could bring back
+ * the files that had them.
+ *
+ * Inputs: tid - the transaction
+ * Outputs: 1 if it's done, 0 if not
+ */
+int32_t journal_done(uint32_t tid)
+{
+	return (int32_t)(tid - done_tid) <= 0;
+}
+
+/*
+ * Commits the running transaction, waits for it and writes everything home
+ *
+ * Inputs: none
+ * Outputs: 0 on success, -1 if a block couldn't be written
+ */
+int32_t journal_sync(void)
+{
+	uint32_t flags;
+	int32_t ret;
+
+	cli_and_save(flags);
+
+	if (active && !handles) {
+		journal_wait();
+		journal_start_commit();
+		journal_wait();
+	}
+	ret = bcache_sync();
+
+	restore_flags(flags);
+	return ret;
+}
+
+/*
+ * Called on every PIT tick. Commits the running transaction once it has
+ * been collecting operations for JOURNAL_COMMIT_TICKS, so operations
+ * close together share one commit.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void journal_tick(void)
+{
+	jticks++;
+
+	if (active && !handles && phase == JPHASE_IDLE && running.count
+			&& jticks - running.started >= JOURNAL_COMMIT_TICKS) {
+		journal_start_commit();
+	}
+}
+
+/*
+ * Replays the committed transactions in the log, oldest first, copying
+ * the blocks they logged home through the cache. The first pass finds
+ * which transactions committed, the second copies their blocks, skipping
+ * those a later committed transaction revoked.
+ *
+ * Inputs: tid - the transaction the log starts with, set to the one after
+ *               the last that committed
+ * Outputs: none
+ */
+static void journal_replay(uint32_t *tid)
+{
+	journal_desc_t *desc;
+	journal_commit_t *commit;
+	buf_t *dbuf, *cbuf, *src, *dst;
+	uint32_t ntx = 0;
+	uint32_t pos = 1;
+	uint32_t count;
+	uint32_t home;
+	uint32_t i, j;
+
+	while (pos + 2 <= jblocks && ntx < sizeof(replay_pos) / sizeof(replay_pos[0])) {
+		dbuf = bread(jfirst + pos);
+		if (!dbuf) {
+			break;
+		}
+		desc = (journal_desc_t*)dbuf->data;
+		count = desc->count;
+		if (desc->magic != JOURNAL_DESC || desc->tid != *tid || count > JOURNAL_MAX_TX
+				|| desc->nrevoke > JOURNAL_MAX_REVOKE || pos + count + 2 > jblocks) {
+			brelse(dbuf);
+			break;
+		}
+		brelse(dbuf);
+
+		cbuf = bread(jfirst + pos + count + 1);
+		if (!cbuf) {
+			break;
+		}
+		commit = (journal_commit_t*)cbuf->data;
+		if (commit->magic != JOURNAL_COMMIT || commit->tid != *tid) {
+			brelse(cbuf);
+			break;
+		}
+		brelse(cbuf);
+
+		replay_pos[ntx++] = pos;
+		pos += count + 2;
+		(*tid)++;
+	}
+
+	for (i = 0; i < ntx; i++) {
+		dbuf = bread(jfirst + replay_pos[i]);
+		if (!dbuf) {
+			continue;
+		}
+		desc = (journal_desc_t*)dbuf->data;
+
+		for (j = 0; j < desc->count; j++) {
+			home = desc->blocks[j];
+			if ((home >= jfirst && home < jfirst + jblocks) || replay_revoked(i, ntx, home)) {
+				continue;
+			}
+
+			src = bread(jfirst + replay_pos[i] + 1 + j);
+			dst = bget(home);
+			if (src && dst) {
+				memcpy(dst->data, src->data, BCACHE_BLOCK_SIZE);
+				bdirty(dst);
+				journal_stats.replayed++;
+			}
+			if (src) {
+				brelse(src);
+			}
+			if (dst) {
+				brelse(dst);
+			}
+		}
+
+		brelse(dbuf);
+	}
+}
+
+/*
+ * Checks whether a transaction after the given one revoked a block
+ *
+ * Inputs: tx - which transaction found by replay
+ *         ntx - how many were found
+ *         block - the block
+ * Outputs: 1 if it was revoked, 0 if not
+ */
+static int32_t replay_revoked(uint32_t tx, uint32_t ntx, uint32_t block)
+{
+	journal_desc_t *desc;
+	buf_t *buf;
+	uint32_t i;
+	int32_t found = 0;
+
+	for (tx++; tx < ntx && !found; tx++) {
+		buf = bread(jfirst + replay_pos[tx]);
+		if (!buf) {
+			continue;
+		}
+		desc = (journal_desc_t*)buf->data;
+		for (i = 0; i < desc->nrevoke && !found; i++) {
+			found = desc->revoked[i] == block;
+		}
+		brelse(buf);
+	}
+
+	return found;
+}
+
+/*
+ * Starts committing the running transaction. Its blocks are copied as they
+ * are now, so operations can carry on changing them for the next one. The
+ * copies are queued for the log along with every dirty data block, then a
+ * flush, which the drive only gets to once all of those are done. The
+ * commit block follows from the flush's completion. Must be called with
+ * interrupts off and no commit in flight.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+static void journal_start_commit(void)
+{
+	journal_desc_t *desc = (journal_desc_t*)frames[0];
+	journal_commit_t *commit;
+	uint32_t n = running.count;
+	uint32_t i;
+
+	if (!n) {
+		return;
+	}
+
+	memset(desc, 0, BCACHE_BLOCK_SIZE);
+	desc->magic = JOURNAL_DESC;
+	desc->tid = running.tid;
+	desc->count = n;
+	desc->nrevoke = running.nrevoke;
+	memcpy(desc->revoked, running.revoked, running.nrevoke * sizeof(uint32_t));
+
+	for (i = 0; i < n; i++) {
+		desc->blocks[i] = running.bufs[i]->block;
+		memcpy(frames[i + 1], running.bufs[i]->data, BCACHE_BLOCK_SIZE);
+		if (nlogged < jblocks) {
+			logged[nlogged++] = running.bufs[i]->block;
+		}
+	}
+
+	commit = (journal_commit_t*)frames[n + 1];
+	memset(commit, 0, BCACHE_BLOCK_SIZE);
+	commit->magic = JOURNAL_COMMIT;
+	commit->tid = running.tid;
+
+	commit_tid = running.tid;
+	commit_count = n;
+	commit_failed = 0;
+
+	for (i = 0; i <= n + 1; i++) {
+		log_req(&log_reqs[i], jhead + i, frames[i]);
+	}
+	jhead += n + 2;
+
+	running.tid++;
+	running.count = 0;
+	running.nrevoke = 0;
+
+	for (i = 0; i <= n; i++) {
+		if (ata_submit(&log_reqs[i])) {
+			commit_failed = 1;
+		}
+	}
+
+	/* file data goes before the commit block, so files never end up with
+	 * blocks that were never written */
+	bcache_writeback();
+
+	phase = JPHASE_LOG;
+	jcurrent = &flush_reqs[0];
+	if (ata_submit(jcurrent)) {
+		journal_finish();
+	}
+}
+
+/*
+ * Moves a commit on to its next step, from the completion of the last
+ *
+ * Inputs: req - the request that finished
+ * Outputs: none
+ */
+static void journal_step(blk_req_t *req)
+{
+	uint32_t i;
+
+	if (req->status) {
+		commit_failed = 1;
+	}
+
+	switch (phase) {
+		case JPHASE_LOG:
+			for (i = 0; i <= commit_count; i++) {
+				if (log_reqs[i].status) {
+					commit_failed = 1;
+				}
+			}
+			if (commit_failed) {
+				break;
+			}
+			phase = JPHASE_COMMIT;
+			jcurrent = &log_reqs[commit_count + 1];
+			jcurrent->complete = &journal_step;
+			if (!ata_submit(jcurrent)) {
+				return;
+			}
+			break;
+
+		case JPHASE_COMMIT:
+			phase = JPHASE_FLUSH;
+			jcurrent = &flush_reqs[1];
+			if (!ata_submit(jcurrent)) {
+				return;
+			}
+			break;
+	}
+
+	journal_finish();
+}
+
+/*
+ * Ends a commit and lets the cache write back what it logged. If the log
+ * couldn't be written the blocks go home anyway, unprotected.
+ */
+static void journal_finish(void)
+{
+	if (commit_failed) {
+		journal_stats.errors++;
+	}
+	else {
+		journal_stats.commits++;
+	}
+
+	bcache_commit(commit_tid);
+	done_tid = commit_tid;
+	phase = JPHASE_IDLE;
+}
+
+/*
+ * Waits for the commit in flight, if any
+ */
+static void journal_wait(void)
+{
+	while (phase != JPHASE_IDLE) {
+		ata_wait(jcurrent);
+	}
+}
+
+/*
+ * Writes everything home and empties the log. Must be called with no
+ * commit in flight and an empty running transaction.
+ */
+static void journal_checkpoint(void)
+{
+	buf_t *buf;
+
+	if (bcache_sync()) {
+		journal_stats.errors++;
+		return;
+	}
+
+	buf = bread(jfirst);
+	if (!buf) {
+		journal_stats.errors++;
+		return;
+	}
+	((journal_header_t*)buf->data)->tid = running.tid;
+	bdirty(buf);
+	brelse(buf);
+
+	if (bcache_sync()) {
+		journal_stats.errors++;
+		return;
+	}
+
+	jhead = 1;
+	nlogged = 0;
+	journal_stats.checkpoints++;
+}
+
+/*
+ * Sets up the write of a frame to a block of the log, and the flushes
+ */
+static void log_req(blk_req_t *req, uint32_t pos, uint8_t *frame)
+{
+	memset(req, 0, sizeof(blk_req_t));
+	req->drive = jdev.drive;
+	req->lba = jdev.start + (jfirst + pos) * BCACHE_SECTORS;
+	req->count = BCACHE_SECTORS;
+	req->buf = frame;
+	req->flags = BLK_WRITE;
+
+	if (req == &log_reqs[0]) {
+		memset(flush_reqs, 0, sizeof(flush_reqs));
+		flush_reqs[0].drive = flush_reqs[1].drive = jdev.drive;
+		flush_reqs[0].flags = flush_reqs[1].flags = BLK_FLUSH;
+		flush_reqs[0].complete = flush_reqs[1].complete = &journal_step;
+	}
+}
@@ -0,0 +1,131 @@
+/* journal.h - write-ahead journal of file system metadata
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include "types.h"
+#include "bcache.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* magic numbers of the header, descriptor and commit blocks:
+ * "YJHD", "YJDS" and "YJCM" */
+#define JOURNAL_MAGIC  0x44484A59
+#define JOURNAL_DESC   0x53444A59
+#define JOURNAL_COMMIT 0x4D434A59
+
+/* most blocks one transaction logs */
+#define JOURNAL_MAX_TX 32
+
+/* blocks of the journal that are used, the rest of a larger one isn't */
+#define JOURNAL_MAX_BLOCKS 512
+
+/* most blocks a single operation logs between journal_begin and
+ * journal_end, a transaction commits early to leave this much room */
+#define JOURNAL_CREDITS 12
+
+/* blocks a write may allocate before it's split into another operation */
+#define JOURNAL_WRITE_CHUNK 256
+
+/* PIT ticks a transaction collects operations for before it commits */
+#define JOURNAL_COMMIT_TICKS 50
+
+/* room a descriptor has for revoked blocks */
+#define JOURNAL_MAX_REVOKE ((BCACHE_BLOCK_SIZE - 16) / sizeof(uint32_t) - JOURNAL_MAX_TX)
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* Journal Header
+ *  The first block of the journal. The log after it holds transactions
+ *  numbered from tid on, each a descriptor, copies of the blocks it lists,
+ *  and a commit block. Replay stops at the first transaction that's
+ *  missing its commit block.
+ */
+typedef struct journal_header {
+	uint32_t magic;
+	uint32_t tid;
+	uint8_t reserved[BCACHE_BLOCK_SIZE - 8];
+} __attribute__((packed)) journal_header_t;
+
+/* Journal Descriptor
+ *  Lists the blocks of a transaction by device block. Revoked blocks were
+ *  logged by an earlier transaction and have been reused for file data
+ *  since, so those earlier copies mustn't be replayed.
+ */
+typedef struct journal_desc {
+	uint32_t magic;
+	uint32_t tid;
+	uint32_t count;
+	uint32_t nrevoke;
+	uint32_t blocks[JOURNAL_MAX_TX];
+	uint32_t revoked[JOURNAL_MAX_REVOKE];
+} __attribute__((packed)) journal_desc_t;
+
+/* Journal Commit Block, written once everything before it is on the disk */
+typedef struct journal_commit {
+	uint32_t magic;
+	uint32_t tid;
+	uint8_t reserved[BCACHE_BLOCK_SIZE - 8];
+} __attribute__((packed)) journal_commit_t;
+
+/* journal counters */
+typedef struct journal_stats {
+	uint32_t ops;
+	uint32_t commits;
+	uint32_t logged;
+	uint32_t checkpoints;
+	uint32_t replayed;
+	uint32_t errors;
+} journal_stats_t;
+
+
+/****************************************
+ *           Global Variables           *
+ ****************************************/
+
+extern journal_stats_t journal_stats;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Replays the journal at a device block, then logs to it if the device is a disk */
+int32_t journal_init(const bdev_t *dev, uint32_t first, uint32_t nblocks);
+
+/* Starts an operation, which joins the running transaction */
+void journal_begin(void);
+
+/* Ends an operation */
+void journal_end(void);
+
+/* Ends the open operations of a process halted partway through one */
+void journal_abandon(void);
+
+/* Logs a changed metadata block in the running transaction, in place of bdirty */
+void journal_dirty(buf_t *buf);
+
+/* Keeps earlier logged copies of a block being reused for file data from being replayed */
+void journal_revoke(uint32_t block);
+
+/* Returns the running transaction, 0 if nothing is being logged */
+uint32_t journal_tid(void);
+
+/* Checks whether a transaction is done committing */
+int32_t journal_done(uint32_t tid);
+
+/* Commits the running transaction and writes everything back */
+int32_t journal_sync(void);
+
+/* Called on every PIT tick, commits transactions that have collected long enough */
+void journal_tick(void);
+
+#endif /* ASM */
+#endif /* _JOURNAL_H */
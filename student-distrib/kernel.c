@@ -18,11 +18,36 @@
 #include "testing.h"
 #include "syscall.h"
 #include "sched.h"
+#include "frame.h"
+#include "ata.h"
+#include "bcache.h"
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags,bit)   ((flags) & (1 << (bit)))
 
+/* Looks for "root=hd<drive>[<partition>]" on the kernel command line, drive
+ * being a-d and partition 1-4, to mount the file system off a disk instead
+ * of the boot module. Returns 0 and fills in drive and part (0 for the
+ * whole disk) if it's there. */
+static int32_t root_disk(const int8_t *cmdline, uint32_t *drive, uint32_t *part)
+{
+	const int8_t *opt;
+
+	for (opt = cmdline; *opt; opt++) {
+		if ((opt == cmdline || opt[-1] == ' ') && !strncmp(opt, "root=hd", 7)) {
+			break;
+		}
+	}
+	if (!*opt || opt[7] < 'a' || opt[7] > 'd') {
+		return -1;
+	}
+
+	*drive = opt[7] - 'a';
+	*part = (opt[8] >= '1' && opt[8] <= '4') ? (uint32_t)(opt[8] - '0') : 0;
+	return 0;
+}
+
 /* Check if MAGIC is valid and print the Multiboot information structure
    pointed by ADDR. */
 void entry (unsigned long magic, unsigned long addr)
@@ -30,7 +55,11 @@ void entry (unsigned long magic, unsigned long addr)
 	multiboot_info_t *mbi;
 
 	boot_block_t* boot_val = NULL;
+	uint32_t fs_size = 0;
 	uint8_t fs_pres = 0;
+	uint32_t mem_top = 0;
+	bdev_t root_dev;
+	uint32_t root_drive, root_part;
 
 	/* Clear the screen. */
 	clear();
@@ -49,9 +78,12 @@ void entry (unsigned long magic, unsigned long addr)
 	printf ("flags = 0x%#x\n", (unsigned) mbi->flags);
 
 	/* Are mem_* valid? */
-	if (CHECK_FLAG (mbi->flags, 0))
+	if (CHECK_FLAG (mbi->flags, 0)) {
 		printf ("mem_lower = %uKB, mem_upper = %uKB\n",
 				(unsigned) mbi->mem_lower, (unsigned) mbi->mem_upper);
+		/* mem_upper counts from 1MB */
+		mem_top = 0x100000 + mbi->mem_upper * 1024;
+	}
 
 	/* Is boot_device valid? */
 	if (CHECK_FLAG (mbi->flags, 1))
@@ -81,6 +113,7 @@ void entry (unsigned long magic, unsigned long addr)
 	/* File system head */
 	module_t* temp = (module_t*)mbi->mods_addr;
 	boot_val = (boot_block_t *)temp->mod_start;
+	fs_size = temp->mod_end - temp->mod_start;
 
 	/* Bits 4 and 5 are mutually exclusive! */
 	if (CHECK_FLAG (mbi->flags, 4) && CHECK_FLAG (mbi->flags, 5))
@@ -211,18 +244,53 @@ void entry (unsigned long magic, unsigned long addr)
 	enable_irq(KBD_IRQ_PORT);
 	puts("done\n");
 
-	/* Initialize File System */
+	/* Initialize Physical Memory */
+	puts("    Initializing Memory... ");
+	frame_init(mem_top);
+	if (fs_pres) {
+		/* the image may run into the kernel pool */
+		frame_reserve((uint32_t)boot_val, (uint32_t)boot_val + fs_size);
+	}
+	puts("done\n");
+
+	/* Initialize Paging */
+	puts("    Initializing Paging... ");
+	paging_init();
+	puts("done\n");
+
+	/* Find the disks, their DMA tables come from the kernel pool */
+	puts("    Initializing Disks... ");
+	ata_init();
+	enable_irq(ATA0_IRQ_PORT);
+	enable_irq(ATA1_IRQ_PORT);
+	puts("done\n");
+
+	/* Initialize File System, from a disk if the command line names one and
+	 * from the boot module otherwise. Both are read through the buffer cache,
+	 * which comes from the kernel pool */
 	puts("    Initializing File System... ");
+	if (CHECK_FLAG(mbi->flags, 2)
+			&& !root_disk((int8_t*)mbi->cmdline, &root_drive, &root_part)) {
+		fs_pres = !bdev_disk(&root_dev, root_drive, root_part);
+	} else if (fs_pres && (uint32_t)boot_val + fs_size > FAKE_VIDEO_MEM) {
+		/* only memory below here is mapped for the kernel */
+		puts("    File System Too Large!\n");
+		fs_pres = 0;
+	} else if (fs_pres) {
+		bdev_mem(&root_dev, boot_val, fs_size);
+	}
 	if (!fs_pres){
 		puts("    File System Unavailable!\n");
+	} else if (fs_init(&root_dev)) {
+		puts("    File System Corrupt!\n");
+		fs_pres = 0;
 	} else {
-		fs_init(boot_val);
 		puts("done\n");
 	}
 
-	/* Initialize Paging */
-	puts("    Initializing Paging... ");
-	paging_init();
+	/* Initialize Process Tables */
+	puts("    Initializing Processes... ");
+	proc_init();
 	puts("done\n");
 
 	/* Initialize Terminal Drivers */
@@ -253,7 +321,7 @@ void entry (unsigned long magic, unsigned long addr)
 	/* Ensure the filesystem actually is in memory before attempting to use it */
 	if(fs_pres){
 		/* Execute the first program (`shell') ... */
-		sys_exec_internal((uint8_t*)"shell", NULL);
+		sys_exec_internal((uint8_t*)"shell", NULL, NULL);
 		halt();
 	}
 
@@ -108,12 +108,21 @@ do {                                    \
 /* Writes four bytes to four consecutive ports */
 #define outl(data, port)                \
 do {                                    \
-	asm volatile("outl  %l1, (%w0)"     \
+	asm volatile("outl  %k1, (%w0)"     \
 			:                           \
 			: "d" (port), "a" (data)    \
 			: "memory", "cc" );         \
 } while(0)
 
+/* Writes a model specific register, the high half is zero */
+#define wrmsr(msr, value)                   \
+do {                                        \
+	asm volatile("wrmsr"                    \
+			:                               \
+			: "c" (msr), "a" (value), "d" (0) \
+			: "memory" );                   \
+} while(0)
+
 /* Clear interrupt flag - disables interrupts on this processor */
 #define cli()                           \
 do {                                    \
@@ -0,0 +1,110 @@
+/* lz4.c - LZ4 block format decompression
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "lz4.h"
+
+/* Helper functions */
+static int32_t lz4_length(const uint8_t **src, const uint8_t *end, uint32_t *len);
+
+/*
+ * Decompresses a block in the LZ4 block format: a series of sequences, each
+ * a token byte whose high nibble counts literals and low nibble counts match
+ * bytes past LZ4_MIN_MATCH, the literals, then a 2 byte little endian offset
+ * back into the output to copy the match from. The last sequence stops after
+ * its literals. Every length and offset is checked, so a corrupt block can't
+ * read or write out of bounds.
+ *
+ * Inputs: src - the compressed block
+ *         src_len - its size
+ *         dst - where to put the output
+ *         dst_len - room there
+ * Outputs: number of bytes produced, -1 if the block is corrupt or doesn't fit
+ */
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_len)
+{
+	const uint8_t *src_end = src + src_len;
+	uint8_t *out = dst;
+	uint8_t *out_end = dst + dst_len;
+	const uint8_t *match;
+	uint32_t token;
+	uint32_t len;
+	uint32_t offset;
+
+	while (src < src_end) {
+		token = *src++;
+
+		/* literals */
+		len = token >> 4;
+		if (len == LZ4_RUN_MASK && lz4_length(&src, src_end, &len)) {
+			return -1;
+		}
+		if (len > (uint32_t)(src_end - src) || len > (uint32_t)(out_end - out)) {
+			return -1;
+		}
+		memcpy(out, src, len);
+		src += len;
+		out += len;
+
+		/* the last sequence has no match */
+		if (src == src_end) {
+			break;
+		}
+
+		if (src_end - src < 2) {
+			return -1;
+		}
+		offset = src[0] | (src[1] << 8);
+		src += 2;
+		if (!offset || offset > (uint32_t)(out - dst)) {
+			return -1;
+		}
+
+		len = token & LZ4_RUN_MASK;
+		if (len == LZ4_RUN_MASK && lz4_length(&src, src_end, &len)) {
+			return -1;
+		}
+		len += LZ4_MIN_MATCH;
+		if (len > (uint32_t)(out_end - out)) {
+			return -1;
+		}
+
+		/* matches may overlap what they produce, which repeats a pattern */
+		match = out - offset;
+		if (offset >= len) {
+			memcpy(out, match, len);
+			out += len;
+		}
+		else {
+			while (len--) {
+				*out++ = *match++;
+			}
+		}
+	}
+
+	return out - dst;
+}
+
+/*
+ * Adds the extra bytes of a length to it, each 255 means another follows
+ *
+ * Inputs: src - where the bytes are, moved past them
+ *         end - end of the block
+ *         len - the length, 15 to start with
+ * Outputs: 0 on success, -1 if the block ends first
+ */
+static int32_t lz4_length(const uint8_t **src, const uint8_t *end, uint32_t *len)
+{
+	uint32_t byte;
+
+	do {
+		if (*src >= end) {
+			return -1;
+		}
+		byte = *(*src)++;
+		*len += byte;
+	} while (byte == 255);
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+/* lz4.h - LZ4 block format decompression
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include "types.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* shortest match a sequence can copy */
+#define LZ4_MIN_MATCH 4
+
+/* a length nibble of 15 is continued in the bytes that follow */
+#define LZ4_RUN_MASK 15
+
+#ifndef ASM
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Decompresses one LZ4 block, returns the bytes produced or -1 if it's corrupt */
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_len);
+
+#endif /* ASM */
+#endif /* _LZ4_H */
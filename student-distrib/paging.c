@@ -7,9 +7,10 @@
 #include "vga.h"
 #include "x86_desc.h"
 #include "proc.h"
+#include "frame.h"
 
-/* +1 is for the kernel's Page Directory */
-pd_t page_directories[MAX_PROCESSES + 1] __attribute__((aligned(PAGE_SIZE)));
+/* the kernel's Page Directory, process directories come from the frame pool */
+pd_t kernel_page_directory __attribute__((aligned(PAGE_SIZE)));
 
 /* for video memory */
 pt_t first_table __attribute__((aligned(PAGE_SIZE)));
@@ -24,6 +25,11 @@ pt_t user_video_mems[NUM_TERMS] __attribute__((aligned(PAGE_SIZE)));
  * swapping video memory */
 pt_t temp_table __attribute__((aligned(PAGE_SIZE)));
 
+#ifdef MAKE_BENCH
+/* nonzero while kernel TLB entries are kept across process switches */
+int32_t tlb_keep = 1;
+#endif
+
 /* define some actions to set/clear status bits */
 
 /* sets the 31 bit of CR0 */
@@ -44,6 +50,24 @@ pt_t temp_table __attribute__((aligned(PAGE_SIZE)));
 		: : : "eax", "cc"             \
 		)
 
+/* sets the 7 bit of CR4 */
+/* enables global pages, which stay in the TLB when CR3 is reloaded */
+#define set_pge_flag() asm (          \
+		"movl    %%cr4, %%eax\n       \
+		 orl     $0x00000080, %%eax\n \
+		 movl    %%eax, %%cr4"        \
+		: : : "eax", "cc"             \
+		)
+
+/* clears the 7 bit of CR4 */
+/* disables global pages, which also flushes them from the TLB */
+#define clr_pge_flag() asm (          \
+		"movl    %%cr4, %%eax\n       \
+		 andl    $0xFFFFFF7F, %%eax\n \
+		 movl    %%eax, %%cr4"        \
+		: : : "eax", "cc"             \
+		)
+
 /* clears the 5 bit of CR4 */
 /* disables physical address extension */
 #define clr_pae_flag() asm (          \
@@ -58,7 +82,7 @@ static void clear_page_dir(pd_t* directory);
 static void clear_page_table(pt_t* table);
 static void install_pages();
 static void install_kernel_page(pd_t *page_directory);
-static void install_user_page(uint32_t index, pd_t *page_directory);
+static void install_user_page(uint32_t user_frame, pd_t *page_directory);
 static void map_video_mem(const vid_mem_t *vidmem, const void *virt_addr, pd_t *proc_pd, pt_t *page_table, uint32_t flags);
 
 /* Definition of some empty values, useful for initialization */
@@ -66,33 +90,43 @@ static const pte_t empty_page_entry = {{.val = 0UL}};
 static const pde_t empty_dir_entry = {{.val = 0UL}};
 
 /*
- * Installation of kernel page directory (0)
- * Different from user Page Directories as Kernel is supervisor only.
+ * Installation of the kernel pages in a page directory.
+ * Different from user pages as Kernel is supervisor only.
+ * Maps the kernel page and identity maps the kernel frame pool. These are
+ * the same in every directory, so they're global and survive CR3 reloads.
  * 
- * Input: pd_t - address of page directory 0 passed in by reference
+ * Input: pd_t - address of page directory passed in by reference
  * Output: none
  */ 
 static void install_kernel_page(pd_t *page_directory)
 {
 		pde_t kernel_mem = empty_dir_entry;
+		uint32_t addr;
 
 		kernel_mem.present = 1;
 		kernel_mem.read_write = 1;
 		kernel_mem.user_supervisor = 0;
 		kernel_mem.page_size = 1;
+		kernel_mem.global_page = 1;
 		kernel_mem.page_base_addr_4mb = PAGE_BASE_ADDR_4MB(KERNEL_MEM);
 
 		page_directory->entry[PAGE_DIR_IDX(KERNEL_MEM)] = kernel_mem;
+
+		for (addr = KERNEL_POOL; addr < KERNEL_POOL + KERNEL_POOL_SIZE; addr += PAGE_SIZE_4MB) {
+			kernel_mem.page_base_addr_4mb = PAGE_BASE_ADDR_4MB(addr);
+			page_directory->entry[PAGE_DIR_IDX(addr)] = kernel_mem;
+		}
 }
 
 /*
- * Install user page directories (>= 1)
- * Different from Kernel Page Directory as User is not a supervisor.
+ * Install a user page in a process's page directory
+ * Different from Kernel Pages as User is not a supervisor.
  *
- * Inputs: page_directory - address of page directory passed in by reference
+ * Inputs: user_frame - physical address of the process's 4MB frame
+ *         page_directory - address of page directory passed in by reference
  * Outputs: none
  */ 
-static void install_user_page(uint32_t index, pd_t *page_directory)
+static void install_user_page(uint32_t user_frame, pd_t *page_directory)
 {
 	pde_t user_mem = empty_dir_entry;
 
@@ -100,11 +134,173 @@ static void install_user_page(uint32_t index, pd_t *page_directory)
 	user_mem.read_write = 1;
 	user_mem.user_supervisor = 1;
 	user_mem.page_size = 1;
-	user_mem.page_base_addr_4mb = PAGE_BASE_ADDR_4MB(KERNEL_MEM+index*OFFSET_4MB);
+	user_mem.page_base_addr_4mb = PAGE_BASE_ADDR_4MB(user_frame);
 
 	page_directory->entry[PAGE_DIR_IDX(USER_MEM)] = user_mem;
 }
 
+/*
+ * Allocates and fills in a page directory for a new process.
+ *
+ * Inputs: user_frame - physical address of the process's 4MB frame
+ * Outputs: the new page directory, NULL when out of memory
+ */
+pd_t *alloc_page_directory(uint32_t user_frame)
+{
+	pd_t *page_directory;
+
+	page_directory = kpage_alloc(0);
+	if (!page_directory) {
+		return NULL;
+	}
+
+	clear_page_dir(page_directory);
+	install_kernel_page(page_directory);
+	map_video_mem((void *)VIDEO, (void *)VIDEO, page_directory, &first_table, PG_WRITE | PG_GLOBAL);
+	install_user_page(user_frame, page_directory);
+
+	return page_directory;
+}
+
+/*
+ * Releases a page directory made by alloc_page_directory, along with the
+ * page tables and frames it owns.
+ *
+ * Inputs: page_directory - directory to free
+ * Outputs: none
+ */
+void free_page_directory(pd_t *page_directory)
+{
+	pt_t *table;
+	int32_t i, j;
+
+	for (i = 0; i < NUM_ENTRIES; i++) {
+		if (!(page_directory->entry[i].val & PG_OWNED)) {
+			continue;
+		}
+
+		table = (pt_t *)(page_directory->entry[i].pt_base_addr << 12);
+		for (j = 0; j < NUM_ENTRIES; j++) {
+			if (table->entry[j].val & PG_OWNED) {
+				kpage_free((void *)(table->entry[j].page_base_addr << 12), 0);
+			}
+		}
+		kpage_free(table, 0);
+	}
+
+	kpage_free(page_directory, 0);
+}
+
+/*
+ * Looks up the page table entry for a user address.
+ *
+ * Inputs: page_directory - directory to look in
+ *         virt_addr - user address
+ * Outputs: the entry, NULL if the address isn't covered by a page table
+ */
+pte_t *get_user_pte(pd_t *page_directory, uint32_t virt_addr)
+{
+	pde_t *dir_entry;
+	pt_t *table;
+
+	dir_entry = &page_directory->entry[PAGE_DIR_IDX(virt_addr)];
+	if (!dir_entry->present || PDE_IS_4MB(*dir_entry)) {
+		return NULL;
+	}
+
+	table = (pt_t *)(dir_entry->pt_base_addr << 12);
+	return &table->entry[PAGE_TABLE_IDX(virt_addr)];
+}
+
+/*
+ * Maps a single 4KB page for user access. A page table is allocated for
+ * the 4MB region if it doesn't have one yet.
+ *
+ * Inputs: page_directory - directory to map into
+ *         virt_addr - page aligned user address
+ *         phys_addr - page aligned physical address
+ *         flags - extra flags to set beyond the present and user bits
+ * Outputs: 0 on success, -1 if already mapped or out of memory
+ */
+int32_t map_user_page(pd_t *page_directory, uint32_t virt_addr, uint32_t phys_addr, uint32_t flags)
+{
+	pde_t *dir_entry;
+	pte_t *entry;
+	pt_t *table;
+
+	dir_entry = &page_directory->entry[PAGE_DIR_IDX(virt_addr)];
+	if (!dir_entry->present) {
+		table = kpage_alloc(0);
+		if (!table) {
+			return -1;
+		}
+		clear_page_table(table);
+
+		*dir_entry = empty_dir_entry;
+		dir_entry->present = 1;
+		dir_entry->read_write = 1;
+		dir_entry->user_supervisor = 1;
+		dir_entry->pt_base_addr = PAGE_BASE_ADDR((uint32_t)table);
+		dir_entry->val |= PG_OWNED;
+	}
+
+	entry = get_user_pte(page_directory, virt_addr);
+	if (!entry || entry->present) {
+		return -1;
+	}
+
+	*entry = empty_page_entry;
+	entry->present = 1;
+	entry->user_supervisor = 1;
+	entry->val |= flags;
+	entry->page_base_addr = PAGE_BASE_ADDR(phys_addr);
+
+	return 0;
+}
+
+/*
+ * Unmaps a single 4KB user page. Frees nothing, the caller decides what to
+ * do with the frame from the returned entry.
+ *
+ * Inputs: page_directory - directory to unmap from
+ *         virt_addr - page aligned user address
+ * Outputs: the entry that was removed, not present if nothing was mapped
+ */
+pte_t unmap_user_page(pd_t *page_directory, uint32_t virt_addr)
+{
+	pte_t *entry;
+	pte_t old = empty_page_entry;
+	uint32_t pdbr;
+
+	entry = get_user_pte(page_directory, virt_addr);
+	if (entry) {
+		old = *entry;
+		*entry = empty_page_entry;
+
+		get_pdbr(pdbr);
+		if (pdbr == (uint32_t)page_directory) {
+			invlpg(virt_addr);
+		}
+	}
+
+	return old;
+}
+
+/*
+ * Copies a parent's fake video memory mapping into a new page directory,
+ * so children started on a background terminal can still print.
+ *
+ * Inputs: page_directory - the new directory
+ *         parent_directory - the directory to copy from
+ * Outputs: none
+ */
+void inherit_video_mem(pd_t *page_directory, const pd_t *parent_directory)
+{
+	uint32_t idx = PAGE_DIR_IDX((uint32_t)fake_video_mem);
+
+	page_directory->entry[idx] = parent_directory->entry[idx];
+}
+
 /*
  * Wrapper function for mapping executable program to video memory in Page directory 0.
  *
@@ -343,28 +539,59 @@ static void install_pages()
 {
 	int i;
 
-	/* Initialize per-process things */
-	for(i = 0; i < MAX_PROCESSES + 1; i++) {
-		clear_page_dir(&page_directories[i]);
-		install_kernel_page(&page_directories[i]);
-		map_video_mem((void *)VIDEO, (void *)VIDEO, &page_directories[i], &first_table, PG_WRITE);
-		if (i > 0) {
-			install_user_page(i, &page_directories[i]);
-		}
-	}
+	/* Initialize the kernel's directory, processes get theirs when they start */
+	clear_page_dir(&kernel_page_directory);
+	install_kernel_page(&kernel_page_directory);
+	map_video_mem((void *)VIDEO, (void *)VIDEO, &kernel_page_directory, &first_table, PG_WRITE | PG_GLOBAL);
 
 	/* Initialize per-terminal things */
 	for (i = 0; i < NUM_TERMS; i++) {
 		clear_page_table(&video_memories[i]);
 	}
 
-	fake_video_mem = (vid_mem_t *)(KERNEL_MEM + OFFSET_4MB * (MAX_PROCESSES + 1));
+	fake_video_mem = (vid_mem_t *)FAKE_VIDEO_MEM;
 
 	/* set up registers */
 	clr_pae_flag();
 	set_pse_flag();
-	set_pdbr(&page_directories[0]);
+	set_pdbr(&kernel_page_directory);
 
 	/* enable paging */
 	set_pg_flag();
+
+	/* keep kernel mappings in the TLB across process switches */
+	set_pge_flag();
+}
+
+#ifdef MAKE_BENCH
+/*
+ * TLB Keep:
+ *  Turns keeping kernel TLB entries across process switches on or off:
+ *  global kernel pages, and not reloading CR3 when the next process uses
+ *  the same page directory. Off, every switch flushes the whole TLB, the
+ *  way it did before, so ctxbench can time a switch both ways. Only
+ *  built with MAKE_BENCH, since it changes the setting for every process.
+ *
+ * INPUT: keep - nonzero to keep the entries, 0 to flush them
+ * Returns the previous setting
+ */
+int32_t sys_tlb_keep(int32_t keep)
+{
+	uint32_t flags;
+	int32_t old;
+
+	cli_and_save(flags);
+
+	old = tlb_keep;
+	tlb_keep = (keep != 0);
+	if (tlb_keep) {
+		set_pge_flag();
+	}
+	else {
+		clr_pge_flag();
+	}
+
+	restore_flags(flags);
+	return old;
 }
+#endif /* MAKE_BENCH */
@@ -18,6 +18,29 @@
 #define USER_MEM   0x08000000
 #define USER_VID   0x088B8000
 
+#define PAGE_SIZE_4MB 0x400000
+
+/* Physical memory layout above the kernel page:
+ *  - a pool of 4KB frames for kernel data (PCBs/kernel stacks, page
+ *    directories, file tables), identity mapped in every page directory
+ *  - one 4MB frame holding the terminals' fake video memory
+ *  - 4MB frames for user programs, up to the top of memory
+ */
+#define KERNEL_POOL       0x800000
+#define KERNEL_POOL_SIZE  0x1000000
+#define FAKE_VIDEO_MEM    (KERNEL_POOL + KERNEL_POOL_SIZE)
+#define USER_FRAMES       (FAKE_VIDEO_MEM + PAGE_SIZE_4MB)
+
+/* User windows mapped with 4KB pages: the heap grown by sbrk, where
+ * shared memory segments may be mapped, the system call ring, and the
+ * stacks of threads */
+#define USER_HEAP     0x09000000
+#define USER_HEAP_END 0x0C000000
+#define USER_SHM      0x0C000000
+#define USER_SHM_END  0x0D000000
+#define USER_RING     0x0D000000
+#define USER_THREADS  0x0D400000
+
 /* Tests if a given directory entry is for a 4MB page */
 #define PDE_IS_4MB(entry) ((entry).page_size == 1)
 
@@ -46,6 +69,9 @@
 #define PG_DIRTY       (1 << 6)
 #define PG_SIZE_4MB    (1 << 7)
 #define PG_GLOBAL      (1 << 8)
+/* available bit: the table or frame came from the kernel pool for this
+ * directory alone and is freed along with it */
+#define PG_OWNED       (1 << 9)
 #define PG_PT_ATTR_IDX (1 << 12)
 
 
@@ -121,12 +147,20 @@ typedef struct pt {
  *           Global Variables           *
  ****************************************/
 
-/* Global page Directories */
-extern pd_t page_directories[];
+/* Page directory used by the kernel before any process runs */
+extern pd_t kernel_page_directory;
 
 /* Global video memory loc array*/
 extern pt_t user_video_mems[];
 
+/* nonzero while kernel TLB entries are kept across process switches,
+ * only benchmark builds can turn it off */
+#ifdef MAKE_BENCH
+extern int32_t tlb_keep;
+#else
+#define tlb_keep 1
+#endif
+
 
 /****************************************
  *           Macro Definitions          *
@@ -146,6 +180,24 @@ extern pt_t user_video_mems[];
 				: : "memory"          \
 			)
 
+/* drops the TLB entry of a single page */
+#define invlpg(addr) asm volatile (   \
+				"invlpg  (%0)"        \
+				: : "r" ((addr))      \
+				: "memory"            \
+			)
+
+/* sets cr3 only if it isn't already pointing at base, reloading the same
+ * directory would just throw away the process's TLB entries. Always
+ * reloads while tlb_keep is off. */
+#define switch_pdbr(base) do {                   \
+				uint32_t _cur_pdbr;              \
+				get_pdbr(_cur_pdbr);             \
+				if (!tlb_keep || _cur_pdbr != (uint32_t)(base)) { \
+					set_pdbr(base);              \
+				}                                \
+			} while (0)
+
 
 /****************************************
  *         Function Declarations        *
@@ -154,6 +206,24 @@ extern pt_t user_video_mems[];
 /* Initialize paging */
 void paging_init(void);
 
+/* Allocates a page directory mapping the kernel and a user frame */
+pd_t *alloc_page_directory(uint32_t user_frame);
+
+/* Releases a page directory from alloc_page_directory */
+void free_page_directory(pd_t *page_directory);
+
+/* Maps a 4KB user page, allocating its page table if needed */
+int32_t map_user_page(pd_t *page_directory, uint32_t virt_addr, uint32_t phys_addr, uint32_t flags);
+
+/* Removes a 4KB user page mapping, returns the entry it had */
+pte_t unmap_user_page(pd_t *page_directory, uint32_t virt_addr);
+
+/* Looks up the entry of a 4KB user page, NULL if it has no page table */
+pte_t *get_user_pte(pd_t *page_directory, uint32_t virt_addr);
+
+/* Gives a new page directory the same terminal video mappings as another */
+void inherit_video_mem(pd_t *page_directory, const pd_t *parent_directory);
+
 /* Installation of user vid mem for executables */
 void install_user_vid_mem(pd_t *page_directory, pt_t *user_vid_mem_table);
 
@@ -161,6 +231,11 @@ void install_user_vid_mem(pd_t *page_directory, pt_t *user_vid_mem_table);
 int32_t switch_to_fake_video_memory();
 int32_t switch_from_fake_video_memory();
 
+#ifdef MAKE_BENCH
+/* Turns keeping kernel TLB entries across switches on or off, for benchmarks */
+int32_t sys_tlb_keep(int32_t keep);
+#endif
+
 #endif /* _ASM_ */
 #endif /* _PAGING_H */
 
@@ -0,0 +1,93 @@
+/* pci.c - PCI configuration space access
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "types.h"
+#include "lib.h"
+#include "pci.h"
+
+/* builds the address a configuration access goes out to */
+#define PCI_ADDRESS(addr, reg) (0x80000000UL | ((uint32_t)(addr)->bus << 16) \
+		| ((uint32_t)(addr)->dev << 11) | ((uint32_t)(addr)->func << 8) | ((reg) & 0xFC))
+
+/*
+ * Reads a dword of a function's configuration space
+ *
+ * Inputs: addr - the function
+ *         reg - offset of the register, dword aligned
+ * Outputs: the register
+ */
+uint32_t pci_read(const pci_addr_t *addr, uint8_t reg)
+{
+	uint32_t value;
+	uint32_t flags;
+
+	cli_and_save(flags);
+	outl(PCI_ADDRESS(addr, reg), PCI_CONFIG_ADDR);
+	value = inl(PCI_CONFIG_DATA);
+	restore_flags(flags);
+
+	return value;
+}
+
+/*
+ * Writes a dword of a function's configuration space
+ *
+ * Inputs: addr - the function
+ *         reg - offset of the register, dword aligned
+ *         value - what to write
+ * Outputs: none
+ */
+void pci_write(const pci_addr_t *addr, uint8_t reg, uint32_t value)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	outl(PCI_ADDRESS(addr, reg), PCI_CONFIG_ADDR);
+	outl(value, PCI_CONFIG_DATA);
+	restore_flags(flags);
+}
+
+/*
+ * Finds the first function on any bus with a given class and subclass,
+ * checking the other functions of a device only if it has them
+ *
+ * Inputs: class, subclass - what to look for
+ *         addr - set to where it was found
+ * Outputs: 0 on success, -1 if there's no such function
+ */
+int32_t pci_find_class(uint8_t class, uint8_t subclass, pci_addr_t *addr)
+{
+	uint32_t bus, dev, func;
+	uint32_t nfuncs;
+	uint32_t reg;
+
+	for (bus = 0; bus < PCI_BUSES; bus++) {
+		for (dev = 0; dev < PCI_DEVICES; dev++) {
+			addr->bus = bus;
+			addr->dev = dev;
+			addr->func = 0;
+
+			if ((pci_read(addr, PCI_VENDOR) & 0xFFFF) == PCI_NO_VENDOR) {
+				continue;
+			}
+
+			/* bit 7 of the header type marks multi-function devices */
+			nfuncs = (pci_read(addr, PCI_HEADER) & 0x00800000) ? PCI_FUNCTIONS : 1;
+
+			for (func = 0; func < nfuncs; func++) {
+				addr->func = func;
+				if ((pci_read(addr, PCI_VENDOR) & 0xFFFF) == PCI_NO_VENDOR) {
+					continue;
+				}
+
+				reg = pci_read(addr, PCI_CLASS);
+				if ((reg >> 24) == class && ((reg >> 16) & 0xFF) == subclass) {
+					return 0;
+				}
+			}
+		}
+	}
+
+	return -1;
+}
@@ -0,0 +1,69 @@
+/* pci.h - PCI configuration space access
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#ifndef _PCI_H
+#define _PCI_H
+
+#include "types.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* configuration mechanism #1 ports */
+#define PCI_CONFIG_ADDR 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+/* configuration space registers */
+#define PCI_VENDOR  0x00
+#define PCI_COMMAND 0x04
+#define PCI_CLASS   0x08
+#define PCI_HEADER  0x0C
+#define PCI_BAR0    0x10
+#define PCI_BAR4    0x20
+
+/* command register bits */
+#define PCI_CMD_IO     0x0001
+#define PCI_CMD_MASTER 0x0004
+
+/* I/O space BARs have their low bits set aside */
+#define PCI_BAR_IO   0x1
+#define PCI_BAR_MASK 0xFFFFFFFC
+
+#define PCI_BUSES     256
+#define PCI_DEVICES   32
+#define PCI_FUNCTIONS 8
+
+#define PCI_NO_VENDOR 0xFFFF
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* location of a function on the bus */
+typedef struct pci_addr {
+	uint8_t bus;
+	uint8_t dev;
+	uint8_t func;
+} pci_addr_t;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Reads a dword of a function's configuration space */
+uint32_t pci_read(const pci_addr_t *addr, uint8_t reg);
+
+/* Writes a dword of a function's configuration space */
+void pci_write(const pci_addr_t *addr, uint8_t reg, uint32_t value);
+
+/* Finds the first function with a class and subclass, 0 on success */
+int32_t pci_find_class(uint8_t class, uint8_t subclass, pci_addr_t *addr);
+
+#endif /* ASM */
+
+#endif /* _PCI_H */
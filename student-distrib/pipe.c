@@ -0,0 +1,402 @@
+/* pipe.c - pipes between processes
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "paging.h"
+#include "frame.h"
+#include "proc.h"
+#include "syscall.h"
+#include "poll.h"
+#include "wait.h"
+#include "pipe.h"
+
+/* Helper functions */
+static int32_t pipe_read(pcb_t *pcb, int32_t fd, void *buf, int32_t nbytes);
+static int32_t pipe_write(pcb_t *pcb, int32_t fd, const void *buf, int32_t nbytes);
+static int32_t pipe_bad_read(pcb_t *pcb, int32_t fd, void *buf, int32_t nbytes);
+static int32_t pipe_bad_write(pcb_t *pcb, int32_t fd, const void *buf, int32_t nbytes);
+static int32_t pipe_close(pcb_t *pcb, int32_t fd);
+static int32_t pipe_read_poll(pcb_t *pcb, int32_t fd, struct wait_entry *wait);
+static int32_t pipe_write_poll(pcb_t *pcb, int32_t fd, struct wait_entry *wait);
+static int32_t pipe_dup(pcb_t *pcb, int32_t fd);
+static pipe_t *pipe_from_fd(pcb_t *pcb, int32_t fd);
+static void pipe_free(pipe_t *pipe);
+
+/* Read end operations jump table */
+fops_t pipe_read_fops = {
+	.read  = &pipe_read,
+	.write = &pipe_bad_write,
+	.close = &pipe_close,
+	.poll  = &pipe_read_poll,
+	.dup   = &pipe_dup,
+};
+
+/* Write end operations jump table */
+fops_t pipe_write_fops = {
+	.read  = &pipe_bad_read,
+	.write = &pipe_write,
+	.close = &pipe_close,
+	.poll  = &pipe_write_poll,
+	.dup   = &pipe_dup,
+};
+
+static pipe_t pipes[PIPE_MAX];
+
+/*
+ * Pipe:
+ *  Creates a pipe and opens a descriptor on each end. Bytes written to
+ *  fds[1] are read back from fds[0] in order. Reads wait for data and
+ *  return 0 once every write descriptor is closed; writes wait for room
+ *  and fail once every read descriptor is closed.
+ *
+ * INPUT: fds - where to store the read and write descriptors
+ * Returns 0 on success, -1 on fail
+ */
+int32_t sys_pipe(int32_t *fds)
+{
+	pcb_t *pcb;
+	pipe_t *pipe;
+	file_t *file;
+	int32_t rfd, wfd;
+	uint32_t flags;
+	uint32_t i;
+
+	if (!user_range_ok(fds, 2 * sizeof(*fds))) {
+		return -1;
+	}
+
+	pcb = get_proc_pcb();
+	if (!pcb) {
+		return -1;
+	}
+
+	/* a slot is taken once it has a buffer */
+	cli_and_save(flags);
+
+	pipe = NULL;
+	for (i = 0; i < PIPE_MAX; i++) {
+		if (!pipes[i].buf) {
+			pipe = &pipes[i];
+			break;
+		}
+	}
+
+	if (pipe) {
+		pipe->buf = kpage_alloc(PIPE_BUF_ORDER);
+	}
+
+	restore_flags(flags);
+
+	if (!pipe || !pipe->buf) {
+		return -1;
+	}
+
+	pipe->head = pipe->tail = 0;
+	pipe->readers = pipe->writers = 1;
+	wait_init(&pipe->rwait);
+	wait_init(&pipe->wwait);
+
+	rfd = get_unused_fd(pcb);
+	if (rfd < 0) {
+		goto fail_pipe;
+	}
+
+	wfd = get_unused_fd(pcb);
+	if (wfd < 0) {
+		goto fail_rfd;
+	}
+
+	file = get_file_from_fd(pcb, rfd);
+	file->file_op = &pipe_read_fops;
+	file->inode_ptr = (uint32_t)pipe;
+	file->file_pos = 0;
+	file->flags = FILE_PRESENT | FILE_OPEN | FILE_RDONLY;
+
+	file = get_file_from_fd(pcb, wfd);
+	file->file_op = &pipe_write_fops;
+	file->inode_ptr = (uint32_t)pipe;
+	file->file_pos = 0;
+	file->flags = FILE_PRESENT | FILE_OPEN | FILE_WRONLY;
+
+	fds[0] = rfd;
+	fds[1] = wfd;
+	return 0;
+
+fail_rfd:
+	release_fd(pcb, rfd);
+fail_pipe:
+	pipe_free(pipe);
+	return -1;
+}
+
+/*
+ * Reads whatever's buffered, up to nbytes, sleeping while the pipe is empty
+ * and still has writers.
+ *
+ * Inputs: fd - read end of the pipe
+ *         buf - buffer to read into
+ *         nbytes - most bytes to read
+ * Outputs: bytes read, 0 at end of file, -EAGAIN if it's non-blocking and
+ *          empty, -1 on fail
+ */
+static int32_t pipe_read(pcb_t *pcb, int32_t fd, void *buf, int32_t nbytes)
+{
+	pipe_t *pipe;
+	uint32_t flags;
+	uint32_t off, n, first;
+
+	pipe = pipe_from_fd(pcb, fd);
+	if (!pipe || nbytes < 0) {
+		return -1;
+	}
+
+	cli_and_save(flags);
+
+	while (pipe->head == pipe->tail) {
+		if (!pipe->writers || !nbytes) {
+			restore_flags(flags);
+			return 0;
+		}
+		if (get_file_from_fd(pcb, fd)->flags & FILE_NONBLOCK) {
+			restore_flags(flags);
+			return -EAGAIN;
+		}
+		sleep_on(&pipe->rwait);
+	}
+
+	n = pipe->tail - pipe->head;
+	if (n > (uint32_t)nbytes) {
+		n = nbytes;
+	}
+
+	/* the data may wrap around the end of the buffer */
+	off = pipe->head & (PIPE_BUF_SIZE - 1);
+	first = PIPE_BUF_SIZE - off;
+	if (first > n) {
+		first = n;
+	}
+	memcpy(buf, pipe->buf + off, first);
+	memcpy((uint8_t *)buf + first, pipe->buf, n - first);
+	pipe->head += n;
+
+	wake_up(&pipe->wwait);
+
+	restore_flags(flags);
+	return n;
+}
+
+/*
+ * Writes all nbytes, sleeping whenever the pipe fills up until a reader
+ * makes room.
+ *
+ * Inputs: fd - write end of the pipe
+ *         buf - bytes to write
+ *         nbytes - how many
+ * Outputs: bytes written, which is nbytes unless every reader closed its
+ *          end or it's non-blocking and filled up partway; -EAGAIN if it's
+ *          non-blocking and full, -1 if there are no readers
+ */
+static int32_t pipe_write(pcb_t *pcb, int32_t fd, const void *buf, int32_t nbytes)
+{
+	pipe_t *pipe;
+	uint32_t flags;
+	uint32_t off, n, first;
+	int32_t written = 0;
+
+	pipe = pipe_from_fd(pcb, fd);
+	if (!pipe || nbytes < 0) {
+		return -1;
+	}
+
+	cli_and_save(flags);
+
+	while (written < nbytes) {
+		if (!pipe->readers) {
+			if (!written) {
+				written = -1;
+			}
+			break;
+		}
+
+		n = PIPE_BUF_SIZE - (pipe->tail - pipe->head);
+		if (!n) {
+			if (get_file_from_fd(pcb, fd)->flags & FILE_NONBLOCK) {
+				if (!written) {
+					written = -EAGAIN;
+				}
+				break;
+			}
+			sleep_on(&pipe->wwait);
+			continue;
+		}
+
+		if (n > (uint32_t)(nbytes - written)) {
+			n = nbytes - written;
+		}
+
+		off = pipe->tail & (PIPE_BUF_SIZE - 1);
+		first = PIPE_BUF_SIZE - off;
+		if (first > n) {
+			first = n;
+		}
+		memcpy(pipe->buf + off, (const uint8_t *)buf + written, first);
+		memcpy(pipe->buf, (const uint8_t *)buf + written + first, n - first);
+		pipe->tail += n;
+		written += n;
+
+		wake_up(&pipe->rwait);
+	}
+
+	restore_flags(flags);
+	return written;
+}
+
+/*
+ * Fails, the write end can't be read
+ */
+static int32_t pipe_bad_read(pcb_t *pcb, int32_t fd, void *buf, int32_t nbytes)
+{
+	(void)pcb; (void)fd; (void)buf; (void)nbytes;
+	return -1;
+}
+
+/*
+ * Fails, the read end can't be written
+ */
+static int32_t pipe_bad_write(pcb_t *pcb, int32_t fd, const void *buf, int32_t nbytes)
+{
+	(void)pcb; (void)fd; (void)buf; (void)nbytes;
+	return -1;
+}
+
+/*
+ * Closes one end, waking the other so it sees end of file or that nobody's
+ * reading. The pipe is freed when both ends are closed everywhere.
+ *
+ * Inputs: fd - either end of the pipe
+ * Outputs: 0 on success, -1 on fail
+ */
+static int32_t pipe_close(pcb_t *pcb, int32_t fd)
+{
+	pipe_t *pipe;
+	uint32_t flags;
+
+	pipe = pipe_from_fd(pcb, fd);
+	if (!pipe) {
+		return -1;
+	}
+
+	cli_and_save(flags);
+
+	if (get_file_from_fd(pcb, fd)->file_op == &pipe_read_fops) {
+		pipe->readers--;
+	}
+	else {
+		pipe->writers--;
+	}
+
+	wake_up(&pipe->rwait);
+	wake_up(&pipe->wwait);
+
+	if (!pipe->readers && !pipe->writers) {
+		pipe_free(pipe);
+	}
+
+	restore_flags(flags);
+
+	release_fd(pcb, fd);
+	return 0;
+}
+
+/*
+ * The read end is readable with data buffered or no writers left
+ */
+static int32_t pipe_read_poll(pcb_t *pcb, int32_t fd, struct wait_entry *wait)
+{
+	pipe_t *pipe;
+
+	pipe = pipe_from_fd(pcb, fd);
+	if (!pipe) {
+		return POLLNVAL;
+	}
+
+	if (wait) {
+		wait_add(&pipe->rwait, wait);
+	}
+
+	return (pipe->head != pipe->tail || !pipe->writers) ? POLLIN : 0;
+}
+
+/*
+ * The write end is writable with room left or no readers left
+ */
+static int32_t pipe_write_poll(pcb_t *pcb, int32_t fd, struct wait_entry *wait)
+{
+	pipe_t *pipe;
+
+	pipe = pipe_from_fd(pcb, fd);
+	if (!pipe) {
+		return POLLNVAL;
+	}
+
+	if (wait) {
+		wait_add(&pipe->wwait, wait);
+	}
+
+	return (pipe->tail - pipe->head < PIPE_BUF_SIZE || !pipe->readers) ? POLLOUT : 0;
+}
+
+/*
+ * Counts a copy of an end made by dup2 or inherited by a new process
+ */
+static int32_t pipe_dup(pcb_t *pcb, int32_t fd)
+{
+	pipe_t *pipe;
+	uint32_t flags;
+
+	pipe = pipe_from_fd(pcb, fd);
+	if (!pipe) {
+		return -1;
+	}
+
+	cli_and_save(flags);
+
+	if (get_file_from_fd(pcb, fd)->file_op == &pipe_read_fops) {
+		pipe->readers++;
+	}
+	else {
+		pipe->writers++;
+	}
+
+	restore_flags(flags);
+	return 0;
+}
+
+/*
+ * Gets the pipe an open descriptor is on, NULL if it isn't one
+ */
+static pipe_t *pipe_from_fd(pcb_t *pcb, int32_t fd)
+{
+	file_t *file;
+
+	file = get_file_from_fd(pcb, fd);
+	if (!file || !(file->flags & FILE_OPEN)) {
+		return NULL;
+	}
+
+	if (file->file_op != &pipe_read_fops && file->file_op != &pipe_write_fops) {
+		return NULL;
+	}
+
+	return (pipe_t *)file->inode_ptr;
+}
+
+/*
+ * Returns a pipe's buffer and frees its slot
+ */
+static void pipe_free(pipe_t *pipe)
+{
+	kpage_free(pipe->buf, PIPE_BUF_ORDER);
+	memset(pipe, 0, sizeof(*pipe));
+}
@@ -0,0 +1,61 @@
+/* pipe.h - pipes between processes
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _PIPE_H
+#define _PIPE_H
+
+#include "types.h"
+#include "proc.h"
+#include "wait.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* each pipe buffers 2^PIPE_BUF_ORDER kernel pages */
+#define PIPE_BUF_ORDER 0
+#define PIPE_BUF_SIZE  (PAGE_SIZE << PIPE_BUF_ORDER)
+
+/* pipes open at once */
+#define PIPE_MAX 32
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* Pipe
+ *  A ring buffer with a count of the descriptors open on each end. head
+ *  and tail count up forever and are masked to index the buffer. Readers
+ *  sleep on rwait until there's data or no writers are left, writers on
+ *  wwait until there's room or no readers are left.
+ */
+typedef struct pipe {
+	uint8_t *buf;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t readers;
+	uint32_t writers;
+	wait_queue_t rwait;
+	wait_queue_t wwait;
+} pipe_t;
+
+
+/****************************************
+ *           Global Variables           *
+ ****************************************/
+
+extern fops_t pipe_read_fops;
+extern fops_t pipe_write_fops;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Creates a pipe, storing its read and write descriptors in fds */
+int32_t sys_pipe(int32_t *fds);
+
+#endif /* ASM */
+#endif /* _PIPE_H */
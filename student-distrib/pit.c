@@ -10,9 +10,14 @@
 #include "sched.h"
 #include "syscall.h"
 #include "term.h"
+#include "bcache.h"
+#include "journal.h"
 
 #define reboot 0
 
+volatile uint32_t pit_ticks = 0;
+wait_queue_t timer_wait;
+
 /* Static helper function */
 static void pit_set_count(void);
 
@@ -25,6 +30,8 @@ void pit_init(void)
 
 	/* Set PIT counter value*/
 	pit_set_count();
+
+	wait_init(&timer_wait);
 }
 
 /* Interrupt handler for the PIT
@@ -38,6 +45,14 @@ void pit_handle_interrupt(registers_t* regs)
 	/* reset PIT counter */
 	pit_set_count();
 
+	pit_ticks++;
+	wake_up(&timer_wait);
+
+	/* commit metadata changes that have collected a while, then start
+	 * writing back blocks that have been dirty a while */
+	journal_tick();
+	bcache_tick();
+
 	/* Update scheduling queues and context switch */
 	scheduler(regs);
 }
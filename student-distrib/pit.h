@@ -8,6 +8,7 @@
 
 #include "isr.h"
 #include "sched.h"
+#include "wait.h"
 
 /****************************************
  *            Global Defines            *
@@ -32,8 +33,21 @@
 #define SCHED_FREQ_LO 0x38
 #define SCHED_FREQ_HI 0x5D
 
+/* 23864 / 1193182 Hz, in milliseconds */
+#define PIT_TICK_MS 20
+
 #ifndef ASM
 
+/****************************************
+ *           Global Variables           *
+ ****************************************/
+
+/* PIT interrupts since boot */
+extern volatile uint32_t pit_ticks;
+
+/* woken on every PIT interrupt, for sleeps with a timeout */
+extern wait_queue_t timer_wait;
+
 /****************************************
  *         Function Declarations        *
  ****************************************/
@@ -0,0 +1,111 @@
+/* poll.c - waiting on several file descriptors at once
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "proc.h"
+#include "pit.h"
+#include "wait.h"
+#include "poll.h"
+
+/* Helper functions */
+static uint16_t poll_fd(pcb_t *pcb, pollfd_t *pfd, wait_entry_t *wait);
+
+/*
+ * Sys Poll:
+ *  Checks each descriptor with its file operations' poll, and if none is
+ *  ready sleeps on all their wait queues at once until one of them fires
+ *  or the timeout runs out. Negative descriptors are skipped.
+ *
+ * INPUT: fds - descriptors and the events wanted on each, revents is
+ *              filled in with the events that happened
+ *        nfds - number of descriptors
+ *        timeout - milliseconds to wait, 0 to just check, negative to wait
+ *                  as long as it takes
+ * Returns the number of descriptors with events, 0 on timeout, -1 on fail
+ */
+int32_t sys_poll(pollfd_t *fds, uint32_t nfds, int32_t timeout)
+{
+	pollfd_t pfds[POLL_MAX_FDS];
+	wait_entry_t waits[POLL_MAX_FDS];
+	wait_entry_t timer;
+	pcb_t *pcb;
+	uint32_t deadline = 0;
+	uint32_t flags;
+	uint32_t i;
+	int32_t nready;
+
+	pcb = get_proc_pcb();
+	if (!pcb || (!fds && nfds) || nfds > POLL_MAX_FDS) {
+		return -1;
+	}
+
+	/* work on a copy, only revents goes back out */
+	if (nfds && !user_range_ok(fds, nfds * sizeof(pollfd_t))) {
+		return -1;
+	}
+	memcpy(pfds, fds, nfds * sizeof(pollfd_t));
+
+	if (timeout > 0) {
+		deadline = pit_ticks + (timeout + PIT_TICK_MS - 1) / PIT_TICK_MS;
+	}
+
+	/* nothing can fire between checking and going to sleep */
+	cli_and_save(flags);
+
+	for (;;) {
+		nready = 0;
+		for (i = 0; i < nfds; i++) {
+			waits[i].pcb = pcb;
+			pfds[i].revents = poll_fd(pcb, &pfds[i], timeout ? &waits[i] : NULL);
+			if (pfds[i].revents) {
+				nready++;
+			}
+		}
+
+		if (nready || !timeout || (timeout > 0 && (int32_t)(pit_ticks - deadline) >= 0)) {
+			break;
+		}
+
+		if (timeout > 0) {
+			timer.pcb = pcb;
+			wait_add(&timer_wait, &timer);
+		}
+
+		wait_sleep();
+		wait_remove_all(pcb);
+	}
+
+	wait_remove_all(pcb);
+	restore_flags(flags);
+
+	/* another thread may have shrunk the heap while we slept */
+	if (nfds && !user_range_ok(fds, nfds * sizeof(pollfd_t))) {
+		return -1;
+	}
+	for (i = 0; i < nfds; i++) {
+		fds[i].revents = pfds[i].revents;
+	}
+
+	return nready;
+}
+
+/*
+ * Gets the events wanted on one descriptor that are ready, putting the
+ * wait entry on the file's queue if it has one
+ */
+static uint16_t poll_fd(pcb_t *pcb, pollfd_t *pfd, wait_entry_t *wait)
+{
+	file_t *file;
+
+	if (pfd->fd < 0) {
+		return 0;
+	}
+
+	file = get_file_from_fd(pcb, pfd->fd);
+	if (!file || !(file->flags & FILE_PRESENT) || !file->file_op->poll) {
+		return POLLNVAL;
+	}
+
+	return file->file_op->poll(pcb, pfd->fd, wait) & (pfd->events | POLLNVAL);
+}
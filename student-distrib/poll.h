@@ -0,0 +1,43 @@
+/* poll.h - waiting on several file descriptors at once
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _POLL_H
+#define _POLL_H
+
+#include "types.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* events, what fops poll returns */
+#define POLLIN   0x01  /* a read won't block */
+#define POLLOUT  0x04  /* a write won't block */
+#define POLLNVAL 0x20  /* not an open descriptor, always reported */
+
+/* descriptors one call can wait on, their wait entries go on the stack */
+#define POLL_MAX_FDS 32
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* What to wait for on a descriptor, and what happened */
+typedef struct pollfd {
+	int32_t fd;
+	uint16_t events;
+	uint16_t revents;
+} pollfd_t;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Waits for any of several descriptors to be ready */
+int32_t sys_poll(pollfd_t *fds, uint32_t nfds, int32_t timeout);
+
+#endif /* ASM */
+#endif /* _POLL_H */
@@ -0,0 +1,310 @@
+/* proc.c, process allocation and file descriptor tables
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "types.h"
+#include "lib.h"
+#include "bitmap.h"
+#include "frame.h"
+#include "paging.h"
+#include "proc.h"
+#include "sched.h"
+#include "thread.h"
+
+/* PCB of every live process, indexed by PID */
+pcb_t *pcb_table[MAX_PROCESSES];
+
+/* PID allocation bitmap */
+static uint32_t pid_map[BITMAP_WORDS(MAX_PROCESSES)];
+static uint32_t pid_full[BITMAP_WORDS(BITMAP_WORDS(MAX_PROCESSES))];
+static bitmap_t pids;
+
+/* processes that have halted but whose memory hasn't been released */
+static pcb_t *reap_list = NULL;
+
+/* Sets up the PID bitmap and PCB table
+ */
+void proc_init(void)
+{
+	bitmap_init(&pids, pid_map, pid_full, MAX_PROCESSES);
+
+	/* PID 0 is never handed out */
+	bitmap_set(&pids, 0);
+
+	memset(pcb_table, 0, sizeof pcb_table);
+	reap_list = NULL;
+}
+
+/* Returns the first process ID possible
+ * OUTPUT: an integer PID, -1 if all are in use
+ */
+int32_t get_first_free_pid()
+{
+	return bitmap_alloc(&pids);
+}
+
+/* Frees a process ID for use elsewhere
+ * INPUT: PID - process ID to release
+ */
+void free_pid(int32_t pid)
+{
+	if (pid > 0 && pid < MAX_PROCESSES) {
+		bitmap_clear(&pids, pid);
+	}
+}
+
+/* Gets the next unused file descriptor from a process's pcb, growing the
+ * table by a page when every descriptor is taken. Pages are never moved, so
+ * pointers to open files stay valid.
+ * OUTPUT: a file descriptor, -1 if none can be had
+ */
+int32_t get_unused_fd(pcb_t *pcb)
+{
+	int32_t fd;
+	file_t *file;
+	file_t *page;
+
+	if (!pcb) {
+		return -1;
+	}
+
+	/* threads share their process's table */
+	pcb = get_proc_leader(pcb);
+
+	/* skip FDs in use until we find an unused one */
+	for (fd = 0; fd < (int32_t)pcb->nfiles; fd++) {
+		file = get_file_from_fd(pcb, fd);
+		if (!(file->flags & FILE_PRESENT)) {
+			file->flags |= FILE_PRESENT;
+			return fd;
+		}
+	}
+
+	/* all are in use, try to grow */
+	if (pcb->nfiles >= MAX_FILES) {
+		return -1;
+	}
+
+	page = kpage_alloc(0);
+	if (!page) {
+		return -1;
+	}
+	memset(page, 0, PAGE_SIZE);
+
+	pcb->file_pages[(pcb->nfiles - NUM_INLINE_FILES) / FILES_PER_PAGE] = page;
+	fd = pcb->nfiles;
+	pcb->nfiles += FILES_PER_PAGE;
+
+	page[0].flags |= FILE_PRESENT;
+	return fd;
+}
+
+/* Allocates everything a new process needs
+ * OUTPUT: a zeroed PCB with its pid, stacks, and memory filled in,
+ *         NULL if we're out of PIDs or memory
+ */
+pcb_t *proc_create(void)
+{
+	pcb_t *pcb;
+	pd_t *page_directory;
+	uint32_t user_frame;
+	int32_t pid;
+
+	/* get back memory from anything that halted since last time */
+	proc_reap();
+
+	pid = get_first_free_pid();
+	if (pid < 0) {
+		return NULL;
+	}
+
+	/* the PCB sits at the bottom of the kernel stack */
+	pcb = kpage_alloc(KSTACK_ORDER);
+	if (!pcb) {
+		goto fail_pid;
+	}
+
+	user_frame = uframe_alloc();
+	if (!user_frame) {
+		goto fail_stack;
+	}
+
+	page_directory = alloc_page_directory(user_frame);
+	if (!page_directory) {
+		goto fail_frame;
+	}
+
+	memset(pcb, 0, sizeof(*pcb));
+	pcb->pid = pid;
+	pcb->kern_stack = ((uint32_t)pcb + USER_STACK_SIZE - 1) & ALIGN_4B;
+	pcb->user_stack = (USER_MEM + OFFSET_4MB - 1) & ALIGN_4B;
+	pcb->page_directory = page_directory;
+	pcb->user_frame = user_frame;
+	pcb->nfiles = NUM_INLINE_FILES;
+	pcb->brk = USER_HEAP;
+
+	pcb_table[pid] = pcb;
+
+	return pcb;
+
+fail_frame:
+	uframe_free(user_frame);
+fail_stack:
+	kpage_free(pcb, KSTACK_ORDER);
+fail_pid:
+	free_pid(pid);
+	return NULL;
+}
+
+/* Allocates what a thread needs of its own, it shares the rest with the
+ * process it belongs to
+ * INPUT: leader - the process
+ * OUTPUT: a zeroed PCB with its pid, kernel stack, and the process's page
+ *         directory filled in, NULL if we're out of PIDs or memory
+ */
+pcb_t *proc_create_thread(pcb_t *leader)
+{
+	pcb_t *pcb;
+	int32_t pid;
+
+	proc_reap();
+
+	pid = get_first_free_pid();
+	if (pid < 0) {
+		return NULL;
+	}
+
+	pcb = kpage_alloc(KSTACK_ORDER);
+	if (!pcb) {
+		free_pid(pid);
+		return NULL;
+	}
+
+	memset(pcb, 0, sizeof(*pcb));
+	pcb->pid = pid;
+	pcb->kern_stack = ((uint32_t)pcb + USER_STACK_SIZE - 1) & ALIGN_4B;
+	pcb->page_directory = leader->page_directory;
+	pcb->term_ctx = get_term_ctx(leader);
+	pcb->leader = leader;
+
+	pcb_table[pid] = pcb;
+
+	return pcb;
+}
+
+/* Releases a process's PID right away, after taking it off the run queues so
+ * a process that gets the PID next isn't run twice. Its memory is freed by proc_reap once
+ * we're off its kernel stack and page directory, since halt runs on both.
+ * INPUT: pcb - the process to destroy
+ */
+void proc_destroy(pcb_t *pcb)
+{
+	uint32_t flags;
+
+	if (!pcb) {
+		return;
+	}
+
+	cli_and_save(flags);
+
+	pcb_table[pcb->pid] = NULL;
+	remove_from_sched(pcb->pid);
+	free_pid(pcb->pid);
+
+	pcb->reap_next = reap_list;
+	reap_list = pcb;
+
+	restore_flags(flags);
+}
+
+/* Frees the memory of destroyed processes, except the one we're running on
+ */
+void proc_reap(void)
+{
+	pcb_t **link, *pcb;
+	uint32_t flags;
+	uint32_t pdbr;
+	int32_t i;
+
+	cli_and_save(flags);
+	get_pdbr(pdbr);
+
+	link = &reap_list;
+	while ((pcb = *link)) {
+		if (pcb == get_proc_pcb()
+				|| (!pcb->leader && (uint32_t)pcb->page_directory == pdbr)) {
+			/* still in use, try again later */
+			link = &pcb->reap_next;
+			continue;
+		}
+
+		*link = pcb->reap_next;
+
+		/* a thread only has its kernel stack */
+		if (!pcb->leader) {
+			for (i = 0; i < MAX_FILE_PAGES; i++) {
+				if (pcb->file_pages[i]) {
+					kpage_free(pcb->file_pages[i], 0);
+				}
+			}
+			free_page_directory(pcb->page_directory);
+			uframe_free(pcb->user_frame);
+		}
+		kpage_free(pcb, KSTACK_ORDER);
+	}
+
+	restore_flags(flags);
+}
+
+/* Checks that a range the current process passed in is its own memory, so
+ * the kernel can read or write it: the program's 4MB page, the heap up to
+ * the break, mapped shared memory, or a thread stack that's in use. Heap
+ * and thread stack pages that weren't touched yet are filled in when the
+ * kernel touches them.
+ * INPUT: ptr - start of the range
+ *        len - its length in bytes
+ * OUTPUT: 1 if it's usable, 0 otherwise
+ */
+int32_t user_range_ok(const void *ptr, uint32_t len)
+{
+	pcb_t *pcb;
+	pte_t *entry;
+	uint32_t start = (uint32_t)ptr;
+	uint32_t end = start + len;
+	uint32_t slot, addr;
+
+	/* threads share their process's memory */
+	pcb = get_proc_leader(get_proc_pcb());
+	if (!pcb || end < start) {
+		return 0;
+	}
+
+	if (start >= USER_MEM && end <= USER_MEM + OFFSET_4MB) {
+		return 1;
+	}
+
+	if (start >= USER_HEAP && end <= pcb->brk) {
+		return 1;
+	}
+
+	/* one stack, above its guard page */
+	if (start >= USER_THREADS && end <= USER_THREADS_END) {
+		slot = (start - USER_THREADS) / THREAD_STACK_SIZE;
+		return (pcb->thread_stacks & (1UL << slot))
+			&& start >= THREAD_STACK_BASE(slot) + PAGE_SIZE
+			&& end <= THREAD_STACK_BASE(slot) + THREAD_STACK_SIZE;
+	}
+
+	/* segments are mapped whole, but every page has to be one */
+	if (start >= USER_SHM && end <= USER_SHM_END) {
+		for (addr = start & PAGE_BASE_MASK; addr < end; addr += PAGE_SIZE) {
+			entry = get_user_pte(pcb->page_directory, addr);
+			if (!entry || !entry->present) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	return 0;
+}
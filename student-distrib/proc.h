@@ -39,15 +39,33 @@
 #define FILE_OPEN    2
 #define FILE_CLOSED  4
 #define FILE_RTC     8
+/* reads that would wait return -EAGAIN instead */
+#define FILE_NONBLOCK 16
+/* only one way works, like either end of a pipe */
+#define FILE_RDONLY  32
+#define FILE_WRONLY  64
 
 /*FILE ARRAY DEFINTIONS*/
-#define MAX_FILES       8
+/* descriptors kept inside the PCB */
+#define NUM_INLINE_FILES 8
+/* descriptors in each page the table grows by (file_t is 20 bytes) */
+#define FILES_PER_PAGE   (PAGE_SIZE / sizeof(file_t))
+/* pages the table may grow by */
+#define MAX_FILE_PAGES   4
+#define MAX_FILES       (NUM_INLINE_FILES + MAX_FILE_PAGES * FILES_PER_PAGE)
 
 /*Maximum length of command line arguments*/
 #define MAX_ARGS_LEN    63
 
-/* Maximum number of processes */
-#define MAX_PROCESSES 10
+/* most buffers one readv or writev takes */
+#define IOV_MAX 16
+
+/* Size of the PID space, PID 0 is never handed out. How many processes can
+ * actually run at once is bounded by free user frames and kernel pool. */
+#define MAX_PROCESSES 1024
+
+/* kernel stack and PCB take 2^KSTACK_ORDER pool frames */
+#define KSTACK_ORDER 1
 
 /* User Space virtual addressing values */
 #define OFFSET_4MB          0x400000
@@ -67,13 +85,37 @@
 
 /* forward declaration for typedefs */
 typedef struct pcb pcb_t;
-
-/* Types used in the file-ops table */
-typedef int32_t open_t(pcb_t *pcb, const uint8_t *filename);
+struct dentry;
+struct ring_ctx;
+struct wait_entry;
+
+/* One buffer of a vectored read or write */
+typedef struct iovec {
+	void *base;
+	int32_t len;
+} iovec_t;
+
+/* Types used in the file-ops table, open gets the already resolved dentry */
+typedef int32_t open_t(pcb_t *pcb, const struct dentry *dentry);
 typedef int32_t read_t(pcb_t *pcb, int32_t fd, void *buf, int32_t nbytes);
 typedef int32_t write_t(pcb_t *pcb, int32_t fd, const void *buf, int32_t nbytes);
 typedef int32_t close_t(pcb_t *pcb, int32_t fd);
 
+/* Returns the POLL* events ready on the descriptor. If wait isn't NULL it's
+ * put on the wait queue that's woken when that changes, if there is one. */
+typedef int32_t poll_t(pcb_t *pcb, int32_t fd, struct wait_entry *wait);
+
+/* Called once the descriptor has been copied to fd, by dup2 or into a new
+ * process, so state shared between copies can count it. Descriptors
+ * without one can't be copied. */
+typedef int32_t dup_t(pcb_t *pcb, int32_t fd);
+
+/* Read or write several buffers in one go, optional; readv and writev go
+ * a buffer at a time through read and write without them. The vectors are
+ * already checked and copied into the kernel. */
+typedef int32_t readv_t(pcb_t *pcb, int32_t fd, const iovec_t *iov, int32_t iovcnt);
+typedef int32_t writev_t(pcb_t *pcb, int32_t fd, const iovec_t *iov, int32_t iovcnt);
+
 /*
  * File Operations Table
  */
@@ -82,11 +124,15 @@ typedef struct fops {
 	write_t *write;
 	open_t *open;
 	close_t *close;
+	poll_t *poll;
+	dup_t *dup;
+	readv_t *readv;
+	writev_t *writev;
 } fops_t;
 
 /*
  * File descriptor structure
- * 16 bytes
+ * 20 bytes
  */
 typedef struct file {
     fops_t* file_op;
@@ -108,8 +154,10 @@ struct pcb
 	/*Process ID*/
 	uint32_t pid;
 
-	/*File Array*/
-	file_t file_array[MAX_FILES];
+	/*File Array, grows a page at a time past the inline descriptors */
+	file_t file_array[NUM_INLINE_FILES];
+	file_t *file_pages[MAX_FILE_PAGES];
+	uint32_t nfiles;
 
 	/*Stacks*/
 	uint32_t kern_stack;
@@ -124,17 +172,53 @@ struct pcb
 	/*Page table*/
 	pd_t *page_directory;
 
+	/*Physical address of the 4MB user frame*/
+	uint32_t user_frame;
+
 	/*Process Parent*/
 	struct pcb *parent;
 
 	/*Parent State*/
 	registers_t *parent_ctx;
 
+	/* started by spawn, runs alongside the process that started it and has
+	 * nobody to return to */
+	int8_t detached;
+
 	/* flag denotes whether process has mapped video memory */
 	int8_t has_video_mapped;
 
+	/* set once it has started halting, which can sleep, so it isn't
+	 * halted twice */
+	int8_t halting;
+
 	/* holds a pointer to the terminal context the process uses */
 	term_t *term_ctx;
+
+	/* end of the heap, pages below it are filled in when first touched */
+	uint32_t brk;
+
+	/* bit n set when the process holds shared memory segment n */
+	uint32_t shm_held;
+
+	/* system call ring, NULL until ring_setup */
+	struct ring_ctx *ring;
+
+	/* wait queue entries while the process is sleeping */
+	struct wait_entry *waits;
+
+	/* next halted process waiting to have its memory released */
+	struct pcb *reap_next;
+
+	/* process a thread belongs to, sharing its page directory, descriptors
+	 * and everything else but the stacks; NULL for a process */
+	struct pcb *leader;
+
+	/* bit n set when thread stack n is in use, kept on the process */
+	uint32_t thread_stacks;
+
+	/* which thread stack a thread runs on */
+	int32_t thread_slot;
 };
 
 
@@ -142,8 +226,8 @@ struct pcb
  *           Global Variables           *
  ****************************************/
 
-extern uint8_t nprocs;
-extern uint32_t proc_bitmap;
+extern uint32_t nprocs;
+extern pcb_t *pcb_table[];
 
 
 /****************************************
@@ -169,40 +253,36 @@ static inline pcb_t *get_proc_pcb()
 	return (pcb_t *)pcb;
 }
 
-/* Gets the file based on a given file descriptor
- * INPUTS: fd - file descriptor to search with
- * OUTPUTS: returns a file_t pointer
+/* Gets the process a thread belongs to, a process is its own
  */
-static inline file_t *get_file_from_fd(pcb_t *pcb, int32_t fd)
+static inline pcb_t *get_proc_leader(pcb_t *pcb)
 {
-	if (pcb && 0 <= fd && fd < MAX_FILES) {
-		return &pcb->file_array[fd];
+	if (pcb && pcb->leader) {
+		return pcb->leader;
 	}
-	return NULL;
+
+	return pcb;
 }
 
-/* Gets the next unused file descriptor from a process's pcb
- * OUTPUT: a file descriptor
+/* Gets the file based on a given file descriptor, threads use their
+ * process's table
+ * INPUTS: fd - file descriptor to search with
+ * OUTPUTS: returns a file_t pointer
  */
-static inline int32_t get_unused_fd(pcb_t *pcb)
+static inline file_t *get_file_from_fd(pcb_t *pcb, int32_t fd)
 {
-	int32_t fd;
+	pcb = get_proc_leader(pcb);
 
-	if (!pcb) {
-		return -1;
+	if (!pcb || fd < 0 || fd >= (int32_t)pcb->nfiles) {
+		return NULL;
 	}
 
-	/* skip FDs in use until we find an unused one */
-	for (fd = 0; pcb->file_array[fd].flags & FILE_PRESENT; ++fd);
-
-	/* if we found one */
-	if (fd < MAX_FILES) {
-		pcb->file_array[fd].flags |= FILE_PRESENT;
-		return fd;
+	if (fd < NUM_INLINE_FILES) {
+		return &pcb->file_array[fd];
 	}
 
-	/* all are in use */
-	return -1;
+	fd -= NUM_INLINE_FILES;
+	return &pcb->file_pages[fd / FILES_PER_PAGE][fd % FILES_PER_PAGE];
 }
 
 /* Clears a passed file descriptor to be used elsewhere
@@ -210,40 +290,40 @@ static inline int32_t get_unused_fd(pcb_t *pcb)
  */
 static inline void release_fd(pcb_t *pcb, int32_t fd)
 {
-	if (fd < 0 || fd > MAX_FILES) {
-		return;
-	}
+	file_t *file;
 
-	if (pcb) {
-		pcb->file_array[fd].flags = 0;
+	file = get_file_from_fd(pcb, fd);
+	if (file) {
+		file->flags = 0;
 	}
 }
 
-/* Returns the first process ID possible
- * OUTPUT: an integery PID
- */
-static inline int32_t get_first_free_pid()
-{
-	int32_t index;
+/* Gets the next unused file descriptor from a process's pcb */
+int32_t get_unused_fd(pcb_t *pcb);
 
-	for (index = 1; ((1 << index) & proc_bitmap) && index <= MAX_PROCESSES; index++);
+/* Returns the first process ID possible */
+int32_t get_first_free_pid();
 
-	if (index > MAX_PROCESSES) {
-		return -1;
-	}
+/* Frees a process ID for use elsewhere */
+void free_pid(int32_t pid);
 
-	proc_bitmap |= 1 << index;
+/* Sets up the PID bitmap and PCB table */
+void proc_init(void);
 
-	return index;
-}
+/* Allocates a PID, PCB, kernel stack, page directory, and user frame */
+pcb_t *proc_create(void);
 
-/* Frees a process ID for use elsewhere
- * INPUT: PID - process ID to release
- */
-static inline void free_pid(int32_t pid)
-{
-	proc_bitmap &= ~(1<<pid);
-}
+/* Allocates a PID, PCB and kernel stack for a thread of leader */
+pcb_t *proc_create_thread(pcb_t *leader);
+
+/* Releases a process's PID and queues its memory to be freed */
+void proc_destroy(pcb_t *pcb);
+
+/* Frees the memory of destroyed processes we're no longer running on */
+void proc_reap(void);
+
+/* Checks that a range passed in by the current process is its own memory */
+int32_t user_range_ok(const void *ptr, uint32_t len);
 
 /* Returns a pointer to the video memory of a passed terminal
  * INPUT: term_id - terminal of which to return its ID
@@ -299,11 +379,11 @@ static inline screen_t *get_screen_ctx(pcb_t *pcb)
  */
 static inline pcb_t *get_pcb_from_pid(int32_t pid)
 {
-	if (pid < 0 || pid > MAX_PROCESSES) {
+	if (pid <= 0 || pid >= MAX_PROCESSES) {
 		return NULL;
 	}
 
-	return (pcb_t *)((KERNEL_MEM + OFFSET_4MB - USER_STACK_SIZE * pid - 1) & ALIGN_8KB);
+	return pcb_table[pid];
 }
 
 #endif /* ASM */
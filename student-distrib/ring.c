@@ -0,0 +1,336 @@
+/* ring.c - batched system call submission and completion rings
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "paging.h"
+#include "frame.h"
+#include "proc.h"
+#include "syscall.h"
+#include "poll.h"
+#include "ring.h"
+
+/* Helper functions */
+static void ring_submit(pcb_t *pcb, const ring_sqe_t *sqe);
+static void ring_complete(ring_ctx_t *ctx, uint32_t user_data, int32_t res);
+static uint32_t ring_room(const ring_ctx_t *ctx);
+static int32_t ring_read(pcb_t *pcb, const ring_sqe_t *sqe);
+static int32_t ring_would_block(pcb_t *pcb, const ring_sqe_t *sqe);
+static int32_t ring_buf_mapped(pcb_t *pcb, const ring_sqe_t *sqe);
+
+/*
+ * Ring Setup:
+ *  Gives the caller a page shared with the kernel holding a submission and
+ *  a completion queue, mapped the way vidmap maps video memory. Calls
+ *  queued there are run by ring_enter, many to a trip into the kernel.
+ *  Calling it again hands back the same ring.
+ *
+ * INPUT: ring - where to store the ring's address
+ * Returns 0 on success, -1 on fail
+ */
+int32_t sys_ring_setup(ring_t **ring)
+{
+	pcb_t *pcb;
+	ring_ctx_t *ctx;
+	ring_t *shared;
+
+	if (!user_range_ok(ring, sizeof(*ring))) {
+		return -1;
+	}
+
+	pcb = get_proc_leader(get_proc_pcb());
+	if (!pcb) {
+		return -1;
+	}
+
+	if (!pcb->ring) {
+		ctx = kpage_alloc(0);
+		if (!ctx) {
+			return -1;
+		}
+
+		shared = kpage_alloc(0);
+		if (!shared) {
+			goto fail_ctx;
+		}
+
+		memset(ctx, 0, PAGE_SIZE);
+		memset(shared, 0, PAGE_SIZE);
+		ctx->ring = shared;
+
+		if (map_user_page(pcb->page_directory, USER_RING, (uint32_t)shared, PG_WRITE)) {
+			goto fail_shared;
+		}
+
+		pcb->ring = ctx;
+	}
+
+	*ring = (ring_t *)USER_RING;
+	return 0;
+
+fail_shared:
+	kpage_free(shared, 0);
+fail_ctx:
+	kpage_free(ctx, 0);
+	return -1;
+}
+
+/*
+ * Ring Enter:
+ *  Runs up to to_submit queued calls, then waits until at least
+ *  min_complete completions are waiting to be reaped. Reads of the
+ *  terminal or the RTC that would block don't hold up the rest; they wait
+ *  in the kernel and complete on their own once there's data, even if the
+ *  process never enters again. Submissions stop early when the completion
+ *  queue couldn't hold their results.
+ *
+ * INPUT: to_submit - how many submissions to take
+ *        min_complete - completions to wait for
+ * Returns the number of submissions taken, -1 on fail
+ */
+int32_t sys_ring_enter(uint32_t to_submit, uint32_t min_complete)
+{
+	pcb_t *pcb;
+	ring_ctx_t *ctx;
+	ring_t *ring;
+	ring_sqe_t sqe;
+	uint32_t submitted;
+
+	pcb = get_proc_leader(get_proc_pcb());
+	if (!pcb || !pcb->ring) {
+		return -1;
+	}
+
+	ctx = pcb->ring;
+	ring = ctx->ring;
+
+	/* reads already waiting go first */
+	ring_poll(pcb);
+
+	for (submitted = 0; submitted < to_submit; submitted++) {
+		if (ring->sq_tail == ctx->sq_head || !ring_room(ctx)) {
+			break;
+		}
+
+		/* copy it out first, the process can change it under us */
+		sqe = ring->sq[ctx->sq_head & (RING_SQ_ENTRIES - 1)];
+		ctx->sq_head++;
+		ring->sq_head = ctx->sq_head;
+
+		ring_submit(pcb, &sqe);
+	}
+
+	if (min_complete > RING_CQ_ENTRIES) {
+		min_complete = RING_CQ_ENTRIES;
+	}
+
+	/* only waiting reads can add completions */
+	while (ctx->npending && ctx->cq_tail - ring->cq_head < min_complete) {
+		sched();
+		ring_poll(pcb);
+	}
+
+	return submitted;
+}
+
+/*
+ * Completes waiting reads whose device has data now. The scheduler calls
+ * this when it switches to a process with a ring, so completions show up
+ * without the process asking; it's then running on another process's
+ * stack and can't fault in heap pages, so reads into heap pages that
+ * aren't there yet are left for ring_enter.
+ *
+ * Inputs: pcb - process whose ring to check, its page directory loaded
+ * Outputs: none
+ */
+void ring_poll(pcb_t *pcb)
+{
+	ring_ctx_t *ctx = pcb->ring;
+	ring_sqe_t *sqe;
+	uint32_t flags;
+	uint32_t i, kept;
+
+	if (!ctx || !ctx->npending) {
+		return;
+	}
+
+	/* keys and ticks arrive from interrupts, hold them off between checking
+	 * for data and reading it */
+	cli_and_save(flags);
+
+	for (i = kept = 0; i < ctx->npending; i++) {
+		sqe = &ctx->pending[i];
+		if (ring_would_block(pcb, sqe)
+				|| (pcb != get_proc_leader(get_proc_pcb()) && !ring_buf_mapped(pcb, sqe))) {
+			ctx->pending[kept++] = *sqe;
+			continue;
+		}
+
+		ring_complete(ctx, sqe->user_data, ring_read(pcb, sqe));
+	}
+	ctx->npending = kept;
+
+	restore_flags(flags);
+}
+
+/*
+ * Frees a halting process's ring, dropping any reads still waiting.
+ *
+ * Inputs: pcb - the halting process
+ * Outputs: none
+ */
+void ring_release(pcb_t *pcb)
+{
+	ring_ctx_t *ctx = pcb->ring;
+
+	if (!ctx) {
+		return;
+	}
+
+	(void)unmap_user_page(pcb->page_directory, USER_RING);
+	kpage_free(ctx->ring, 0);
+	kpage_free(ctx, 0);
+	pcb->ring = NULL;
+}
+
+/*
+ * Runs one submission, or leaves it waiting if it's a read that would block
+ */
+static void ring_submit(pcb_t *pcb, const ring_sqe_t *sqe)
+{
+	ring_ctx_t *ctx = pcb->ring;
+	uint32_t flags;
+	int32_t block;
+	int32_t res;
+
+	switch (sqe->opcode) {
+		case RING_OP_NOP:
+			res = 0;
+			break;
+		case RING_OP_READ:
+			cli_and_save(flags);
+			block = ring_would_block(pcb, sqe);
+			if (block) {
+				ctx->pending[ctx->npending++] = *sqe;
+			}
+			restore_flags(flags);
+
+			if (block) {
+				return;
+			}
+			res = ring_read(pcb, sqe);
+			break;
+		case RING_OP_WRITE:
+			res = sys_write(sqe->fd, sqe->buf, sqe->nbytes);
+			break;
+		case RING_OP_OPEN:
+			res = sys_open(sqe->buf);
+			break;
+		case RING_OP_CLOSE:
+			res = sys_close(sqe->fd);
+			break;
+		default:
+			res = -1;
+			break;
+	}
+
+	ring_complete(ctx, sqe->user_data, res);
+}
+
+/*
+ * Posts a completion, ring_room was checked when its submission was taken
+ */
+static void ring_complete(ring_ctx_t *ctx, uint32_t user_data, int32_t res)
+{
+	ring_cqe_t *cqe;
+
+	cqe = &ctx->ring->cq[ctx->cq_tail & (RING_CQ_ENTRIES - 1)];
+	cqe->user_data = user_data;
+	cqe->res = res;
+
+	ctx->cq_tail++;
+	ctx->ring->cq_tail = ctx->cq_tail;
+}
+
+/*
+ * Counts completions that could still be posted without overwriting ones
+ * that weren't reaped, leaving room for every waiting read
+ */
+static uint32_t ring_room(const ring_ctx_t *ctx)
+{
+	uint32_t used;
+
+	used = ctx->cq_tail - ctx->ring->cq_head;
+	if (used > RING_CQ_ENTRIES || used + ctx->npending >= RING_CQ_ENTRIES) {
+		return 0;
+	}
+
+	return RING_CQ_ENTRIES - used - ctx->npending;
+}
+
+/*
+ * Reads through the descriptor's file operations like sys_read, but for
+ * any process
+ */
+static int32_t ring_read(pcb_t *pcb, const ring_sqe_t *sqe)
+{
+	file_t *file;
+
+	file = get_file_from_fd(pcb, sqe->fd);
+	if (!sqe->buf || !file || !(file->flags & FILE_PRESENT)) {
+		return -1;
+	}
+
+	return file->file_op->read(pcb, sqe->fd, sqe->buf, sqe->nbytes);
+}
+
+/*
+ * True if the submission is a read of a device, like the terminal or the
+ * RTC, with nothing to read yet. Anything else either finishes or fails
+ * right away.
+ */
+static int32_t ring_would_block(pcb_t *pcb, const ring_sqe_t *sqe)
+{
+	file_t *file;
+
+	file = get_file_from_fd(pcb, sqe->fd);
+	if (!sqe->buf || !file || !(file->flags & FILE_PRESENT) || !file->file_op->poll) {
+		return 0;
+	}
+
+	return !(file->file_op->poll(pcb, sqe->fd, NULL) & POLLIN);
+}
+
+/*
+ * True if every page of a read's buffer is mapped, so it can be filled in
+ * without faulting
+ */
+static int32_t ring_buf_mapped(pcb_t *pcb, const ring_sqe_t *sqe)
+{
+	uint32_t addr = (uint32_t)sqe->buf;
+	uint32_t end;
+	pte_t *entry;
+
+	if (sqe->nbytes <= 0) {
+		return 1;
+	}
+
+	end = addr + sqe->nbytes;
+	if (end < addr) {
+		return 0;
+	}
+
+	for (addr &= PAGE_BASE_MASK; addr < end; addr += PAGE_SIZE) {
+		/* the program's 4MB page is always there */
+		if (addr >= USER_MEM && addr < USER_MEM + OFFSET_4MB) {
+			continue;
+		}
+
+		entry = get_user_pte(pcb->page_directory, addr);
+		if (!entry || !entry->present) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
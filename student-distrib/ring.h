@@ -0,0 +1,94 @@
+/* ring.h - batched system call submission and completion rings
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _RING_H
+#define _RING_H
+
+#include "types.h"
+#include "proc.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* entries in each queue, powers of two so the indices can be masked */
+#define RING_SQ_ENTRIES 64
+#define RING_CQ_ENTRIES 128
+
+/* operations a submission can ask for */
+#define RING_OP_NOP   0
+#define RING_OP_READ  1
+#define RING_OP_WRITE 2
+#define RING_OP_OPEN  3
+#define RING_OP_CLOSE 4
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* Submission queue entry, the arguments of one call. Open takes the file
+ * name in buf. */
+typedef struct ring_sqe {
+	uint32_t opcode;
+	int32_t fd;
+	void *buf;
+	int32_t nbytes;
+	uint32_t user_data;
+} ring_sqe_t;
+
+/* Completion queue entry, what the call returned */
+typedef struct ring_cqe {
+	uint32_t user_data;
+	int32_t res;
+} ring_cqe_t;
+
+/* The page shared with the process
+ *  Indices count up forever and are masked to find the entry. The process
+ *  fills in sq entries and moves sq_tail, the kernel moves sq_head as it
+ *  takes them; the kernel fills in cq entries and moves cq_tail, the
+ *  process moves cq_head as it reaps them.
+ */
+typedef struct ring {
+	volatile uint32_t sq_head;
+	volatile uint32_t sq_tail;
+	volatile uint32_t cq_head;
+	volatile uint32_t cq_tail;
+	ring_sqe_t sq[RING_SQ_ENTRIES];
+	ring_cqe_t cq[RING_CQ_ENTRIES];
+} ring_t;
+
+/* Kernel side of a ring
+ *  The kernel keeps its own copies of the indices it moves, so the process
+ *  scribbling on the shared page can't make it take an entry twice or
+ *  overwrite completions. Reads of devices that would block wait here
+ *  until there's data.
+ */
+typedef struct ring_ctx {
+	ring_t *ring;
+	uint32_t sq_head;
+	uint32_t cq_tail;
+	uint32_t npending;
+	ring_sqe_t pending[RING_CQ_ENTRIES];
+} ring_ctx_t;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Maps the caller's ring into its address space, creating it if needed */
+int32_t sys_ring_setup(ring_t **ring);
+
+/* Runs queued submissions and waits for completions */
+int32_t sys_ring_enter(uint32_t to_submit, uint32_t min_complete);
+
+/* Posts completions for waiting reads whose device has data now */
+void ring_poll(pcb_t *pcb);
+
+/* Frees a halting process's ring */
+void ring_release(pcb_t *pcb);
+
+#endif /* ASM */
+#endif /* _RING_H */
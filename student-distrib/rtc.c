@@ -6,6 +6,8 @@
 #include "proc.h"
 #include "syscall.h"
 #include "rtc.h"
+#include "wait.h"
+#include "poll.h"
 
 /* File operations jump table */
 fops_t rtc_fops = {
@@ -13,10 +15,14 @@ fops_t rtc_fops = {
   .write = rtc_write,
   .open  = rtc_open,
   .close = rtc_close,
+  .poll  = rtc_poll,
 };
 
 static file_t *open_rtcs = NULL;
 
+/* readers sleeping until their virtual rtc ticks */
+static wait_queue_t rtc_wait;
+
 /* frequency stored in bytes 24-27 of the flags variable */
 #define rtc_virt_get_freq(_rtc) (((_rtc)->flags & 0x0F000000UL) >> 24)
 
@@ -163,6 +169,7 @@ void rtc_init(void)
 
 	/* clear chain */
 	open_rtcs = NULL;
+	wait_init(&rtc_wait);
 
 	/* set defualt frequency */
 	rtc_modify_freq(RTC_FREQ);
@@ -182,6 +189,7 @@ void rtc_handle_interrupt()
 {
 	file_t *rtc;
 	uint32_t flags;
+	uint32_t ticked = 0;
 
 	/* read a byte from reg c to allow interrupts to continue */
 	outb(REG_C, NMI_RTC_PORT);
@@ -196,8 +204,14 @@ void rtc_handle_interrupt()
 				rtc_virt_rst_ctr(rtc);
 				rtc_virt_incr_ticks(rtc);
 				rtc_virt_set_ticked(rtc);
+				ticked = 1;
 			}
 		}
+
+		/* readers check their own rtc when they wake */
+		if (ticked) {
+			wake_up(&rtc_wait);
+		}
 		restore_flags(flags);
 	}
 }
@@ -245,7 +259,7 @@ void rtc_modify_freq(uint32_t freq)
  * Inputs: fd - virtual rtc file descriptor
  *         buf - buffer to be written to
  *         nbytes - number of bytes to be written to buffer
- * Outputs: 0 on success
+ * Outputs: 0 on success, -EAGAIN if it's non-blocking and hasn't ticked
  *
  */
 int32_t rtc_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes)
@@ -260,13 +274,18 @@ int32_t rtc_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes)
 		return -1;
 	}
 
-	/* wait until there are ticks to return */
+	/* don't get interrupted when messing with rtc counts */
+	cli_and_save(flags);
+
+	/* sleep until there are ticks to return */
 	while (!rtc_virt_has_ticked(rtc)) {
-		sched();
+		if (rtc->flags & FILE_NONBLOCK) {
+			restore_flags(flags);
+			return -EAGAIN;
+		}
+		sleep_on(&rtc_wait);
 	}
 
-	/* don't get interrupted when messing with rtc counts */
-	cli_and_save(flags);
 	rtc_virt_clr_ticked(rtc);
 
 	ticks = rtc_virt_ticks(rtc);
@@ -277,6 +296,31 @@ int32_t rtc_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes)
 	return 0;
 }
 
+/*
+ * Poll for rtc type files. Readable once the virtual rtc has ticked,
+ * writing never waits.
+ *
+ * Inputs: fd - virtual rtc file descriptor
+ *         wait - put on rtc_wait if not NULL
+ * Outputs: POLLIN and POLLOUT events, POLLNVAL if it isn't an open rtc
+ *
+ */
+int32_t rtc_poll(pcb_t *pcb, int32_t fd, struct wait_entry *wait)
+{
+	file_t *rtc;
+
+	rtc = get_file_from_fd(pcb, fd);
+	if (!rtc || !(rtc->flags & (FILE_OPEN | FILE_RTC))) {
+		return POLLNVAL;
+	}
+
+	if (wait) {
+		wait_add(&rtc_wait, wait);
+	}
+
+	return POLLOUT | (rtc_virt_has_ticked(rtc) ? POLLIN : 0);
+}
+
 /*
  * Write system call for rtc type file
  * Write a new interrupt frequency to the virtual RTC file
@@ -339,14 +383,14 @@ int32_t rtc_write(pcb_t *pcb, int32_t fd, const void* buf, int32_t nbytes)
  * Open system call for an rtc type file.
  * Modify rtc to a default freq of 2Hz.
  *
- * Inputs: filename - name of the rtc file
+ * Inputs: dentry - directory entry of the rtc file, unused
  * Outputs: 0 on success
  *
  */
-int32_t rtc_open(pcb_t *pcb, const uint8_t* filename)
+int32_t rtc_open(pcb_t *pcb, const struct dentry *dentry)
 {
-	/* filename unused */
-	(void)filename;
+	/* dentry unused */
+	(void)dentry;
 
 	int32_t fd;
 	file_t *file;
@@ -70,11 +70,14 @@ void rtc_modify_freq(uint32_t freq);
 /*System calls for rtc type files*/
 int32_t rtc_read(pcb_t *pcb, int32_t fd, void* buf, int32_t nbytes);
 
+/* Checks whether an RTC can be read or written without waiting */
+int32_t rtc_poll(pcb_t *pcb, int32_t fd, struct wait_entry *wait);
+
 /* Write to the RTC */
 int32_t rtc_write(pcb_t *pcb, int32_t fd, const void* buf, int32_t nbytes);
 
 /* Open a new RTC for a file */
-int32_t rtc_open(pcb_t *pcb, const uint8_t* filename);
+int32_t rtc_open(pcb_t *pcb, const struct dentry *dentry);
 
 /* Close a RTC */
 int32_t rtc_close(pcb_t *pcb, int32_t fd);
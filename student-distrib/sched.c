@@ -10,6 +10,7 @@
 #include "lib.h"
 #include "syscall.h"
 #include "sched.h"
+#include "ring.h"
 
 #ifdef MODE_DEBUG
 #define DEBUG(...) printf(__VA_ARGS__)
@@ -19,6 +20,7 @@
 
 /* Helper functions */
 static void context_switch(registers_t* regs);
+static void remove_from_queue(sched_queue_t *queue, uint32_t pid);
 
 /* Local variables */
 sched_queue_t SCHED_QUEUE_1;
@@ -80,6 +82,37 @@ uint8_t push_to_expired(uint32_t pid)
 	return 0;
 }
 
+/* Takes every entry for a pid out of a queue, keeping the rest in order
+ */
+static void remove_from_queue(sched_queue_t *queue, uint32_t pid)
+{
+	uint32_t n, val, ok;
+
+	for (n = BUF_PTR_DIFF(*queue, tail, head); n > 0; n--) {
+		CIRC_BUF_POP(*queue, val, ok);
+		if (val != pid) {
+			CIRC_BUF_PUSH(*queue, val, ok);
+		}
+	}
+
+	/* putting back what was just popped always fits */
+	(void)ok;
+}
+
+/* When a process is destroyed:
+ *  Drop it from both queues, so its pid can be handed out again without
+ *  the new process getting the old one's turns as well
+ */
+void remove_from_sched(uint32_t pid)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	remove_from_queue(active_queue, pid);
+	remove_from_queue(expired_queue, pid);
+	restore_flags(flags);
+}
+
 /* When a process is finished:
  *  Remove it from the scheduler completely
  *  Set it's state to DEAD
@@ -152,10 +185,11 @@ void context_switch(registers_t* regs)
 {
 	/* Set ESP/EIP of current process by means of PID*/
 	pcb_t* pcb;
+	pcb_t* prev;
 	uint32_t pid, ok;
 
 	/* Get the PCB of current process */
-	pcb = get_proc_pcb();
+	pcb = prev = get_proc_pcb();
 
 	/* If no processes are running, we have nothing to switch to */
 	if (!pcb && !nprocs) {
@@ -165,8 +199,11 @@ void context_switch(registers_t* regs)
 	if (pcb) {
 		/* We're switching from another process */
 		if (!(pcb->state & EXIT_DEAD)) {
-			/* If we're not dead, we're expired */
-			push_to_expired(pcb->pid);
+			/* If we're not dead, we're expired, unless we're asleep; then
+			 * whatever wakes us queues us again */
+			if (!(pcb->state & TASK_INTERRUPTIBLE)) {
+				push_to_expired(pcb->pid);
+			}
 		}
 		else {
 			//printf("DEAD! [%d]\n", pcb->pid);
@@ -198,9 +235,15 @@ next_process:
 			goto next_process;
 		}
 
+		/* everything's asleep, idle where we are until an interrupt wakes
+		 * something up */
+		if (prev && (prev->state & TASK_INTERRUPTIBLE)) {
+			goto leave;
+		}
+
 		/* spawn a new shell to rescue us */
 		puts("Spawning a new shell...\n");
-		pid = sys_exec_internal((uint8_t*)"shell", NULL);
+		pid = sys_exec_internal((uint8_t*)"shell", NULL, NULL);
 		if (pid > 0) {
 			goto next_process;
 		}
@@ -212,10 +255,9 @@ next_process:
 	/* Get PCB of next Process */
 	pcb = get_pcb_from_pid(pid);
 
-	/* Error checking when PID not [fully] initialized */
+	/* the process halted after it was queued */
 	if (!pcb) {
-		DEBUG("PANIC: invalid process in sched queue\n");
-		goto leave;
+		goto next_process;
 	}
 
 	if (pcb->state & EXIT_DEAD) {
@@ -229,14 +271,20 @@ next_process:
 		goto leave;
 	}
 
+	/* free memory of halted processes, we're not running on them anymore */
+	proc_reap();
+
 	tss.esp0 = pcb->kern_stack;
 	tss.ss0 = KERNEL_DS;
 
 	regs = pcb->sched_ctx;
 	pcb->sched_ctx = NULL;
 
-	/*reload CR3*/
-	set_pdbr(pcb->page_directory);
+	/*reload CR3, unless the next process shares our page directory*/
+	switch_pdbr(pcb->page_directory);
+
+	/* finish reads its ring is waiting on, now its memory is mapped */
+	ring_poll(pcb);
 
 	/* TODO: move this? */
 	send_eoi(PIT_IRQ_PORT);
@@ -52,6 +52,9 @@ uint8_t push_to_active(uint32_t pid);
 /* Pushes a PID to the expired queue */
 uint8_t push_to_expired(uint32_t pid);
 
+/* Drops a destroyed process's PID from both queues */
+void remove_from_sched(uint32_t pid);
+
 /* Sets the PID status of the end process in the active queue for removal */
 uint8_t remove_active_from_sched(void);
 
@@ -0,0 +1,228 @@
+/* shm.c - named shared memory segments
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "paging.h"
+#include "frame.h"
+#include "proc.h"
+#include "shm.h"
+
+static shm_t segments[SHM_MAX_SEGMENTS];
+
+/* Helper functions */
+static void shm_free(shm_t *shm);
+
+/*
+ * Returns a segment's frames to the kernel pool and frees its slot.
+ *
+ * Inputs: shm - segment to free
+ * Outputs: none
+ */
+static void shm_free(shm_t *shm)
+{
+	uint32_t i;
+
+	for (i = 0; i < shm->npages; i++) {
+		if (shm->frames[i]) {
+			kpage_free((void *)shm->frames[i], 0);
+		}
+	}
+
+	memset(shm, 0, sizeof(*shm));
+}
+
+/*
+ * Shm Open:
+ *  Looks up a segment by name and creates it if it doesn't exist. Opening
+ *  an existing segment succeeds as long as it's at least size bytes.
+ *
+ * INPUT: name - name of the segment
+ *        size - bytes needed, rounded up to whole pages
+ * Returns the segment id on success, -1 on fail
+ */
+int32_t sys_shm_open(const uint8_t *name, uint32_t size)
+{
+	uint8_t kname[SHM_NAME_LEN + 1];
+	pcb_t *pcb;
+	shm_t *shm;
+	uint32_t flags;
+	uint32_t npages;
+	int32_t id, free_id;
+	uint32_t i;
+
+	pcb = get_proc_leader(get_proc_pcb());
+	if (!pcb || !name) {
+		return -1;
+	}
+
+	/* copy the name in a byte at a time, it may end right at the edge of
+	 * the caller's memory */
+	for (i = 0; i < SHM_NAME_LEN + 1; i++) {
+		if (!user_range_ok(name + i, 1)) {
+			return -1;
+		}
+		kname[i] = name[i];
+		if (kname[i] == '\0') {
+			break;
+		}
+	}
+
+	if (!kname[0] || i > SHM_NAME_LEN) {
+		return -1;
+	}
+
+	npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (npages > SHM_MAX_PAGES) {
+		return -1;
+	}
+
+	cli_and_save(flags);
+
+	/* look for the name, remembering a free slot on the way */
+	free_id = -1;
+	for (id = 0; id < SHM_MAX_SEGMENTS; id++) {
+		shm = &segments[id];
+		if (!shm->refcount) {
+			if (free_id < 0) {
+				free_id = id;
+			}
+			continue;
+		}
+		if (!strncmp((int8_t *)shm->name, (int8_t *)kname, SHM_NAME_LEN + 1)) {
+			break;
+		}
+	}
+
+	if (id < SHM_MAX_SEGMENTS) {
+		if (npages > shm->npages) {
+			goto fail;
+		}
+	}
+	else {
+		/* doesn't exist, create it */
+		if (free_id < 0 || !npages) {
+			goto fail;
+		}
+
+		id = free_id;
+		shm = &segments[id];
+		strncpy((int8_t *)shm->name, (int8_t *)kname, SHM_NAME_LEN + 1);
+		shm->npages = npages;
+
+		for (i = 0; i < npages; i++) {
+			shm->frames[i] = (uint32_t)kpage_alloc_user();
+			if (!shm->frames[i]) {
+				shm_free(shm);
+				goto fail;
+			}
+			memset((void *)shm->frames[i], 0, PAGE_SIZE);
+		}
+	}
+
+	/* each process holds one reference no matter how often it opens */
+	if (!(pcb->shm_held & (1UL << id))) {
+		pcb->shm_held |= 1UL << id;
+		shm->refcount++;
+	}
+
+	restore_flags(flags);
+	return id;
+
+fail:
+	restore_flags(flags);
+	return -1;
+}
+
+/*
+ * Shm Map:
+ *  Maps all of an opened segment into the caller's page directory, the same
+ *  way vidmap maps video memory, so writes are seen by every process that
+ *  maps it without going through the kernel.
+ *
+ * INPUT: shmid - id from shm_open
+ *        addr - page aligned address inside the shared memory window
+ * Returns 0 on success, -1 on fail
+ */
+int32_t sys_shm_map(int32_t shmid, void *addr)
+{
+	pcb_t *pcb;
+	shm_t *shm;
+	uint32_t flags;
+	uint32_t start = (uint32_t)addr;
+	uint32_t i;
+	pte_t *entry;
+
+	pcb = get_proc_leader(get_proc_pcb());
+	if (!pcb || shmid < 0 || shmid >= SHM_MAX_SEGMENTS) {
+		return -1;
+	}
+
+	/* only segments this process opened */
+	if (!(pcb->shm_held & (1UL << shmid))) {
+		return -1;
+	}
+
+	shm = &segments[shmid];
+	/* written so the end of the range can't wrap around */
+	if (start & PAGE_OFFSET_MASK || start < USER_SHM || start >= USER_SHM_END
+			|| shm->npages * PAGE_SIZE > USER_SHM_END - start) {
+		return -1;
+	}
+
+	cli_and_save(flags);
+
+	/* the whole range has to be free */
+	for (i = 0; i < shm->npages; i++) {
+		entry = get_user_pte(pcb->page_directory, start + i * PAGE_SIZE);
+		if (entry && entry->present) {
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < shm->npages; i++) {
+		if (map_user_page(pcb->page_directory, start + i * PAGE_SIZE, shm->frames[i], PG_WRITE)) {
+			/* out of memory for page tables, undo what we did */
+			while (i--) {
+				(void)unmap_user_page(pcb->page_directory, start + i * PAGE_SIZE);
+			}
+			goto fail;
+		}
+	}
+
+	restore_flags(flags);
+	return 0;
+
+fail:
+	restore_flags(flags);
+	return -1;
+}
+
+/*
+ * Drops the references a halting process holds. Its mappings go away with
+ * its page directory; the frames aren't owned by it so they're kept until
+ * the last reference is gone.
+ *
+ * Inputs: pcb - the halting process
+ * Outputs: none
+ */
+void shm_release_all(pcb_t *pcb)
+{
+	uint32_t flags;
+	int32_t id;
+
+	cli_and_save(flags);
+
+	for (id = 0; id < SHM_MAX_SEGMENTS; id++) {
+		if (!(pcb->shm_held & (1UL << id))) {
+			continue;
+		}
+
+		if (--segments[id].refcount == 0) {
+			shm_free(&segments[id]);
+		}
+	}
+	pcb->shm_held = 0;
+
+	restore_flags(flags);
+}
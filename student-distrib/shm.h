@@ -0,0 +1,56 @@
+/* shm.h - named shared memory segments
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "types.h"
+#include "proc.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* number of segments, one bit each in pcb->shm_held */
+#define SHM_MAX_SEGMENTS 32
+
+/* longest segment name */
+#define SHM_NAME_LEN     31
+
+/* largest segment, in 4KB pages (1MB) */
+#define SHM_MAX_PAGES    256
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* Shared memory segment
+ *  Frames come from the kernel pool and are shared by every process that
+ *  maps the segment. The segment lives until the last process that opened
+ *  it halts.
+ */
+typedef struct shm {
+	uint8_t name[SHM_NAME_LEN + 1];
+	uint32_t npages;
+	uint32_t refcount;
+	uint32_t frames[SHM_MAX_PAGES];
+} shm_t;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Opens a segment by name, creating it with at least size bytes if needed */
+int32_t sys_shm_open(const uint8_t *name, uint32_t size);
+
+/* Maps an opened segment into the caller at a page aligned address */
+int32_t sys_shm_map(int32_t shmid, void *addr);
+
+/* Drops every segment a halting process has open */
+void shm_release_all(pcb_t *pcb);
+
+#endif /* ASM */
+#endif /* _SHM_H */
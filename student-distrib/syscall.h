@@ -21,9 +21,59 @@
 #define SYS_GETARGS 7
 #define SYS_VIDMAP  8
 #define SYS_SCHED   9
+#define SYS_SHM_OPEN 11
+#define SYS_SHM_MAP  12
+#define SYS_SBRK     13
+#define SYS_CREATE   14
+#define SYS_APPEND   15
+#define SYS_TRUNCATE 16
+#define SYS_UNLINK   17
+#define SYS_CACHESTAT 18
+#define SYS_RING_SETUP 19
+#define SYS_RING_ENTER 20
+#define SYS_POLL       21
+#define SYS_FCNTL      22
+#define SYS_PIPE       23
+#define SYS_DUP2       24
+#define SYS_SPAWN      25
+#define SYS_SENDFILE   26
+#define SYS_LSEEK      27
+#define SYS_PREAD      28
+#define SYS_FSTAT      29
+#define SYS_READV      30
+#define SYS_WRITEV     31
+#define SYS_THREAD_CREATE 32
+#define SYS_FUTEX_WAIT 33
+#define SYS_FUTEX_WAKE 34
+#define SYS_TLB_KEEP   35
 
 #define MIN_SYSCALL 1
-#define MAX_SYSCALL 9
+#define MAX_SYSCALL 35
+
+/* returned negated when a non-blocking descriptor would have to wait */
+#define EAGAIN 11
+
+/* fcntl commands and the descriptor flags they get and set */
+#define F_GETFL    3
+#define F_SETFL    4
+#define O_NONBLOCK 0x800
+
+/* access mode F_GETFL reports, F_SETFL ignores it */
+#define O_ACCMODE  3
+#define O_RDONLY   0
+#define O_WRONLY   1
+#define O_RDWR     2
+
+/* MSRs SYSENTER loads the kernel's cs, esp and eip from */
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* CPUID leaf 1 sets this bit of edx on processors with SYSENTER */
+#define CPUID_EDX_SEP (1 << 11)
+
+/* IF is bit 9 in EFLAGS */
+#define EFLAGS_IF 0x200
 
 #ifndef ASM
 
@@ -34,6 +84,12 @@
 /* Enters a system call */
 void enter_syscall();
 
+/* Enters a system call through SYSENTER */
+void enter_sysenter();
+
+/* Points the SYSENTER MSRs at enter_sysenter if the processor has it */
+void sysenter_init(void);
+
 /* Opens a new system call */
 int32_t sys_open(const uint8_t *filename);
 
@@ -61,8 +117,24 @@ int32_t sys_vidmap(uint8_t **screen_start);
 /* Relinquish remainder of scheduled time to another process */
 int32_t sys_sched(int32_t unused);
 
-/* for internal use to spawn parentless processes */
-int32_t sys_exec_internal(const uint8_t *command, registers_t *parent_ctx);
+/* Reads into or writes from several buffers with one call */
+struct iovec;
+int32_t sys_readv(int32_t fd, const struct iovec *iov, int32_t iovcnt);
+int32_t sys_writev(int32_t fd, const struct iovec *iov, int32_t iovcnt);
+
+/* Gets or sets the flags of a file descriptor */
+int32_t sys_fcntl(int32_t fd, int32_t cmd, int32_t arg);
+
+/* Copies a file descriptor over another */
+int32_t sys_dup2(int32_t oldfd, int32_t newfd);
+
+/* Starts a program that runs alongside the caller */
+int32_t sys_spawn(const uint8_t *command);
+
+/* for internal use to spawn parentless processes, or with spawner set, ones
+ * that run alongside spawner */
+struct pcb;
+int32_t sys_exec_internal(const uint8_t *command, registers_t *parent_ctx, struct pcb *spawner);
 int32_t sys_halt_internal(int32_t pid, int32_t status);
 
 /* used by the kernel to relinquish sheduling time */
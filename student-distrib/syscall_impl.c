@@ -11,6 +11,11 @@
 #include "paging.h"
 #include "rtc.h"
 #include "sched.h"
+#include "shm.h"
+#include "ring.h"
+#include "wait.h"
+#include "pipe.h"
+#include "thread.h"
 
 /* IF is bit 9 in EFLAGS */
 #define FLAG_INT (1<<9)
@@ -31,8 +36,11 @@
 		: : "g"((_ss)), "g"((_esp)), "g"((_flags)), "g"((_cs)), "g"((_eip))   \
 		: "memory", "cc", "eax")
 
-uint8_t nprocs = 0;
-uint32_t proc_bitmap = 0;
+uint32_t nprocs = 0;
+
+/* Helper functions */
+static void inherit_std(pcb_t *pcb, pcb_t *parent);
+static int32_t copy_iov(iovec_t *vec, const iovec_t *iov, int32_t iovcnt);
 
 /* Sys Open:
  *
@@ -54,13 +62,14 @@ int32_t sys_open(const uint8_t *filename)
 		return -1;
 	}
 
+	/* hand the dentry over so the open doesn't look the name up again */
 	switch (dentry.file_type) {
 		case FILE_TYPE_REG:
-			return file_fops.open(get_proc_pcb(), filename);
+			return file_fops.open(get_proc_pcb(), &dentry);
 		case FILE_TYPE_DIR:
-			return dir_fops.open(get_proc_pcb(), filename);
+			return dir_fops.open(get_proc_pcb(), &dentry);
 		case FILE_TYPE_RTC:
-			return rtc_fops.open(get_proc_pcb(), filename);
+			return rtc_fops.open(get_proc_pcb(), &dentry);
 		default:
 			/* unknown type */
 			return -1;
@@ -107,8 +116,9 @@ int32_t sys_write(int32_t fd, const void *buf, int32_t nbytes)
 {
 	pcb_t *pcb;
 
-	/* no point writing if it's a null buffer */
-	if (!buf) {
+	/* no point writing if it's a null buffer, and a file write can't fault
+	 * partway through changing the file system */
+	if (!buf || (nbytes > 0 && !user_range_ok(buf, nbytes))) {
 		return -1;
 	}
 
@@ -123,6 +133,90 @@ int32_t sys_write(int32_t fd, const void *buf, int32_t nbytes)
 	return file->file_op->write(pcb, fd, buf, nbytes);
 }
 
+/* Sys Readv:
+ *  Reads into several buffers in turn with one call. Stops early when a
+ *  read comes up short, as at the end of a file or a line of input.
+ *
+ * INPUT: fd - file descriptor of file that is being read
+ *        iov - the buffers
+ *        iovcnt - how many, at most IOV_MAX
+ * Returns number of bytes read, -1 on fail
+ */
+int32_t sys_readv(int32_t fd, const iovec_t *iov, int32_t iovcnt)
+{
+	pcb_t *pcb;
+	file_t *file;
+	iovec_t vec[IOV_MAX];
+	int32_t i, ret, total;
+
+	pcb = get_proc_pcb();
+	file = get_file_from_fd(pcb, fd);
+
+	/* get_file_from_fd validates the fd for us */
+	if (!file || !(file->flags & FILE_PRESENT) || copy_iov(vec, iov, iovcnt)) {
+		return -1;
+	}
+
+	if (file->file_op->readv) {
+		return file->file_op->readv(pcb, fd, vec, iovcnt);
+	}
+
+	for (i = 0, total = 0; i < iovcnt; i++) {
+		ret = file->file_op->read(pcb, fd, vec[i].base, vec[i].len);
+		if (ret < 0) {
+			return total ? total : ret;
+		}
+		total += ret;
+		if (ret < vec[i].len) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+/* Sys Writev:
+ *  Writes several buffers in turn with one call, so the terminal can
+ *  draw them all and move its cursor once.
+ *
+ * INPUT: fd - file descriptor of file that is being written to
+ *        iov - the buffers
+ *        iovcnt - how many, at most IOV_MAX
+ * Returns number of bytes written, -1 on fail
+ */
+int32_t sys_writev(int32_t fd, const iovec_t *iov, int32_t iovcnt)
+{
+	pcb_t *pcb;
+	file_t *file;
+	iovec_t vec[IOV_MAX];
+	int32_t i, ret, total;
+
+	pcb = get_proc_pcb();
+	file = get_file_from_fd(pcb, fd);
+
+	/* get_file_from_fd validates the fd for us */
+	if (!file || !(file->flags & FILE_PRESENT) || copy_iov(vec, iov, iovcnt)) {
+		return -1;
+	}
+
+	if (file->file_op->writev) {
+		return file->file_op->writev(pcb, fd, vec, iovcnt);
+	}
+
+	for (i = 0, total = 0; i < iovcnt; i++) {
+		ret = file->file_op->write(pcb, fd, vec[i].base, vec[i].len);
+		if (ret < 0) {
+			return total ? total : ret;
+		}
+		total += ret;
+		if (ret < vec[i].len) {
+			break;
+		}
+	}
+
+	return total;
+}
+
 /* Sys Close:
  *
  * INPUT: fd - file descriptor of file that is being Closed
@@ -151,10 +245,17 @@ int32_t sys_close(int32_t fd)
 int32_t sys_exec(const uint8_t *command)
 {
 	int32_t ret;
+
+	/* the program would return to the thread, which is gone if the process
+	 * halts first; threads can spawn instead */
+	if (get_proc_pcb()->leader) {
+		return -1;
+	}
+
 	/* since command was actually passed in as eax, and since eax is the top of
 	 * the registers_t structure, the address of command is also a pointer to the
 	 * top of the hardware context of the syscall */
-	ret = sys_exec_internal(command, (registers_t *)&command);
+	ret = sys_exec_internal(command, (registers_t *)&command, NULL);
 
 	/* if ret > 0, we started a new process, else we've failed */
 	return (ret > 0) ? 0 : -1;
@@ -206,12 +307,12 @@ int32_t sys_getargs(uint8_t *buf, int32_t nbytes)
 int32_t sys_vidmap(uint8_t **screen_start)
 {
 	pcb_t *pcb;
-	if (screen_start < (uint8_t **)USER_MEM
-			|| screen_start >= (uint8_t **)(USER_MEM + OFFSET_4MB)) {
+	if (!user_range_ok(screen_start, sizeof(*screen_start))) {
 		return -1;
 	}
 
-	pcb = get_proc_pcb();
+	/* threads map it for their process, so it's kept across terminal switches */
+	pcb = get_proc_leader(get_proc_pcb());
 	install_user_vid_mem(pcb->page_directory, &user_video_mems[terminal_num]);
 	pcb->has_video_mapped = 1;
 
@@ -223,6 +324,114 @@ int32_t sys_vidmap(uint8_t **screen_start)
 	return 0;
 }
 
+/* Sys Fcntl:
+ *  Gets or sets the flags of an open file descriptor. O_NONBLOCK makes
+ *  reads of the terminal, the RTC and pipes return -EAGAIN rather than
+ *  wait. F_GETFL also reports the access mode, O_RDONLY for the read end
+ *  of a pipe and O_WRONLY for its write end.
+ *
+ * INPUT: fd - file descriptor
+ *        cmd - F_GETFL or F_SETFL
+ *        arg - new flags for F_SETFL
+ * Returns the flags for F_GETFL, 0 for F_SETFL, -1 on fail
+ */
+int32_t sys_fcntl(int32_t fd, int32_t cmd, int32_t arg)
+{
+	pcb_t *pcb;
+	file_t *file;
+	int32_t mode;
+
+	pcb = get_proc_pcb();
+	file = get_file_from_fd(pcb, fd);
+
+	/* get_file_from_fd validates the fd for us */
+	if (!file || !(file->flags & FILE_PRESENT)) {
+		return -1;
+	}
+
+	switch (cmd) {
+		case F_GETFL:
+			if (file->flags & FILE_RDONLY) {
+				mode = O_RDONLY;
+			}
+			else if (file->flags & FILE_WRONLY) {
+				mode = O_WRONLY;
+			}
+			else {
+				mode = O_RDWR;
+			}
+			return mode | ((file->flags & FILE_NONBLOCK) ? O_NONBLOCK : 0);
+		case F_SETFL:
+			if (arg & ~(O_NONBLOCK | O_ACCMODE)) {
+				return -1;
+			}
+			if (arg & O_NONBLOCK) {
+				file->flags |= FILE_NONBLOCK;
+			}
+			else {
+				file->flags &= ~FILE_NONBLOCK;
+			}
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+/* Sys Dup2:
+ *  Makes newfd a copy of oldfd, closing whatever newfd had open first.
+ *  Only descriptors that can be shared, the terminal and pipes, can be
+ *  copied.
+ *
+ * INPUT: oldfd - descriptor to copy
+ *        newfd - descriptor to copy it to
+ * Returns newfd on success, -1 on fail
+ */
+int32_t sys_dup2(int32_t oldfd, int32_t newfd)
+{
+	pcb_t *pcb;
+	file_t *old, *new;
+
+	pcb = get_proc_pcb();
+	old = get_file_from_fd(pcb, oldfd);
+	new = get_file_from_fd(pcb, newfd);
+
+	/* get_file_from_fd validates the fds for us */
+	if (!old || !new || !(old->flags & FILE_PRESENT) || !old->file_op->dup) {
+		return -1;
+	}
+
+	if (oldfd == newfd) {
+		return newfd;
+	}
+
+	/* stdin and stdout of the terminal won't close, they're just replaced */
+	if (new->flags & FILE_PRESENT) {
+		(void)new->file_op->close(pcb, newfd);
+	}
+
+	*new = *old;
+	if (new->file_op->dup(pcb, newfd)) {
+		release_fd(pcb, newfd);
+		return -1;
+	}
+
+	return newfd;
+}
+
+/* Sys Spawn:
+ *  Starts a program that runs alongside the caller, where execute runs it
+ *  in the caller's place. It gets copies of the caller's stdin and stdout,
+ *  so a shell can connect programs with pipes. Nothing waits for it and
+ *  its exit status is dropped.
+ *
+ * INPUT: command - command to run, as for execute
+ * Returns the new process's pid on success, -1 on fail
+ */
+int32_t sys_spawn(const uint8_t *command)
+{
+	return sys_exec_internal(command, NULL, get_proc_pcb());
+}
+
 /*
  * sys_sched
  *   Relinquishes the remaining scheduled time to another process
@@ -254,9 +463,10 @@ int32_t sys_sched(int32_t unused)
  *
  * INPUT: Command - Command to be executed
  *        parent_ctx - context data of the parent process of the to-be spawned process
+ *        spawner - process the new one runs alongside, NULL if it's not spawned
  * Returns 0 on success, -1 on fail
  */
-int32_t sys_exec_internal(const uint8_t *command, registers_t *parent_ctx)
+int32_t sys_exec_internal(const uint8_t *command, registers_t *parent_ctx, pcb_t *spawner)
 {
 	uint8_t file_name[MAX_CMD_LEN];
 	int32_t i, fn_cnt;
@@ -267,7 +477,6 @@ int32_t sys_exec_internal(const uint8_t *command, registers_t *parent_ctx)
 	uint32_t old_pdbr;
 	uint32_t kern_esp;
 	uint32_t user_esp;
-	int32_t pid;
 	pcb_t *pcb;
 	dentry_t dentry;
 
@@ -294,129 +503,127 @@ int32_t sys_exec_internal(const uint8_t *command, registers_t *parent_ctx)
 		goto fail;
 	}
 
-	if (nprocs < MAX_PROCESSES) {
-		cli_and_save(flags);
+	cli_and_save(flags);
 
-		/* increase our process counter */
-		nprocs++;
+	/* Get a pid and memory for the process, if none are available, call pid_fail */
+	pcb = proc_create();
+	if (!pcb) {
+		goto pid_fail;
+	}
 
-		/* Get first free pid, if none are available, call pid_fail */
-		pid = get_first_free_pid();
-		if(pid == -1) {
-			goto pid_fail;
-		}
+	/* increase our process counter */
+	nprocs++;
 
-		/* calculate location of bottom of process's stack */
-		kern_esp = (KERNEL_MEM + OFFSET_4MB - USER_STACK_SIZE * pid - 1) & ALIGN_4B;
-		user_esp = (USER_MEM + OFFSET_4MB - 1) & ALIGN_4B;
-
-		/* obtain and initialize the PCB */
-		pcb = (pcb_t *)(kern_esp & ALIGN_8KB);
-		memset(pcb, 0, sizeof(*pcb));
-		pcb->pid = pid;
-		pcb->kern_stack = kern_esp;
-		pcb->user_stack = user_esp;
-		pcb->sched_ctx = NULL;
-		pcb->page_directory = &page_directories[pcb->pid];
-
-		/* Save old state */
-		pcb->parent_ctx = parent_ctx;
-
-		/* copy args into pcb, first eat leading spaces */
-		for (c = command; *c == (uint8_t)' '; i++, c++) {
-			/* skip space */
-		}
+	/* bottom of the process's stacks */
+	kern_esp = pcb->kern_stack;
+	user_esp = pcb->user_stack;
 
-		/* copy args to buffer in pcb */
-		strncpy((int8_t *)pcb->cmd_args, (int8_t *)c, MAX_ARGS_LEN);
+	/* Save old state */
+	pcb->parent_ctx = parent_ctx;
 
-		/* strncpy doesn't set last char to NULL if full length is read */
-		pcb->cmd_args[MAX_ARGS_LEN] = '\0';
+	/* copy args into pcb, first eat leading spaces */
+	for (c = command; *c == (uint8_t)' '; i++, c++) {
+		/* skip space */
+	}
 
-		/* store parent pcb if called from a process, will be null if called
-		 * from the kernel */
-		if (parent_ctx) {
-			pcb->parent = get_proc_pcb();
-		}
-		else {
-			pcb->parent = NULL;
-		}
+	/* copy args to buffer in pcb */
+	strncpy((int8_t *)pcb->cmd_args, (int8_t *)c, MAX_ARGS_LEN);
+
+	/* strncpy doesn't set last char to NULL if full length is read */
+	pcb->cmd_args[MAX_ARGS_LEN] = '\0';
+
+	/* store parent pcb if called from a process, will be null if called
+	 * from the kernel */
+	if (parent_ctx) {
+		pcb->parent = get_proc_pcb();
+		inherit_video_mem(pcb->page_directory, pcb->parent->page_directory);
+	}
+	else {
+		pcb->parent = NULL;
+	}
 
+	if (spawner) {
+		/* share the spawner's terminal without taking it over */
+		pcb->detached = 1;
+		pcb->term_ctx = get_term_ctx(spawner);
+		inherit_video_mem(pcb->page_directory, spawner->page_directory);
+	}
+	else {
 		/* set up the terminal driver */
 		term_fops.open(pcb, NULL);
+	}
 
-		/* save old page directory */
-		get_pdbr(old_pdbr);
+	/* keep pipes the parent put on stdin and stdout */
+	inherit_std(pcb, spawner ? spawner : pcb->parent);
 
-		/* set new page directory */
-		set_pdbr(pcb->page_directory);
+	/* save old page directory */
+	get_pdbr(old_pdbr);
 
-		/* load the executable */
-		/* TODO: do this earlier somehow? It's hard, since it needs to be done
-		 *      after swapping page tables, but swapping page tables screws up
-		 *      the current process's stack. Otherwise we do all this work and
-		 *      may end up failing to a non-executable. */
-		status = file_loader(&dentry, &eip);
-		if (status) {
-			goto exit_paging;
-		}
+	/* set new page directory */
+	set_pdbr(pcb->page_directory);
 
-		if (parent_ctx) {
-			/* if we're executing on behalf of a userspace program, we'll jump straight
-			 * into execution */
-			tss.ss0 = KERNEL_DS;
-			tss.esp0 = kern_esp;
+	/* load the executable */
+	/* TODO: do this earlier somehow? It's hard, since it needs to be done
+	 *      after swapping page tables, but swapping page tables screws up
+	 *      the current process's stack. Otherwise we do all this work and
+	 *      may end up failing to a non-executable. */
+	status = file_loader(&dentry, &eip);
+	if (status) {
+		goto exit_paging;
+	}
 
-			/* exec the actual process. this WON'T return */
-			enter_userland(USER_DS, user_esp, flags, USER_CS, eip);
-		}
+	if (parent_ctx) {
+		/* if we're executing on behalf of a userspace program, we'll jump straight
+		 * into execution */
+		tss.ss0 = KERNEL_DS;
+		tss.esp0 = kern_esp;
 
-		/* set the context in the PCB */
-		pcb->sched_ctx = (registers_t *)kern_esp - 1;
-		/* iret context */
-		pcb->sched_ctx->ss = USER_DS;
-		pcb->sched_ctx->user_esp = user_esp;
-		/* ensure interrupt flag is set, as this may be called with the flag cleared */
-		pcb->sched_ctx->eflags = FLAG_INT;
-		pcb->sched_ctx->cs = USER_CS;
-		pcb->sched_ctx->eip = eip;
-		/* unused filler */
-		pcb->sched_ctx->isrno = 0;
-		pcb->sched_ctx->errno = 0;
-		/* segments */
-		pcb->sched_ctx->fs = USER_DS;
-		pcb->sched_ctx->es = USER_DS;
-		pcb->sched_ctx->ds = USER_DS;
-		/* general purpose registers */
-		pcb->sched_ctx->eax = 0;
-		pcb->sched_ctx->ebp = 0;
-		pcb->sched_ctx->edi = 0;
-		pcb->sched_ctx->esi = 0;
-		pcb->sched_ctx->edx = 0;
-		pcb->sched_ctx->ecx = 0;
-		pcb->sched_ctx->ebx = 0;
-
-		/* needed so the process will get scheduled eventually */
-		push_to_active(pcb->pid);
-
-		/* since we may be returning to the parent process, restore the pdbr */
-		set_pdbr(old_pdbr);
-
-		goto out;
-	}
-	else {
-		goto fail;
+		/* exec the actual process. this WON'T return */
+		enter_userland(USER_DS, user_esp, flags, USER_CS, eip);
 	}
 
+	/* set the context in the PCB */
+	pcb->sched_ctx = (registers_t *)kern_esp - 1;
+	/* iret context */
+	pcb->sched_ctx->ss = USER_DS;
+	pcb->sched_ctx->user_esp = user_esp;
+	/* ensure interrupt flag is set, as this may be called with the flag cleared */
+	pcb->sched_ctx->eflags = FLAG_INT;
+	pcb->sched_ctx->cs = USER_CS;
+	pcb->sched_ctx->eip = eip;
+	/* unused filler */
+	pcb->sched_ctx->isrno = 0;
+	pcb->sched_ctx->errno = 0;
+	/* segments */
+	pcb->sched_ctx->fs = USER_DS;
+	pcb->sched_ctx->es = USER_DS;
+	pcb->sched_ctx->ds = USER_DS;
+	/* general purpose registers */
+	pcb->sched_ctx->eax = 0;
+	pcb->sched_ctx->ebp = 0;
+	pcb->sched_ctx->edi = 0;
+	pcb->sched_ctx->esi = 0;
+	pcb->sched_ctx->edx = 0;
+	pcb->sched_ctx->ecx = 0;
+	pcb->sched_ctx->ebx = 0;
+
+	/* needed so the process will get scheduled eventually */
+	push_to_active(pcb->pid);
+
+	/* since we may be returning to the parent process, restore the pdbr */
+	set_pdbr(old_pdbr);
+
+	goto out;
+
 exit_paging:
-	free_pid(pcb->pid);
 	set_pdbr(old_pdbr);
 	if (pcb->parent) {
 		tss.ss0 = KERNEL_DS;
 		tss.esp0 = pcb->parent->kern_stack;
 	}
-pid_fail:
+	proc_destroy(pcb);
 	--nprocs;
+pid_fail:
 	restore_flags(flags);
 fail:
 	return -1;
@@ -429,23 +636,59 @@ int32_t sys_halt_internal(int32_t pid, int32_t status)
 {
 	int32_t term_id;
 	int32_t i;
+	int32_t killed_self;
 	file_t *file;
 	uint32_t flags;
 
 	cli_and_save(flags);
 
+	/* a change to the file system can't be stopped halfway, let it finish */
+	pcb_t *pcb;
+	do {
+		pcb = get_pcb_from_pid(pid);
+		if (!pcb || pcb->halting) {
+			restore_flags(flags);
+			return -1;
+		}
+	} while (fs_halting(pcb));
+
+	pcb->halting = 1;
+
+	if (pcb->leader) {
+		/* a thread, the process keeps everything else */
+		thread_destroy(pcb);
+		if (pcb == get_proc_pcb()) {
+			sched();
+		}
+
+		restore_flags(flags);
+		return 0;
+	}
+
+	/* threads go with their process, we can't return to one that's running */
+	killed_self = thread_destroy_all(pcb);
+
 	nprocs--;
-	pcb_t *pcb = get_pcb_from_pid(pid);
-	free_pid(pcb->pid);
 
 	/* close all open files */
-	for (i = 0; i < MAX_FILES; i++) {
-		file = &pcb->file_array[i];
+	for (i = 0; i < (int32_t)pcb->nfiles; i++) {
+		file = get_file_from_fd(pcb, i);
 		if (file->flags & (FILE_OPEN | FILE_PRESENT)) {
 			file->file_op->close(pcb, i);
 		}
 	}
 
+	/* drop shared memory and the system call ring */
+	shm_release_all(pcb);
+	ring_release(pcb);
+
+	/* stop waiting on anything if it was killed in its sleep */
+	wait_remove_all(pcb);
+	pcb->state &= ~TASK_INTERRUPTIBLE;
+
+	/* give up the pid, memory is released once we're off this process */
+	proc_destroy(pcb);
+
 	/* Scheduling: halting child, set for removal */
 	pcb->state |= EXIT_DEAD;
 
@@ -456,6 +699,15 @@ int32_t sys_halt_internal(int32_t pid, int32_t status)
 		term_pids[term_id] = pcb->parent->pid;
 		pcb->parent_ctx->eax = status;
 	}
+	else if (pcb->detached) {
+		/* spawned, nobody's waiting on us */
+		if (pcb == get_proc_pcb() || killed_self) {
+			sched();
+		}
+
+		restore_flags(flags);
+		return 0;
+	}
 	else {
 		/* do whatcha want */
 		printf("EXITING LAST SHELL IN TERMINAL\n");
@@ -465,7 +717,7 @@ int32_t sys_halt_internal(int32_t pid, int32_t status)
 		term_pids[term_id] = -1;
 
 		/* let the scheduler kill us off for good */
-		if (pcb == get_proc_pcb()) {
+		if (pcb == get_proc_pcb() || killed_self) {
 			/* yield if we're calling for ourself */
 			sched();
 		}
@@ -494,9 +746,80 @@ int32_t sys_halt_internal(int32_t pid, int32_t status)
 		pcb->parent->sched_ctx = pcb->parent_ctx;
 	}
 
+	if (killed_self) {
+		sched();
+	}
+
 	restore_flags(flags);
 
 	return 0;
 }
 
 
+
+/*
+ * Gives a new process copies of its parent's stdin and stdout in place of
+ * its own terminal ones. Ones the parent closed or that can't be shared are
+ * left alone.
+ *
+ * Inputs: pcb - the new process
+ *         parent - process it's copying from, may be NULL
+ * Outputs: none
+ */
+static void inherit_std(pcb_t *pcb, pcb_t *parent)
+{
+	file_t *file;
+	int32_t fd;
+
+	if (!parent) {
+		return;
+	}
+
+	for (fd = STDIN; fd <= STDOUT; fd++) {
+		file = get_file_from_fd(parent, fd);
+		if (!(file->flags & FILE_PRESENT) || !file->file_op->dup) {
+			continue;
+		}
+
+		pcb->file_array[fd] = *file;
+		if (file->file_op->dup(pcb, fd)) {
+			release_fd(pcb, fd);
+		}
+	}
+}
+
+/*
+ * Copies a process's buffer list into the kernel, so it can't change while
+ * it's used, and checks it
+ *
+ * Inputs: vec - room for IOV_MAX buffers
+ *         iov - the process's list
+ *         iovcnt - how many it has
+ * Outputs: 0 if they're all in the process's memory and their total fits
+ *          in an int32_t, -1 otherwise
+ */
+static int32_t copy_iov(iovec_t *vec, const iovec_t *iov, int32_t iovcnt)
+{
+	uint32_t total;
+	int32_t i;
+
+	if (iovcnt < 0 || iovcnt > IOV_MAX
+			|| !user_range_ok(iov, iovcnt * sizeof(iovec_t))) {
+		return -1;
+	}
+
+	memcpy(vec, iov, iovcnt * sizeof(iovec_t));
+
+	/* both stay under 2^31, so the sum can't wrap */
+	for (i = 0, total = 0; i < iovcnt; i++) {
+		if (vec[i].len < 0 || (vec[i].len && !user_range_ok(vec[i].base, vec[i].len))) {
+			return -1;
+		}
+		total += vec[i].len;
+		if (total > 0x7FFFFFFF) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
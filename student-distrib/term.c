@@ -8,7 +8,9 @@
 #include "queue.h"
 #include "proc.h"
 #include "syscall.h"
+#include "file_sys.h"
 #include "term.h"
+#include "poll.h"
 
 /* XXX: ENABLING AWFUL (wonderful*) HACK BELOW */
 #include "i8259.h"
@@ -19,6 +21,9 @@ fops_t term_fops = {
 	.write = &term_write,
 	.open  = &term_open,
 	.close = &term_close,
+	.poll  = &term_poll,
+	.dup   = &term_dup,
+	.writev = &term_writev,
 };
 
 /* global terminal context, used by the kernel */
@@ -162,6 +167,7 @@ int32_t term_init_global_ctx()
 
 		/* initialize individual terminal */
 		init_ctx(&term_terms[i]);
+		wait_init(&term_terms[i].key_wait);
 	}
 
 	return 0;
@@ -170,9 +176,9 @@ int32_t term_init_global_ctx()
 /* open terminal fd
  * Returns: STDIN
  */
-int32_t term_open(pcb_t *pcb, const uint8_t *filename)
+int32_t term_open(pcb_t *pcb, const struct dentry *dentry)
 {
-	(void)filename; /* we don't use the filename for terminal */
+	(void)dentry; /* terminals aren't in the file system */
 	screen_t *screen;
 	term_t *term;
 
@@ -220,15 +226,28 @@ int32_t term_open(pcb_t *pcb, const uint8_t *filename)
 }
 
 /* closes terminal fd
- * fails always!
+ * fails for stdin and stdout, copies made by dup2 can be closed
  */
 int32_t term_close(pcb_t *pcb, int32_t fd)
+{
+	if (fd == STDIN || fd == STDOUT) {
+		return -1;
+	}
+
+	release_fd(pcb, fd);
+	return 0;
+}
+
+/* copies of the terminal share nothing, so there's nothing to count
+ */
+int32_t term_dup(pcb_t *pcb, int32_t fd)
 {
 	(void)pcb; (void)fd;
-	return -1;
+	return 0;
 }
 
 /* if fd is STDIN, proceed as normal, otherwise fail 
+ * non-blocking descriptors get -EAGAIN instead of waiting for a line
  */
 int32_t term_read(pcb_t *pcb, int32_t fd, void *buf, int32_t nbytes)
 {
@@ -238,6 +257,10 @@ int32_t term_read(pcb_t *pcb, int32_t fd, void *buf, int32_t nbytes)
 	int ok;
 	int8_t c = 0;
 	int8_t *buffer = (int8_t *)buf;
+	uint32_t flags;
+	uint32_t nb_flags = 0;
+	file_t *file;
+	int nonblock;
 
 	if (fd != STDIN) {
 		return -1;
@@ -253,6 +276,18 @@ int32_t term_read(pcb_t *pcb, int32_t fd, void *buf, int32_t nbytes)
 		return -1;
 	}
 
+	/* non-blocking reads take a whole line or nothing, with keys held off
+	 * so the line can't be cleared out from under us */
+	file = get_file_from_fd(pcb, fd);
+	nonblock = file && (file->flags & FILE_NONBLOCK);
+	if (nonblock) {
+		cli_and_save(nb_flags);
+		if (!(term_poll(pcb, fd, NULL) & POLLIN)) {
+			restore_flags(nb_flags);
+			return -EAGAIN;
+		}
+	}
+
 	do {
 		/* dequeue a character and test for backspace and screen clear */
 		CIRC_BUF_POP(term->key_buf, c, ok);
@@ -273,19 +308,72 @@ int32_t term_read(pcb_t *pcb, int32_t fd, void *buf, int32_t nbytes)
 			}
 		}
 		else {
-			/* no data, sleep */
-			sched();
+			/* no data, sleep until a key comes in, checking again with
+			 * interrupts off so it can't come in first */
+			cli_and_save(flags);
+			if (CIRC_BUF_EMPTY(term->key_buf)) {
+				sleep_on(&term->key_wait);
+			}
+			restore_flags(flags);
 		}
 	} while (c != '\n' && idx < nbytes);
 
+	if (nonblock) {
+		restore_flags(nb_flags);
+	}
+
 	return idx;
 }
 
+/* STDIN is readable once a whole line is waiting, a read then stops at its
+ * end at the latest. Keys wake the terminal's key_wait queue.
+ */
+int32_t term_poll(pcb_t *pcb, int32_t fd, struct wait_entry *wait)
+{
+	term_t *term;
+	int32_t i, n;
+
+	if (fd == STDOUT) {
+		return POLLOUT;
+	}
+
+	term = get_term_ctx(pcb);
+	if (fd != STDIN || !term) {
+		return POLLNVAL;
+	}
+
+	if (wait) {
+		wait_add(&term->key_wait, wait);
+	}
+
+	n = BUF_PTR_DIFF(term->key_buf, tail, head);
+	for (i = 0; i < n; i++) {
+		if (*CIRC_BUF_IDX(term->key_buf, i) == '\n') {
+			return POLLIN;
+		}
+	}
+
+	return 0;
+}
+
 /* if fd is STDOUT, proceed as normal, otherwise fail 
  */
 int32_t term_write(pcb_t *pcb, int32_t fd, const void *buf, int32_t nbytes)
+{
+	iovec_t iov;
+
+	iov.base = (void *)buf;
+	iov.len = nbytes;
+
+	return term_writev(pcb, fd, &iov, 1);
+}
+
+/* writes every buffer to STDOUT, moving the cursor once at the end
+ */
+int32_t term_writev(pcb_t *pcb, int32_t fd, const iovec_t *iov, int32_t iovcnt)
 {
 	int idx;
+	int32_t i, total;
 	screen_t *screen;
 
 	if (fd != STDOUT) {
@@ -297,8 +385,11 @@ int32_t term_write(pcb_t *pcb, int32_t fd, const void *buf, int32_t nbytes)
 		return -1;
 	}
 
-	for (idx = 0; idx < nbytes; idx++) {
-		term_putc(screen, ((int8_t *)buf)[idx]);
+	for (i = 0, total = 0; i < iovcnt; i++) {
+		for (idx = 0; idx < iov[i].len; idx++) {
+			term_putc(screen, ((int8_t *)iov[i].base)[idx]);
+		}
+		total += idx;
 	}
 
 	/* update based on screen location, but only if it's active */
@@ -306,7 +397,7 @@ int32_t term_write(pcb_t *pcb, int32_t fd, const void *buf, int32_t nbytes)
 		screen_update_cursor(screen);
 	}
 
-	return idx;
+	return total;
 }
 
 /* Handles the keypress of a terminal
@@ -349,6 +440,7 @@ void term_handle_keypress(uint16_t key, uint8_t status)
 			screen_update_cursor(screen);
 			CIRC_BUF_INIT(term->key_buf);
 			CIRC_BUF_PUSH(term->key_buf, KBD_KEY_NULL, ok);
+			wake_up(&term->key_wait);
 			return;
 		}
 		if ( ((term->lctrl_held || term->rctrl_held) && key == KBD_KEY_C) ||
@@ -358,7 +450,9 @@ void term_handle_keypress(uint16_t key, uint8_t status)
 			if (term_pids[terminal_num] > 0) {
 				/* XXX: AWFUL HACK */
 				send_eoi(KBD_IRQ_PORT);
-				sys_halt_internal(term_pids[terminal_num], 256);
+				if (!fs_halt_later(term_pids[terminal_num])) {
+					sys_halt_internal(term_pids[terminal_num], 256);
+				}
 			}
 
 			/* just return here or the last character of the chord gets added
@@ -428,13 +522,17 @@ void term_handle_keypress(uint16_t key, uint8_t status)
 								CIRC_BUF_PUSH(term->key_buf, key, ok);
 							}
 						}
-						else {
+						else if (key == '\n' || BUF_PTR_DIFF(term->key_buf, tail, head)
+								< SIZEOF_BUF(term->key_buf) - 3) {
+							/* the last slot is kept for enter, so a full line can
+							 * always be finished */
 							CIRC_BUF_PUSH(term->key_buf, key, ok);
 							if (ok) {
 								term_putc(screen, (int8_t)key);
 							}
 						}
 						screen_update_cursor(screen);
+						wake_up(&term->key_wait);
 					}
 				}
 				break;
@@ -503,7 +601,7 @@ static int32_t switch_terminals(int32_t new_terminal)
 	/* Check for an existing process on the terminal we're switching to */
 	if (term_pids[terminal_num] < 0) {
 		/* spawn a new terminal */
-		new_pid = sys_exec_internal((uint8_t*)"shell", NULL);
+		new_pid = sys_exec_internal((uint8_t*)"shell", NULL, NULL);
 		if (new_pid <= 0) {
 			return -1;
 		}
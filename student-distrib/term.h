@@ -6,6 +6,7 @@
 
 #include "types.h"
 #include "queue.h"
+#include "wait.h"
 
 /****************************************
  *            Global Defines            *
@@ -32,6 +33,8 @@
 struct fops;
 struct screen;
 struct pcb;
+struct dentry;
+struct iovec;
 
 /* Terminal struct
  */
@@ -39,6 +42,9 @@ typedef struct terminal {
 	/* Defines a circular buffer for keypresses */
 	DECLARE_CIRC_BUF(int8_t, key_buf, KBD_BUF_SIZE);
 
+	/* readers sleeping until a key comes in */
+	wait_queue_t key_wait;
+
 	/* handle modifier keys */
 	int8_t lctrl_held;
 	int8_t rctrl_held;
@@ -67,7 +73,7 @@ extern term_t term_terms[];
 
 /* Opens a terminal 
  */
-int32_t term_open(struct pcb *pcb, const uint8_t *filename);
+int32_t term_open(struct pcb *pcb, const struct dentry *dentry);
 
 /* Closes a terminal
  */
@@ -77,10 +83,22 @@ int32_t term_close(struct pcb *pcb, int32_t fd);
  */
 int32_t term_read(struct pcb *pcb, int32_t fd, void *buf, int32_t nbytes);
 
+/* Counts a copy of a terminal descriptor, there's nothing to count
+ */
+int32_t term_dup(struct pcb *pcb, int32_t fd);
+
+/* Checks whether the terminal can be read or written without waiting
+ */
+int32_t term_poll(struct pcb *pcb, int32_t fd, struct wait_entry *wait);
+
 /* Writes to the terminal
  */
 int32_t term_write(struct pcb *pcb, int32_t fd, const void *buf, int32_t nbytes);
 
+/* Writes several buffers to the terminal, moving the cursor once
+ */
+int32_t term_writev(struct pcb *pcb, int32_t fd, const struct iovec *iov, int32_t iovcnt);
+
 /* Handles the keypress of a terminal
  */
 void term_handle_keypress(uint16_t key, uint8_t status);
@@ -0,0 +1,211 @@
+/* thread.c - threads sharing a process's memory and descriptors
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "paging.h"
+#include "frame.h"
+#include "x86_desc.h"
+#include "proc.h"
+#include "sched.h"
+#include "syscall.h"
+#include "wait.h"
+#include "thread.h"
+
+/* Helper functions */
+static int32_t thread_stack_page(pcb_t *leader, uint32_t addr);
+
+/*
+ * Thread Create:
+ *  Starts a thread of the caller's process. It's scheduled on its own,
+ *  with its own kernel stack and a user stack in the thread window, and
+ *  shares the page directory, descriptors, heap, and everything else with
+ *  the process, so switching between them doesn't reload CR3. It runs
+ *  entry(arg), and returns from entry to done, which should halt. Halting
+ *  a thread ends only it; halting the process ends all of its threads.
+ *
+ * INPUT: entry - function the thread runs
+ *        arg - passed to entry
+ *        done - where entry returns to
+ * Returns the thread's pid on success, -1 on fail
+ */
+int32_t sys_thread_create(void (*entry)(void *), void *arg, void (*done)(void))
+{
+	pcb_t *leader, *thread;
+	registers_t *ctx;
+	uint32_t flags;
+	uint32_t esp;
+	int32_t slot;
+
+	/* both are code, and code is in the program's 4MB page */
+	if ((uint32_t)entry < USER_MEM || (uint32_t)entry >= USER_MEM + OFFSET_4MB
+			|| (uint32_t)done < USER_MEM || (uint32_t)done >= USER_MEM + OFFSET_4MB) {
+		return -1;
+	}
+
+	/* a thread starting a thread adds it to the process */
+	leader = get_proc_leader(get_proc_pcb());
+	if (!leader) {
+		return -1;
+	}
+
+	cli_and_save(flags);
+
+	for (slot = 0; slot < THREAD_MAX; slot++) {
+		if (!(leader->thread_stacks & (1UL << slot))) {
+			break;
+		}
+	}
+
+	if (slot == THREAD_MAX) {
+		goto fail;
+	}
+
+	thread = proc_create_thread(leader);
+	if (!thread) {
+		goto fail;
+	}
+
+	thread->thread_slot = slot;
+	leader->thread_stacks |= 1UL << slot;
+
+	/* entry finds its argument above the return address, like any call.
+	 * We're on the process's page directory, so it can be written here. */
+	esp = THREAD_STACK_BASE(slot) + THREAD_STACK_SIZE - 2 * sizeof(uint32_t);
+	if (thread_stack_page(leader, esp)) {
+		goto fail_thread;
+	}
+	((uint32_t *)esp)[0] = (uint32_t)done;
+	((uint32_t *)esp)[1] = (uint32_t)arg;
+
+	/* the scheduler starts it by returning to this context */
+	ctx = (registers_t *)thread->kern_stack - 1;
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->ss = USER_DS;
+	ctx->user_esp = esp;
+	ctx->eflags = EFLAGS_IF;
+	ctx->cs = USER_CS;
+	ctx->eip = (uint32_t)entry;
+	ctx->fs = USER_DS;
+	ctx->es = USER_DS;
+	ctx->ds = USER_DS;
+	thread->sched_ctx = ctx;
+
+	nprocs++;
+	push_to_active(thread->pid);
+
+	restore_flags(flags);
+	return thread->pid;
+
+fail_thread:
+	leader->thread_stacks &= ~(1UL << slot);
+	proc_destroy(thread);
+fail:
+	restore_flags(flags);
+	return -1;
+}
+
+/*
+ * Handles a not-present fault inside a thread stack of the current process
+ * by mapping a freshly zeroed page there, like heap_fault does for the heap.
+ *
+ * Inputs: addr - the faulting address (cr2)
+ * Outputs: 0 if the fault was handled and the access can be retried,
+ *          -1 if it's a real fault
+ */
+int32_t thread_fault(uint32_t addr)
+{
+	pcb_t *leader;
+
+	leader = get_proc_leader(get_proc_pcb());
+	if (!leader || addr < USER_THREADS || addr >= USER_THREADS_END) {
+		return -1;
+	}
+
+	return thread_stack_page(leader, addr);
+}
+
+/*
+ * Releases a halting thread: gives back its user stack and its pid, and
+ * takes it off anything it's sleeping on. Its kernel stack is freed by
+ * proc_reap once we're off it. Called with interrupts off.
+ *
+ * Inputs: pcb - the halting thread
+ * Outputs: none
+ */
+void thread_destroy(pcb_t *pcb)
+{
+	uint32_t base, addr;
+	pte_t entry;
+
+	base = THREAD_STACK_BASE(pcb->thread_slot);
+	for (addr = base + PAGE_SIZE; addr < base + THREAD_STACK_SIZE; addr += PAGE_SIZE) {
+		entry = unmap_user_page(pcb->page_directory, addr);
+		if (entry.present && (entry.val & PG_OWNED)) {
+			kpage_free((void *)(entry.page_base_addr << 12), 0);
+		}
+	}
+	pcb->leader->thread_stacks &= ~(1UL << pcb->thread_slot);
+
+	wait_remove_all(pcb);
+	pcb->state &= ~TASK_INTERRUPTIBLE;
+
+	proc_destroy(pcb);
+	pcb->state |= EXIT_DEAD;
+	nprocs--;
+}
+
+/*
+ * Releases every thread of a halting process, since they can't run without
+ * its memory. Called with interrupts off.
+ *
+ * Inputs: leader - the halting process
+ * Outputs: nonzero if the running thread was one of them, so the caller
+ *          mustn't return to it
+ */
+int32_t thread_destroy_all(pcb_t *leader)
+{
+	pcb_t *pcb;
+	int32_t pid;
+	int32_t self = 0;
+
+	for (pid = 1; pid < MAX_PROCESSES && leader->thread_stacks; pid++) {
+		pcb = pcb_table[pid];
+		if (pcb && pcb->leader == leader) {
+			self |= (pcb == get_proc_pcb());
+			thread_destroy(pcb);
+		}
+	}
+
+	return self;
+}
+
+/*
+ * Maps a zeroed page at addr if it's in a thread stack that's in use,
+ * above the stack's guard page
+ */
+static int32_t thread_stack_page(pcb_t *leader, uint32_t addr)
+{
+	uint32_t slot;
+	void *page;
+
+	slot = (addr - USER_THREADS) / THREAD_STACK_SIZE;
+	if (!(leader->thread_stacks & (1UL << slot))
+			|| addr - THREAD_STACK_BASE(slot) < PAGE_SIZE) {
+		return -1;
+	}
+
+	page = kpage_alloc_user();
+	if (!page) {
+		return -1;
+	}
+	memset(page, 0, PAGE_SIZE);
+
+	if (map_user_page(leader->page_directory, addr & ~PAGE_OFFSET_MASK, (uint32_t)page,
+				PG_WRITE | PG_OWNED)) {
+		kpage_free(page, 0);
+		return -1;
+	}
+
+	return 0;
+}
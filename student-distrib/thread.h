@@ -0,0 +1,48 @@
+/* thread.h - threads sharing a process's memory and descriptors
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _THREAD_H
+#define _THREAD_H
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+
+/****************************************
+ *            Global Defines            *
+ ****************************************/
+
+/* threads a process may have at once, one bit each in pcb->thread_stacks */
+#define THREAD_MAX 32
+
+/* each thread's user stack, the bottom page is never mapped so running off
+ * the end faults instead of running into the next stack */
+#define THREAD_STACK_SIZE 0x10000
+
+#define USER_THREADS_END  (USER_THREADS + THREAD_MAX * THREAD_STACK_SIZE)
+
+/* lowest address of a thread stack */
+#define THREAD_STACK_BASE(slot) (USER_THREADS + (slot) * THREAD_STACK_SIZE)
+
+#ifndef ASM
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Starts a thread of the caller's process running entry(arg) */
+int32_t sys_thread_create(void (*entry)(void *), void *arg, void (*done)(void));
+
+/* Backs a faulting thread stack address with a zeroed page, 0 if it was
+ * handled */
+int32_t thread_fault(uint32_t addr);
+
+/* Releases a halting thread */
+void thread_destroy(pcb_t *pcb);
+
+/* Releases every thread of a halting process, nonzero if the running one
+ * was among them */
+int32_t thread_destroy_all(pcb_t *leader);
+
+#endif /* ASM */
+#endif /* _THREAD_H */
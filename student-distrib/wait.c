@@ -0,0 +1,250 @@
+/* wait.c - wait queues for processes sleeping until something happens
+ * vim:ts=4 sw=4 noexpandtab
+ */
+
+#include "lib.h"
+#include "proc.h"
+#include "sched.h"
+#include "syscall.h"
+#include "wait.h"
+
+/* Helper functions */
+static void wait_wake(pcb_t *pcb);
+
+/*
+ * Empties a wait queue.
+ *
+ * Inputs: queue - the queue
+ * Outputs: none
+ */
+void wait_init(wait_queue_t *queue)
+{
+	queue->head = NULL;
+}
+
+/*
+ * Puts an entry on a queue and on its process's list of entries. The
+ * process isn't asleep until it calls wait_sleep, so it can add itself to
+ * several queues first.
+ *
+ * Inputs: queue - queue to wait on
+ *         entry - entry with its pcb filled in, lives until it's removed
+ * Outputs: none
+ */
+void wait_add(wait_queue_t *queue, wait_entry_t *entry)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	entry->queue = queue;
+	entry->next = queue->head;
+	queue->head = entry;
+
+	entry->pcb_next = entry->pcb->waits;
+	entry->pcb->waits = entry;
+
+	restore_flags(flags);
+}
+
+/*
+ * Takes an entry off its queue and its process's list.
+ *
+ * Inputs: entry - an entry from wait_add
+ * Outputs: none
+ */
+void wait_remove(wait_entry_t *entry)
+{
+	wait_entry_t **link;
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	for (link = &entry->queue->head; *link; link = &(*link)->next) {
+		if (*link == entry) {
+			*link = entry->next;
+			break;
+		}
+	}
+
+	for (link = &entry->pcb->waits; *link; link = &(*link)->pcb_next) {
+		if (*link == entry) {
+			*link = entry->pcb_next;
+			break;
+		}
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * Takes every entry of a process off its queue, when it's done waiting or
+ * halts in its sleep.
+ *
+ * Inputs: pcb - the process
+ * Outputs: none
+ */
+void wait_remove_all(pcb_t *pcb)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	while (pcb->waits) {
+		wait_remove(pcb->waits);
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * Wakes every process on a queue, safe to call from interrupt handlers.
+ *
+ * Inputs: queue - the queue
+ * Outputs: none
+ */
+void wake_up(wait_queue_t *queue)
+{
+	wait_entry_t *entry;
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	for (entry = queue->head; entry; entry = entry->next) {
+		wait_wake(entry->pcb);
+	}
+
+	restore_flags(flags);
+}
+
+/*
+ * Wakes the process of just one entry, for queues shared by processes
+ * waiting on different things. Safe to call from interrupt handlers.
+ *
+ * Inputs: entry - an entry from wait_add
+ * Outputs: none
+ */
+void wake_up_entry(wait_entry_t *entry)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	wait_wake(entry->pcb);
+	restore_flags(flags);
+}
+
+/*
+ * Sleeps until one of the queues the caller added itself to is woken. The
+ * scheduler leaves sleeping processes out of its queues. Call it with
+ * interrupts off, after checking that what we're waiting for isn't there
+ * yet, so a wake up can't slip in between. It can return without a wake
+ * up, callers check again either way.
+ *
+ * Inputs: none
+ * Outputs: none
+ */
+void wait_sleep(void)
+{
+	pcb_t *pcb;
+
+	pcb = get_proc_pcb();
+	if (!pcb) {
+		sched();
+		return;
+	}
+
+	pcb->state |= TASK_INTERRUPTIBLE;
+	sched();
+	pcb->state &= ~TASK_INTERRUPTIBLE;
+}
+
+/*
+ * Sleeps on a single queue. Call it with interrupts off, as wait_sleep.
+ *
+ * Inputs: queue - the queue
+ * Outputs: none
+ */
+void sleep_on(wait_queue_t *queue)
+{
+	wait_entry_t entry;
+
+	entry.pcb = get_proc_pcb();
+	if (!entry.pcb) {
+		sched();
+		return;
+	}
+
+	wait_add(queue, &entry);
+	wait_sleep();
+	wait_remove(&entry);
+}
+
+/*
+ * Sets up an unlocked mutex.
+ *
+ * Inputs: mutex - the mutex
+ * Outputs: none
+ */
+void mutex_init(mutex_t *mutex)
+{
+	mutex->locked = 0;
+	mutex->owner = NULL;
+	wait_init(&mutex->waiters);
+}
+
+/*
+ * Takes a mutex, sleeping until whoever holds it unlocks it. Not
+ * recursive, and not for interrupt handlers.
+ *
+ * Inputs: mutex - the mutex
+ * Outputs: none
+ */
+void mutex_lock(mutex_t *mutex)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	while (mutex->locked) {
+		sleep_on(&mutex->waiters);
+	}
+	mutex->locked = 1;
+	mutex->owner = get_proc_pcb();
+
+	restore_flags(flags);
+}
+
+/*
+ * Releases a mutex. Everyone waiting wakes and tries again.
+ *
+ * Inputs: mutex - a mutex the caller holds
+ * Outputs: none
+ */
+void mutex_unlock(mutex_t *mutex)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+
+	mutex->locked = 0;
+	mutex->owner = NULL;
+	wake_up(&mutex->waiters);
+
+	restore_flags(flags);
+}
+
+/*
+ * Makes a sleeping process runnable. One that never got switched out is
+ * still running on its own stack and just stops sleeping.
+ */
+static void wait_wake(pcb_t *pcb)
+{
+	if (!(pcb->state & TASK_INTERRUPTIBLE)) {
+		return;
+	}
+
+	pcb->state &= ~TASK_INTERRUPTIBLE;
+	if (pcb != get_proc_pcb()) {
+		push_to_active(pcb->pid);
+	}
+}
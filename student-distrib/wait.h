@@ -0,0 +1,90 @@
+/* wait.h - wait queues for processes sleeping until something happens
+ * vim:ts=4 sw=4 noexpandtab
+ */
+#ifndef _WAIT_H
+#define _WAIT_H
+
+#include "types.h"
+
+#ifndef ASM
+
+/****************************************
+ *              Data Types              *
+ ****************************************/
+
+/* forward declarations, the terminal keeps a wait queue and proc.h needs
+ * the terminal */
+struct pcb;
+struct wait_queue;
+
+/* Wait queue entry
+ *  One for each queue a process is sleeping on, kept on its kernel stack
+ *  while it sleeps. Each entry is linked on its queue and on the process,
+ *  so everything a process waits on can be dropped at once.
+ */
+typedef struct wait_entry {
+	struct pcb *pcb;
+	struct wait_queue *queue;
+	struct wait_entry *next;
+	struct wait_entry *pcb_next;
+} wait_entry_t;
+
+/* Wait queue
+ *  Processes waiting for the same thing, woken all together when it
+ *  happens. Waking doesn't take them off; each one checks whether what it
+ *  wanted is there and takes itself off or goes back to sleep.
+ */
+typedef struct wait_queue {
+	wait_entry_t *head;
+} wait_queue_t;
+
+/* Mutex
+ *  A lock that can be held across waits for the disk, unlike cli. Processes
+ *  that find it taken sleep on its queue until it's unlocked.
+ */
+typedef struct mutex {
+	volatile uint32_t locked;
+	struct pcb *owner;
+	wait_queue_t waiters;
+} mutex_t;
+
+
+/****************************************
+ *         Function Declarations        *
+ ****************************************/
+
+/* Empties a wait queue */
+void wait_init(wait_queue_t *queue);
+
+/* Puts an entry, with its pcb filled in, on a queue */
+void wait_add(wait_queue_t *queue, wait_entry_t *entry);
+
+/* Takes an entry off its queue */
+void wait_remove(wait_entry_t *entry);
+
+/* Takes every entry of a process off its queue */
+void wait_remove_all(struct pcb *pcb);
+
+/* Wakes every process on a queue */
+void wake_up(wait_queue_t *queue);
+
+/* Wakes the process of one entry */
+void wake_up_entry(wait_entry_t *entry);
+
+/* Sleeps until a queue the caller is on is woken */
+void wait_sleep(void);
+
+/* Sleeps on a single queue */
+void sleep_on(wait_queue_t *queue);
+
+/* Sets up an unlocked mutex */
+void mutex_init(mutex_t *mutex);
+
+/* Takes a mutex, sleeping while someone else holds it */
+void mutex_lock(mutex_t *mutex);
+
+/* Releases a mutex and wakes whoever is waiting for it */
+void mutex_unlock(mutex_t *mutex);
+
+#endif /* ASM */
+#endif /* _WAIT_H */
@@ -0,0 +1,60 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/*
+ * Prints the file system buffer cache counters and its hit rate. Run it
+ * before and after a workload to see how the cache size and readahead
+ * window are doing.
+ */
+
+#define BUFSIZE 16
+
+/* order of the counters the kernel copies out */
+enum { HITS, MISSES, READAHEAD, RA_HITS, EVICTIONS, WRITEBACKS, ERRORS, NSTATS };
+
+static const char* names[NSTATS] = {
+    "hits: ", "misses: ", "readahead: ", "readahead hits: ", "evictions: ",
+    "writebacks: ", "errors: "
+};
+
+int main ()
+{
+    uint32_t stats[NSTATS];
+    uint32_t i, lookups, rate;
+    uint8_t buf[BUFSIZE];
+
+    if (ece391_cachestat (stats, sizeof (stats)) != sizeof (stats)) {
+        ece391_fdputs (1, (uint8_t*)"Can't read the cache counters.\n");
+        return 2;
+    }
+
+    for (i = 0; i < NSTATS; i++) {
+        ece391_fdputs (1, (uint8_t*)names[i]);
+        ece391_fdputs (1, ece391_itoa (stats[i], buf, 10));
+        ece391_fdputs (1, (uint8_t*)"\n");
+    }
+
+    lookups = stats[HITS] + stats[MISSES];
+    if (lookups) {
+        /* without overflowing hits * 100 */
+        if (stats[HITS] > 0xFFFFFFFF / 100)
+            rate = stats[HITS] / (lookups / 100);
+        else
+            rate = stats[HITS] * 100 / lookups;
+
+        ece391_fdputs (1, (uint8_t*)"hit rate: ");
+        ece391_fdputs (1, ece391_itoa (rate, buf, 10));
+        ece391_fdputs (1, (uint8_t*)"%\n");
+    }
+
+    /* how much of what was read ahead was wanted */
+    if (stats[READAHEAD] && stats[RA_HITS] <= 0xFFFFFFFF / 100) {
+        ece391_fdputs (1, (uint8_t*)"readahead used: ");
+        ece391_fdputs (1, ece391_itoa (stats[RA_HITS] * 100 / stats[READAHEAD], buf, 10));
+        ece391_fdputs (1, (uint8_t*)"%\n");
+    }
+
+    return 0;
+}
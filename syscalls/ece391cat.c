@@ -3,6 +3,9 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
+/* most bytes handed to the kernel to copy at once */
+#define CHUNK 16384
+
 int main ()
 {
     int32_t fd, cnt;
@@ -18,13 +21,12 @@ int main ()
 	return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, 1024))) {
-        if (-1 == cnt) {
+    /* the kernel copies straight from the file to stdout */
+    while (0 != (cnt = ece391_sendfile (1, fd, CHUNK))) {
+        if (0 > cnt) {
 	    ece391_fdputs (1, (uint8_t*)"file read failed\n");
 	    return 3;
 	}
-	if (-1 == ece391_write (1, buf, cnt))
-	    return 3;
     }
 
     return 0;
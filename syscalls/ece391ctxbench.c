@@ -0,0 +1,91 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/*
+ * Context switch microbenchmark. Yields the processor ITERS times and
+ * reports the average cycles per yield, measured with rdtsc, once with
+ * the kernel flushing its TLB entries on every switch and once with it
+ * keeping them (global kernel pages, no CR3 reload within a process).
+ * Only kernels built with MAKE_BENCH can switch between the two; on
+ * others it times the kernel as it is.
+ *
+ * Open shells on the other terminals first (Alt+F2..F4) so there is
+ * something to switch to; with nothing else runnable a yield just sleeps
+ * until the next interrupt.  Each yield is then a round trip through the
+ * other shells' page directories and back.  Pass an iteration count as
+ * the argument to override the default.
+ */
+
+#define BUFSIZE 64
+#define ITERS   10000
+
+static inline uint32_t rdtsc_lo (void)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+/* average cycles per yield, with kernel TLB entries kept or not */
+static uint32_t time_yields (uint32_t iters, int32_t keep)
+{
+    uint32_t i, start;
+
+    ece391_tlb_keep (keep);
+
+    /* warm up the caches and TLB */
+    for (i = 0; i < 16; i++)
+        ece391_sched ();
+
+    start = rdtsc_lo ();
+    for (i = 0; i < iters; i++)
+        ece391_sched ();
+    return (rdtsc_lo () - start) / iters;
+}
+
+int main ()
+{
+    uint32_t i, iters, flushed, kept;
+    int32_t old;
+    uint8_t buf[BUFSIZE];
+
+    iters = ITERS;
+    if (0 == ece391_getargs (buf, BUFSIZE) && '\0' != buf[0]) {
+        iters = 0;
+        for (i = 0; buf[i] >= '0' && buf[i] <= '9'; i++)
+            iters = iters * 10 + (buf[i] - '0');
+        if (0 == iters)
+            iters = ITERS;
+    }
+
+    old = ece391_tlb_keep (1);
+    if (old < 0) {
+        ece391_fdputs (1, (uint8_t*)"yields: ");
+        ece391_fdputs (1, ece391_itoa (iters, buf, 10));
+        ece391_fdputs (1, (uint8_t*)"\ncycles per yield: ");
+        ece391_fdputs (1, ece391_itoa (time_yields (iters, 1), buf, 10));
+        ece391_fdputs (1, (uint8_t*)"\nBuild the kernel with MAKE_BENCH to compare with a flushed TLB.\n");
+        return 0;
+    }
+
+    flushed = time_yields (iters, 0);
+    kept = time_yields (iters, 1);
+    ece391_tlb_keep (old);
+
+    ece391_fdputs (1, (uint8_t*)"yields: ");
+    ece391_fdputs (1, ece391_itoa (iters, buf, 10));
+    ece391_fdputs (1, (uint8_t*)"\ncycles per yield, TLB flushed: ");
+    ece391_fdputs (1, ece391_itoa (flushed, buf, 10));
+    ece391_fdputs (1, (uint8_t*)"\ncycles per yield, kernel TLB kept: ");
+    ece391_fdputs (1, ece391_itoa (kept, buf, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+    if (flushed > kept) {
+        ece391_fdputs (1, (uint8_t*)"saved per yield: ");
+        ece391_fdputs (1, ece391_itoa (flushed - kept, buf, 10));
+        ece391_fdputs (1, (uint8_t*)"\n");
+    }
+
+    return 0;
+}
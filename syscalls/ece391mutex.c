@@ -0,0 +1,84 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/*
+ * Mutex test and microbenchmark. Starts NTHREADS threads that each add 1
+ * to a shared count ITERS times, taking a mutex around every add, waits
+ * for them with a futex, and checks that no add was lost. Reports the
+ * average cycles per locked add, measured with rdtsc. Pass an iteration
+ * count as the argument to override the default.
+ */
+
+#define BUFSIZE  64
+#define ITERS    100000
+#define NTHREADS 4
+
+static ece391_mutex_t lock = ECE391_MUTEX_INIT;
+static volatile int32_t count;
+static volatile int32_t done;
+static uint32_t iters;
+
+static inline uint32_t rdtsc_lo (void)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+static void worker (void* arg)
+{
+    uint32_t i;
+
+    (void)arg;
+    for (i = 0; i < iters; i++) {
+        ece391_mutex_lock (&lock);
+        count++;
+        ece391_mutex_unlock (&lock);
+    }
+
+    ece391_mutex_lock (&lock);
+    done++;
+    ece391_mutex_unlock (&lock);
+    (void)ece391_futex_wake ((int32_t*)&done, 1);
+}
+
+int main ()
+{
+    uint32_t i, start, cycles;
+    int32_t d;
+    uint8_t buf[BUFSIZE];
+
+    iters = ITERS;
+    if (0 == ece391_getargs (buf, BUFSIZE) && '\0' != buf[0]) {
+        iters = 0;
+        for (i = 0; buf[i] >= '0' && buf[i] <= '9'; i++)
+            iters = iters * 10 + (buf[i] - '0');
+        if (0 == iters)
+            iters = ITERS;
+    }
+
+    start = rdtsc_lo ();
+    for (i = 0; i < NTHREADS; i++) {
+        if (-1 == ece391_thread_start (worker, 0)) {
+            ece391_fdputs (1, (uint8_t*)"thread create failed\n");
+            return 2;
+        }
+    }
+
+    /* sleep until the last one is done, rechecking after every wake */
+    while ((d = done) < NTHREADS)
+        (void)ece391_futex_wait ((int32_t*)&done, d);
+    cycles = rdtsc_lo () - start;
+
+    ece391_fdputs (1, (uint8_t*)"count: ");
+    ece391_fdputs (1, ece391_itoa (count, buf, 10));
+    ece391_fdputs (1, (uint8_t*)" of ");
+    ece391_fdputs (1, ece391_itoa (iters * NTHREADS, buf, 10));
+    ece391_fdputs (1, (uint8_t*)"\ncycles per locked add: ");
+    ece391_fdputs (1, ece391_itoa (cycles / (iters * NTHREADS), buf, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+
+    return (count == (int32_t)(iters * NTHREADS)) ? 0 : 1;
+}
@@ -5,10 +5,91 @@
 
 #define BUFSIZE 1024
 
+/* most commands joined by '|' in one line */
+#define MAX_STAGES 8
+
+/* where the shell keeps its own stdin and stdout while a pipeline runs */
+#define SAVED_STDIN  6
+#define SAVED_STDOUT 7
+
+/*
+ * Splits a line at each '|' into commands, trimming the spaces around
+ * them. Returns how many there are, -1 if there are too many or one of
+ * several is empty.
+ */
+static int32_t
+split_pipeline (uint8_t* buf, uint8_t* cmds[])
+{
+    int32_t i, n, last;
+    uint8_t* c;
+    uint8_t* end;
+
+    n = 0;
+    c = buf;
+    do {
+        if (MAX_STAGES == n)
+            return -1;
+        while (' ' == *c)
+            c++;
+        cmds[n++] = c;
+        while ('\0' != *c && '|' != *c)
+            c++;
+        for (end = c; end > cmds[n - 1] && ' ' == end[-1]; end--);
+        last = ('\0' == *c);
+        *end = '\0';
+        c++;
+    } while (!last);
+
+    for (i = 0; n > 1 && i < n; i++)
+        if ('\0' == cmds[i][0])
+            return -1;
+    return n;
+}
+
+/*
+ * Runs each command but the last alongside the shell with its stdout on a
+ * pipe to the next one's stdin, then runs the last one in the shell's
+ * place. Returns what execute returned for the last command.
+ */
+static int32_t
+run_pipeline (uint8_t* cmds[], int32_t n)
+{
+    int32_t i, rval, fds[2];
+
+    if (-1 == ece391_dup2 (0, SAVED_STDIN) ||
+        -1 == ece391_dup2 (1, SAVED_STDOUT))
+        return -1;
+
+    rval = 0;
+    for (i = 0; i < n - 1 && -1 != rval; i++) {
+        if (-1 == ece391_pipe (fds)) {
+            rval = -1;
+            break;
+        }
+        ece391_dup2 (fds[1], 1);
+        ece391_close (fds[1]);
+        if (-1 == ece391_spawn (cmds[i]))
+            rval = -1;
+        ece391_dup2 (fds[0], 0);
+        ece391_close (fds[0]);
+        ece391_dup2 (SAVED_STDOUT, 1);
+    }
+    if (-1 != rval)
+        rval = ece391_execute (cmds[n - 1]);
+
+    /* dropping our copy of the last pipe lets anything still writing
+       into it see that nobody's reading */
+    ece391_dup2 (SAVED_STDIN, 0);
+    ece391_close (SAVED_STDIN);
+    ece391_close (SAVED_STDOUT);
+    return rval;
+}
+
 int main ()
 {
-    int32_t cnt, rval;
+    int32_t cnt, rval, ncmds;
     uint8_t buf[BUFSIZE];
+    uint8_t* cmds[MAX_STAGES];
 
     while (1) {
         ece391_fdputs (1, (uint8_t*)"391OS> ");
@@ -23,7 +104,14 @@ int main ()
 	    return 0;
 	if ('\0' == buf[0])
 	    continue;
-	rval = ece391_execute (buf);
+	if (-1 == (ncmds = split_pipeline (buf, cmds))) {
+	    ece391_fdputs (1, (uint8_t*)"bad pipeline\n");
+	    continue;
+	}
+	if (1 == ncmds)
+	    rval = ece391_execute (cmds[0]);
+	else
+	    rval = run_pipeline (cmds, ncmds);
 	if (-1 == rval)
 	    ece391_fdputs (1, (uint8_t*)"no such command\n");
 	else if (256 == rval)
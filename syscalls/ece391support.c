@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stddef.h>
 
 #include "ece391support.h"
 #include "ece391syscall.h"
@@ -21,6 +22,22 @@ void ece391_fdputs(int32_t fd, const uint8_t* s)
     (void)ece391_write (fd, s, ece391_strlen(s));
 }
 
+void ece391_fdputsv(int32_t fd, const uint8_t* strs[], int32_t n)
+{
+    ece391_iovec_t iov[IOV_MAX];
+    int32_t i;
+
+    while (n > 0) {
+        for (i = 0; i < n && i < IOV_MAX; i++) {
+            iov[i].base = (void*)strs[i];
+            iov[i].len = ece391_strlen(strs[i]);
+        }
+        (void)ece391_writev (fd, iov, i);
+        strs += i;
+        n -= i;
+    }
+}
+
 int32_t ece391_strcmp(const uint8_t* s1, const uint8_t* s2)
 {
     while (*s1 == *s2) {
@@ -102,3 +119,163 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/*
+ * malloc: power-of-two size classes, each with its own free list, so both
+ * malloc and free are a handful of instructions once the heap is warm.
+ * Small classes are carved out of MALLOC_CHUNK sized sbrk calls; the kernel
+ * only backs heap pages once they are touched, so unused parts of a chunk
+ * cost nothing. Freed blocks go back on their class's list and are never
+ * returned to the kernel. A mutex keeps threads off each other's lists.
+ */
+#define MALLOC_MIN_ORDER 4      /* 16 byte blocks */
+#define MALLOC_MAX_ORDER 26     /* 64MB, more than the heap can hold */
+#define MALLOC_CHUNK     16384
+
+typedef union malloc_block {
+    union malloc_block* next;   /* while free */
+    uint32_t order;             /* while allocated, stored just before the data */
+    uint64_t align;
+} malloc_block_t;
+
+static malloc_block_t* malloc_free_lists[MALLOC_MAX_ORDER + 1];
+static ece391_mutex_t malloc_lock = ECE391_MUTEX_INIT;
+
+/* Refills an empty size class, returns 0 on success or -1 if out of heap */
+static int32_t malloc_refill(uint32_t order)
+{
+    uint32_t size = 1UL << order;
+    uint32_t chunk = size > MALLOC_CHUNK ? size : MALLOC_CHUNK;
+    uint8_t* mem;
+    uint32_t off;
+    malloc_block_t* block;
+
+    mem = ece391_sbrk(chunk);
+    if ((void*)-1 == mem) {
+        return -1;
+    }
+
+    for (off = 0; off < chunk; off += size) {
+        block = (malloc_block_t*)(mem + off);
+        block->next = malloc_free_lists[order];
+        malloc_free_lists[order] = block;
+    }
+    return 0;
+}
+
+void* ece391_malloc(uint32_t size)
+{
+    uint32_t order = MALLOC_MIN_ORDER;
+    malloc_block_t* block;
+
+    if (0 == size || size > (1UL << MALLOC_MAX_ORDER) - sizeof(malloc_block_t)) {
+        return NULL;
+    }
+
+    /* smallest class that fits the data and its header */
+    while ((1UL << order) < size + sizeof(malloc_block_t)) {
+        order++;
+    }
+
+    ece391_mutex_lock (&malloc_lock);
+
+    if (NULL == malloc_free_lists[order] && 0 != malloc_refill(order)) {
+        ece391_mutex_unlock (&malloc_lock);
+        return NULL;
+    }
+
+    block = malloc_free_lists[order];
+    malloc_free_lists[order] = block->next;
+
+    ece391_mutex_unlock (&malloc_lock);
+
+    block->order = order;
+    return block + 1;
+}
+
+void ece391_free(void* ptr)
+{
+    malloc_block_t* block;
+
+    if (NULL == ptr) {
+        return;
+    }
+
+    block = (malloc_block_t*)ptr - 1;
+
+    ece391_mutex_lock (&malloc_lock);
+    block->next = malloc_free_lists[block->order];
+    malloc_free_lists[block->order] = block;
+    ece391_mutex_unlock (&malloc_lock);
+}
+
+
+/*
+ * Threads: ece391_thread_start runs fn(arg) in a new thread that halts
+ * once fn returns.
+ */
+static void thread_done(void)
+{
+    (void)ece391_halt (0);
+}
+
+int32_t ece391_thread_start(void (*fn)(void*), void* arg)
+{
+    return ece391_thread_create (fn, arg, thread_done);
+}
+
+
+/*
+ * Mutexes: taking a free one is a single compare-and-swap and releasing
+ * one nobody waits for is a single swap, neither enters the kernel. A
+ * thread that finds it taken marks it contended (2) and sleeps in
+ * ece391_futex_wait until the holder's unlock sees the mark and wakes
+ * one waiter. The woken thread takes it marked contended, since it can't
+ * tell whether others are still waiting.
+ */
+static inline int32_t mutex_cmpxchg (volatile int32_t* p, int32_t old, int32_t new)
+{
+    int32_t prev;
+    asm volatile ("lock; cmpxchgl %2, %1"
+            : "=a"(prev), "+m"(*p)
+            : "r"(new), "0"(old)
+            : "memory");
+    return prev;
+}
+
+/* xchg with memory is locked even without the prefix */
+static inline int32_t mutex_xchg (volatile int32_t* p, int32_t new)
+{
+    asm volatile ("xchgl %0, %1"
+            : "+r"(new), "+m"(*p)
+            :
+            : "memory");
+    return new;
+}
+
+void ece391_mutex_init(ece391_mutex_t* m)
+{
+    m->state = 0;
+}
+
+void ece391_mutex_lock(ece391_mutex_t* m)
+{
+    int32_t c;
+
+    c = mutex_cmpxchg (&m->state, 0, 1);
+    if (0 == c)
+        return;
+
+    if (2 != c)
+        c = mutex_xchg (&m->state, 2);
+    while (0 != c) {
+        (void)ece391_futex_wait ((int32_t*)&m->state, 2);
+        c = mutex_xchg (&m->state, 2);
+    }
+}
+
+void ece391_mutex_unlock(ece391_mutex_t* m)
+{
+    if (2 == mutex_xchg (&m->state, 0))
+        (void)ece391_futex_wake ((int32_t*)&m->state, 1);
+}
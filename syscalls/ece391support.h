@@ -1,13 +1,27 @@
 #if !defined(ECE391SUPPORT_H)
 #define ECE391SUPPORT_H
 
+/* 0 unlocked, 1 locked, 2 locked with threads waiting for it */
+typedef struct ece391_mutex {
+    volatile int32_t state;
+} ece391_mutex_t;
+
+#define ECE391_MUTEX_INIT {0}
+
 extern uint32_t ece391_strlen(const uint8_t* s);
 extern void ece391_strcpy(uint8_t* dst, const uint8_t* src);
 extern void ece391_fdputs(int32_t fd, const uint8_t* s);
+extern void ece391_fdputsv(int32_t fd, const uint8_t* strs[], int32_t n);
 extern int32_t ece391_strcmp(const uint8_t* s1, const uint8_t* s2);
 extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
+extern void* ece391_malloc(uint32_t size);
+extern void ece391_free(void* ptr);
+extern int32_t ece391_thread_start(void (*fn)(void*), void* arg);
+extern void ece391_mutex_init(ece391_mutex_t* m);
+extern void ece391_mutex_lock(ece391_mutex_t* m);
+extern void ece391_mutex_unlock(ece391_mutex_t* m);
 
 #endif /* ECE391SUPPORT_H */
 
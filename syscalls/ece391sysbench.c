@@ -0,0 +1,111 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+#include "ece391sysnum.h"
+
+/*
+ * System call latency microbenchmark. Makes ITERS calls that go straight
+ * back out of the kernel (sigreturn isn't implemented, so it's just the
+ * dispatch) through INT $0x80, through SYSENTER, and through the library
+ * wrapper, and reports the average cycles per call for each, measured
+ * with rdtsc. Pass an iteration count as the argument to override the
+ * default.
+ */
+
+#define BUFSIZE 64
+#define ITERS   100000
+
+static inline uint32_t rdtsc_lo (void)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+static inline int32_t call_int80 (void)
+{
+    int32_t ret;
+    asm volatile ("int $0x80"
+            : "=a"(ret)
+            : "a"(SYS_SIGRETURN)
+            : "memory");
+    return ret;
+}
+
+/* SYSENTER comes back to the address in ESI on the stack in EBP */
+static inline int32_t call_sysenter (void)
+{
+    int32_t ret;
+    asm volatile ("pushl %%ebp\n\t"
+            "movl $1f, %%esi\n\t"
+            "movl %%esp, %%ebp\n\t"
+            "sysenter\n"
+            "1:\tpopl %%ebp"
+            : "=a"(ret)
+            : "a"(SYS_SIGRETURN)
+            : "ecx", "edx", "esi", "memory");
+    return ret;
+}
+
+static void report (const char* name, uint32_t cycles, uint32_t iters)
+{
+    uint8_t buf[BUFSIZE];
+    const uint8_t* out[3];
+
+    /* one write, so the report itself doesn't cost three calls */
+    out[0] = (const uint8_t*)name;
+    out[1] = ece391_itoa (cycles / iters, buf, 10);
+    out[2] = (const uint8_t*)" cycles per call\n";
+    ece391_fdputsv (1, out, 3);
+}
+
+int main ()
+{
+    uint32_t i, iters, start, cycles;
+    uint8_t buf[BUFSIZE];
+
+    iters = ITERS;
+    if (0 == ece391_getargs (buf, BUFSIZE) && '\0' != buf[0]) {
+        iters = 0;
+        for (i = 0; buf[i] >= '0' && buf[i] <= '9'; i++)
+            iters = iters * 10 + (buf[i] - '0');
+        if (0 == iters)
+            iters = ITERS;
+    }
+
+    ece391_fdputs (1, (uint8_t*)"calls: ");
+    ece391_fdputs (1, ece391_itoa (iters, buf, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+
+    /* warm up the caches and TLB */
+    for (i = 0; i < 16; i++)
+        call_int80 ();
+
+    start = rdtsc_lo ();
+    for (i = 0; i < iters; i++)
+        call_int80 ();
+    cycles = rdtsc_lo () - start;
+    report ("int $0x80: ", cycles, iters);
+
+    if (ece391_use_sysenter) {
+        for (i = 0; i < 16; i++)
+            call_sysenter ();
+
+        start = rdtsc_lo ();
+        for (i = 0; i < iters; i++)
+            call_sysenter ();
+        cycles = rdtsc_lo () - start;
+        report ("sysenter: ", cycles, iters);
+    } else {
+        ece391_fdputs (1, (uint8_t*)"sysenter: not supported\n");
+    }
+
+    start = rdtsc_lo ();
+    for (i = 0; i < iters; i++)
+        ece391_sigreturn ();
+    cycles = rdtsc_lo () - start;
+    report ("library wrapper: ", cycles, iters);
+
+    return 0;
+}
@@ -3,7 +3,136 @@
 
 #include <stdint.h>
 
-/* All calls return >= 0 on success or -1 on failure. */
+/* All calls return >= 0 on success or -1 on failure. Reads of
+ * descriptors set O_NONBLOCK return -EAGAIN instead of waiting. */
+#define EAGAIN 11
+
+/* ece391_fcntl commands, F_SETFL takes O_NONBLOCK or 0 */
+#define F_GETFL    3
+#define F_SETFL    4
+#define O_NONBLOCK 0x800
+
+/* access mode in what F_GETFL returns, pipe ends are one way */
+#define O_ACCMODE  3
+#define O_RDONLY   0
+#define O_WRONLY   1
+#define O_RDWR     2
+
+/*
+ * System call ring shared with the kernel, from ece391_ring_setup. Fill in
+ * sq[sq_tail % RING_SQ_ENTRIES] and bump sq_tail for each call, then have
+ * ece391_ring_enter run them. Results show up at cq[cq_head %
+ * RING_CQ_ENTRIES] up to cq_tail, bump cq_head once they're read. Reads
+ * of the terminal or RTC that would block complete later on their own.
+ */
+#define RING_SQ_ENTRIES 64
+#define RING_CQ_ENTRIES 128
+
+#define RING_OP_NOP   0
+#define RING_OP_READ  1
+#define RING_OP_WRITE 2
+#define RING_OP_OPEN  3  /* file name in buf */
+#define RING_OP_CLOSE 4
+
+typedef struct ece391_ring_sqe {
+    uint32_t opcode;
+    int32_t fd;
+    void* buf;
+    int32_t nbytes;
+    uint32_t user_data;
+} ece391_ring_sqe_t;
+
+typedef struct ece391_ring_cqe {
+    uint32_t user_data;
+    int32_t res;
+} ece391_ring_cqe_t;
+
+typedef struct ece391_ring {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    ece391_ring_sqe_t sq[RING_SQ_ENTRIES];
+    ece391_ring_cqe_t cq[RING_CQ_ENTRIES];
+} ece391_ring_t;
+
+/*
+ * Descriptors for ece391_poll to wait on. It returns how many have events
+ * in revents, 0 if the timeout (in milliseconds, negative waits forever)
+ * ran out first. The terminal is readable once a whole line is typed.
+ */
+#define POLLIN   0x01
+#define POLLOUT  0x04
+#define POLLNVAL 0x20
+
+typedef struct ece391_pollfd {
+    int32_t fd;
+    uint16_t events;
+    uint16_t revents;
+} ece391_pollfd_t;
+
+/*
+ * What ece391_fstat reports about an open file or directory. size is the
+ * length in bytes. ece391_lseek may move past the end, reads there return 0.
+ */
+#define FILE_TYPE_RTC 0
+#define FILE_TYPE_DIR 1
+#define FILE_TYPE_REG 2
+
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+typedef struct ece391_stat {
+    uint32_t type;
+    uint32_t inode;
+    uint32_t size;
+} ece391_stat_t;
+
+/*
+ * Buffers for ece391_readv and ece391_writev, which go through them in
+ * order as one read or write. At most IOV_MAX buffers per call; readv
+ * stops at the first buffer that isn't filled.
+ */
+#define IOV_MAX 16
+
+typedef struct ece391_iovec {
+    void* base;
+    int32_t len;
+} ece391_iovec_t;
+
+/*
+ * ece391_pipe stores a read descriptor in fds[0] and a write descriptor in
+ * fds[1]. Programs started by ece391_execute or ece391_spawn get copies of
+ * the caller's descriptors 0 and 1, so point those at pipe ends with
+ * ece391_dup2 first. ece391_spawn returns the new pid right away instead
+ * of waiting for the program to halt.
+ */
+
+/*
+ * ece391_thread_create starts entry(arg) in a thread sharing the caller's
+ * memory and descriptors, on a stack of its own, and returns its pid.
+ * When entry returns it goes to done, which should call ece391_halt;
+ * ece391_thread_start passes one that does. Halting a thread ends only
+ * it, halting from the program's first thread ends them all. Threads
+ * can't ece391_execute, but can ece391_spawn.
+ */
+
+/*
+ * ece391_futex_wait sleeps until an ece391_futex_wake on the same word,
+ * unless the word no longer holds val, when it returns -EAGAIN right
+ * away. The check and the sleep can't be split by a wake. Words are
+ * matched by where they are in memory, so threads, and processes sharing
+ * memory, can wait on each other. ece391_futex_wake returns how many it
+ * woke. Both take 4 byte aligned words.
+ */
+
+/*
+ * ece391_tlb_keep turns off (0) or back on keeping the kernel's TLB
+ * entries across context switches, and returns the old setting. It's
+ * there for ece391ctxbench to compare the two, and only kernels built
+ * with MAKE_BENCH have it; others return -1.
+ */
 
 /*
  * Note that the system call for halt will have to make sure that only
@@ -21,6 +150,35 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+extern int32_t ece391_sched (void);
+extern int32_t ece391_shm_open (const uint8_t* name, uint32_t size);
+extern int32_t ece391_shm_map (int32_t id, void* addr);
+extern void* ece391_sbrk (int32_t increment);
+extern int32_t ece391_create (const uint8_t* filename);
+extern int32_t ece391_append (int32_t fd, const void* buf, int32_t nbytes);
+extern int32_t ece391_truncate (int32_t fd, uint32_t length);
+extern int32_t ece391_unlink (const uint8_t* filename);
+extern int32_t ece391_cachestat (uint32_t* stats, int32_t nbytes);
+extern int32_t ece391_ring_setup (ece391_ring_t** ring);
+extern int32_t ece391_ring_enter (uint32_t to_submit, uint32_t min_complete);
+extern int32_t ece391_poll (ece391_pollfd_t* fds, uint32_t nfds, int32_t timeout);
+extern int32_t ece391_fcntl (int32_t fd, int32_t cmd, int32_t arg);
+extern int32_t ece391_pipe (int32_t fds[2]);
+extern int32_t ece391_dup2 (int32_t oldfd, int32_t newfd);
+extern int32_t ece391_spawn (const uint8_t* command);
+extern int32_t ece391_sendfile (int32_t out_fd, int32_t in_fd, int32_t count);
+extern int32_t ece391_lseek (int32_t fd, int32_t offset, int32_t whence);
+extern int32_t ece391_pread (int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+extern int32_t ece391_fstat (int32_t fd, ece391_stat_t* buf);
+extern int32_t ece391_readv (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern int32_t ece391_writev (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern int32_t ece391_thread_create (void (*entry)(void*), void* arg, void (*done)(void));
+extern int32_t ece391_futex_wait (int32_t* addr, int32_t val);
+extern int32_t ece391_futex_wake (int32_t* addr, int32_t n);
+extern int32_t ece391_tlb_keep (int32_t keep);
+
+/* nonzero when the wrappers enter the kernel through SYSENTER */
+extern int32_t ece391_use_sysenter;
 
 enum signums {
 	DIV_ZERO = 0,
@@ -12,4 +12,33 @@
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
 
+/* this kernel has no signals; 9 gives up the rest of the time slice */
+#define SYS_SCHED   9
+
+#define SYS_SHM_OPEN 11
+#define SYS_SHM_MAP  12
+#define SYS_SBRK     13
+#define SYS_CREATE   14
+#define SYS_APPEND   15
+#define SYS_TRUNCATE 16
+#define SYS_UNLINK   17
+#define SYS_CACHESTAT 18
+#define SYS_RING_SETUP 19
+#define SYS_RING_ENTER 20
+#define SYS_POLL       21
+#define SYS_FCNTL      22
+#define SYS_PIPE       23
+#define SYS_DUP2       24
+#define SYS_SPAWN      25
+#define SYS_SENDFILE   26
+#define SYS_LSEEK      27
+#define SYS_PREAD      28
+#define SYS_FSTAT      29
+#define SYS_READV      30
+#define SYS_WRITEV     31
+#define SYS_THREAD_CREATE 32
+#define SYS_FUTEX_WAIT 33
+#define SYS_FUTEX_WAKE 34
+#define SYS_TLB_KEEP   35
+
 #endif /* ECE391SYSNUM_H */